@@ -123,6 +123,20 @@ void await(const QFuture<void> &future, QObject *context, Handler handler)
     watcher->setFuture(future);
 }
 
+// Registers a continuation on a task where no QObject can control its
+// lifetime (e.g., in interfaces not derived from QObject).
+// The context object is owned by the continuation, so the continuation is
+// always called once the task has finished.
+template<typename T, typename Continuation>
+void thenWithoutContext(QXmppTask<T> &&task, Continuation continuation)
+{
+    auto context = std::make_shared<QObject>();
+    auto *contextPtr = context.get();
+    task.then(contextPtr, [context = std::move(context), continuation = std::move(continuation)](auto &&...result) mutable {
+        continuation(std::forward<decltype(result)>(result)...);
+    });
+}
+
 template<typename Result, typename Input, typename Converter>
 auto chain(QXmppTask<Input> &&source, QObject *context, Converter task) -> QXmppTask<Result>
 {
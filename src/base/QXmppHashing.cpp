@@ -9,10 +9,14 @@
 #include "Algorithms.h"
 #include "StringLiterals.h"
 
+#include <algorithm>
+
 #include <QCryptographicHash>
+#include <QFile>
 #include <QFuture>
 #include <QFutureInterface>
 #include <QIODevice>
+#include <QMutex>
 #include <QRunnable>
 #include <QThreadPool>
 
@@ -21,10 +25,12 @@ using namespace QXmpp::Private;
 
 class HashGenerator;
 
-// 8 kB
+// 32 kB
 constexpr std::size_t PROCESS_SYNC_MAX_SIZE = 32 * 1024;
-// 512 kB (two buffers are used so 1 MB)
+// 512 kB
 constexpr std::size_t BUFFER_SIZE = 512 * 1024;
+// count of buffers in the ring (i.e., 2 MB at most)
+constexpr std::size_t BUFFERS_COUNT = 4;
 
 /// \cond
 static HashAlgorithm toHashAlgorithm(QCryptographicHash::Algorithm algorithm)
@@ -170,6 +176,233 @@ uint16_t QXmpp::Private::hashPriority(HashAlgorithm algorithm)
     return 0;
 }
 
+// Hash algorithms used for files being shared
+std::vector<HashAlgorithm> QXmpp::Private::defaultHashAlgorithms()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    return { HashAlgorithm::Sha256, HashAlgorithm::Blake2b_256 };
+#else
+    return { HashAlgorithm::Sha256, HashAlgorithm::Sha3_256 };
+#endif
+}
+
+// Returns the secure hash with the highest priority that can be calculated
+std::optional<QXmppHash> QXmpp::Private::preferredHash(std::vector<QXmppHash> hashes)
+{
+    // filter out invalid hashes and insecure
+    auto isInvalid = [](const auto &hash) {
+        return hash.hash().isEmpty() || !isHashingAlgorithmSecure(hash.algorithm()) || !toCryptograhicHashAlgorithm(hash.algorithm());
+    };
+    hashes.erase(std::remove_if(hashes.begin(), hashes.end(), isInvalid), hashes.end());
+
+    if (hashes.empty()) {
+        return {};
+    }
+
+    return *std::max_element(hashes.cbegin(), hashes.cend(), [](const auto &a, const auto &b) {
+        return hashPriority(a.algorithm()) < hashPriority(b.algorithm());
+    });
+}
+
+StreamHasher::StreamHasher(const std::vector<HashAlgorithm> &algorithms)
+{
+    m_hashes.reserve(algorithms.size());
+    for (auto algorithm : algorithms) {
+        auto converted = toCryptograhicHashAlgorithm(algorithm);
+        Q_ASSERT_X(converted.has_value(), "stream hasher", "Must only be called with algorithms supported by QCryptographicHash");
+        m_hashes.emplace_back(algorithm, std::make_unique<QCryptographicHash>(*converted));
+    }
+}
+
+StreamHasher::~StreamHasher() = default;
+
+void StreamHasher::addData(const char *data, qint64 size)
+{
+    for (auto &hash : m_hashes) {
+#if QT_VERSION >= QT_VERSION_CHECK(6, 3, 0)
+        hash.second->addData(QByteArrayView(data, size));
+#else
+        hash.second->addData(data, int(size));
+#endif
+    }
+}
+
+// Marks the hashes as incomplete because data has been skipped.
+void StreamHasher::invalidate()
+{
+    m_valid = false;
+}
+
+// Marks the hashes as complete because all data has been passed.
+void StreamHasher::finish()
+{
+    m_finished = true;
+}
+
+// Returns the hashes if all data has been passed without gaps.
+std::optional<std::vector<QXmppHash>> StreamHasher::result() const
+{
+    if (!m_valid || !m_finished) {
+        return {};
+    }
+
+    return transform<std::vector<QXmppHash>>(m_hashes, [](const auto &pair) {
+        QXmppHash hash;
+        hash.setAlgorithm(pair.first);
+        hash.setHash(pair.second->result());
+        return hash;
+    });
+}
+
+HashingDevice::HashingDevice(std::unique_ptr<QIODevice> input, std::shared_ptr<StreamHasher> hasher)
+    : m_input(std::move(input)),
+      m_hasher(std::move(hasher))
+{
+    // The input device buffers already.
+    if (m_input->isOpen()) {
+        setOpenMode((m_input->openMode() & QIODevice::ReadWrite) | QIODevice::Unbuffered);
+    }
+}
+
+HashingDevice::~HashingDevice() = default;
+
+bool HashingDevice::open(OpenMode mode)
+{
+    if (!m_input->isOpen() && !m_input->open(mode)) {
+        setErrorString(m_input->errorString());
+        return false;
+    }
+
+    // The input device buffers already.
+    return QIODevice::open((m_input->openMode() & QIODevice::ReadWrite) | QIODevice::Unbuffered);
+}
+
+void HashingDevice::close()
+{
+    // written data is complete if nothing is missing in front of the pending data
+    if (isWritable()) {
+        if (m_pendingData.empty()) {
+            m_hasher->finish();
+        } else {
+            m_hasher->invalidate();
+        }
+    }
+    m_input->close();
+    QIODevice::close();
+}
+
+bool HashingDevice::isSequential() const
+{
+    return m_input->isSequential();
+}
+
+qint64 HashingDevice::size() const
+{
+    return m_input->size();
+}
+
+bool HashingDevice::seek(qint64 pos)
+{
+    QIODevice::seek(pos);
+    return m_input->seek(pos);
+}
+
+bool HashingDevice::atEnd() const
+{
+    return m_input->atEnd();
+}
+
+qint64 HashingDevice::readData(char *data, qint64 maxlen)
+{
+    // Sequential devices have no position, their data is always read consecutively.
+    const auto position = m_input->isSequential() ? m_hashedBytes : m_input->pos();
+    const auto readBytes = m_input->read(data, maxlen);
+
+    if (readBytes > 0) {
+        hashReadData(position, data, readBytes);
+    }
+
+    if (m_input->atEnd() && (m_input->isSequential() || m_hashedBytes == m_input->size())) {
+        m_hasher->finish();
+    }
+
+    return readBytes;
+}
+
+qint64 HashingDevice::writeData(const char *data, qint64 len)
+{
+    // Sequential devices have no position, their data is always written consecutively.
+    const auto position = m_input->isSequential() ? m_hashedBytes + m_pendingSize : m_input->pos();
+    const auto writtenBytes = m_input->write(data, len);
+
+    if (writtenBytes > 0) {
+        hashWrittenData(position, data, writtenBytes);
+    }
+    return writtenBytes;
+}
+
+// Returns the wrapped device if it is a local file.
+//
+// That way, the file can be mapped into memory and its data passed to hashReadData() instead
+// of reading it via this device.
+QFile *HashingDevice::file() const
+{
+    return qobject_cast<QFile *>(m_input.get());
+}
+
+// Hashes data of the wrapped device at the given position, e.g., data read via file().
+void HashingDevice::hashReadData(qint64 position, const char *data, qint64 size)
+{
+    if (position > m_hashedBytes) {
+        // data has been skipped
+        m_hasher->invalidate();
+    } else if (position + size > m_hashedBytes) {
+        // only hash data that has not been hashed yet
+        const auto offset = m_hashedBytes - position;
+        m_hasher->addData(data + offset, size - offset);
+        m_hashedBytes = position + size;
+    }
+
+    if (!m_input->isSequential() && m_hashedBytes == m_input->size()) {
+        m_hasher->finish();
+    }
+}
+
+void HashingDevice::hashWrittenData(qint64 position, const char *data, qint64 size)
+{
+    // Limits the memory used for data written ahead, e.g., by parallel downloads.
+    constexpr qint64 MAX_PENDING_SIZE = 64 * 1024 * 1024;
+
+    if (position < m_hashedBytes) {
+        // data has been overwritten
+        m_hasher->invalidate();
+    } else if (position > m_hashedBytes) {
+        if (m_pendingSize + size > MAX_PENDING_SIZE) {
+            m_hasher->invalidate();
+            m_pendingData.clear();
+            m_pendingSize = 0;
+        } else {
+            m_pendingData[position].append(data, int(size));
+            m_pendingSize += size;
+        }
+    } else {
+        m_hasher->addData(data, size);
+        m_hashedBytes += size;
+
+        // hash pending data that follows now
+        for (auto itr = m_pendingData.begin(); itr != m_pendingData.end() && itr->first <= m_hashedBytes;) {
+            if (itr->first < m_hashedBytes) {
+                m_hasher->invalidate();
+            } else {
+                m_hasher->addData(itr->second.constData(), itr->second.size());
+                m_hashedBytes += itr->second.size();
+            }
+            m_pendingSize -= itr->second.size();
+            itr = m_pendingData.erase(itr);
+        }
+    }
+}
+
 auto makeReadyResult(HashingResult::Result result, std::unique_ptr<QIODevice> device)
 {
     return makeReadyFuture<HashingResultPtr>(std::make_shared<HashingResult>(std::move(result), std::move(device)));
@@ -192,26 +425,31 @@ auto deviceSize(QIODevice &device) -> std::optional<std::size_t>
 
 HashingResult calculateHashesSync(std::unique_ptr<QIODevice> data, const std::vector<QCryptographicHash::Algorithm> &algorithms)
 {
+    // read the data only once for all algorithms
+    data->seek(0);
+    const auto size = data->size();
+    const auto bytes = data->read(size);
+    if (bytes.size() != size) {
+        return { QXmppError::fromIoDevice(*data), std::move(data) };
+    }
+
     std::vector<QXmppHash> results;
     results.reserve(algorithms.size());
     for (auto algorithm : algorithms) {
-        QCryptographicHash hasher(algorithm);
-        data->seek(0);
-        if (!hasher.addData(data.get())) {
-            return { QXmppError::fromIoDevice(*data), std::move(data) };
-        }
-
         QXmppHash hash;
         hash.setAlgorithm(toHashAlgorithm(algorithm));
-        hash.setHash(hasher.result());
+        hash.setHash(QCryptographicHash::hash(bytes, algorithm));
         results.push_back(hash);
     }
     return { std::move(results), std::move(data) };
 }
 
+//
+// Reads the data into the free buffers of the ring as long as there are any.
+//
 struct BufferReader : public QRunnable {
-    BufferReader(HashGenerator &creator)
-        : generator(creator)
+    BufferReader(HashGenerator &generator)
+        : generator(generator)
     {
         setAutoDelete(false);
     }
@@ -220,8 +458,13 @@ struct BufferReader : public QRunnable {
     void run() override;
 
     HashGenerator &generator;
+    // whether the reader is started or running
+    bool isRunning = false;
 };
 
+//
+// Hashes the filled buffers of the ring with one algorithm as long as there are any.
+//
 struct HashProcessor : public QRunnable {
     HashProcessor(HashGenerator *generator, QCryptographicHash::Algorithm algorithm)
         : generator(generator),
@@ -235,6 +478,7 @@ struct HashProcessor : public QRunnable {
           hash(std::move(other.hash)),
           algorithm(other.algorithm)
     {
+        setAutoDelete(false);
     }
     ~HashProcessor() override = default;
 
@@ -243,8 +487,25 @@ struct HashProcessor : public QRunnable {
     HashGenerator *generator;
     std::unique_ptr<QCryptographicHash> hash;
     QCryptographicHash::Algorithm algorithm;
+    // count of buffers hashed by this processor
+    qint64 processedBuffersCount = 0;
+    // whether the processor is started or running
+    bool isRunning = false;
 };
 
+//
+// Calculates multiple hashes of data while reading the data only once.
+//
+// The data is read into a ring of buffers.
+// Each buffer is hashed by one processor per algorithm and reused once all
+// processors are done with it.
+// That way, reading can run ahead of hashing and the processors of fast
+// algorithms do not wait for the slow ones after each buffer.
+//
+// The reader and the processors are only (re)started if they have been idle,
+// i.e., if the ring was full or empty.
+// They never block a thread of the thread pool while waiting for each other.
+//
 class HashGenerator : public QObject
 {
     Q_OBJECT
@@ -301,83 +562,146 @@ public:
             return HashProcessor(this, algorithm);
         });
 
-        // create buffers
+        // Local files are mapped into memory and hashed in slices without copying them into
+        // buffers.
+        if (mapData()) {
+            m_readBuffersCount = (m_mappedSize + qint64(BUFFER_SIZE) - 1) / qint64(BUFFER_SIZE);
+            m_readingFinished = true;
+
+            QMutexLocker locker(&m_mutex);
+            startHashProcessors();
+            finishIfDone(locker);
+            return;
+        }
+
+        // create buffers, small data is read in one go
         auto size = deviceSize(*m_data);
-        if (size && *size <= 2 * BUFFER_SIZE) {
-            // read everything in one go
-            m_readBuffer.reserve(*size);
-        } else {
-            m_readBuffer.reserve(BUFFER_SIZE);
-            m_processBuffer.reserve(BUFFER_SIZE);
+        const auto bufferSize = size ? std::clamp(*size, std::size_t(1), BUFFER_SIZE) : BUFFER_SIZE;
+        const auto buffersCount = size ? std::min((*size + bufferSize - 1) / bufferSize, BUFFERS_COUNT) : BUFFERS_COUNT;
+        m_buffers.resize(std::max(buffersCount, std::size_t(1)));
+        for (auto &buffer : m_buffers) {
+            buffer.reserve(bufferSize);
         }
 
-        // start reading buffer
-        m_runningJobs = 1;
-        QThreadPool::globalInstance()->start(&m_bufferReader);
+        // start reading
+        QMutexLocker locker(&m_mutex);
+        startBufferReader();
     }
     ~HashGenerator() override = default;
 
-    void startNextIteration()
+    bool mapData()
     {
-        if (m_errorOccurred) {
-            // error has been reported already
-            deleteLater();
-            return;
+        auto *file = qobject_cast<QFile *>(m_data.get());
+        if (!file || file->isSequential() || file->size() <= 0) {
+            return false;
         }
 
-        // reading was already finished, processing of the last data is now also finished
-        if (m_readingFinished) {
-            finish();
-            deleteLater();
-            return;
+        m_mappedData = file->map(0, file->size());
+        if (!m_mappedData) {
+            return false;
         }
+        m_mappedFile = file;
+        m_mappedSize = file->size();
+        return true;
+    }
 
-        // check for cancellation
-        if (m_isCancelled()) {
-            m_reportResult({ Cancelled(), std::move(m_data) });
-            deleteLater();
-            return;
+    void unmapData()
+    {
+        if (m_mappedData) {
+            m_mappedFile->unmap(m_mappedData);
+            m_mappedData = nullptr;
         }
+    }
 
-        m_readingFinished = m_data->atEnd();
-
-        // swap buffers: read data is now processed, the buffer of the
-        // processed data is reused as new read buffer
-        m_processBuffer.swap(m_readBuffer);
+    std::vector<char> &buffer(qint64 index)
+    {
+        return m_buffers[std::size_t(index % qint64(m_buffers.size()))];
+    }
 
-        // reset counter
-        if (m_readingFinished) {
-            m_runningJobs = int(m_hashProcessors.size());
-        } else {
-            m_runningJobs = int(m_hashProcessors.size() + 1);
+    // Returns the data of the n-th block, either a slice of the mapped file or a buffer of the
+    // ring.
+    std::pair<const char *, qint64> block(qint64 index)
+    {
+        if (m_mappedData) {
+            const auto offset = index * qint64(BUFFER_SIZE);
+            return { reinterpret_cast<const char *>(m_mappedData) + offset, std::min(qint64(BUFFER_SIZE), m_mappedSize - offset) };
         }
 
-        auto *pool = QThreadPool::globalInstance();
-        // optimization: don't restart the buffer reader if we know no more bytes can be read
-        if (!m_readingFinished) {
-            pool->start(&m_bufferReader);
+        const auto &readBuffer = buffer(index);
+        return { readBuffer.data(), qint64(readBuffer.size()) };
+    }
+
+    // Returns whether a buffer is free, i.e., it has been hashed by all processors.
+    bool isBufferFree() const
+    {
+        if (m_hashProcessors.empty()) {
+            return true;
         }
-        // start all hash processors
-        for (auto &hashProcessor : m_hashProcessors) {
-            hashProcessor.setAutoDelete(false);
-            pool->start(&hashProcessor);
+
+        const auto minProcessedBuffersCount = std::min_element(m_hashProcessors.cbegin(), m_hashProcessors.cend(), [](const auto &a, const auto &b) {
+                                                  return a.processedBuffersCount < b.processedBuffersCount;
+                                              })->processedBuffersCount;
+        return m_readBuffersCount - minProcessedBuffersCount < qint64(m_buffers.size());
+    }
+
+    bool isStopped() const
+    {
+        return m_errorOccurred || m_cancelled;
+    }
+
+    // must be called with locked mutex
+    void startBufferReader()
+    {
+        if (!m_bufferReader.isRunning && !m_readingFinished && !isStopped()) {
+            m_bufferReader.isRunning = true;
+            QThreadPool::globalInstance()->start(&m_bufferReader);
         }
     }
 
-    void reportJobFinished()
+    // must be called with locked mutex
+    void startHashProcessors()
     {
-        if (!m_runningJobs.deref()) {
-            // no other jobs are running anymore
-            // all hashes have processed the current buffer
-            // a new buffer has been read
-            startNextIteration();
+        for (auto &processor : m_hashProcessors) {
+            if (!processor.isRunning && processor.processedBuffersCount < m_readBuffersCount && !isStopped()) {
+                processor.isRunning = true;
+                QThreadPool::globalInstance()->start(&processor);
+            }
         }
     }
 
-    void reportBufferReadError(QXmppError err)
+    // must be called with locked mutex, reports the result if the reader and all processors are
+    // done
+    template<typename Locker>
+    void finishIfDone(Locker &locker)
     {
-        m_errorOccurred = true;
-        m_reportResult({ std::move(err), std::move(m_data) });
+        if (m_reported || m_bufferReader.isRunning) {
+            return;
+        }
+        for (const auto &processor : m_hashProcessors) {
+            if (processor.isRunning) {
+                return;
+            }
+        }
+
+        if (isStopped()) {
+            m_reported = true;
+            locker.unlock();
+            unmapData();
+            if (m_errorOccurred) {
+                m_reportResult({ std::move(m_error), std::move(m_data) });
+            } else {
+                m_reportResult({ Cancelled(), std::move(m_data) });
+            }
+            deleteLater();
+        } else if (m_readingFinished && std::all_of(m_hashProcessors.cbegin(), m_hashProcessors.cend(), [this](const auto &processor) {
+                       return processor.processedBuffersCount == m_readBuffersCount;
+                   })) {
+            m_reported = true;
+            locker.unlock();
+            finish();
+            unmapData();
+            deleteLater();
+        }
     }
 
     void finish()
@@ -391,12 +715,20 @@ public:
         m_reportResult({ std::move(hashes), std::move(m_data) });
     }
 
+    QMutex m_mutex;
     bool m_errorOccurred = false;
+    bool m_cancelled = false;
     bool m_readingFinished = false;
+    bool m_reported = false;
+    QXmppError m_error;
     std::unique_ptr<QIODevice> m_data;
-    std::vector<char> m_readBuffer;
-    std::vector<char> m_processBuffer;
-    QAtomicInt m_runningJobs = 0;
+    // ring of buffers, buffer n is used for the n-th read block modulo the ring size
+    std::vector<std::vector<char>> m_buffers;
+    // mapped file used instead of the buffers if the data is a local file
+    uchar *m_mappedData = nullptr;
+    qint64 m_mappedSize = 0;
+    QFile *m_mappedFile = nullptr;
+    qint64 m_readBuffersCount = 0;
     std::vector<HashProcessor> m_hashProcessors;
     BufferReader m_bufferReader;
     std::function<void(HashingResult)> m_reportResult;
@@ -405,31 +737,81 @@ public:
 
 void BufferReader::run()
 {
-    auto &data = *generator.m_data;
-    auto &buffer = generator.m_readBuffer;
+    QMutexLocker locker(&generator.m_mutex);
+
+    while (true) {
+        if (generator.m_isCancelled()) {
+            generator.m_cancelled = true;
+        }
+
+        if (generator.isStopped() || generator.m_readingFinished || !generator.isBufferFree()) {
+            isRunning = false;
+            generator.finishIfDone(locker);
+            return;
+        }
 
-    buffer.resize(buffer.capacity());
-    auto readBytes = data.read(buffer.data(), buffer.size());
+        // The free buffer is not accessed by the processors until the count of read buffers
+        // is increased.
+        auto &buffer = generator.buffer(generator.m_readBuffersCount);
+        auto &data = *generator.m_data;
+        locker.unlock();
 
-    // negative values indicate errors
-    if (readBytes < 0) {
-        buffer.resize(0);
-        generator.reportBufferReadError(QXmppError::fromIoDevice(*generator.m_data));
-    } else {
-        buffer.resize(readBytes);
+        buffer.resize(buffer.capacity());
+        auto readBytes = data.read(buffer.data(), qint64(buffer.size()));
+        const auto isAtEnd = data.atEnd();
+
+        locker.relock();
+
+        // negative values indicate errors
+        if (readBytes < 0) {
+            buffer.clear();
+            generator.m_errorOccurred = true;
+            generator.m_error = QXmppError::fromIoDevice(data);
+            continue;
+        }
+
+        buffer.resize(std::size_t(readBytes));
+        generator.m_readingFinished = isAtEnd || readBytes == 0;
+
+        if (readBytes > 0) {
+            ++generator.m_readBuffersCount;
+            generator.startHashProcessors();
+        }
     }
-    generator.reportJobFinished();
 }
 
 void HashProcessor::run()
 {
-    auto &buffer = generator->m_processBuffer;
+    QMutexLocker locker(&generator->m_mutex);
+
+    while (true) {
+        // The reader is not used for mapped files and thus cannot check for cancellation.
+        if (generator->m_mappedData && generator->m_isCancelled()) {
+            generator->m_cancelled = true;
+        }
+
+        if (generator->isStopped() || processedBuffersCount == generator->m_readBuffersCount) {
+            isRunning = false;
+            generator->finishIfDone(locker);
+            return;
+        }
+
+        // The filled buffer is not modified by the reader until all processors are done with it.
+        const auto [data, size] = generator->block(processedBuffersCount);
+        locker.unlock();
+
 #if QT_VERSION >= QT_VERSION_CHECK(6, 3, 0)
-    hash->addData(QByteArrayView(buffer.data(), buffer.size()));
+        hash->addData(QByteArrayView(data, size));
 #else
-    hash->addData(buffer.data(), buffer.size());
+        hash->addData(data, int(size));
 #endif
-    generator->reportJobFinished();
+
+        locker.relock();
+        ++processedBuffersCount;
+
+        // a buffer may have become free for the reader
+        generator->startBufferReader();
+    }
 }
 
 QFuture<HashingResultPtr> QXmpp::Private::calculateHashes(std::unique_ptr<QIODevice> data, std::vector<HashAlgorithm> algorithms)
@@ -450,21 +832,12 @@ QFuture<HashingResultPtr> QXmpp::Private::calculateHashes(std::unique_ptr<QIODev
 
 QFuture<HashVerificationResultPtr> QXmpp::Private::verifyHashes(std::unique_ptr<QIODevice> data, std::vector<QXmppHash> hashes)
 {
-    // filter out invalid hashes and insecure
-    auto isInvalid = [](const auto &hash) {
-        return hash.hash().isEmpty() || !isHashingAlgorithmSecure(hash.algorithm());
-    };
-    hashes.erase(std::remove_if(hashes.begin(), hashes.end(), isInvalid), hashes.end());
-
-    if (hashes.empty()) {
+    auto preferred = preferredHash(std::move(hashes));
+    if (!preferred) {
         return makeReadyResult(HashVerificationResult::NoStrongHashes(), std::move(data));
     }
 
-    std::sort(hashes.begin(), hashes.end(), [](const auto &a, const auto &b) {
-        return hashPriority(a.algorithm()) < hashPriority(b.algorithm());
-    });
-
-    auto expected = hashes.back();
+    auto expected = *preferred;
 
     auto verifyResult = [](auto &result, auto &expected) -> HashVerificationResult::Result {
         if (auto actualHashes = std::get_if<std::vector<QXmppHash>>(&result)) {
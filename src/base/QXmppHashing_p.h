@@ -9,11 +9,16 @@
 #include "QXmppGlobal.h"
 #include "QXmppHash.h"
 
+#include <map>
 #include <memory>
+#include <optional>
 #include <variant>
 #include <vector>
 
 #include <QCryptographicHash>
+#include <QIODevice>
+
+class QFile;
 
 template<typename T>
 class QFuture;
@@ -53,6 +58,69 @@ using HashVerificationResultPtr = std::shared_ptr<HashVerificationResult>;
 
 bool isHashingAlgorithmSecure(HashAlgorithm algorithm);
 uint16_t hashPriority(HashAlgorithm algorithm);
+std::vector<HashAlgorithm> defaultHashAlgorithms();
+std::optional<QXmppHash> preferredHash(std::vector<QXmppHash> hashes);
+
+//
+// Calculates hashes of data passed in consecutive blocks.
+//
+// The hashes are only available if all data has been passed without gaps.
+//
+class QXMPP_EXPORT StreamHasher
+{
+public:
+    explicit StreamHasher(const std::vector<HashAlgorithm> &algorithms);
+    ~StreamHasher();
+
+    void addData(const char *data, qint64 size);
+    void invalidate();
+    void finish();
+    std::optional<std::vector<QXmppHash>> result() const;
+
+private:
+    std::vector<std::pair<HashAlgorithm, std::unique_ptr<QCryptographicHash>>> m_hashes;
+    bool m_valid = true;
+    bool m_finished = false;
+};
+
+//
+// Passes the data read from or written to a device to a StreamHasher.
+//
+// That way, the hashes of data being uploaded or downloaded can be calculated
+// without reading the data a second time.
+// Data read again after seeking backwards is not hashed twice.
+// Data written ahead of the hashed data is kept until the data in front of it
+// has been written.
+//
+// export for tests
+class QXMPP_EXPORT HashingDevice : public QIODevice
+{
+public:
+    HashingDevice(std::unique_ptr<QIODevice> input, std::shared_ptr<StreamHasher> hasher);
+    ~HashingDevice() override;
+
+    bool open(QIODevice::OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override;
+    qint64 size() const override;
+    bool seek(qint64 pos) override;
+    bool atEnd() const override;
+    qint64 readData(char *data, qint64 maxlen) override;
+    qint64 writeData(const char *data, qint64 len) override;
+
+    QFile *file() const;
+    void hashReadData(qint64 position, const char *data, qint64 size);
+
+private:
+    void hashWrittenData(qint64 position, const char *data, qint64 size);
+
+    std::unique_ptr<QIODevice> m_input;
+    std::shared_ptr<StreamHasher> m_hasher;
+    qint64 m_hashedBytes = 0;
+    // written data not hashed yet by position
+    std::map<qint64, QByteArray> m_pendingData;
+    qint64 m_pendingSize = 0;
+};
 
 // QXMPP_EXPORT for unit tests
 QXMPP_EXPORT QFuture<HashingResultPtr> calculateHashes(std::unique_ptr<QIODevice> data, std::vector<HashAlgorithm> hashes);
@@ -14,8 +14,10 @@
 #include "Algorithms.h"
 #include "StringLiterals.h"
 
+#include <QCache>
 #include <QDomElement>
 #include <QMessageAuthenticationCode>
+#include <QMutex>
 #include <QPasswordDigestor>
 #include <QUrlQuery>
 #include <QXmlStreamWriter>
@@ -34,6 +36,9 @@ overloaded(Ts...) -> overloaded<Ts...>;
 
 static QByteArray forcedNonce;
 
+// Number of PBKDF2 results kept for SCRAM reconnects
+constexpr int SALTED_PASSWORD_CACHE_SIZE = 16;
+
 constexpr auto SASL_ERROR_CONDITIONS = to_array<QStringView>({
     u"aborted",
     u"account-disabled",
@@ -963,6 +968,52 @@ static QMap<char, QByteArray> parseGS2(const QByteArray &ba)
     return map;
 }
 
+// Compares two byte arrays in time that only depends on their size, so comparing secrets does
+// not reveal how many leading bytes matched.
+static bool constantTimeEquals(const QByteArray &a, const QByteArray &b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    char difference = 0;
+    for (qsizetype i = 0; i < a.size(); i++) {
+        difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+}
+
+// Derives the SCRAM SaltedPassword (RFC 5802, section 3).
+//
+// PBKDF2 is deliberately expensive, so results are cached per (algorithm, salt, iterations,
+// password) and reconnects with the same server parameters can skip the derivation. Only a hash
+// of the password is part of the cache key.
+static QByteArray deriveSaltedPassword(QCryptographicHash::Algorithm algorithm, const QString &password, const QByteArray &salt, int iterations, uint32_t dklen)
+{
+    struct SaltedPasswordCache {
+        QMutex mutex;
+        QCache<QByteArray, QByteArray> entries { SALTED_PASSWORD_CACHE_SIZE };
+    };
+    static SaltedPasswordCache cache;
+
+    const QByteArray passwordUtf8 = password.toUtf8();
+    const QByteArray key = QByteArray::number(int(algorithm)) + ',' +
+        QByteArray::number(iterations) + ',' +
+        salt.toBase64() + ',' +
+        QCryptographicHash::hash(passwordUtf8, QCryptographicHash::Sha256).toBase64();
+
+    QMutexLocker locker(&cache.mutex);
+    if (const auto *saltedPassword = cache.entries.object(key)) {
+        return *saltedPassword;
+    }
+    locker.unlock();
+
+    const auto saltedPassword = QPasswordDigestor::deriveKeyPbkdf2(algorithm, passwordUtf8, salt, iterations, dklen);
+
+    locker.relock();
+    cache.entries.insert(key, new QByteArray(saltedPassword));
+    return saltedPassword;
+}
+
 bool QXmppSaslClient::isMechanismAvailable(SaslMechanism mechanism, const Credentials &credentials)
 {
     return visit(
@@ -1241,8 +1292,8 @@ std::optional<QByteArray> QXmppSaslClientScram::respond(const QByteArray &challe
 
         // calculate proofs
         const QByteArray clientFinalMessageBare = QByteArrayLiteral("c=") + m_gs2Header.toBase64() + QByteArrayLiteral(",r=") + nonce;
-        const QByteArray saltedPassword = QPasswordDigestor::deriveKeyPbkdf2(
-            m_mechanism.qtAlgorithm(), m_password.toUtf8(), salt, iterations, m_dklen);
+        const QByteArray saltedPassword = deriveSaltedPassword(
+            m_mechanism.qtAlgorithm(), m_password, salt, iterations, m_dklen);
         const QByteArray clientKey = QMessageAuthenticationCode::hash(QByteArrayLiteral("Client Key"), saltedPassword, m_mechanism.qtAlgorithm());
         const QByteArray storedKey = QCryptographicHash::hash(clientKey, m_mechanism.qtAlgorithm());
         const QByteArray authMessage = m_clientFirstMessageBare + QByteArrayLiteral(",") + challenge + QByteArrayLiteral(",") + clientFinalMessageBare;
@@ -1316,6 +1367,9 @@ std::unique_ptr<QXmppSaslServer> QXmppSaslServer::create(const QString &mechanis
         return std::make_unique<QXmppSaslServerDigestMd5>(parent);
     } else if (mechanism == u"ANONYMOUS") {
         return std::make_unique<QXmppSaslServerAnonymous>(parent);
+    } else if (auto scram = SaslScramMechanism::fromString(mechanism);
+               scram && (scram->algorithm == SaslScramMechanism::Sha256 || scram->algorithm == SaslScramMechanism::Sha512)) {
+        return std::make_unique<QXmppSaslServerScram>(*scram, parent);
     } else {
         return {};
     }
@@ -1498,6 +1552,128 @@ QXmppSaslServer::Response QXmppSaslServerPlain::respond(const QByteArray &reques
     }
 }
 
+QXmppSaslServerScram::QXmppSaslServerScram(SaslScramMechanism mechanism, QObject *parent)
+    : QXmppSaslServer(parent), m_mechanism(mechanism), m_step(0)
+{
+}
+
+QString QXmppSaslServerScram::mechanism() const
+{
+    return m_mechanism.toString();
+}
+
+///
+/// Sets the stored credentials of the user (RFC 5802, section 3).
+///
+/// The server only needs StoredKey and ServerKey to verify the client, so no PBKDF2 derivation
+/// is needed during the login.
+///
+void QXmppSaslServerScram::setCredentials(const QByteArray &salt, int iterations, const QByteArray &storedKey, const QByteArray &serverKey)
+{
+    m_salt = salt;
+    m_iterations = iterations;
+    m_storedKey = storedKey;
+    m_serverKey = serverKey;
+}
+
+///
+/// Returns whether the client proof has been verified.
+///
+/// The server-final-message is returned as a challenge after that, which SASL 2 sends as
+/// additional data of the success element instead.
+///
+bool QXmppSaslServerScram::isClientVerified() const
+{
+    return m_step >= 2;
+}
+
+QXmppSaslServer::Response QXmppSaslServerScram::respond(const QByteArray &request, QByteArray &response)
+{
+    const auto algorithm = m_mechanism.qtAlgorithm();
+
+    if (m_step == 0) {
+        if (request.isEmpty()) {
+            response = QByteArray();
+            return Challenge;
+        }
+
+        // split GS2 header and client-first-message-bare
+        const auto flagEnd = request.indexOf(',');
+        const auto headerEnd = flagEnd < 0 ? -1 : request.indexOf(',', flagEnd + 1);
+        if (headerEnd < 0 || (request.front() != 'n' && request.front() != 'y')) {
+            warning(u"QXmppSaslServerScram : Invalid GS2 header or unsupported channel binding"_s);
+            return Failed;
+        }
+
+        m_gs2Header = request.left(headerEnd + 1);
+        m_clientFirstMessageBare = request.mid(headerEnd + 1);
+
+        const QMap<char, QByteArray> input = parseGS2(m_clientFirstMessageBare);
+        auto username = input.value('n');
+        const auto clientNonce = input.value('r');
+        if (username.isEmpty() || clientNonce.isEmpty()) {
+            warning(u"QXmppSaslServerScram : Invalid input on step 0"_s);
+            return Failed;
+        }
+        username.replace("=2C", ",");
+        username.replace("=3D", "=");
+        setUsername(QString::fromUtf8(username));
+
+        if (m_storedKey.isEmpty() || m_serverKey.isEmpty() || m_salt.isEmpty() || m_iterations < 1) {
+            return InputNeeded;
+        }
+
+        m_nonce = clientNonce + generateNonce();
+        m_serverFirstMessage = QByteArrayLiteral("r=") + m_nonce +
+            QByteArrayLiteral(",s=") + m_salt.toBase64() +
+            QByteArrayLiteral(",i=") + QByteArray::number(m_iterations);
+
+        m_step++;
+        response = m_serverFirstMessage;
+        return Challenge;
+    } else if (m_step == 1) {
+        const auto proofIndex = request.lastIndexOf(",p=");
+        if (proofIndex < 0) {
+            warning(u"QXmppSaslServerScram : Missing client proof"_s);
+            return Failed;
+        }
+
+        const QMap<char, QByteArray> input = parseGS2(request);
+        if (input.value('c') != m_gs2Header.toBase64() || input.value('r') != m_nonce) {
+            warning(u"QXmppSaslServerScram : Invalid channel binding or nonce"_s);
+            return Failed;
+        }
+
+        const QByteArray clientFinalMessageWithoutProof = request.left(proofIndex);
+        const QByteArray authMessage = m_clientFirstMessageBare + ',' + m_serverFirstMessage + ',' + clientFinalMessageWithoutProof;
+
+        // ClientKey = ClientProof XOR ClientSignature; it must hash to StoredKey
+        QByteArray clientKey = QByteArray::fromBase64(input.value('p'));
+        const QByteArray clientSignature = QMessageAuthenticationCode::hash(authMessage, m_storedKey, algorithm);
+        if (clientKey.size() != clientSignature.size()) {
+            return Failed;
+        }
+        std::transform(clientKey.cbegin(), clientKey.cend(), clientSignature.cbegin(),
+                       clientKey.begin(), std::bit_xor<char>());
+        if (!constantTimeEquals(QCryptographicHash::hash(clientKey, algorithm), m_storedKey)) {
+            return Failed;
+        }
+
+        const QByteArray serverSignature = QMessageAuthenticationCode::hash(authMessage, m_serverKey, algorithm);
+
+        m_step++;
+        response = QByteArrayLiteral("v=") + serverSignature.toBase64();
+        return Challenge;
+    } else if (m_step == 2) {
+        m_step++;
+        response = QByteArray();
+        return Succeeded;
+    } else {
+        warning(u"QXmppSaslServerScram : Invalid step"_s);
+        return Failed;
+    }
+}
+
 void QXmppSaslDigestMd5::setNonce(const QByteArray &nonce)
 {
     forcedNonce = nonce;
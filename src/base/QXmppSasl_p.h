@@ -612,4 +612,30 @@ private:
     int m_step;
 };
 
+class QXMPP_AUTOTEST_EXPORT QXmppSaslServerScram : public QXmppSaslServer
+{
+    Q_OBJECT
+public:
+    QXmppSaslServerScram(QXmpp::Private::SaslScramMechanism mechanism, QObject *parent = nullptr);
+    QString mechanism() const override;
+    QCryptographicHash::Algorithm algorithm() const { return m_mechanism.qtAlgorithm(); }
+
+    void setCredentials(const QByteArray &salt, int iterations, const QByteArray &storedKey, const QByteArray &serverKey);
+    bool isClientVerified() const;
+
+    Response respond(const QByteArray &challenge, QByteArray &response) override;
+
+private:
+    QXmpp::Private::SaslScramMechanism m_mechanism;
+    int m_step;
+    QByteArray m_salt;
+    int m_iterations = 0;
+    QByteArray m_storedKey;
+    QByteArray m_serverKey;
+    QByteArray m_gs2Header;
+    QByteArray m_clientFirstMessageBare;
+    QByteArray m_serverFirstMessage;
+    QByteArray m_nonce;
+};
+
 #endif
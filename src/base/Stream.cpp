@@ -22,6 +22,9 @@
 using namespace QXmpp;
 using namespace QXmpp::Private;
 
+// Size of the socket's read buffer while reading is paused
+constexpr qint64 PAUSED_READ_BUFFER_SIZE = 4096;
+
 namespace QXmpp::Private {
 
 void StreamOpen::toXml(QXmlStreamWriter *writer) const
@@ -161,6 +164,7 @@ void XmppSocket::setSocket(QSslSocket *socket)
         // do not emit started() with direct TLS (this happens in encrypted())
         if (!m_directTls) {
             m_dataBuffer.clear();
+            m_incompleteUtf8.clear();
             m_streamOpenElement.clear();
             Q_EMIT started();
         }
@@ -169,15 +173,78 @@ void XmppSocket::setSocket(QSslSocket *socket)
         debug(u"Socket encrypted"_s);
         // this happens with direct TLS or STARTTLS
         m_dataBuffer.clear();
+        m_incompleteUtf8.clear();
         m_streamOpenElement.clear();
         Q_EMIT started();
     });
     QObject::connect(socket, &QSslSocket::errorOccurred, this, [this](QAbstractSocket::SocketError) {
         warning(u"Socket error: "_s + m_socket->errorString());
     });
-    QObject::connect(socket, &QSslSocket::readyRead, this, [this]() {
-        processData(QString::fromUtf8(m_socket->readAll()));
-    });
+    QObject::connect(socket, &QSslSocket::readyRead, this, &XmppSocket::readData);
+}
+
+///
+/// Stops or resumes reading from the socket.
+///
+/// While paused, incoming data is left in the socket, so the peer is slowed
+/// down by TCP flow control instead of having its data buffered here.
+///
+void XmppSocket::setReadingPaused(bool paused)
+{
+    if (m_readingPaused == paused) {
+        return;
+    }
+    m_readingPaused = paused;
+
+    if (m_socket) {
+        m_socket->setReadBufferSize(paused ? PAUSED_READ_BUFFER_SIZE : 0);
+
+        // data may have arrived in the meantime without another readyRead()
+        if (!paused && m_socket->bytesAvailable()) {
+            QMetaObject::invokeMethod(this, &XmppSocket::readData, Qt::QueuedConnection);
+        }
+    }
+}
+
+// Returns the length of data without a trailing incomplete UTF-8 sequence.
+static qsizetype completeUtf8Length(const QByteArray &data)
+{
+    for (auto i = data.size() - 1; i >= 0 && i >= data.size() - 3; --i) {
+        const auto byte = uchar(data.at(i));
+        if ((byte & 0xc0) == 0x80) {
+            // continuation byte
+            continue;
+        }
+        const qsizetype length = byte >= 0xf0 ? 4 : byte >= 0xe0 ? 3 : byte >= 0xc0 ? 2 : 1;
+        return i + length > data.size() ? i : data.size();
+    }
+    return data.size();
+}
+
+///
+/// Reads available data from the socket, but at most the maximum read size
+/// if one is set.
+///
+void XmppSocket::readData()
+{
+    if (m_readingPaused || !m_socket) {
+        return;
+    }
+
+    const auto data = m_maximumReadSize > 0 ? m_socket->read(m_maximumReadSize) : m_socket->readAll();
+    Q_EMIT bytesReceived(data.size());
+
+    // a read may end in the middle of a character
+    m_incompleteUtf8 += data;
+    const auto length = completeUtf8Length(m_incompleteUtf8);
+    const auto text = QString::fromUtf8(m_incompleteUtf8.constData(), length);
+    m_incompleteUtf8.remove(0, length);
+    processData(text);
+
+    // the rest of the data does not trigger another readyRead()
+    if (!m_readingPaused && m_socket && m_socket->bytesAvailable()) {
+        QMetaObject::invokeMethod(this, &XmppSocket::readData, Qt::QueuedConnection);
+    }
 }
 
 bool XmppSocket::isConnected() const
@@ -46,18 +46,27 @@ public:
     void disconnectFromHost();
     bool sendData(const QByteArray &) override;
 
+    bool isReadingPaused() const { return m_readingPaused; }
+    void setReadingPaused(bool paused);
+    void setMaximumReadSize(qint64 size) { m_maximumReadSize = size; }
+
     Q_SIGNAL void started();
+    Q_SIGNAL void bytesReceived(qint64 bytes);
     Q_SIGNAL void stanzaReceived(const QDomElement &);
     Q_SIGNAL void streamReceived(const QDomElement &);
     Q_SIGNAL void streamClosed();
 
 private:
+    void readData();
     void processData(const QString &data);
 
     friend class ::tst_QXmppStream;
 
     QString m_dataBuffer;
+    QByteArray m_incompleteUtf8;
+    qint64 m_maximumReadSize = 0;
     bool m_directTls = false;
+    bool m_readingPaused = false;
     QSslSocket *m_socket = nullptr;
 
     // incoming stream state
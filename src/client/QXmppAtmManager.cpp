@@ -15,8 +15,369 @@
 #include "QXmppUtils.h"
 #include "QXmppUtils_p.h"
 
+#include "StringLiterals.h"
+
+#include <QTimer>
+
 using namespace QXmpp;
 using namespace QXmpp::Private;
+using namespace std::chrono_literals;
+
+// delay for collecting trust messages before processing or sending them in one batch
+constexpr auto TRUST_MESSAGE_BATCH_DELAY = 100ms;
+
+struct ReceivedTrustMessage {
+    QString senderJid;
+    QByteArray senderKey;
+    // key owners whose keys the sender is qualified to authenticate or distrust
+    QList<QXmppTrustMessageKeyOwner> keyOwners;
+    QXmppPromise<void> promise;
+};
+
+struct OutgoingTrustMessage {
+    QList<QXmppTrustMessageKeyOwner> keyOwners;
+    QList<QXmppPromise<QXmpp::SendResult>> promises;
+};
+
+//
+// The private data is a child object of the manager instead of a member so that the layout of
+// the exported QXmppAtmManager class is not changed.
+//
+class QXmppAtmManagerPrivate : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppAtmManagerPrivate(QXmppAtmManager *q);
+
+    void processBatch();
+    void processReceivedTrustMessages(const QString &encryption, QVector<ReceivedTrustMessage> &&trustMessages);
+    void finishReceivedTrustMessagesProcessing(int batchId);
+    QHash<QString, QMultiHash<QString, QByteArray>> addModifiedKeys(const QString &encryption, const QHash<QString, QMultiHash<QString, QByteArray>> &keys, bool isKeyOwnerDecisive);
+    void finishPendingPromises();
+
+    QXmppAtmManager *q;
+
+    bool isBatchingEnabled = false;
+    QTimer batchTimer;
+
+    // encryption protocols mapped to received trust messages being processed in the next batch
+    QHash<QString, QVector<ReceivedTrustMessage>> receivedTrustMessages;
+    // encryption protocols and recipient JIDs mapped to trust messages being sent in the next
+    // batch
+    QHash<std::pair<QString, QString>, OutgoingTrustMessage> outgoingTrustMessages;
+
+    // IDs of batches of received trust messages being processed mapped to the promises of
+    // their trust messages
+    QHash<int, QVector<QXmppPromise<void>>> runningBatches;
+    int nextBatchId = 0;
+    // encryption protocols mapped to key owner JIDs mapped to the IDs of the keys whose trust
+    // levels are decided by the running batches
+    QHash<QString, QMultiHash<QString, QByteArray>> batchKeys;
+    // keys of the running batches whose trust levels are modified, emitted via
+    // trustLevelsChanged() once all batches are processed
+    QHash<QString, QMultiHash<QString, QByteArray>> modifiedKeys;
+};
+
+//
+// Returns the key owners whose keys the sender of a trust message is allowed to
+// authenticate or distrust.
+//
+// A trust message from an own endpoint is allowed to authenticate or distrust
+// the keys of own endpoints and endpoints of contacts.
+// Whereas a trust message from an endpoint of a contact is only allowed to
+// authenticate or distrust the keys of that contact's own endpoints.
+//
+static QList<QXmppTrustMessageKeyOwner> qualifiedKeyOwners(const QList<QXmppTrustMessageKeyOwner> &keyOwners, const QString &senderJid, const QString &ownJid)
+{
+    QList<QXmppTrustMessageKeyOwner> senderKeyOwners;
+
+    for (const auto &keyOwner : keyOwners) {
+        if (senderJid == ownJid || senderJid == keyOwner.jid()) {
+            senderKeyOwners.append(keyOwner);
+        }
+    }
+
+    return senderKeyOwners;
+}
+
+//
+// Adds key IDs to the ones of a key owner if they are not already contained.
+//
+static void insertKeys(QMultiHash<QString, QByteArray> &keys, const QString &keyOwnerJid, const QList<QByteArray> &keyIds)
+{
+    for (const auto &keyId : keyIds) {
+        if (!keys.contains(keyOwnerJid, keyId)) {
+            keys.insert(keyOwnerJid, keyId);
+        }
+    }
+}
+
+//
+// Adds key IDs of one trust decision to the ones of a key owner and removes them
+// from the ones of the opposite trust decision.
+//
+// That way, the decision of the newest trust message is used if a key is both
+// authenticated and distrusted by the trust messages of a batch.
+//
+static void insertTrustDecisions(QMultiHash<QString, QByteArray> &keys, QMultiHash<QString, QByteArray> &opposingKeys, const QString &keyOwnerJid, const QList<QByteArray> &keyIds)
+{
+    for (const auto &keyId : keyIds) {
+        opposingKeys.remove(keyOwnerJid, keyId);
+    }
+
+    insertKeys(keys, keyOwnerJid, keyIds);
+}
+
+//
+// Merges key owners into existing ones.
+//
+// If a key is trusted by one key owner and distrusted by another one with the
+// same JID, the decision of the newer key owner is used.
+//
+static void mergeKeyOwners(QList<QXmppTrustMessageKeyOwner> &keyOwners, const QList<QXmppTrustMessageKeyOwner> &newKeyOwners)
+{
+    for (const auto &newKeyOwner : newKeyOwners) {
+        auto itr = std::find_if(keyOwners.begin(), keyOwners.end(), [&](const QXmppTrustMessageKeyOwner &keyOwner) {
+            return keyOwner.jid() == newKeyOwner.jid();
+        });
+
+        if (itr == keyOwners.end()) {
+            keyOwners.append(newKeyOwner);
+            continue;
+        }
+
+        auto trustedKeys = itr->trustedKeys();
+        auto distrustedKeys = itr->distrustedKeys();
+
+        const auto newTrustedKeys = newKeyOwner.trustedKeys();
+        for (const auto &keyId : newTrustedKeys) {
+            distrustedKeys.removeAll(keyId);
+            if (!trustedKeys.contains(keyId)) {
+                trustedKeys.append(keyId);
+            }
+        }
+
+        const auto newDistrustedKeys = newKeyOwner.distrustedKeys();
+        for (const auto &keyId : newDistrustedKeys) {
+            trustedKeys.removeAll(keyId);
+            if (!distrustedKeys.contains(keyId)) {
+                distrustedKeys.append(keyId);
+            }
+        }
+
+        itr->setTrustedKeys(trustedKeys);
+        itr->setDistrustedKeys(distrustedKeys);
+    }
+}
+
+static QXmppMessage createTrustMessage(const QString &encryption, const QList<QXmppTrustMessageKeyOwner> &keyOwners, const QString &recipientJid)
+{
+    QXmppTrustMessageElement trustMessageElement;
+    trustMessageElement.setUsage(ns_atm.toString());
+    trustMessageElement.setEncryption(encryption);
+    trustMessageElement.setKeyOwners(keyOwners);
+
+    QXmppMessage message;
+    message.setTo(recipientJid);
+    message.setTrustMessageElement(trustMessageElement);
+
+    return message;
+}
+
+static QXmppSendStanzaParams trustMessageSendParams()
+{
+    QXmppSendStanzaParams params;
+    params.setAcceptedTrustLevels(TrustLevel::Authenticated);
+    return params;
+}
+
+QXmppAtmManagerPrivate::QXmppAtmManagerPrivate(QXmppAtmManager *q)
+    : QObject(q),
+      q(q),
+      batchTimer(this)
+{
+    batchTimer.setSingleShot(true);
+    batchTimer.setInterval(TRUST_MESSAGE_BATCH_DELAY);
+    QObject::connect(&batchTimer, &QTimer::timeout, q, [this]() {
+        processBatch();
+    });
+}
+
+//
+// Sends the collected outgoing trust messages and processes the collected
+// received ones.
+//
+void QXmppAtmManagerPrivate::processBatch()
+{
+    const auto outgoingMessages = std::exchange(outgoingTrustMessages, {});
+    for (auto itr = outgoingMessages.cbegin(); itr != outgoingMessages.cend(); ++itr) {
+        const auto &[encryption, recipientJid] = itr.key();
+
+        // The promises are finished even if the manager is destroyed meanwhile.
+        thenWithoutContext(q->client()->sendSensitive(createTrustMessage(encryption, itr->keyOwners, recipientJid), trustMessageSendParams()), [promises = itr->promises](QXmpp::SendResult &&result) mutable {
+            for (auto &promise : promises) {
+                promise.finish(QXmpp::SendResult(result));
+            }
+        });
+    }
+
+    auto receivedMessages = std::exchange(receivedTrustMessages, {});
+    for (auto itr = receivedMessages.begin(); itr != receivedMessages.end(); ++itr) {
+        processReceivedTrustMessages(itr.key(), std::move(itr.value()));
+    }
+}
+
+//
+// Processes multiple received trust messages of the same encryption protocol at
+// once.
+//
+// The trust levels of all sender keys are requested at once.
+// The trust decisions of all messages whose senders' keys are authenticated are
+// made together.
+// Finally, a single trustLevelsChanged() signal is emitted for all modified
+// keys.
+//
+void QXmppAtmManagerPrivate::processReceivedTrustMessages(const QString &encryption, QVector<ReceivedTrustMessage> &&trustMessages)
+{
+    QList<QString> senderJids;
+    for (const auto &trustMessage : std::as_const(trustMessages)) {
+        if (!senderJids.contains(trustMessage.senderJid)) {
+            senderJids.append(trustMessage.senderJid);
+        }
+    }
+
+    // The promises are kept by the manager to finish them if it is destroyed during the
+    // processing.
+    const auto batchId = nextBatchId++;
+    auto &promises = runningBatches[batchId];
+    for (const auto &trustMessage : std::as_const(trustMessages)) {
+        promises.append(trustMessage.promise);
+    }
+
+    auto future = q->keys(encryption, senderJids, TrustLevel::Authenticated);
+    future.then(q, [this, encryption, batchId, trustMessages = std::move(trustMessages)](QHash<QString, QHash<QByteArray, TrustLevel>> &&authenticatedSenderKeys) mutable {
+        // key owner JIDs mapped to key IDs
+        QMultiHash<QString, QByteArray> keysBeingAuthenticated;
+        QMultiHash<QString, QByteArray> keysBeingDistrusted;
+
+        // sender keys mapped to the key owners of their trust messages
+        QHash<QByteArray, QList<QXmppTrustMessageKeyOwner>> keyOwnersForPostponedTrustDecisions;
+
+        for (const auto &trustMessage : std::as_const(trustMessages)) {
+            // Make trust decisions if the key of the sender is authenticated.
+            // Othwerwise, store the keys of the trust message for making the
+            // trust decisions as soon as the key of the sender is
+            // authenticated.
+            if (authenticatedSenderKeys.value(trustMessage.senderJid).contains(trustMessage.senderKey)) {
+                for (const auto &keyOwner : trustMessage.keyOwners) {
+                    insertTrustDecisions(keysBeingAuthenticated, keysBeingDistrusted, keyOwner.jid(), keyOwner.trustedKeys());
+                    insertTrustDecisions(keysBeingDistrusted, keysBeingAuthenticated, keyOwner.jid(), keyOwner.distrustedKeys());
+                }
+            } else if (!trustMessage.keyOwners.isEmpty()) {
+                mergeKeyOwners(keyOwnersForPostponedTrustDecisions[trustMessage.senderKey], trustMessage.keyOwners);
+            }
+        }
+
+        auto &encryptionBatchKeys = batchKeys[encryption];
+        for (const auto *decidedKeys : { &keysBeingAuthenticated, &keysBeingDistrusted }) {
+            for (auto itr = decidedKeys->cbegin(); itr != decidedKeys->cend(); ++itr) {
+                insertKeys(encryptionBatchKeys, itr.key(), { itr.value() });
+            }
+        }
+
+        auto makeTrustDecisions = [=, this]() mutable {
+            auto future = q->makeTrustDecisions(encryption, keysBeingAuthenticated, keysBeingDistrusted);
+            future.then(q, [=, this]() mutable {
+                finishReceivedTrustMessagesProcessing(batchId);
+            });
+        };
+
+        if (keyOwnersForPostponedTrustDecisions.isEmpty()) {
+            makeTrustDecisions();
+            return;
+        }
+
+        auto remainingStorageCalls = std::make_shared<int>(keyOwnersForPostponedTrustDecisions.size());
+
+        for (auto itr = keyOwnersForPostponedTrustDecisions.cbegin(); itr != keyOwnersForPostponedTrustDecisions.cend(); ++itr) {
+            auto future = q->trustStorage()->addKeysForPostponedTrustDecisions(encryption, itr.key(), itr.value());
+            future.then(q, [=]() mutable {
+                if (--(*remainingStorageCalls) == 0) {
+                    makeTrustDecisions();
+                }
+            });
+        }
+    });
+}
+
+void QXmppAtmManagerPrivate::finishReceivedTrustMessagesProcessing(int batchId)
+{
+    auto promises = runningBatches.take(batchId);
+    for (auto &promise : promises) {
+        promise.finish();
+    }
+
+    if (runningBatches.isEmpty()) {
+        batchKeys.clear();
+
+        if (!modifiedKeys.isEmpty()) {
+            Q_EMIT q->trustLevelsChanged(std::exchange(modifiedKeys, {}));
+        }
+    }
+}
+
+//
+// Collects modified keys whose trust levels are decided by the running batches
+// for a single emission of trustLevelsChanged().
+//
+// \param encryption encryption protocol namespace of the modification
+// \param keys encryption protocols mapped to the modified keys
+// \param isKeyOwnerDecisive whether all keys of a key owner are collected if
+//        the batches decide on any of them (e.g., when the trust levels of all
+//        keys of a key owner are changed as a consequence of a trust decision)
+//
+// \return the modified keys that are not collected
+//
+QHash<QString, QMultiHash<QString, QByteArray>> QXmppAtmManagerPrivate::addModifiedKeys(const QString &encryption, const QHash<QString, QMultiHash<QString, QByteArray>> &keys, bool isKeyOwnerDecisive)
+{
+    QHash<QString, QMultiHash<QString, QByteArray>> otherKeys;
+    const auto encryptionBatchKeys = batchKeys.value(encryption);
+
+    for (auto itr = keys.cbegin(); itr != keys.cend(); ++itr) {
+        for (auto keyItr = itr->cbegin(); keyItr != itr->cend(); ++keyItr) {
+            const auto isInBatch = isKeyOwnerDecisive ? encryptionBatchKeys.contains(keyItr.key()) : encryptionBatchKeys.contains(keyItr.key(), keyItr.value());
+            insertKeys(isInBatch ? modifiedKeys[itr.key()] : otherKeys[itr.key()], keyItr.key(), { keyItr.value() });
+        }
+    }
+
+    return otherKeys;
+}
+
+//
+// Finishes the promises of trust messages that are not processed or sent
+// anymore because the manager is destroyed.
+//
+void QXmppAtmManagerPrivate::finishPendingPromises()
+{
+    for (auto &trustMessages : receivedTrustMessages) {
+        for (auto &trustMessage : trustMessages) {
+            trustMessage.promise.finish();
+        }
+    }
+
+    for (auto &promises : runningBatches) {
+        for (auto &promise : promises) {
+            promise.finish();
+        }
+    }
+
+    for (auto &outgoingTrustMessage : outgoingTrustMessages) {
+        for (auto &promise : outgoingTrustMessage.promises) {
+            promise.finish(QXmppError { u"Trust message could not be sent because the manager was destroyed"_s, QXmpp::SendError::Disconnected });
+        }
+    }
+}
 
 ///
 /// \class QXmppAtmManager
@@ -66,6 +427,12 @@ using namespace QXmpp::Private;
 QXmppAtmManager::QXmppAtmManager(QXmppAtmTrustStorage *trustStorage)
     : QXmppTrustManager(trustStorage)
 {
+    new QXmppAtmManagerPrivate(this);
+}
+
+QXmppAtmManager::~QXmppAtmManager()
+{
+    d()->finishPendingPromises();
 }
 
 ///
@@ -243,6 +610,49 @@ QXmppTask<void> QXmppAtmManager::makeTrustDecisions(const QString &encryption, c
     return promise.task();
 }
 
+///
+/// Returns whether trust messages are processed and sent in batches.
+///
+/// \since QXmpp 1.9
+///
+bool QXmppAtmManager::isBatchingEnabled() const
+{
+    return d()->isBatchingEnabled;
+}
+
+///
+/// Sets whether trust messages are processed and sent in batches.
+///
+/// By default, each received trust message is processed on its own.
+/// That results in separate storage calls and a separate emission of
+/// trustLevelsChanged() for each message.
+/// A change of a group's devices can trigger many trust messages in a short
+/// time.
+///
+/// If batching is enabled, received trust messages are collected for a short
+/// time and processed together.
+/// Their trust decisions are stored together and trustLevelsChanged() is
+/// emitted once for all of them.
+/// Outgoing trust messages for the same recipient are collected as well and
+/// sent as one trust message.
+///
+/// If batching is disabled, the collected trust messages are processed and sent
+/// immediately.
+///
+/// \param enabled whether trust messages are processed in batches
+///
+/// \since QXmpp 1.9
+///
+void QXmppAtmManager::setBatchingEnabled(bool enabled)
+{
+    d()->isBatchingEnabled = enabled;
+
+    if (!enabled && d()->batchTimer.isActive()) {
+        d()->batchTimer.stop();
+        d()->processBatch();
+    }
+}
+
 /// \cond
 void QXmppAtmManager::onRegistered(QXmppClient *client)
 {
@@ -303,6 +713,17 @@ QXmppTask<void> QXmppAtmManager::handleMessage(const QXmppMessage &message)
         const auto e2eeMetadata = message.e2eeMetadata();
         const auto senderKey = e2eeMetadata ? e2eeMetadata->senderKey() : QByteArray();
         const auto encryption = trustMessageElement->encryption();
+        const auto keyOwners = qualifiedKeyOwners(trustMessageElement->keyOwners(), senderJid, client()->configuration().jidBare());
+
+        if (d()->isBatchingEnabled) {
+            d()->receivedTrustMessages[encryption].append({ senderJid, senderKey, keyOwners, promise });
+
+            if (!d()->batchTimer.isActive()) {
+                d()->batchTimer.start();
+            }
+
+            return promise.task();
+        }
 
         auto future = trustLevel(encryption, senderJid, senderKey);
         future.then(this, [=, this](const auto &&senderKeyTrustLevel) mutable {
@@ -314,39 +735,26 @@ QXmppTask<void> QXmppAtmManager::handleMessage(const QXmppMessage &message)
 
             QList<QXmppTrustMessageKeyOwner> keyOwnersForPostponedTrustDecisions;
 
-            const auto ownJid = client()->configuration().jidBare();
-            const auto isOwnTrustMessage = senderJid == ownJid;
-            const auto keyOwners = trustMessageElement->keyOwners();
-
             for (const auto &keyOwner : keyOwners) {
                 const auto keyOwnerJid = keyOwner.jid();
 
-                // A trust message from an own endpoint is allowed to
-                // authenticate or distrust the keys of own endpoints and
-                // endpoints of contacts.
-                // Whereas a trust message from an endpoint of a contact is
-                // only allowed to authenticate or distrust the keys of that
-                // contact's own endpoints.
-                const auto isSenderQualifiedForTrustDecisions = isOwnTrustMessage || senderJid == keyOwnerJid;
-                if (isSenderQualifiedForTrustDecisions) {
-                    // Make trust decisions if the key of the sender is
-                    // authenticated.
-                    // Othwerwise, store the keys of the trust message for
-                    // making the trust decisions as soon as the key of the
-                    // sender is authenticated.
-                    if (isSenderKeyAuthenticated) {
-                        const auto trustedKeys = keyOwner.trustedKeys();
-                        for (const auto &key : trustedKeys) {
-                            keysBeingAuthenticated.insert(keyOwnerJid, key);
-                        }
+                // Make trust decisions if the key of the sender is
+                // authenticated.
+                // Othwerwise, store the keys of the trust message for
+                // making the trust decisions as soon as the key of the
+                // sender is authenticated.
+                if (isSenderKeyAuthenticated) {
+                    const auto trustedKeys = keyOwner.trustedKeys();
+                    for (const auto &key : trustedKeys) {
+                        keysBeingAuthenticated.insert(keyOwnerJid, key);
+                    }
 
-                        const auto distrustedKeys = keyOwner.distrustedKeys();
-                        for (const auto &key : distrustedKeys) {
-                            keysBeingDistrusted.insert(keyOwnerJid, key);
-                        }
-                    } else {
-                        keyOwnersForPostponedTrustDecisions.append(keyOwner);
+                    const auto distrustedKeys = keyOwner.distrustedKeys();
+                    for (const auto &key : distrustedKeys) {
+                        keysBeingDistrusted.insert(keyOwnerJid, key);
                     }
+                } else {
+                    keyOwnersForPostponedTrustDecisions.append(keyOwner);
                 }
             }
 
@@ -383,7 +791,7 @@ QXmppTask<void> QXmppAtmManager::authenticate(const QString &encryption, const Q
 
     QXmppPromise<void> promise;
 
-    auto future = setTrustLevel(encryption, keyIds, TrustLevel::Authenticated);
+    auto future = setTrustLevelOfKeys(encryption, keyIds, TrustLevel::Authenticated);
     future.then(this, [=, this]() mutable {
         auto future = securityPolicy(encryption);
         future.then(this, [=, this](auto securityPolicy) mutable {
@@ -421,7 +829,7 @@ QXmppTask<void> QXmppAtmManager::distrust(const QString &encryption, const QMult
 
     QXmppPromise<void> promise;
 
-    auto future = setTrustLevel(encryption, keyIds, TrustLevel::ManuallyDistrusted);
+    auto future = setTrustLevelOfKeys(encryption, keyIds, TrustLevel::ManuallyDistrusted);
     future.then(this, [=, this]() mutable {
         auto future = trustStorage()->removeKeysForPostponedTrustDecisions(encryption, keyIds.values());
         future.then(this, [=]() mutable {
@@ -441,7 +849,68 @@ QXmppTask<void> QXmppAtmManager::distrust(const QString &encryption, const QMult
 ///
 QXmppTask<void> QXmppAtmManager::distrustAutomaticallyTrustedKeys(const QString &encryption, const QList<QString> &keyOwnerJids)
 {
-    return setTrustLevel(encryption, keyOwnerJids, TrustLevel::AutomaticallyTrusted, TrustLevel::AutomaticallyDistrusted);
+    return setTrustLevelOfKeys(encryption, keyOwnerJids, TrustLevel::AutomaticallyTrusted, TrustLevel::AutomaticallyDistrusted);
+}
+
+///
+/// Sets the trust level of keys.
+///
+/// While received trust messages are processed in a batch, the modified keys
+/// decided by the batch are collected for a single emission of
+/// trustLevelsChanged() instead of emitting it for each change.
+///
+/// \param encryption encryption protocol namespace
+/// \param keyIds key owners' bare JIDs mapped to the IDs of their keys
+/// \param trustLevel trust level being set
+///
+QXmppTask<void> QXmppAtmManager::setTrustLevelOfKeys(const QString &encryption, const QMultiHash<QString, QByteArray> &keyIds, TrustLevel trustLevel)
+{
+    if (d()->runningBatches.isEmpty()) {
+        return setTrustLevel(encryption, keyIds, trustLevel);
+    }
+
+    QXmppPromise<void> promise;
+
+    auto future = trustStorage()->setTrustLevel(encryption, keyIds, trustLevel);
+    future.then(this, [=, this](QHash<QString, QMultiHash<QString, QByteArray>> modifiedKeys) mutable {
+        if (const auto otherKeys = d()->addModifiedKeys(encryption, modifiedKeys, false); !otherKeys.isEmpty()) {
+            Q_EMIT trustLevelsChanged(otherKeys);
+        }
+        promise.finish();
+    });
+
+    return promise.task();
+}
+
+///
+/// Sets the trust level of keys specified by their key owner and trust level.
+///
+/// While received trust messages are processed in a batch, the modified keys
+/// of key owners whose keys are decided by the batch are collected for a single
+/// emission of trustLevelsChanged() instead of emitting it for each change.
+///
+/// \param encryption encryption protocol namespace
+/// \param keyOwnerJids key owners' bare JIDs
+/// \param oldTrustLevel trust level being changed
+/// \param newTrustLevel trust level being set
+///
+QXmppTask<void> QXmppAtmManager::setTrustLevelOfKeys(const QString &encryption, const QList<QString> &keyOwnerJids, TrustLevel oldTrustLevel, TrustLevel newTrustLevel)
+{
+    if (d()->runningBatches.isEmpty()) {
+        return setTrustLevel(encryption, keyOwnerJids, oldTrustLevel, newTrustLevel);
+    }
+
+    QXmppPromise<void> promise;
+
+    auto future = trustStorage()->setTrustLevel(encryption, keyOwnerJids, oldTrustLevel, newTrustLevel);
+    future.then(this, [=, this](QHash<QString, QMultiHash<QString, QByteArray>> modifiedKeys) mutable {
+        if (const auto otherKeys = d()->addModifiedKeys(encryption, modifiedKeys, true); !otherKeys.isEmpty()) {
+            Q_EMIT trustLevelsChanged(otherKeys);
+        }
+        promise.finish();
+    });
+
+    return promise.task();
 }
 
 ///
@@ -485,17 +954,30 @@ QXmppTask<void> QXmppAtmManager::makePostponedTrustDecisions(const QString &encr
 ///
 QXmppTask<QXmpp::SendResult> QXmppAtmManager::sendTrustMessage(const QString &encryption, const QList<QXmppTrustMessageKeyOwner> &keyOwners, const QString &recipientJid)
 {
-    QXmppTrustMessageElement trustMessageElement;
-    trustMessageElement.setUsage(ns_atm.toString());
-    trustMessageElement.setEncryption(encryption);
-    trustMessageElement.setKeyOwners(keyOwners);
+    // Collect the key owners for sending a single trust message to the
+    // recipient.
+    if (d()->isBatchingEnabled) {
+        auto &outgoingTrustMessage = d()->outgoingTrustMessages[{ encryption, recipientJid }];
+        mergeKeyOwners(outgoingTrustMessage.keyOwners, keyOwners);
 
-    QXmppMessage message;
-    message.setTo(recipientJid);
-    message.setTrustMessageElement(trustMessageElement);
+        QXmppPromise<QXmpp::SendResult> promise;
+        outgoingTrustMessage.promises.append(promise);
 
-    QXmppSendStanzaParams params;
-    params.setAcceptedTrustLevels(TrustLevel::Authenticated);
+        if (!d()->batchTimer.isActive()) {
+            d()->batchTimer.start();
+        }
+
+        return promise.task();
+    }
 
-    return client()->sendSensitive(std::move(message), params);
+    return client()->sendSensitive(createTrustMessage(encryption, keyOwners, recipientJid), trustMessageSendParams());
 }
+
+/// \cond
+QXmppAtmManagerPrivate *QXmppAtmManager::d() const
+{
+    return findChild<QXmppAtmManagerPrivate *>(QString(), Qt::FindDirectChildrenOnly);
+}
+/// \endcond
+
+#include "QXmppAtmManager.moc"
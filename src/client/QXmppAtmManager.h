@@ -9,6 +9,7 @@
 #include "QXmppSendResult.h"
 #include "QXmppTrustManager.h"
 
+class QXmppAtmManagerPrivate;
 class QXmppMessage;
 class QXmppTrustMessageKeyOwner;
 template<typename T>
@@ -20,8 +21,13 @@ class QXMPP_EXPORT QXmppAtmManager : public QXmppTrustManager
 
 public:
     QXmppAtmManager(QXmppAtmTrustStorage *trustStorage);
+    ~QXmppAtmManager() override;
+
     QXmppTask<void> makeTrustDecisions(const QString &encryption, const QString &keyOwnerJid, const QList<QByteArray> &keyIdsForAuthentication, const QList<QByteArray> &keyIdsForDistrusting = {});
 
+    bool isBatchingEnabled() const;
+    void setBatchingEnabled(bool enabled);
+
 protected:
     /// \cond
     void onRegistered(QXmppClient *client) override;
@@ -37,6 +43,9 @@ private:
     QXmppTask<void> authenticate(const QString &encryption, const QMultiHash<QString, QByteArray> &keyIds);
     QXmppTask<void> distrust(const QString &encryption, const QMultiHash<QString, QByteArray> &keyIds);
 
+    QXmppTask<void> setTrustLevelOfKeys(const QString &encryption, const QMultiHash<QString, QByteArray> &keyIds, QXmpp::TrustLevel trustLevel);
+    QXmppTask<void> setTrustLevelOfKeys(const QString &encryption, const QList<QString> &keyOwnerJids, QXmpp::TrustLevel oldTrustLevel, QXmpp::TrustLevel newTrustLevel);
+
     QXmppTask<void> distrustAutomaticallyTrustedKeys(const QString &encryption, const QList<QString> &keyOwnerJids);
     QXmppTask<void> makePostponedTrustDecisions(const QString &encryption, const QList<QByteArray> &senderKeyIds);
 
@@ -49,6 +58,9 @@ private:
     }
     /// \endcond
 
+    QXmppAtmManagerPrivate *d() const;
+
+    friend class QXmppAtmManagerPrivate;
     friend class tst_QXmppAtmManager;
 };
 
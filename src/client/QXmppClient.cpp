@@ -29,6 +29,7 @@
 #include "StringLiterals.h"
 #include "XmppSocket.h"
 
+#include <algorithm>
 #include <chrono>
 
 #include <QDomElement>
@@ -147,12 +148,94 @@ void QXmppClientPrivate::onErrorOccurred(const QString &text, const QXmppOutgoin
 }
 /// \endcond
 
+namespace QXmpp::Private {
+
+void StanzaDispatchIndex::build(const QList<QXmppClientExtension *> &extensions)
+{
+    QHash<QXmppClientExtension *, QList<QXmppClientExtension::StanzaFilter>> filters;
+
+    m_tags.clear();
+    m_childNamespaces.clear();
+    m_index.clear();
+    m_messageHandlers.clear();
+
+    for (auto *extension : extensions) {
+        if (auto *messageHandler = dynamic_cast<QXmppMessageHandler *>(extension)) {
+            m_messageHandlers << messageHandler;
+        }
+
+        const auto extensionFilters = extension->stanzaFilters();
+        if (extensionFilters.isEmpty()) {
+            continue;
+        }
+        filters.insert(extension, extensionFilters);
+        for (const auto &filter : extensionFilters) {
+            if (!filter.tagName.isEmpty()) {
+                m_tags.insert(filter.tagName);
+            }
+            if (!filter.childXmlns.isEmpty()) {
+                m_childNamespaces.insert(filter.childXmlns);
+            }
+        }
+    }
+
+    // An empty string stands for any tag name or namespace that is not used in a filter.
+    auto tags = m_tags.values();
+    tags << QString();
+    auto childNamespaces = m_childNamespaces.values();
+    childNamespaces << QString();
+
+    for (const auto &tag : std::as_const(tags)) {
+        for (const auto &childXmlns : std::as_const(childNamespaces)) {
+            QList<QXmppClientExtension *> candidates;
+            for (auto *extension : extensions) {
+                const auto extensionFilters = filters.constFind(extension);
+                if (extensionFilters == filters.constEnd() ||
+                    std::any_of(extensionFilters->cbegin(), extensionFilters->cend(), [&](const auto &filter) {
+                        return (filter.tagName.isEmpty() || filter.tagName == tag) &&
+                            (filter.childXmlns.isEmpty() || filter.childXmlns == childXmlns);
+                    })) {
+                    candidates << extension;
+                }
+            }
+            m_index.insert({ tag, childXmlns }, candidates);
+        }
+    }
+    m_valid = true;
+}
+
+QList<QXmppClientExtension *> StanzaDispatchIndex::candidates(const QList<QXmppClientExtension *> &extensions, const QDomElement &element)
+{
+    if (!m_valid) {
+        build(extensions);
+    }
+
+    const auto tagName = element.tagName();
+    const auto childXmlns = element.firstChildElement().namespaceURI();
+    return m_index.value({
+        m_tags.contains(tagName) ? tagName : QString(),
+        m_childNamespaces.contains(childXmlns) ? childXmlns : QString(),
+    });
+}
+
+QList<QXmppMessageHandler *> StanzaDispatchIndex::messageHandlers(const QList<QXmppClientExtension *> &extensions)
+{
+    if (!m_valid) {
+        build(extensions);
+    }
+    return m_messageHandlers;
+}
+
+}  // namespace QXmpp::Private
+
 namespace QXmpp::Private::StanzaPipeline {
 
-bool process(const QList<QXmppClientExtension *> &extensions, const QDomElement &element, const std::optional<QXmppE2eeMetadata> &e2eeMetadata)
+// The candidates are an implicitly shared copy, so extensions may be added or removed while
+// handling the stanza.
+bool process(const QList<QXmppClientExtension *> &candidates, const QDomElement &element, const std::optional<QXmppE2eeMetadata> &e2eeMetadata)
 {
     const bool unencrypted = !e2eeMetadata.has_value();
-    for (auto *extension : extensions) {
+    for (auto *extension : candidates) {
         // e2e encrypted stanzas are not passed to the old handleStanza() overload, because such
         // managers are likely not handling the encrypted contents correctly (e.g. sending
         // unencrypted replies and thereby leaking information).
@@ -168,19 +251,17 @@ bool process(const QList<QXmppClientExtension *> &extensions, const QDomElement
 
 namespace QXmpp::Private::MessagePipeline {
 
-bool process(QXmppClient *client, const QList<QXmppClientExtension *> &extensions, QXmppMessage &&message)
+bool process(QXmppClient *client, const QList<QXmppMessageHandler *> &handlers, QXmppMessage &&message)
 {
-    for (auto *extension : extensions) {
-        if (auto *messageHandler = dynamic_cast<QXmppMessageHandler *>(extension)) {
-            if (messageHandler->handleMessage(message)) {
-                return true;
-            }
+    for (auto *messageHandler : handlers) {
+        if (messageHandler->handleMessage(message)) {
+            return true;
         }
     }
     return false;
 }
 
-bool process(QXmppClient *client, const QList<QXmppClientExtension *> &extensions, QXmppE2eeExtension *e2eeExt, const QDomElement &element)
+bool process(QXmppClient *client, const QList<QXmppMessageHandler *> &handlers, QXmppE2eeExtension *e2eeExt, const QDomElement &element)
 {
     if (element.tagName() != u"message") {
         return false;
@@ -191,7 +272,7 @@ bool process(QXmppClient *client, const QList<QXmppClientExtension *> &extension
     } else {
         message.parse(element);
     }
-    return process(client, extensions, std::move(message));
+    return process(client, handlers, std::move(message));
 }
 
 }  // namespace QXmpp::Private::MessagePipeline
@@ -380,6 +461,7 @@ bool QXmppClient::insertExtension(int index, QXmppClientExtension *extension)
 
     extension->setParent(this);
     d->extensions.insert(index, extension);
+    d->dispatchIndex.invalidate();
     extension->setClient(this);
     return true;
 }
@@ -392,6 +474,7 @@ bool QXmppClient::removeExtension(QXmppClientExtension *extension)
 {
     if (d->extensions.contains(extension)) {
         d->extensions.removeAll(extension);
+        d->dispatchIndex.invalidate();
         extension->setClient(nullptr);
         delete extension;
         return true;
@@ -899,7 +982,7 @@ void QXmppClient::injectIq(const QDomElement &element, const std::optional<QXmpp
     if (element.tagName() != u"iq") {
         return;
     }
-    if (!StanzaPipeline::process(d->extensions, element, e2eeMetadata)) {
+    if (!StanzaPipeline::process(d->dispatchIndex.candidates(d->extensions, element), element, e2eeMetadata)) {
         const auto iqType = element.attribute(u"type"_s);
         if (iqType == u"get" || iqType == u"set") {
             // send error IQ
@@ -923,7 +1006,7 @@ void QXmppClient::injectIq(const QDomElement &element, const std::optional<QXmpp
 ///
 bool QXmppClient::injectMessage(QXmppMessage &&message)
 {
-    auto handled = MessagePipeline::process(this, d->extensions, std::move(message));
+    auto handled = MessagePipeline::process(this, d->dispatchIndex.messageHandlers(d->extensions), std::move(message));
     if (!handled) {
         // no extension handled the message
         Q_EMIT messageReceived(message);
@@ -938,8 +1021,8 @@ void QXmppClient::_q_elementReceived(const QDomElement &element, bool &handled)
 {
     // The stanza comes directly from the XMPP stream, so it's not end-to-end
     // encrypted and there's no e2ee metadata (std::nullopt).
-    handled = StanzaPipeline::process(d->extensions, element, std::nullopt) ||
-        MessagePipeline::process(this, d->extensions, d->encryptionExtension, element);
+    handled = StanzaPipeline::process(d->dispatchIndex.candidates(d->extensions, element), element, std::nullopt) ||
+        MessagePipeline::process(this, d->dispatchIndex.messageHandlers(d->extensions), d->encryptionExtension, element);
 }
 
 void QXmppClient::_q_reconnect()
@@ -32,6 +32,27 @@ QList<QXmppDiscoveryIq::Identity> QXmppClientExtension::discoveryIdentities() co
     return QList<QXmppDiscoveryIq::Identity>();
 }
 
+///
+/// Returns the incoming stanzas this extension handles.
+///
+/// QXmppClient looks up the extensions for an incoming stanza in an index
+/// built from the filters and only passes the stanza to the handleStanza()
+/// functions of matching extensions. The filters are read when the extension
+/// is added and must not change afterwards.
+///
+/// Note that the first child element of messages is usually not meaningful,
+/// so filters for messages should normally only contain the tag name.
+///
+/// The default implementation returns an empty list, which means that all
+/// stanzas are passed to handleStanza().
+///
+/// \since QXmpp 1.9
+///
+QList<QXmppClientExtension::StanzaFilter> QXmppClientExtension::stanzaFilters() const
+{
+    return {};
+}
+
 ///
 /// \brief You need to implement this method to process incoming XMPP
 /// stanzas.
@@ -33,11 +33,26 @@ class QXMPP_EXPORT QXmppClientExtension : public QXmppLoggable, public QXmppExte
     Q_OBJECT
 
 public:
+    ///
+    /// \brief Describes incoming stanzas an extension wants to handle.
+    ///
+    /// Empty members match any value.
+    ///
+    /// \since QXmpp 1.9
+    ///
+    struct StanzaFilter {
+        /// Tag name of the stanza, e.g. "iq"
+        QString tagName;
+        /// Namespace of the first child element, e.g. the payload of an IQ
+        QString childXmlns;
+    };
+
     QXmppClientExtension();
     ~QXmppClientExtension() override;
 
     virtual QStringList discoveryFeatures() const;
     virtual QList<QXmppDiscoveryIq::Identity> discoveryIdentities() const;
+    virtual QList<StanzaFilter> stanzaFilters() const;
 
     virtual bool handleStanza(const QDomElement &stanza);
     virtual bool handleStanza(const QDomElement &stanza, const std::optional<QXmppE2eeMetadata> &e2eeMetadata);
@@ -23,12 +23,48 @@
 
 #include <chrono>
 
+#include <QHash>
+#include <QSet>
+
+class QDomElement;
 class QXmppClient;
 class QXmppClientExtension;
 class QXmppE2eeExtension;
 class QXmppLogger;
+class QXmppMessageHandler;
 class QTimer;
 
+namespace QXmpp::Private {
+
+//
+// Maps the tag name and the namespace of the first child element of incoming
+// stanzas to the extensions that may handle them (in registration order).
+//
+// Extensions without stanza filters are candidates for every stanza. The index
+// is rebuilt lazily after it has been invalidated.
+//
+class StanzaDispatchIndex
+{
+public:
+    void invalidate() { m_valid = false; }
+
+    QList<QXmppClientExtension *> candidates(const QList<QXmppClientExtension *> &extensions, const QDomElement &element);
+    QList<QXmppMessageHandler *> messageHandlers(const QList<QXmppClientExtension *> &extensions);
+
+private:
+    using Key = std::pair<QString, QString>;
+
+    void build(const QList<QXmppClientExtension *> &extensions);
+
+    QSet<QString> m_tags;
+    QSet<QString> m_childNamespaces;
+    QHash<Key, QList<QXmppClientExtension *>> m_index;
+    QList<QXmppMessageHandler *> m_messageHandlers;
+    bool m_valid = false;
+};
+
+}  // namespace QXmpp::Private
+
 class QXmppClientPrivate
 {
 public:
@@ -37,6 +73,7 @@ public:
     /// Current presence of the client
     QXmppPresence clientPresence;
     QList<QXmppClientExtension *> extensions;
+    QXmpp::Private::StanzaDispatchIndex dispatchIndex;
     QXmppLogger *logger;
     /// Pointer to the XMPP stream
     QXmppOutgoingClient *stream;
@@ -312,6 +312,14 @@ QStringList QXmppDiscoveryManager::discoveryFeatures() const
     return { ns_disco_info.toString() };
 }
 
+QList<QXmppClientExtension::StanzaFilter> QXmppDiscoveryManager::stanzaFilters() const
+{
+    return {
+        { u"iq"_s, ns_disco_info.toString() },
+        { u"iq"_s, ns_disco_items.toString() },
+    };
+}
+
 bool QXmppDiscoveryManager::handleStanza(const QDomElement &element)
 {
     if (QXmpp::handleIqRequests<QXmppDiscoveryIq>(element, client(), this)) {
@@ -58,6 +58,7 @@ public:
 
     /// \cond
     QStringList discoveryFeatures() const override;
+    QList<StanzaFilter> stanzaFilters() const override;
     bool handleStanza(const QDomElement &element) override;
     std::variant<QXmppDiscoveryIq, QXmppStanza::Error> handleIq(QXmppDiscoveryIq &&iq);
     /// \endcond
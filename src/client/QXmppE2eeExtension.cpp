@@ -4,6 +4,11 @@
 
 #include "QXmppE2eeExtension.h"
 
+#include "QXmppFutureUtils_p.h"
+#include "QXmppMessage.h"
+
+using namespace QXmpp::Private;
+
 ///
 /// \class QXmppE2eeExtension
 ///
@@ -95,3 +100,38 @@
 ///
 /// Returns whether the message is encrypted with this encryption.
 ///
+
+///
+/// Decrypts multiple QXmppMessages at once, e.g., messages retrieved from an archive.
+///
+/// The results are in the same order as the passed messages. For each message that was not
+/// encrypted, QXmppE2eeExtension::NotEncrypted should be returned.
+///
+/// The default implementation calls decryptMessage() for each message.
+/// Encryptions can override it to process the messages in a batch.
+///
+/// \since QXmpp 1.9
+///
+QXmppTask<QVector<QXmppE2eeExtension::MessageDecryptResult>> QXmppE2eeExtension::decryptMessages(QVector<QXmppMessage> &&messages)
+{
+    QXmppPromise<QVector<MessageDecryptResult>> interface;
+    if (messages.isEmpty()) {
+        interface.finish({});
+        return interface.task();
+    }
+
+    auto results = std::make_shared<QVector<MessageDecryptResult>>(messages.size());
+    auto remainingCount = std::make_shared<qsizetype>(messages.size());
+
+    for (qsizetype i = 0; i < messages.size(); ++i) {
+        thenWithoutContext(decryptMessage(std::move(messages[i])), [interface, results, remainingCount, i](MessageDecryptResult &&result) mutable {
+            (*results)[i] = std::move(result);
+
+            if (--(*remainingCount) == 0) {
+                interface.finish(std::move(*results));
+            }
+        });
+    }
+
+    return interface.task();
+}
@@ -13,6 +13,8 @@
 #include <memory>
 #include <optional>
 
+#include <QVector>
+
 class QDomElement;
 class QXmppMessage;
 class QXmppIq;
@@ -35,6 +37,7 @@ public:
     virtual QXmppTask<IqDecryptResult> decryptIq(const QDomElement &) = 0;
     virtual bool isEncrypted(const QDomElement &) = 0;
     virtual bool isEncrypted(const QXmppMessage &) = 0;
+    virtual QXmppTask<QVector<MessageDecryptResult>> decryptMessages(QVector<QXmppMessage> &&);
 };
 
 #endif  // QXMPPE2EEEXTENSION_H
@@ -9,8 +9,10 @@
 #include "QXmppFileMetadata.h"
 #include "QXmppFileSharingManager.h"
 #include "QXmppFutureUtils_p.h"
+#include "QXmppHashing_p.h"
 #include "QXmppUtils.h"
 
+#include "Algorithms.h"
 #include "QcaInitializer_p.h"
 #include "StringLiterals.h"
 
@@ -95,7 +97,11 @@ auto QXmppEncryptedFileSharingProvider::uploadFile(std::unique_ptr<QIODevice> da
     auto key = Encryption::generateKey(cipher);
     auto iv = Encryption::generateInitializationVector(cipher);
 
-    auto encDevice = std::make_unique<Encryption::EncryptionDevice>(std::move(data), cipher, key, iv);
+    // The hashes of the encrypted file are calculated while it is uploaded.
+    auto encryptedHasher = std::make_shared<StreamHasher>(defaultHashAlgorithms());
+    auto encDevice = std::make_unique<HashingDevice>(
+        std::make_unique<Encryption::EncryptionDevice>(std::move(data), cipher, key, iv),
+        encryptedHasher);
     auto encryptedSize = encDevice->size();
 
     QXmppFileMetadata metadata;
@@ -116,6 +122,11 @@ auto QXmppEncryptedFileSharingProvider::uploadFile(std::unique_ptr<QIODevice> da
                 encryptedSource.setKey(key);
                 encryptedSource.setIv(iv);
                 encryptedSource.setHttpSources({ std::any_cast<QXmppHttpFileSource>(std::move(httpSourceAny)) });
+                if (const auto hashes = encryptedHasher->result()) {
+                    encryptedSource.setHashes(transform<QVector<QXmppHash>>(*hashes, [](auto &&hash) {
+                        return hash;
+                    }));
+                }
 
                 return encryptedSource;
             });
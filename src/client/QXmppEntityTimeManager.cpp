@@ -72,6 +72,11 @@ QStringList QXmppEntityTimeManager::discoveryFeatures() const
     return { ns_entity_time.toString() };
 }
 
+QList<QXmppClientExtension::StanzaFilter> QXmppEntityTimeManager::stanzaFilters() const
+{
+    return { { u"iq"_s, ns_entity_time.toString() } };
+}
+
 bool QXmppEntityTimeManager::handleStanza(const QDomElement &element)
 {
     if (QXmpp::handleIqRequests<QXmppEntityTimeIq>(element, client(), this)) {
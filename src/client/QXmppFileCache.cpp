@@ -0,0 +1,675 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "QXmppFileCache.h"
+
+#include "QXmppFileCache_p.h"
+#include "QXmppFutureUtils_p.h"
+
+#include "Algorithms.h"
+#include "StringLiterals.h"
+
+#include <functional>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureInterface>
+#include <QTemporaryFile>
+#include <QThreadPool>
+
+using namespace std::chrono_literals;
+using namespace QXmpp;
+using namespace QXmpp::Private;
+
+constexpr qint64 DEFAULT_MAX_SIZE = 1024 * 1024 * 1024;
+// upload services commonly remove files after some days
+constexpr std::chrono::seconds DEFAULT_SOURCE_LIFETIME = 24h;
+// maximum number of entries, also of those without stored files
+constexpr std::size_t MAX_ENTRIES = 10000;
+constexpr qint64 COPY_BLOCK_SIZE = 1024 * 1024;
+static const auto PARTIAL_FILE_SUFFIX = u".part"_s;
+
+// Returns the key of a hash, which is also the name of a stored file with that hash.
+static QString hashKey(const QXmppHash &hash)
+{
+    return QString::number(uint32_t(hash.algorithm())) + u'-' + QString::fromLatin1(hash.hash().toHex());
+}
+
+static std::optional<QXmppHash> parseHashKey(const QString &key)
+{
+    const auto separatorIndex = key.indexOf(u'-');
+    if (separatorIndex <= 0) {
+        return {};
+    }
+
+    bool ok = false;
+    const auto algorithm = key.left(separatorIndex).toUInt(&ok);
+    const auto value = QByteArray::fromHex(key.mid(separatorIndex + 1).toLatin1());
+    if (!ok || value.isEmpty() || !isHashingAlgorithmSecure(HashAlgorithm(algorithm))) {
+        return {};
+    }
+
+    QXmppHash hash;
+    hash.setAlgorithm(HashAlgorithm(algorithm));
+    hash.setHash(value);
+    return hash;
+}
+
+static bool isUsableHash(const QXmppHash &hash)
+{
+    return !hash.hash().isEmpty() && isHashingAlgorithmSecure(hash.algorithm());
+}
+
+//
+// Passes the data of a device in blocks to 'process', from the mapped memory if it is a local file.
+//
+// Returns false if the device could not be read or 'process' returned false.
+//
+template<typename Process>
+static bool processBlocks(QIODevice &device, Process process)
+{
+    auto *file = qobject_cast<QFile *>(&device);
+    const auto fileSize = file ? file->size() : 0;
+    if (auto *mappedData = fileSize > 0 ? file->map(0, fileSize) : nullptr) {
+        for (qint64 offset = 0; offset < fileSize; offset += COPY_BLOCK_SIZE) {
+            if (!process(reinterpret_cast<const char *>(mappedData) + offset, std::min(COPY_BLOCK_SIZE, fileSize - offset))) {
+                file->unmap(mappedData);
+                return false;
+            }
+        }
+        file->unmap(mappedData);
+        return true;
+    }
+
+    QByteArray buffer(COPY_BLOCK_SIZE, Qt::Uninitialized);
+    qint64 read = 0;
+    while ((read = device.read(buffer.data(), COPY_BLOCK_SIZE)) > 0) {
+        if (!process(buffer.constData(), read)) {
+            return false;
+        }
+    }
+    return read == 0;
+}
+
+//
+// Writes the content of a stored file to 'output' and checks its hash.
+//
+// Weak hashes are not accepted since the content is used in place of a downloaded file.
+//
+static HashVerificationResult::Result copyStoredFile(const QString &filePath, const std::optional<QXmppHash> &expectedHash, QIODevice &output)
+{
+    if (!expectedHash) {
+        return HashVerificationResult::NoStrongHashes();
+    }
+
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QXmppError::fromFileDevice(file);
+    }
+
+    StreamHasher hasher({ expectedHash->algorithm() });
+    bool writeFailed = false;
+    const auto copied = processBlocks(file, [&](const char *data, qint64 size) {
+        hasher.addData(data, size);
+        writeFailed = output.write(data, size) != size;
+        return !writeFailed;
+    });
+    if (!copied) {
+        return writeFailed ? QXmppError::fromIoDevice(output) : QXmppError::fromFileDevice(file);
+    }
+
+    hasher.finish();
+    if (hasher.result()->front().hash() != expectedHash->hash()) {
+        return HashVerificationResult::NotMatching();
+    }
+    return HashVerificationResult::Verified();
+}
+
+//
+// Calculates the hashes of 'data' and writes it to 'copy' at the same time if 'copy' is set.
+//
+// The copy is optional, it is closed and removed if it cannot be written.
+//
+static HashingResult::Result hashAndCopy(QIODevice &data, std::unique_ptr<QFile> &copy, const std::function<bool()> &isCancelled)
+{
+    StreamHasher hasher(defaultHashAlgorithms());
+    bool cancelled = false;
+    const auto hashed = processBlocks(data, [&](const char *block, qint64 size) {
+        if (isCancelled()) {
+            cancelled = true;
+            return false;
+        }
+
+        hasher.addData(block, size);
+        if (copy && copy->write(block, size) != size) {
+            copy->remove();
+            copy.reset();
+        }
+        return true;
+    });
+
+    if (copy && (!hashed || !copy->flush())) {
+        copy->remove();
+        copy.reset();
+    }
+    if (cancelled) {
+        return Cancelled();
+    }
+    if (!hashed) {
+        return QXmppError::fromIoDevice(data);
+    }
+
+    hasher.finish();
+    return *hasher.result();
+}
+
+QXmppFileCachePrivate::Entries::iterator QXmppFileCachePrivate::find(const QVector<QXmppHash> &hashes)
+{
+    for (const auto &hash : hashes) {
+        if (isUsableHash(hash)) {
+            if (auto itr = index.find(hashKey(hash)); itr != index.end()) {
+                return itr->second;
+            }
+        }
+    }
+    return entries.end();
+}
+
+//
+// Returns the entry of the hashes and adds the hashes it does not contain yet.
+//
+QXmppFileCachePrivate::Entries::iterator QXmppFileCachePrivate::findOrInsert(const QVector<QXmppHash> &hashes)
+{
+    auto entry = find(hashes);
+    if (entry == entries.end()) {
+        if (entries.size() >= MAX_ENTRIES) {
+            remove(std::prev(entries.end()));
+        }
+        entries.emplace_front();
+        entry = entries.begin();
+    }
+
+    for (const auto &hash : hashes) {
+        if (isUsableHash(hash) && index.try_emplace(hashKey(hash), entry).second) {
+            entry->hashes.append(hash);
+        }
+    }
+    return entry;
+}
+
+void QXmppFileCachePrivate::use(Entries::iterator entry)
+{
+    entries.splice(entries.begin(), entries, entry);
+}
+
+void QXmppFileCachePrivate::remove(Entries::iterator entry)
+{
+    for (const auto &hash : std::as_const(entry->hashes)) {
+        index.erase(hashKey(hash));
+    }
+    removeStoredFile(*entry);
+    entries.erase(entry);
+}
+
+void QXmppFileCachePrivate::removeStoredFile(FileCacheEntry &entry)
+{
+    if (!entry.fileKey.isEmpty()) {
+        QFile::remove(filePath(entry.fileKey));
+        size -= entry.fileSize;
+        entry.fileKey.clear();
+        entry.fileSize = 0;
+    }
+}
+
+//
+// Removes the least recently used files until the maximum size is not exceeded anymore.
+//
+// Entries without files are kept as long as they contain sources.
+//
+void QXmppFileCachePrivate::evict()
+{
+    auto entry = entries.end();
+    while (size > maxSize && entry != entries.begin()) {
+        --entry;
+        removeStoredFile(*entry);
+
+        if (entry->sources.empty()) {
+            auto next = std::next(entry);
+            remove(entry);
+            entry = next;
+        }
+    }
+}
+
+///
+/// \class QXmppFileCache
+///
+/// Stores files and their sources by their hashes to share and download each file only once.
+///
+/// When the QXmppFileSharingManager uploads a file whose content has already
+/// been uploaded with the same provider, the existing source is reused.
+/// When it downloads a file that is stored here, the stored file is written
+/// to the output instead, after checking its hash.
+///
+/// Verified downloads written to QFiles are copied into the directory of the
+/// cache, uploaded files only if storeUploadedFiles() is enabled.
+/// The least recently used files are removed once the maximum size is exceeded.
+/// The files are reused after restarting while the sources are only kept in
+/// memory.
+///
+/// \code
+/// auto *cache = new QXmppFileCache(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + u"/files", this);
+/// fileSharingManager->setFileCache(cache);
+/// \endcode
+///
+/// \since QXmpp 1.9
+///
+
+///
+/// Constructs a file cache storing its files in a directory.
+///
+/// Files from a previous use of the directory are added to the cache.
+///
+/// \param directory directory used exclusively by the cache, created if it
+///        does not exist
+/// \param parent QObject parent
+///
+QXmppFileCache::QXmppFileCache(const QString &directory, QObject *parent)
+    : QObject(parent), d(std::make_unique<QXmppFileCachePrivate>(this))
+{
+    d->directory = directory;
+    d->maxSize = DEFAULT_MAX_SIZE;
+    d->sourceLifetime = DEFAULT_SOURCE_LIFETIME;
+
+    QDir dir(directory);
+    dir.mkpath(u"."_s);
+
+    // most recently modified files first
+    const auto fileInfos = dir.entryInfoList(QDir::Files, QDir::Time);
+    for (const auto &fileInfo : fileInfos) {
+        if (fileInfo.fileName().endsWith(PARTIAL_FILE_SUFFIX)) {
+            // interrupted copy
+            QFile::remove(fileInfo.absoluteFilePath());
+            continue;
+        }
+
+        if (auto hash = parseHashKey(fileInfo.fileName())) {
+            if (hashKey(*hash) != fileInfo.fileName() || d->entries.size() >= MAX_ENTRIES) {
+                continue;
+            }
+
+            auto &entry = d->entries.emplace_back();
+            entry.hashes = { *hash };
+            entry.fileKey = fileInfo.fileName();
+            entry.fileSize = fileInfo.size();
+            d->index.emplace(entry.fileKey, std::prev(d->entries.end()));
+            d->size += entry.fileSize;
+        }
+    }
+
+    d->evict();
+}
+
+QXmppFileCache::~QXmppFileCache() = default;
+
+///
+/// Returns the directory of the stored files.
+///
+QString QXmppFileCache::directory() const
+{
+    return d->directory;
+}
+
+///
+/// Returns the total size of the stored files in bytes.
+///
+qint64 QXmppFileCache::size() const
+{
+    return d->size;
+}
+
+///
+/// Returns the maximum total size of the stored files in bytes.
+///
+/// By default, it is 1 GiB.
+///
+qint64 QXmppFileCache::maxSize() const
+{
+    return d->maxSize;
+}
+
+///
+/// Sets the maximum total size of the stored files in bytes.
+///
+/// The least recently used files are removed if the size is exceeded.
+/// Files larger than the maximum size are not stored.
+///
+/// \param maxSize maximum size, 0 to disable storing files
+///
+void QXmppFileCache::setMaxSize(qint64 maxSize)
+{
+    d->maxSize = std::max(maxSize, qint64(0));
+    d->evict();
+}
+
+///
+/// Returns how long the sources of uploaded or downloaded files are reused.
+///
+/// By default, sources are reused for one day.
+///
+std::chrono::seconds QXmppFileCache::sourceLifetime() const
+{
+    return d->sourceLifetime;
+}
+
+///
+/// Sets how long the sources of uploaded or downloaded files are reused.
+///
+/// Older sources are removed instead of sharing them again since their files may not be
+/// available anymore, e.g., because an upload service removes files after some time.
+///
+/// \param lifetime time after adding a source until it is not reused anymore, 0 to disable
+///        reusing sources
+///
+void QXmppFileCache::setSourceLifetime(std::chrono::seconds lifetime)
+{
+    d->sourceLifetime = std::max(lifetime, std::chrono::seconds(0));
+}
+
+///
+/// Returns whether uploaded files are copied into the directory of the cache.
+///
+/// By default, uploaded files are not stored.
+///
+bool QXmppFileCache::storeUploadedFiles() const
+{
+    return d->uploadedFilesStored;
+}
+
+///
+/// Sets whether uploaded files are copied into the directory of the cache.
+///
+/// Stored files are used instead of downloading files with the same content.
+/// Each uploaded local file of up to maxSize() is copied while it is hashed before the upload,
+/// which costs as much disk space and I/O as the file itself.
+///
+/// \param enabled whether to store uploaded files
+///
+void QXmppFileCache::setStoreUploadedFiles(bool enabled)
+{
+    d->uploadedFilesStored = enabled;
+}
+
+///
+/// Returns how often a file or source has been found in the cache.
+///
+quint64 QXmppFileCache::hits() const
+{
+    return d->hits;
+}
+
+///
+/// Returns how often a file or source has not been found in the cache.
+///
+quint64 QXmppFileCache::misses() const
+{
+    return d->misses;
+}
+
+///
+/// Removes all stored files and sources.
+///
+void QXmppFileCache::clear()
+{
+    while (!d->entries.empty()) {
+        d->remove(d->entries.begin());
+    }
+}
+
+std::optional<std::any> QXmppFileCachePrivate::findSource(const QVector<QXmppHash> &hashes, std::type_index providerType)
+{
+    auto entry = find(hashes);
+    if (entry != entries.end()) {
+        if (auto source = entry->sources.find(providerType); source != entry->sources.end()) {
+            if (std::chrono::steady_clock::now() - source->second.addedAt < sourceLifetime) {
+                hits++;
+                use(entry);
+                return source->second.source;
+            }
+
+            // The file may have been removed from the server in the meantime.
+            entry->sources.erase(source);
+        }
+    }
+
+    misses++;
+    return {};
+}
+
+void QXmppFileCachePrivate::addSource(const QVector<QXmppHash> &hashes, std::type_index providerType, const std::any &source)
+{
+    if (std::none_of(hashes.cbegin(), hashes.cend(), isUsableHash)) {
+        return;
+    }
+
+    auto entry = findOrInsert(hashes);
+    entry->sources.insert_or_assign(providerType, FileCacheSource { source, std::chrono::steady_clock::now() });
+    use(entry);
+}
+
+bool QXmppFileCachePrivate::containsFile(const QVector<QXmppHash> &hashes)
+{
+    auto entry = find(hashes);
+    if (entry != entries.end() && !entry->fileKey.isEmpty()) {
+        if (QFile::exists(filePath(entry->fileKey))) {
+            hits++;
+            return true;
+        }
+
+        // removed by someone else
+        size -= entry->fileSize;
+        entry->fileKey.clear();
+        entry->fileSize = 0;
+    }
+
+    misses++;
+    return false;
+}
+
+//
+// Writes the stored file of the hashes to 'output' in another thread.
+//
+// The content is checked against the strongest of the passed hashes.
+// The output is part of the result for continuing to use it if the content
+// does not match.
+//
+QFuture<HashVerificationResultPtr> QXmppFileCachePrivate::copyFile(const QVector<QXmppHash> &hashes, std::unique_ptr<QIODevice> output)
+{
+    struct CopyJob {
+        QString filePath;
+        std::optional<QXmppHash> expectedHash;
+        std::unique_ptr<QIODevice> output;
+        QFutureInterface<HashVerificationResultPtr> interface;
+    };
+
+    auto entry = find(hashes);
+    if (entry == entries.end() || entry->fileKey.isEmpty()) {
+        return makeReadyFuture(std::make_shared<HashVerificationResult>(
+            QXmppError { u"No file with the hashes is stored in the cache."_s, {} },
+            std::move(output)));
+    }
+    use(entry);
+
+    auto job = std::make_shared<CopyJob>();
+    job->filePath = filePath(entry->fileKey);
+    job->expectedHash = preferredHash(transform<std::vector<QXmppHash>>(hashes, [](auto hash) { return hash; }));
+    job->output = std::move(output);
+    job->interface.reportStarted();
+
+    QThreadPool::globalInstance()->start([job]() {
+        auto result = copyStoredFile(job->filePath, job->expectedHash, *job->output);
+        job->interface.reportResult(std::make_shared<HashVerificationResult>(std::move(result), std::move(job->output)));
+        job->interface.reportFinished();
+    });
+
+    return job->interface.future();
+}
+
+//
+// Calculates the hashes of a local file in another thread and copies it into the directory at
+// the same time if uploaded files are stored.
+//
+// That way, the file is read only once for both.
+// The copy is discarded if a file with the same content is already stored.
+// The data is part of the result for uploading it afterwards.
+//
+QFuture<HashingResultPtr> QXmppFileCachePrivate::hashAndStoreFile(std::unique_ptr<QIODevice> data)
+{
+    struct HashJob {
+        std::unique_ptr<QIODevice> data;
+        std::unique_ptr<QFile> copy;
+        HashingResult::Result result = Cancelled();
+    };
+
+    auto job = std::make_shared<HashJob>();
+    job->data = std::move(data);
+    if (auto *file = qobject_cast<QFile *>(job->data.get()); uploadedFilesStored && file && file->size() <= maxSize) {
+        // The copy is renamed once its hashes are known.
+        auto copy = std::make_unique<QTemporaryFile>(filePath(u"XXXXXX"_s + PARTIAL_FILE_SUFFIX));
+        copy->setAutoRemove(false);
+        if (copy->open()) {
+            job->copy = std::move(copy);
+        }
+    }
+
+    QFutureInterface<HashingResultPtr> interface;
+    interface.reportStarted();
+
+    QFutureInterface<void> jobInterface;
+    jobInterface.reportStarted();
+
+    QThreadPool::globalInstance()->start([job, jobInterface, interface]() mutable {
+        job->result = hashAndCopy(*job->data, job->copy, [interface]() mutable { return interface.isCanceled(); });
+        if (job->copy) {
+            job->copy->close();
+        }
+        jobInterface.reportFinished();
+    });
+
+    await(jobInterface.future(), q, [this, job, interface]() mutable {
+        if (job->copy) {
+            const auto partialFilePath = job->copy->fileName();
+            const auto *hashes = std::get_if<std::vector<QXmppHash>>(&job->result);
+            if (!hashes || !addStoredFile(transform<QVector<QXmppHash>>(*hashes, [](auto hash) { return hash; }), partialFilePath)) {
+                QFile::remove(partialFilePath);
+            }
+        }
+
+        interface.reportResult(std::make_shared<HashingResult>(std::move(job->result), std::move(job->data)));
+        interface.reportFinished();
+    });
+
+    return interface.future();
+}
+
+//
+// Moves a copy of a file with the given hashes in the directory to its final name and adds it.
+//
+// Returns false if the copy is not used because a file with the same content is already stored.
+//
+bool QXmppFileCachePrivate::addStoredFile(const QVector<QXmppHash> &hashes, const QString &partialFilePath)
+{
+    const auto hash = preferredHash(transform<std::vector<QXmppHash>>(hashes, [](auto hash) { return hash; }));
+    if (!hash) {
+        return false;
+    }
+
+    auto entry = findOrInsert(hashes);
+    use(entry);
+
+    const auto fileKey = hashKey(*hash);
+    const auto fileSize = QFileInfo(partialFilePath).size();
+    if (!entry->fileKey.isEmpty() || pendingFileKeys.count(fileKey) || fileSize > maxSize) {
+        return false;
+    }
+
+    const auto storedFilePath = filePath(fileKey);
+    QFile::remove(storedFilePath);
+    if (!QFile::rename(partialFilePath, storedFilePath)) {
+        return false;
+    }
+
+    entry->fileKey = fileKey;
+    entry->fileSize = fileSize;
+    size += fileSize;
+    evict();
+    return true;
+}
+
+//
+// Copies a file with the given hashes into the directory in another thread.
+//
+void QXmppFileCachePrivate::storeFile(const QVector<QXmppHash> &hashes, const QString &sourceFilePath)
+{
+    const auto hash = preferredHash(transform<std::vector<QXmppHash>>(hashes, [](auto hash) { return hash; }));
+    if (!hash) {
+        return;
+    }
+
+    auto entry = findOrInsert(hashes);
+    use(entry);
+
+    const auto fileKey = hashKey(*hash);
+    if (!entry->fileKey.isEmpty() || pendingFileKeys.count(fileKey) || QFileInfo(sourceFilePath).size() > maxSize) {
+        return;
+    }
+
+    pendingFileKeys.insert(fileKey);
+
+    QFutureInterface<qint64> interface;
+    interface.reportStarted();
+
+    QThreadPool::globalInstance()->start([interface, sourceFilePath, storedFilePath = filePath(fileKey)]() mutable {
+        // The file is renamed after copying it completely so that interrupted copies are not
+        // used.
+        const auto partialFilePath = storedFilePath + PARTIAL_FILE_SUFFIX;
+        QFile::remove(partialFilePath);
+        QFile::remove(storedFilePath);
+
+        qint64 fileSize = -1;
+        if (QFile::copy(sourceFilePath, partialFilePath) && QFile::rename(partialFilePath, storedFilePath)) {
+            fileSize = QFileInfo(storedFilePath).size();
+        } else {
+            QFile::remove(partialFilePath);
+        }
+
+        interface.reportResult(fileSize);
+        interface.reportFinished();
+    });
+
+    await(interface.future(), q, [this, hashes, fileKey](qint64 fileSize) {
+        pendingFileKeys.erase(fileKey);
+        if (fileSize < 0) {
+            return;
+        }
+
+        // the entry may have been removed in the meantime
+        auto entry = findOrInsert(hashes);
+        if (entry->fileKey.isEmpty()) {
+            entry->fileKey = fileKey;
+            entry->fileSize = fileSize;
+            size += fileSize;
+            evict();
+        } else if (entry->fileKey != fileKey) {
+            QFile::remove(filePath(fileKey));
+        }
+    });
+}
+
+void QXmppFileCachePrivate::removeFile(const QVector<QXmppHash> &hashes)
+{
+    if (auto entry = find(hashes); entry != entries.end()) {
+        removeStoredFile(*entry);
+    }
+}
@@ -0,0 +1,47 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#ifndef QXMPPFILECACHE_H
+#define QXMPPFILECACHE_H
+
+#include "QXmppGlobal.h"
+
+#include <chrono>
+#include <memory>
+
+#include <QObject>
+
+class QXmppFileCachePrivate;
+
+class QXMPP_EXPORT QXmppFileCache : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QXmppFileCache(const QString &directory, QObject *parent = nullptr);
+    ~QXmppFileCache() override;
+
+    QString directory() const;
+
+    qint64 size() const;
+    qint64 maxSize() const;
+    void setMaxSize(qint64 maxSize);
+
+    std::chrono::seconds sourceLifetime() const;
+    void setSourceLifetime(std::chrono::seconds lifetime);
+
+    bool storeUploadedFiles() const;
+    void setStoreUploadedFiles(bool enabled);
+
+    quint64 hits() const;
+    quint64 misses() const;
+
+    void clear();
+
+private:
+    friend class QXmppFileCachePrivate;
+
+    std::unique_ptr<QXmppFileCachePrivate> d;
+};
+
+#endif  // QXMPPFILECACHE_H
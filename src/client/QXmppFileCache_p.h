@@ -0,0 +1,106 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#ifndef QXMPPFILECACHE_P_H
+#define QXMPPFILECACHE_P_H
+
+#include "QXmppFileCache.h"
+#include "QXmppHashing_p.h"
+
+#include <any>
+#include <chrono>
+#include <list>
+#include <optional>
+#include <typeindex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <QDir>
+#include <QFuture>
+#include <QVector>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+namespace QXmpp::Private {
+
+struct FileCacheSource {
+    std::any source;
+    std::chrono::steady_clock::time_point addedAt;
+};
+
+struct FileCacheEntry {
+    QVector<QXmppHash> hashes;
+    // name of the stored file, empty if there is none
+    QString fileKey;
+    qint64 fileSize = 0;
+    // sources of uploaded or downloaded files by the type of their provider
+    std::unordered_map<std::type_index, FileCacheSource> sources;
+};
+
+}  // namespace QXmpp::Private
+
+class QXmppFileCachePrivate
+{
+public:
+    using Entries = std::list<QXmpp::Private::FileCacheEntry>;
+
+    static QXmppFileCachePrivate *get(QXmppFileCache *cache)
+    {
+        return cache->d.get();
+    }
+
+    explicit QXmppFileCachePrivate(QXmppFileCache *q)
+        : q(q)
+    {
+    }
+
+    // used by QXmppFileSharingManager
+    std::optional<std::any> findSource(const QVector<QXmppHash> &hashes, std::type_index providerType);
+    void addSource(const QVector<QXmppHash> &hashes, std::type_index providerType, const std::any &source);
+    bool containsFile(const QVector<QXmppHash> &hashes);
+    QFuture<QXmpp::Private::HashVerificationResultPtr> copyFile(const QVector<QXmppHash> &hashes, std::unique_ptr<QIODevice> output);
+    QFuture<QXmpp::Private::HashingResultPtr> hashAndStoreFile(std::unique_ptr<QIODevice> data);
+    void storeFile(const QVector<QXmppHash> &hashes, const QString &filePath);
+    void removeFile(const QVector<QXmppHash> &hashes);
+
+    bool addStoredFile(const QVector<QXmppHash> &hashes, const QString &partialFilePath);
+    Entries::iterator find(const QVector<QXmppHash> &hashes);
+    Entries::iterator findOrInsert(const QVector<QXmppHash> &hashes);
+    void use(Entries::iterator entry);
+    void remove(Entries::iterator entry);
+    void removeStoredFile(QXmpp::Private::FileCacheEntry &entry);
+    void evict();
+
+    QString filePath(const QString &fileKey) const
+    {
+        return QDir(directory).filePath(fileKey);
+    }
+
+    QXmppFileCache *q;
+    QString directory;
+    qint64 size = 0;
+    qint64 maxSize = 0;
+    std::chrono::seconds sourceLifetime {};
+    bool uploadedFilesStored = false;
+    quint64 hits = 0;
+    quint64 misses = 0;
+    // most recently used entry first
+    Entries entries;
+    // entries by the keys of all their strong hashes
+    std::unordered_map<QString, Entries::iterator> index;
+    // keys of files being copied into the directory
+    std::unordered_set<QString> pendingFileKeys;
+};
+
+#endif  // QXMPPFILECACHE_P_H
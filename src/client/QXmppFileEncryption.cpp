@@ -4,9 +4,12 @@
 
 #include "QXmppFileEncryption.h"
 
+#include "QXmppHashing_p.h"
+
 #include "StringLiterals.h"
 
 #include <QByteArray>
+#include <QFile>
 #include <QtCrypto>
 
 #undef min
@@ -84,6 +87,16 @@ static std::size_t roundUpToBlockSize(qint64 size, std::size_t blockSize)
     return (size / blockSize + 1) * blockSize;
 }
 
+// Copies as much processed data as fits into the caller's buffer and appends the rest to the
+// output buffer.
+static qint64 copyProcessed(const MemoryRegion &processed, char *data, qint64 len, QByteArray &outputBuffer)
+{
+    auto copied = std::min(qint64(processed.size()), len);
+    std::copy_n(processed.constData(), copied, data);
+    outputBuffer.append(processed.constData() + copied, processed.size() - copied);
+    return copied;
+}
+
 bool isSupported(Cipher config)
 {
     auto cipherString = QCA::Cipher::withAlgorithms(cipherName(config), cipherMode(config), padding(config));
@@ -149,29 +162,42 @@ EncryptionDevice::EncryptionDevice(std::unique_ptr<QIODevice> input,
     // output must not be sequential
     Q_ASSERT(!m_input->isSequential());
 
-    Q_ASSERT(m_outputBuffer.empty());
+    Q_ASSERT(m_outputBuffer.isEmpty());
 
     setOpenMode(m_input->openMode() & QIODevice::ReadOnly);
 
     Q_ASSERT(m_cipher->validKeyLength(int(key.length())));
     Q_ASSERT(m_cipher->ok());
+
+    if (m_input->isReadable()) {
+        mapInput();
+    }
 }
 
-EncryptionDevice::~EncryptionDevice() = default;
+EncryptionDevice::~EncryptionDevice()
+{
+    unmapInput();
+}
 
 bool EncryptionDevice::open(OpenMode mode)
 {
-    return m_input->open(mode);
+    if (!m_input->open(mode)) {
+        return false;
+    }
+    mapInput();
+    return true;
 }
 
 void EncryptionDevice::close()
 {
+    unmapInput();
     m_input->close();
 }
 
+// The encrypted data can only be read once because the cipher cannot be rewound.
 bool EncryptionDevice::isSequential() const
 {
-    return false;
+    return true;
 }
 
 qint64 EncryptionDevice::size() const
@@ -194,44 +220,37 @@ qint64 EncryptionDevice::readData(char *data, qint64 len)
     qint64 read = 0;
 
     {
-        // try to read from output buffer
-        qint64 outputBufferRead = std::min(qint64(m_outputBuffer.size()), len);
-        std::copy_n(m_outputBuffer.cbegin(), outputBufferRead, data);
-        m_outputBuffer.erase(m_outputBuffer.begin(), m_outputBuffer.begin() + outputBufferRead);
+        // try to read from output buffer, the consumed part is skipped instead of erased
+        qint64 outputBufferRead = std::min(qint64(m_outputBuffer.size() - m_outputBufferOffset), len);
+        std::copy_n(m_outputBuffer.constData() + m_outputBufferOffset, outputBufferRead, data);
+        m_outputBufferOffset += outputBufferRead;
+        if (m_outputBufferOffset == m_outputBuffer.size()) {
+            m_outputBuffer.clear();
+            m_outputBufferOffset = 0;
+        }
         read += outputBufferRead;
         len -= outputBufferRead;
     }
 
-    if (len > 0) {
+    if (len > 0 && !m_finalized) {
         // read from input and encrypt new data
 
         // output buffer is empty here
-        Q_ASSERT(m_outputBuffer.empty());
-
-        // read unencrypted data (may read one block more than needed)
-        auto inputBufferSize = roundUpToBlockSize(len, blockSize(m_cipherConfig));
-        Q_ASSERT(inputBufferSize > 0);
-        QByteArray inputBuffer;
-        inputBuffer.resize(inputBufferSize);
-        inputBuffer.resize(m_input->read(inputBuffer.data(), inputBufferSize));
-
-        // process input buffer
-        auto processed = m_cipher->update(MemoryRegion(inputBuffer));
-        if (m_input->atEnd()) {
-            m_finalized = true;
-            processed = processed + m_cipher->final();
-        }
+        Q_ASSERT(m_outputBuffer.isEmpty());
 
-        // split up into part for user and put rest into output buffer
-        auto processedReadBytes = std::min(qint64(processed.size()), len);
-        std::copy_n(processed.constData(), processedReadBytes, data + read);
+        // The whole requested length is encrypted at once (may read one block more than needed).
+        // The result is copied into the caller's buffer directly, only the data exceeding the
+        // requested length is kept in the output buffer.
+        auto processedReadBytes = copyProcessed(m_cipher->update(MemoryRegion(readInput(len))), data + read, len, m_outputBuffer);
         read += processedReadBytes;
         len -= processedReadBytes;
 
-        Q_ASSERT(processed.size() >= processedReadBytes);
-        auto restBytes = size_t(processed.size() - processedReadBytes);
-        m_outputBuffer.resize(restBytes);
-        std::copy_n(processed.constData() + processedReadBytes, restBytes, m_outputBuffer.data());
+        if (isInputAtEnd()) {
+            m_finalized = true;
+            processedReadBytes = copyProcessed(m_cipher->final(), data + read, len, m_outputBuffer);
+            read += processedReadBytes;
+            len -= processedReadBytes;
+        }
     }
 
     Q_ASSERT((len + read) == requestedLen);
@@ -245,7 +264,59 @@ qint64 EncryptionDevice::writeData(const char *, qint64)
 
 bool EncryptionDevice::atEnd() const
 {
-    return m_finalized && m_outputBuffer.empty();
+    return m_finalized && m_outputBuffer.isEmpty();
+}
+
+// Maps the input into memory if it is a local file, also if it is wrapped by a hashing device.
+void EncryptionDevice::mapInput()
+{
+    m_hashingDevice = dynamic_cast<HashingDevice *>(m_input.get());
+    auto *file = m_hashingDevice ? m_hashingDevice->file() : qobject_cast<QFile *>(m_input.get());
+    if (!m_mappedInput && file && file->size() > 0) {
+        m_mappedInputPosition = file->pos();
+        m_mappedInputSize = file->size();
+        m_mappedInput = file->map(0, m_mappedInputSize);
+        m_mappedFile = file;
+    }
+}
+
+void EncryptionDevice::unmapInput()
+{
+    if (m_mappedInput) {
+        m_mappedFile->unmap(m_mappedInput);
+        m_mappedInput = nullptr;
+    }
+}
+
+// Returns the next unencrypted data of at least 'len' bytes rounded up to the block size or less
+// at the end of the input.
+QByteArray EncryptionDevice::readInput(qint64 len)
+{
+    auto inputBufferSize = qint64(roundUpToBlockSize(len, blockSize(m_cipherConfig)));
+    Q_ASSERT(inputBufferSize > 0);
+
+    if (m_mappedInput) {
+        // refers to the mapped memory without copying
+        auto size = std::min(inputBufferSize, m_mappedInputSize - m_mappedInputPosition);
+        auto input = QByteArray::fromRawData(reinterpret_cast<const char *>(m_mappedInput) + m_mappedInputPosition, size);
+        if (m_hashingDevice) {
+            m_hashingDevice->hashReadData(m_mappedInputPosition, input.constData(), size);
+        }
+        m_mappedInputPosition += size;
+        return input;
+    }
+
+    m_inputBuffer.resize(inputBufferSize);
+    m_inputBuffer.resize(std::max(m_input->read(m_inputBuffer.data(), inputBufferSize), qint64(0)));
+    return m_inputBuffer;
+}
+
+bool EncryptionDevice::isInputAtEnd() const
+{
+    if (m_mappedInput) {
+        return m_mappedInputPosition == m_mappedInputSize;
+    }
+    return m_input->atEnd();
 }
 
 DecryptionDevice::DecryptionDevice(std::unique_ptr<QIODevice> input,
@@ -303,7 +374,8 @@ qint64 DecryptionDevice::readData(char *, qint64)
 
 qint64 DecryptionDevice::writeData(const char *data, qint64 len)
 {
-    auto decrypted = m_cipher->update(QByteArray(data, len));
+    // the data is passed to the cipher without copying it
+    auto decrypted = m_cipher->update(MemoryRegion(QByteArray::fromRawData(data, len)));
     m_output->write(decrypted.constData(), decrypted.size());
     return len;
 }
@@ -16,6 +16,12 @@ class Cipher;
 class Initializer;
 }  // namespace QCA
 
+class QFile;
+
+namespace QXmpp::Private {
+class HashingDevice;
+}
+
 namespace QXmpp::Private::Encryption {
 
 enum Direction {
@@ -44,9 +50,25 @@ public:
     bool atEnd() const override;
 
 private:
+    void mapInput();
+    void unmapInput();
+    QByteArray readInput(qint64 len);
+    bool isInputAtEnd() const;
+
     Cipher m_cipherConfig;
     bool m_finalized = false;
-    std::vector<char> m_outputBuffer;
+    // encrypted data not yet returned, starting at the offset
+    QByteArray m_outputBuffer;
+    qsizetype m_outputBufferOffset = 0;
+    // reused buffer for reading unencrypted data if the input is not mapped
+    QByteArray m_inputBuffer;
+    // local files are mapped into memory and encrypted without copying
+    uchar *m_mappedInput = nullptr;
+    QFile *m_mappedFile = nullptr;
+    // hashing device wrapping the mapped file, its hasher is passed the mapped data instead
+    HashingDevice *m_hashingDevice = nullptr;
+    qint64 m_mappedInputSize = 0;
+    qint64 m_mappedInputPosition = 0;
     std::unique_ptr<QIODevice> m_input;
     std::unique_ptr<QCA::Cipher> m_cipher;
 };
@@ -7,6 +7,8 @@
 
 #include "QXmppBitsOfBinaryContentId.h"
 #include "QXmppBitsOfBinaryData.h"
+#include "QXmppFileCache.h"
+#include "QXmppFileCache_p.h"
 #include "QXmppFileMetadata.h"
 #include "QXmppFileShare.h"
 #include "QXmppFutureUtils_p.h"
@@ -25,9 +27,11 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QFutureInterface>
+#include <QFutureWatcher>
 #include <QMimeDatabase>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
+#include <QPointer>
 
 using namespace QXmpp;
 using namespace QXmpp::Private;
@@ -35,16 +39,6 @@ using namespace QXmpp::Private;
 using MetadataGenerator = QXmppFileSharingManager::MetadataGenerator;
 using MetadataGeneratorResult = QXmppFileSharingManager::MetadataGeneratorResult;
 
-// The manager generates a hash with each hash algorithm
-static std::vector<HashAlgorithm> hashAlgorithms()
-{
-#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-    return { HashAlgorithm::Sha256, HashAlgorithm::Blake2b_256 };
-#else
-    return { HashAlgorithm::Sha256, HashAlgorithm::Sha3_256 };
-#endif
-}
-
 class QXmppFileUploadPrivate
 {
 public:
@@ -335,6 +329,7 @@ public:
         return makeReadyFuture(std::make_shared<MetadataGeneratorResult>());
     };
     std::unordered_map<std::type_index, std::shared_ptr<QXmppFileSharingProvider>> providers;
+    QPointer<QXmppFileCache> fileCache;
 };
 
 ///
@@ -383,6 +378,39 @@ void QXmppFileSharingManager::setMetadataGenerator(MetadataGenerator &&generator
     d->metadataGenerator = std::move(generator);
 }
 
+///
+/// Returns the file cache used for uploads and downloads.
+///
+/// \since QXmpp 1.9
+///
+QXmppFileCache *QXmppFileSharingManager::fileCache() const
+{
+    return d->fileCache;
+}
+
+///
+/// Sets a file cache used for uploads and downloads.
+///
+/// Files with the same content are only uploaded once and files already stored in the cache are
+/// copied instead of downloading them again.
+///
+/// That has costs for each upload: Without a cache, the hashes are calculated while the file is
+/// uploaded. With a cache, the file is read completely for calculating its hashes before the
+/// upload starts so that an existing source can be found, which delays each upload by the time
+/// needed for hashing. See QXmppFileCache::setStoreUploadedFiles() for the costs of storing
+/// uploaded files and QXmppFileCache::setSourceLifetime() for how long sources are reused.
+///
+/// The cache is not owned by the manager.
+///
+/// \param cache file cache or nullptr to disable caching
+///
+/// \since QXmpp 1.9
+///
+void QXmppFileSharingManager::setFileCache(QXmppFileCache *cache)
+{
+    d->fileCache = cache;
+}
+
 ///
 /// \brief Upload a file in a way that it can be attached to a message.
 /// \param provider The provider class decides how the file is uploaded
@@ -411,9 +439,15 @@ std::shared_ptr<QXmppFileUpload> QXmppFileSharingManager::uploadFile(std::shared
         return device;
     };
 
+    // The hashes are calculated while the file is read for uploading it.
+    // With a file cache, they are needed before and calculated separately.
+    auto hasher = std::make_shared<StreamHasher>(defaultHashAlgorithms());
+
     auto metadataIoDevice = openFile();
-    auto hashesIoDevice = openFile();
     auto uploadIoDevice = openFile();
+    if (!d->fileCache) {
+        uploadIoDevice = std::make_unique<HashingDevice>(std::move(uploadIoDevice), hasher);
+    }
 
     if (upload->d->finished) {
         // error occurred while opening file
@@ -421,19 +455,40 @@ std::shared_ptr<QXmppFileUpload> QXmppFileSharingManager::uploadFile(std::shared
     }
 
     upload->d->metadataFuture = d->metadataGenerator(std::move(metadataIoDevice));
-    upload->d->hashesFuture = calculateHashes(std::move(hashesIoDevice), hashAlgorithms());
 
     auto onProgress = [upload](quint64 sent, quint64 total) {
         upload->d->bytesSent = sent;
         upload->d->bytesTotal = total;
         Q_EMIT upload->progressChanged();
     };
-    auto onFinished = [this, upload](QXmppFileSharingProvider::UploadResult uploadResult) {
+    // Remembers the source of the uploaded file for sharing it again.
+    // The file has been stored while calculating its hashes.
+    auto addToCache = [this, providerType = std::type_index(typeid(*provider))](const std::shared_ptr<QXmppFileUpload> &upload) {
+        if (d->fileCache) {
+            QXmppFileCachePrivate::get(d->fileCache)->addSource(upload->d->metadata.hashes(), providerType, upload->d->source);
+        }
+    };
+    auto onFinished = [this, upload, hasher, openFile, addToCache](QXmppFileSharingProvider::UploadResult uploadResult) {
         // free memory
         upload->d->providerUpload.reset();
         if (std::holds_alternative<std::any>(uploadResult)) {
             upload->d->source = std::get<std::any>(std::move(uploadResult));
-            await(upload->d->metadataFuture, this, [this, upload](auto &&result) mutable {
+            auto *metadataWatcher = new QFutureWatcher<std::shared_ptr<MetadataGeneratorResult>>(this);
+            connect(metadataWatcher, &QFutureWatcherBase::finished, this, [this, upload, hasher, openFile, addToCache, metadataWatcher]() mutable {
+                metadataWatcher->deleteLater();
+
+                if (metadataWatcher->future().resultCount() == 0) {
+                    // the metadata generation is cancelled together with the upload
+                    if (metadataWatcher->future().isCanceled()) {
+                        upload->d->cancelled = true;
+                    } else {
+                        upload->d->error = QXmppError { u"The metadata generator did not report a result."_s, {} };
+                    }
+                    upload->reportFinished();
+                    return;
+                }
+
+                auto result = metadataWatcher->result();
                 if (result->dimensions) {
                     upload->d->metadata.setWidth(result->dimensions->width());
                     upload->d->metadata.setHeight(result->dimensions->height());
@@ -463,7 +518,33 @@ std::shared_ptr<QXmppFileUpload> QXmppFileSharingManager::uploadFile(std::shared
                     upload->d->metadata.setThumbnails(thumbnails);
                 }
 
-                await(upload->d->hashesFuture, this, [upload](auto hashResult) mutable {
+                // the hashes have been calculated before the upload
+                if (!upload->d->metadata.hashes().isEmpty()) {
+                    addToCache(upload);
+                    upload->d->success = true;
+                    upload->reportFinished();
+                    return;
+                }
+
+                if (const auto hashes = hasher->result()) {
+                    upload->d->metadata.setHashes(transform<QVector<QXmppHash>>(*hashes, [](auto &&hash) {
+                        return hash;
+                    }));
+                    addToCache(upload);
+                    upload->d->success = true;
+                    upload->reportFinished();
+                    return;
+                }
+
+                // The provider did not read the file completely in order, so the hashes need
+                // to be calculated separately.
+                auto hashesIoDevice = openFile();
+                if (upload->d->finished) {
+                    return;
+                }
+
+                upload->d->hashesFuture = calculateHashes(std::move(hashesIoDevice), defaultHashAlgorithms());
+                await(upload->d->hashesFuture, this, [upload, addToCache](auto hashResult) mutable {
                     auto &hashValue = hashResult->result;
                     if (std::holds_alternative<std::vector<QXmppHash>>(hashValue)) {
                         const auto &hashesVector = std::get<std::vector<QXmppHash>>(hashValue);
@@ -471,6 +552,7 @@ std::shared_ptr<QXmppFileUpload> QXmppFileSharingManager::uploadFile(std::shared
                             return hash;
                         });
                         upload->d->metadata.setHashes(hashes);
+                        addToCache(upload);
                         upload->d->success = true;
                     } else if (std::holds_alternative<Cancelled>(hashValue)) {
                         upload->d->cancelled = true;
@@ -480,6 +562,7 @@ std::shared_ptr<QXmppFileUpload> QXmppFileSharingManager::uploadFile(std::shared
                     upload->reportFinished();
                 });
             });
+            metadataWatcher->setFuture(upload->d->metadataFuture);
         } else if (std::holds_alternative<Cancelled>(uploadResult)) {
             upload->d->cancelled = true;
             upload->reportFinished();
@@ -489,7 +572,44 @@ std::shared_ptr<QXmppFileUpload> QXmppFileSharingManager::uploadFile(std::shared
         }
     };
 
-    upload->d->providerUpload = provider->uploadFile(std::move(uploadIoDevice), upload->d->metadata, std::move(onProgress), std::move(onFinished));
+    if (!d->fileCache) {
+        upload->d->providerUpload = provider->uploadFile(std::move(uploadIoDevice), upload->d->metadata, std::move(onProgress), std::move(onFinished));
+        return upload;
+    }
+
+    // The source of a file with the same content uploaded before is reused instead of uploading
+    // the file again.
+    // The file is stored in the cache while its hashes are calculated.
+    upload->d->hashesFuture = QXmppFileCachePrivate::get(d->fileCache)->hashAndStoreFile(std::move(uploadIoDevice));
+    await(upload->d->hashesFuture, this, [this, upload, provider, onProgress, onFinished](HashingResultPtr hashResult) mutable {
+        auto &hashValue = hashResult->result;
+        if (std::holds_alternative<Cancelled>(hashValue)) {
+            upload->d->cancelled = true;
+            upload->reportFinished();
+            return;
+        }
+        if (auto *error = std::get_if<QXmppError>(&hashValue)) {
+            upload->d->error = std::move(*error);
+            upload->reportFinished();
+            return;
+        }
+
+        upload->d->metadata.setHashes(transform<QVector<QXmppHash>>(std::get<std::vector<QXmppHash>>(hashValue), [](auto &&hash) {
+            return hash;
+        }));
+
+        if (d->fileCache) {
+            if (auto source = QXmppFileCachePrivate::get(d->fileCache)->findSource(upload->d->metadata.hashes(), std::type_index(typeid(*provider)))) {
+                onFinished(std::move(*source));
+                return;
+            }
+        }
+
+        // the file has been read completely for hashing
+        auto data = std::move(hashResult->data);
+        data->seek(0);
+        upload->d->providerUpload = provider->uploadFile(std::move(data), upload->d->metadata, std::move(onProgress), std::move(onFinished));
+    });
     return upload;
 }
 
@@ -513,7 +633,58 @@ std::shared_ptr<QXmppFileDownload> QXmppFileSharingManager::downloadFile(
     std::shared_ptr<QXmppFileDownload> download(new QXmppFileDownload());
     download->d->hashes = fileShare.metadata().hashes();
 
-    // currently hashing does only work with QFiles
+    // A file with the same content in the file cache is written to the output instead of
+    // downloading it.
+    if (d->fileCache && QXmppFileCachePrivate::get(d->fileCache)->containsFile(download->d->hashes)) {
+        download->d->hashesFuture = QXmppFileCachePrivate::get(d->fileCache)->copyFile(download->d->hashes, std::move(output));
+        auto *copyWatcher = new QFutureWatcher<HashVerificationResultPtr>(this);
+        connect(copyWatcher, &QFutureWatcherBase::finished, this, [this, download, fileShare, copyWatcher]() {
+            copyWatcher->deleteLater();
+
+            // the copy is cancelled together with the download
+            if (copyWatcher->future().resultCount() == 0) {
+                download->reportFinished(Cancelled());
+                return;
+            }
+
+            auto hashResult = copyWatcher->result();
+            if (std::holds_alternative<HashVerificationResult::Verified>(hashResult->result)) {
+                // closes the output
+                hashResult->data.reset();
+                download->reportFinished(QXmppFileDownload::Downloaded { QXmppFileDownload::HashVerified });
+                return;
+            }
+            if (std::holds_alternative<Cancelled>(hashResult->result)) {
+                download->reportFinished(Cancelled());
+                return;
+            }
+
+            // The stored file has been modified or could not be read.
+            if (d->fileCache) {
+                QXmppFileCachePrivate::get(d->fileCache)->removeFile(download->d->hashes);
+            }
+
+            // the data written from the stored file is discarded
+            auto output = std::move(hashResult->data);
+            auto *file = qobject_cast<QFile *>(output.get());
+            if (!file || !file->resize(0) || !file->seek(0)) {
+                download->reportFinished(QXmppError { u"Could not use the cached file and the output device could not be reset."_s, {} });
+                return;
+            }
+
+            startDownload(fileShare, download, std::move(output));
+        });
+        copyWatcher->setFuture(download->d->hashesFuture);
+        return download;
+    }
+
+    startDownload(fileShare, download, std::move(output));
+    return download;
+}
+
+void QXmppFileSharingManager::startDownload(const QXmppFileShare &fileShare, const std::shared_ptr<QXmppFileDownload> &download, std::unique_ptr<QIODevice> output)
+{
+    // reading the data again for hashing does only work with QFiles
     auto filePath = [&]() -> QString {
         if (auto *file = dynamic_cast<QFile *>(output.get())) {
             return file->fileName();
@@ -521,10 +692,38 @@ std::shared_ptr<QXmppFileDownload> QXmppFileSharingManager::downloadFile(
         return {};
     }();
 
+    // Hash the data while it is written, also if it is written in ranges by parallel
+    // connections.
+    // The file is only read again if that has not been possible.
+    auto expectedHash = preferredHash(transform<std::vector<QXmppHash>>(download->d->hashes, [](auto hash) { return hash; }));
+    std::shared_ptr<StreamHasher> hasher;
+    if (expectedHash) {
+        hasher = std::make_shared<StreamHasher>(std::vector { expectedHash->algorithm() });
+        output = std::make_unique<HashingDevice>(std::move(output), hasher);
+    }
+
+    // Remembers the verified file for sharing and downloading it again.
+    auto addToCache = [this, fileShare, filePath]() {
+        if (!d->fileCache) {
+            return;
+        }
+
+        const auto hashes = fileShare.metadata().hashes();
+        fileShare.visitSources([&](const std::any &source) {
+            if (auto provider = providerForSource(source)) {
+                QXmppFileCachePrivate::get(d->fileCache)->addSource(hashes, std::type_index(typeid(*provider)), source);
+            }
+            return false;
+        });
+        if (!filePath.isEmpty()) {
+            QXmppFileCachePrivate::get(d->fileCache)->storeFile(hashes, filePath);
+        }
+    };
+
     auto onProgress = [download](quint64 received, quint64 total) {
         download->reportProgress(received, total);
     };
-    auto onFinished = [this, download, filePath](QXmppFileSharingProvider::DownloadResult result) mutable {
+    auto onFinished = [this, download, filePath, expectedHash, hasher, addToCache](QXmppFileSharingProvider::DownloadResult result) mutable {
         // reduce ref count
         download->d->providerDownload.reset();
 
@@ -538,6 +737,22 @@ std::shared_ptr<QXmppFileDownload> QXmppFileSharingManager::downloadFile(
             return;
         }
 
+        if (!expectedHash) {
+            download->reportFinished(QXmppFileDownload::Downloaded { QXmppFileDownload::NoStrongHashes });
+            return;
+        }
+
+        // use the hashes calculated while writing
+        if (auto hashes = hasher->result()) {
+            if (hashes->front().hash() == expectedHash->hash()) {
+                addToCache();
+                download->reportFinished(QXmppFileDownload::Downloaded { QXmppFileDownload::HashVerified });
+            } else {
+                download->reportFinished(QXmppError { u"Checksum does not match"_s, {} });
+            }
+            return;
+        }
+
         // try to do hash verification
         if (filePath.isEmpty()) {
             warning(u"Can't verify hashes of other io devices than QFile!"_s);
@@ -555,7 +770,11 @@ std::shared_ptr<QXmppFileDownload> QXmppFileSharingManager::downloadFile(
             std::move(file),
             transform<std::vector<QXmppHash>>(download->d->hashes, [](auto hash) { return hash; }));
 
-        await(download->d->hashesFuture, this, [download](HashVerificationResultPtr hashResult) {
+        await(download->d->hashesFuture, this, [download, addToCache](HashVerificationResultPtr hashResult) {
+            if (std::holds_alternative<HashVerificationResult::Verified>(hashResult->result)) {
+                addToCache();
+            }
+
             auto convert = overloaded {
                 [](HashVerificationResult::NoStrongHashes) {
                     return QXmppFileDownload::Downloaded {
@@ -585,8 +804,6 @@ std::shared_ptr<QXmppFileDownload> QXmppFileSharingManager::downloadFile(
         }
         return false;
     });
-
-    return download;
 }
 
 void QXmppFileSharingManager::internalRegisterProvider(std::type_index index, std::shared_ptr<QXmppFileSharingProvider> provider)
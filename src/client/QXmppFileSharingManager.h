@@ -22,6 +22,7 @@
 #include <QSize>
 
 class QIODevice;
+class QXmppFileCache;
 class QXmppFileDownloadPrivate;
 class QXmppFileMetadata;
 class QXmppFileShare;
@@ -139,6 +140,9 @@ public:
 
     void setMetadataGenerator(MetadataGenerator &&generator);
 
+    QXmppFileCache *fileCache() const;
+    void setFileCache(QXmppFileCache *cache);
+
     ///
     /// \brief Register a provider for automatic downloads
     /// \param manager A shared_ptr to a QXmppFileSharingProvider subclass
@@ -163,6 +167,7 @@ private:
 
     void internalRegisterProvider(std::type_index, std::shared_ptr<QXmppFileSharingProvider> provider);
     std::shared_ptr<QXmppFileSharingProvider> providerForSource(const std::any &source) const;
+    void startDownload(const QXmppFileShare &fileShare, const std::shared_ptr<QXmppFileDownload> &download, std::unique_ptr<QIODevice> output);
 
     std::unique_ptr<QXmppFileSharingManagerPrivate> d;
 };
@@ -12,17 +12,315 @@
 
 #include "StringLiterals.h"
 
+#include <algorithm>
+
 #include <QMimeDatabase>
 #include <QNetworkReply>
 
 using namespace QXmpp;
 using namespace QXmpp::Private;
 
+constexpr qint64 DEFAULT_PARALLEL_DOWNLOAD_RANGE_SIZE = 4 * 1024 * 1024;
+// count of attempts to continue an interrupted range
+constexpr int MAX_RANGE_RETRIES = 3;
+
+// Returns the total size from a "Content-Range: bytes 0-99/1234" header or -1 if it is unknown.
+static qint64 parseContentRangeTotalSize(const QByteArray &contentRange)
+{
+    const auto separatorIndex = contentRange.lastIndexOf('/');
+    if (separatorIndex < 0) {
+        return -1;
+    }
+
+    bool ok = false;
+    const auto size = contentRange.mid(separatorIndex + 1).trimmed().toLongLong(&ok);
+    return ok ? size : -1;
+}
+
+// Returns the first byte from a "Content-Range: bytes 0-99/1234" header or -1 if it is invalid.
+static qint64 parseContentRangeStart(const QByteArray &contentRange)
+{
+    const QByteArray unit = QByteArrayLiteral("bytes ");
+    const auto separatorIndex = contentRange.indexOf('-');
+    if (!contentRange.startsWith(unit) || separatorIndex < 0) {
+        return -1;
+    }
+
+    bool ok = false;
+    const auto start = contentRange.mid(unit.size(), separatorIndex - unit.size()).trimmed().toLongLong(&ok);
+    return ok ? start : -1;
+}
+
+//
+// Downloads a file in byte ranges over multiple connections.
+//
+// The first range is requested alone to find out the size of the file and whether the server
+// supports range requests.
+// The remaining ranges are requested in order over the configured count of connections and
+// written into the target at their offsets.
+// An interrupted range is requested again starting at its first byte not received yet.
+//
+// If the server does not support range requests, the whole file is downloaded with the first
+// request.
+//
+struct RangeDownload : QXmppFileSharingProvider::Download, std::enable_shared_from_this<RangeDownload> {
+    struct Range {
+        qint64 begin = 0;
+        // exclusive, -1 if the range reaches until the end of the file
+        qint64 end = -1;
+        qint64 received = 0;
+        int retries = 0;
+        QNetworkReply *reply = nullptr;
+        bool headersChecked = false;
+        bool dataUsable = false;
+    };
+
+    ~RangeDownload() override = default;
+
+    void cancel() override
+    {
+        if (!finished) {
+            finish(Cancelled());
+        }
+    }
+
+    void start()
+    {
+        addRange(0, rangeSize);
+    }
+
+    void addRange(qint64 begin, qint64 end)
+    {
+        auto range = std::make_unique<Range>();
+        range->begin = begin;
+        range->end = end;
+        nextOffset = end;
+
+        request(range.get());
+        ranges.push_back(std::move(range));
+    }
+
+    void scheduleRanges()
+    {
+        if (!rangesSupported) {
+            return;
+        }
+
+        // Without the total size, the rest of the file can only be requested at once.
+        if (totalSize < 0) {
+            if (ranges.empty()) {
+                addRange(nextOffset, -1);
+            }
+            return;
+        }
+
+        while (int(ranges.size()) < connections && nextOffset < totalSize) {
+            addRange(nextOffset, std::min(nextOffset + rangeSize, totalSize));
+        }
+    }
+
+    void request(Range *range)
+    {
+        const auto from = range->begin + range->received;
+        const auto rangeHeader = range->end < 0
+            ? u"bytes=%1-"_s.arg(from)
+            : u"bytes=%1-%2"_s.arg(from).arg(range->end - 1);
+
+        QNetworkRequest request(url);
+        request.setRawHeader("Range", rangeHeader.toLatin1());
+
+        range->headersChecked = false;
+        range->dataUsable = false;
+        range->reply = netManager->get(request);
+
+        QObject::connect(range->reply, &QNetworkReply::readyRead, range->reply, [self = shared_from_this(), range, reply = range->reply]() {
+            self->readData(range, reply);
+        });
+        QObject::connect(range->reply, &QNetworkReply::finished, range->reply, [self = shared_from_this(), range, reply = range->reply]() {
+            self->handleFinished(range, reply);
+        });
+    }
+
+    // Returns whether the data of the reply belongs to the file.
+    bool checkHeaders(Range *range, QNetworkReply *reply)
+    {
+        if (range->headersChecked) {
+            return range->dataUsable;
+        }
+        range->headersChecked = true;
+
+        const auto status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (status == 206) {
+            // The data is written at the requested offset, so it must start there.
+            const auto contentRange = reply->rawHeader("Content-Range");
+            if (parseContentRangeStart(contentRange) != range->begin + range->received) {
+                fail(QXmppError { u"Server sent a different range than requested."_s, {} });
+                return false;
+            }
+
+            if (totalSize < 0) {
+                totalSize = parseContentRangeTotalSize(contentRange);
+                scheduleRanges();
+            }
+            range->dataUsable = true;
+        } else if (status == 200) {
+            // The whole file is sent because range requests are not supported.
+            if (range->begin + range->received != 0) {
+                fail(QXmppError { u"Server stopped supporting range requests."_s, {} });
+                return false;
+            }
+
+            rangesSupported = false;
+            range->end = -1;
+            const auto contentLength = reply->header(QNetworkRequest::ContentLengthHeader);
+            totalSize = contentLength.isValid() ? contentLength.toLongLong() : -1;
+            range->dataUsable = true;
+        }
+
+        // The data of error responses is not written.
+        return range->dataUsable;
+    }
+
+    void readData(Range *range, QNetworkReply *reply)
+    {
+        if (finished || !checkHeaders(range, reply)) {
+            return;
+        }
+
+        auto data = reply->readAll();
+        if (range->end >= 0) {
+            data.truncate(qsizetype(std::max(range->end - range->begin - range->received, qint64(0))));
+        }
+
+        // avoid seeking if not needed because that flushes buffered data of files
+        const auto offset = range->begin + range->received;
+        if ((output->pos() != offset && !output->seek(offset)) || output->write(data) != data.size()) {
+            fail(QXmppError::fromIoDevice(*output));
+            return;
+        }
+
+        range->received += data.size();
+        receivedBytes += data.size();
+        reportProgress(receivedBytes, std::max(totalSize, qint64(0)));
+    }
+
+    // Returns whether all data of a range has been received, assuming that the reply succeeded.
+    bool isComplete(Range *range)
+    {
+        if (range->end < 0) {
+            totalSize = nextOffset = range->begin + range->received;
+            return true;
+        }
+
+        if (totalSize < 0) {
+            // a shorter range is the end of the file
+            if (range->begin + range->received < range->end) {
+                totalSize = nextOffset = range->begin + range->received;
+            }
+            return true;
+        }
+
+        return range->begin + range->received >= std::min(range->end, totalSize);
+    }
+
+    void handleFinished(Range *range, QNetworkReply *reply)
+    {
+        if (finished) {
+            return;
+        }
+
+        range->reply = nullptr;
+        reply->deleteLater();
+
+        // empty files cannot be requested in ranges
+        const auto status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (status == 416 && parseContentRangeTotalSize(reply->rawHeader("Content-Range")) == 0) {
+            finish(Success());
+            return;
+        }
+
+        // read data that has not been read yet, also if the range has been interrupted
+        readData(range, reply);
+        if (finished) {
+            return;
+        }
+
+        if (reply->error() != QNetworkReply::NoError || !isComplete(range)) {
+            const auto canContinue = rangesSupported &&
+                status < 400 &&
+                reply->error() != QNetworkReply::OperationCanceledError &&
+                range->retries < MAX_RANGE_RETRIES;
+
+            if (canContinue) {
+                ++range->retries;
+                request(range);
+            } else if (reply->error() != QNetworkReply::NoError) {
+                fail(QXmppError::fromNetworkReply(*reply));
+            } else {
+                fail(QXmppError { u"Download of a range ended early."_s, {} });
+            }
+            return;
+        }
+
+        ranges.erase(std::find_if(ranges.begin(), ranges.end(), [range](const auto &other) {
+            return other.get() == range;
+        }));
+
+        scheduleRanges();
+        if (ranges.empty()) {
+            finish(Success());
+        }
+    }
+
+    void fail(QXmppError &&error)
+    {
+        finish(std::move(error));
+    }
+
+    void finish(DownloadResult &&result)
+    {
+        finished = true;
+
+        // finished() of the aborted replies is ignored
+        for (const auto &range : ranges) {
+            if (range->reply) {
+                range->reply->abort();
+                range->reply->deleteLater();
+            }
+        }
+        ranges.clear();
+
+        if (output && output->isOpen()) {
+            output->close();
+        }
+        reportFinished(std::move(result));
+    }
+
+    QNetworkAccessManager *netManager = nullptr;
+    QUrl url;
+    int connections = 1;
+    qint64 rangeSize = DEFAULT_PARALLEL_DOWNLOAD_RANGE_SIZE;
+    std::unique_ptr<QIODevice> output;
+    std::function<void(quint64, quint64)> reportProgress;
+    std::function<void(DownloadResult)> reportFinished;
+    std::vector<std::unique_ptr<Range>> ranges;
+    // -1 while unknown
+    qint64 totalSize = -1;
+    // begin of the next range to be requested
+    qint64 nextOffset = 0;
+    qint64 receivedBytes = 0;
+    bool rangesSupported = true;
+    bool finished = false;
+};
+
 ///
 /// \class QXmppHttpFileSharingProvider
 ///
 /// A file sharing provider that uses HTTP File Upload to upload and download files.
 ///
+/// Large files can be downloaded in byte ranges over multiple connections in parallel, see
+/// setParallelDownloadConnections().
+///
 /// \since QXmpp 1.5
 ///
 
@@ -31,6 +329,8 @@ class QXmppHttpFileSharingProviderPrivate
 public:
     QXmppHttpUploadManager *manager;
     QNetworkAccessManager *netManager;
+    int parallelDownloadConnections = 1;
+    qint64 parallelDownloadRangeSize = DEFAULT_PARALLEL_DOWNLOAD_RANGE_SIZE;
 };
 
 ///
@@ -47,6 +347,58 @@ QXmppHttpFileSharingProvider::QXmppHttpFileSharingProvider(QXmppHttpUploadManage
 
 QXmppHttpFileSharingProvider::~QXmppHttpFileSharingProvider() = default;
 
+///
+/// Returns the count of connections used for downloading a file in parallel.
+///
+/// \since QXmpp 1.9
+///
+int QXmppHttpFileSharingProvider::parallelDownloadConnections() const
+{
+    return d->parallelDownloadConnections;
+}
+
+///
+/// Sets the count of connections used for downloading a file in parallel.
+///
+/// With more than one connection, files are downloaded in byte ranges of
+/// parallelDownloadRangeSize() if the target device is not sequential and the server supports
+/// range requests.
+/// Each range is written into the target at its offset.
+/// Interrupted ranges are continued at the first byte not received yet.
+///
+/// By default, only one connection is used and files are downloaded with a single request.
+///
+/// \since QXmpp 1.9
+///
+void QXmppHttpFileSharingProvider::setParallelDownloadConnections(int connections)
+{
+    d->parallelDownloadConnections = std::max(connections, 1);
+}
+
+///
+/// Returns the size of the byte ranges used for downloading a file in parallel.
+///
+/// \since QXmpp 1.9
+///
+qint64 QXmppHttpFileSharingProvider::parallelDownloadRangeSize() const
+{
+    return d->parallelDownloadRangeSize;
+}
+
+///
+/// Sets the size of the byte ranges used for downloading a file in parallel.
+///
+/// The default size is 4 MiB.
+///
+/// \since QXmpp 1.9
+///
+void QXmppHttpFileSharingProvider::setParallelDownloadRangeSize(qint64 size)
+{
+    if (size > 0) {
+        d->parallelDownloadRangeSize = size;
+    }
+}
+
 auto QXmppHttpFileSharingProvider::downloadFile(const std::any &source,
                                                 std::unique_ptr<QIODevice> target,
                                                 std::function<void(quint64, quint64)> reportProgress,
@@ -88,6 +440,20 @@ auto QXmppHttpFileSharingProvider::downloadFile(const std::any &source,
         qFatal("QXmppHttpFileSharingProvider::downloadFile can only handle QXmppHttpFileSource.");
     }
 
+    // ranges can only be written at their offsets into non-sequential devices
+    if (d->parallelDownloadConnections > 1 && !target->isSequential()) {
+        auto download = std::make_shared<RangeDownload>();
+        download->netManager = d->netManager;
+        download->url = httpSource.url();
+        download->connections = d->parallelDownloadConnections;
+        download->rangeSize = d->parallelDownloadRangeSize;
+        download->output = std::move(target);
+        download->reportProgress = std::move(reportProgress);
+        download->reportFinished = std::move(reportFinished);
+        download->start();
+        return download;
+    }
+
     auto state = std::make_shared<State>();
     state->output = std::move(target);
     state->reportFinished = std::move(reportFinished);
@@ -24,6 +24,12 @@ public:
     QXmppHttpFileSharingProvider(QXmppHttpUploadManager *manager, QNetworkAccessManager *netManager);
     ~QXmppHttpFileSharingProvider() override;
 
+    int parallelDownloadConnections() const;
+    void setParallelDownloadConnections(int connections);
+
+    qint64 parallelDownloadRangeSize() const;
+    void setParallelDownloadRangeSize(qint64 size);
+
     auto downloadFile(const std::any &source,
                       std::unique_ptr<QIODevice> target,
                       std::function<void(quint64, quint64)> reportProgress,
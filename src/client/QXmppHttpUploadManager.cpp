@@ -6,22 +6,176 @@
 
 #include "QXmppClient.h"
 #include "QXmppHttpUploadIq.h"
+#include "QXmppHttpUploadManager_p.h"
 #include "QXmppTask.h"
 #include "QXmppUploadRequestManager.h"
 #include "QXmppUtils_p.h"
 
 #include "StringLiterals.h"
 
+#include <algorithm>
+
+#include <QDateTime>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
 #include <QMimeDatabase>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
-#include <QPointer>
+#include <QTimer>
 
 using namespace QXmpp;
 using namespace QXmpp::Private;
 
+using namespace std::chrono_literals;
+
+constexpr int DEFAULT_MAX_RETRIES = 3;
+// time after which prefetched slots are not used anymore because servers let them expire
+constexpr auto PREFETCHED_SLOT_TTL = 2min;
+constexpr std::size_t MAX_PREFETCHED_SLOTS = 8;
+
+HttpUploader::HttpUploader(QNetworkAccessManager *netManager, QNetworkRequest request, std::unique_ptr<QIODevice> data, qint64 size, Options options)
+    : m_netManager(netManager),
+      m_request(std::move(request)),
+      m_data(std::move(data)),
+      m_size(size),
+      m_options(options),
+      m_chunked(options.chunkSize > 0 && !m_data->isSequential() && size > options.chunkSize)
+{
+}
+
+HttpUploader::~HttpUploader() = default;
+
+void HttpUploader::start()
+{
+    if (!m_started) {
+        m_started = true;
+        sendRequest();
+    }
+}
+
+void HttpUploader::cancel()
+{
+    if (m_finished || m_cancelled) {
+        return;
+    }
+
+    m_cancelled = true;
+    if (m_reply) {
+        // the cancellation is reported when the reply is finished
+        m_reply->abort();
+    } else if (m_started) {
+        // waiting for a retry
+        finish(Cancelled());
+    }
+}
+
+void HttpUploader::sendRequest()
+{
+    if (m_chunked) {
+        m_chunkEnd = std::min(m_chunkBegin + m_options.chunkSize, m_size);
+
+        QByteArray chunk;
+        if (m_data->seek(m_chunkBegin)) {
+            chunk = m_data->read(m_chunkEnd - m_chunkBegin);
+        }
+        if (chunk.size() != m_chunkEnd - m_chunkBegin) {
+            finish(QXmppError::fromIoDevice(*m_data));
+            return;
+        }
+
+        auto request = m_request;
+        request.setRawHeader("Content-Range", "bytes " + QByteArray::number(m_chunkBegin) + '-' + QByteArray::number(m_chunkEnd - 1) + '/' + QByteArray::number(m_size));
+        m_reply = m_netManager->put(request, chunk);
+    } else {
+        // All data is uploaded from the beginning, also after a retry or a rejected first chunk.
+        // Sequential data is only uploaded once and cannot be rewound.
+        if (!m_data->isSequential() && !m_data->seek(0)) {
+            finish(QXmppError::fromIoDevice(*m_data));
+            return;
+        }
+
+        m_chunkBegin = 0;
+        m_chunkEnd = m_size;
+
+        // sequential data is not buffered completely if its size is known
+        auto request = m_request;
+        request.setHeader(QNetworkRequest::ContentLengthHeader, m_size);
+        m_reply = m_netManager->put(request, m_data.get());
+    }
+
+    // the uploader is kept alive by its requests
+    QObject::connect(m_reply, &QNetworkReply::finished, m_netManager, [self = shared_from_this(), reply = m_reply]() {
+        self->handleFinished(reply);
+    });
+    QObject::connect(m_reply, &QNetworkReply::uploadProgress, m_netManager, [self = weak_from_this()](qint64 sent, qint64 total) {
+        // QNetworkReply resets the progress in the end
+        if (auto uploader = self.lock(); uploader && total > 0 && uploader->reportProgress) {
+            uploader->reportProgress(quint64(uploader->m_chunkBegin + sent), quint64(uploader->m_size));
+        }
+    });
+}
+
+void HttpUploader::handleFinished(QNetworkReply *reply)
+{
+    reply->deleteLater();
+    m_reply = nullptr;
+
+    if (m_finished) {
+        return;
+    }
+    if (m_cancelled) {
+        finish(Cancelled());
+        return;
+    }
+
+    const auto status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    if (reply->error() == QNetworkReply::NoError) {
+        m_retries = 0;
+        m_chunkBegin = m_chunkEnd;
+        if (m_chunkBegin < m_size) {
+            sendRequest();
+        } else {
+            finish(Success());
+        }
+        return;
+    }
+
+    // The server does not support uploads in chunks.
+    if (m_chunked && m_chunkBegin == 0 && (status == 400 || status == 405 || status == 416 || status == 501)) {
+        m_chunked = false;
+        sendRequest();
+        return;
+    }
+
+    // Only errors of the connection or the server may be temporary.
+    // Sequential data cannot be read again.
+    const auto isTemporary = (status == 0 || status >= 500) && reply->error() != QNetworkReply::OperationCanceledError;
+    if (isTemporary && m_retries < m_options.maxRetries && (m_chunked || !m_data->isSequential())) {
+        const auto delay = m_options.retryDelay * (1 << m_retries);
+        ++m_retries;
+        ++m_totalRetries;
+
+        QTimer::singleShot(delay, m_netManager, [self = shared_from_this()]() {
+            if (!self->m_finished) {
+                self->sendRequest();
+            }
+        });
+        return;
+    }
+
+    finish(QXmppError::fromNetworkReply(*reply));
+}
+
+void HttpUploader::finish(Result &&result)
+{
+    m_finished = true;
+    if (reportFinished) {
+        reportFinished(std::move(result));
+    }
+}
+
 struct QXmppHttpUploadPrivate {
     explicit QXmppHttpUploadPrivate(QXmppHttpUpload *q) : q(q) { }
 
@@ -29,7 +183,10 @@ struct QXmppHttpUploadPrivate {
     std::optional<QXmppError> error;
     quint64 bytesSent = 0;
     quint64 bytesTotal = 0;
-    QPointer<QNetworkReply> reply;
+    std::weak_ptr<HttpUploader> uploader;
+    // measures the time of uploading the data
+    QElapsedTimer uploadTimer;
+    qint64 uploadTime = 0;
     bool finished = false;
     bool cancelled = false;
 
@@ -48,6 +205,9 @@ struct QXmppHttpUploadPrivate {
     {
         if (!finished) {
             finished = true;
+            if (uploadTimer.isValid()) {
+                uploadTime = uploadTimer.elapsed();
+            }
             Q_EMIT q->finished(result());
         }
     }
@@ -108,6 +268,14 @@ private:
 /// Number of bytes that need to be sent in total to complete the upload
 ///
 
+///
+/// \property QXmppHttpUpload::throughput
+///
+/// Average count of bytes sent per second
+///
+/// \since QXmpp 1.9
+///
+
 ///
 /// \fn QXmppHttpUpload::progressChanged
 ///
@@ -171,14 +339,31 @@ quint64 QXmppHttpUpload::bytesTotal() const
     return d->bytesTotal;
 }
 
+///
+/// Returns the average count of bytes sent per second since the data started to be uploaded.
+///
+/// The time of requests repeated after errors is included, but the data sent again is only counted
+/// once since only the progress of the upload is taken into account.
+///
+/// \since QXmpp 1.9
+///
+double QXmppHttpUpload::throughput() const
+{
+    const auto time = d->finished ? d->uploadTime : (d->uploadTimer.isValid() ? d->uploadTimer.elapsed() : 0);
+    if (time <= 0) {
+        return 0;
+    }
+    return double(d->bytesSent) * 1000.0 / double(time);
+}
+
 ///
 /// Cancels the upload.
 ///
 void QXmppHttpUpload::cancel()
 {
     d->cancelled = true;
-    if (d->reply) {
-        d->reply->abort();
+    if (auto uploader = d->uploader.lock()) {
+        uploader->cancel();
     }
 }
 
@@ -207,13 +392,76 @@ QXmppHttpUpload::QXmppHttpUpload()
 {
 }
 
+// Upload slot requested before the upload of the file
+struct PrefetchedSlot {
+    QString serviceJid;
+    QString filename;
+    qint64 fileSize;
+    QString mimeType;
+    QDateTime requestTime;
+    std::optional<QXmppUploadRequestManager::SlotResult> result;
+    // set if the slot is used by an upload before its result is received
+    std::function<void(QXmppUploadRequestManager::SlotResult)> handleResult;
+};
+
+// Returns the JID of the first upload service accepting the file size, an empty string if no
+// service is known or nothing if the file is too large for all services.
+static std::optional<QString> selectUploadService(const QXmppUploadRequestManager &uploadRequestManager, qint64 fileSize)
+{
+    const auto services = uploadRequestManager.uploadServices();
+    if (services.isEmpty()) {
+        return QString();
+    }
+
+    for (const auto &service : services) {
+        if (service.sizeLimit() < 0 || fileSize <= service.sizeLimit()) {
+            return service.jid();
+        }
+    }
+    return {};
+}
+
 struct QXmppHttpUploadManagerPrivate {
     explicit QXmppHttpUploadManagerPrivate(QNetworkAccessManager *netManager)
         : netManager(netManager)
     {
     }
 
+    void removeExpiredSlots()
+    {
+        const auto minRequestTime = QDateTime::currentDateTimeUtc().addSecs(-std::chrono::seconds(PREFETCHED_SLOT_TTL).count());
+        prefetchedSlots.erase(std::remove_if(prefetchedSlots.begin(), prefetchedSlots.end(), [&](const auto &slot) {
+                                  return slot->requestTime < minRequestTime || (slot->result && std::holds_alternative<QXmppError>(*slot->result));
+                              }),
+                              prefetchedSlots.end());
+    }
+
+    std::shared_ptr<PrefetchedSlot> findPrefetchedSlot(const QString &serviceJid, const QString &filename, qint64 fileSize, const QString &mimeType)
+    {
+        removeExpiredSlots();
+
+        auto itr = std::find_if(prefetchedSlots.begin(), prefetchedSlots.end(), [&](const auto &slot) {
+            return slot->serviceJid == serviceJid && slot->filename == filename && slot->fileSize == fileSize && slot->mimeType == mimeType;
+        });
+        if (itr == prefetchedSlots.end()) {
+            return {};
+        }
+        return *itr;
+    }
+
+    std::shared_ptr<PrefetchedSlot> takePrefetchedSlot(const QString &serviceJid, const QString &filename, qint64 fileSize, const QString &mimeType)
+    {
+        auto slot = findPrefetchedSlot(serviceJid, filename, fileSize, mimeType);
+        if (slot) {
+            prefetchedSlots.erase(std::find(prefetchedSlots.begin(), prefetchedSlots.end(), slot));
+        }
+        return slot;
+    }
+
     QNetworkAccessManager *netManager;
+    qint64 chunkSize = 0;
+    int maxRetries = DEFAULT_MAX_RETRIES;
+    std::vector<std::shared_ptr<PrefetchedSlot>> prefetchedSlots;
 };
 
 ///
@@ -239,6 +487,66 @@ QXmppHttpUploadManager::QXmppHttpUploadManager(QNetworkAccessManager *netManager
 
 QXmppHttpUploadManager::~QXmppHttpUploadManager() = default;
 
+///
+/// Returns the size of the chunks that are uploaded with separate requests.
+///
+/// \since QXmpp 1.9
+///
+qint64 QXmppHttpUploadManager::chunkSize() const
+{
+    return d->chunkSize;
+}
+
+///
+/// Sets the size of the chunks that are uploaded with separate requests.
+///
+/// Each chunk is uploaded with a PUT request containing a Content-Range header.
+/// That way, only the failed chunk needs to be uploaded again after a network error.
+/// If the server does not accept the first chunk, the whole file is uploaded with one request.
+///
+/// Only data of non-sequential devices is uploaded in chunks.
+/// That excludes files encrypted by QXmppFileSharingManager since they are encrypted while being
+/// read.
+///
+/// By default, the chunk size is 0 and files are uploaded with one request since \xep{0363, HTTP
+/// File Upload} does not cover partial uploads.
+///
+/// \since QXmpp 1.9
+///
+void QXmppHttpUploadManager::setChunkSize(qint64 chunkSize)
+{
+    d->chunkSize = std::max(chunkSize, qint64(0));
+}
+
+///
+/// Returns how often a failed request is repeated.
+///
+/// \since QXmpp 1.9
+///
+int QXmppHttpUploadManager::maxRetries() const
+{
+    return d->maxRetries;
+}
+
+///
+/// Sets how often a failed request is repeated.
+///
+/// Requests failing because of network errors or server errors are repeated with a delay
+/// doubling with each retry.
+/// The upload slot is reused, i.e., no new slot is requested.
+/// Data from sequential devices can only be uploaded once.
+/// That includes files encrypted by QXmppFileSharingManager since they are encrypted while being
+/// read.
+///
+/// The default is 3.
+///
+/// \since QXmpp 1.9
+///
+void QXmppHttpUploadManager::setMaxRetries(int maxRetries)
+{
+    d->maxRetries = std::max(maxRetries, 0);
+}
+
 ///
 /// Uploads the data from a QIODevice.
 ///
@@ -299,9 +607,18 @@ std::shared_ptr<QXmppHttpUpload> QXmppHttpUploadManager::uploadFile(std::unique_
         }
     }
 
-    auto future = client()->findExtension<QXmppUploadRequestManager>()->requestSlot(filename, fileSize, mimeType, uploadServiceJid);
-    // TODO: rawSourceDevice: could this lead to a memory leak if the "then lambda" is never executed?
-    future.then(this, [this, upload, rawSourceDevice = data.release()](SlotResult result) mutable {
+    // files too large for all known services are rejected without a request
+    auto serviceJid = uploadServiceJid.isEmpty() ? selectUploadService(*uploadRequestManager, fileSize) : uploadServiceJid;
+    if (!serviceJid) {
+        upload->d->reportError({ u"The file is too large for the upload services."_s, std::any() });
+        upload->d->reportFinished();
+        return upload;
+    }
+
+    // TODO: rawSourceDevice: could this lead to a memory leak if the lambda is never executed?
+    auto handleSlot = [this, upload, fileSize, rawSourceDevice = data.release()](SlotResult result) mutable {
+        std::unique_ptr<QIODevice> sourceDevice(rawSourceDevice);
+
         // first check whether upload was cancelled in the meantime
         if (upload->d->cancelled) {
             upload->d->reportFinished();
@@ -329,35 +646,122 @@ std::shared_ptr<QXmppHttpUpload> QXmppHttpUploadManager::uploadFile(std::unique_
                 request.setRawHeader(itr.key().toUtf8(), itr.value().toUtf8());
             }
 
-            auto *reply = d->netManager->put(request, rawSourceDevice);
-            rawSourceDevice->setParent(reply);
-            upload->d->reply = reply;
-
-            connect(reply, &QNetworkReply::finished, this, [reply, upload]() {
-                if (reply->error() == QNetworkReply::NoError) {
-                    upload->d->reportFinished();
+            HttpUploader::Options options;
+            options.chunkSize = d->chunkSize;
+            options.maxRetries = d->maxRetries;
+
+            // the upload is kept alive by the uploader until it is finished
+            auto uploader = std::make_shared<HttpUploader>(d->netManager, std::move(request), std::move(sourceDevice), fileSize, options);
+            uploader->reportProgress = [upload](quint64 sent, quint64 total) {
+                upload->d->reportProgress(sent, total);
+            };
+            uploader->reportFinished = [upload](HttpUploader::Result result) {
+                if (auto *error = std::get_if<QXmppError>(&result)) {
+                    upload->d->reportError(std::move(*error));
                 }
-                reply->deleteLater();
-            });
-
-            connect(reply, &QNetworkReply::errorOccurred, this,
-                    [upload, reply](QNetworkReply::NetworkError error) {
-                        upload->d->reportError({ reply->errorString(), error });
-                        upload->d->reportFinished();
-                        reply->deleteLater();
-                    });
-
-            connect(reply, &QNetworkReply::uploadProgress, this, [upload](qint64 sent, qint64 total) {
-                quint64 sentBytes = sent < 0 ? 0 : quint64(sent);
-                quint64 totalBytes = total < 0 ? 0 : quint64(total);
-                upload->d->reportProgress(sentBytes, totalBytes);
-            });
+                upload->d->reportFinished();
+            };
+
+            upload->d->uploader = uploader;
+            upload->d->uploadTimer.start();
+            uploader->start();
         }
-    });
+    };
+
+    if (auto slot = d->takePrefetchedSlot(*serviceJid, filename, fileSize, mimeType.name())) {
+        if (slot->result) {
+            handleSlot(std::move(*slot->result));
+        } else {
+            slot->handleResult = std::move(handleSlot);
+        }
+    } else {
+        uploadRequestManager->requestSlot(filename, fileSize, mimeType, *serviceJid).then(this, std::move(handleSlot));
+    }
 
     return upload;
 }
 
+///
+/// Requests an upload slot for a file before it is uploaded.
+///
+/// That can be used to request the slot while the file is still being
+/// prepared (e.g., compressed or encrypted) or while the user has not yet
+/// confirmed sending it.
+/// A later call of uploadFile() with the same filename, MIME type, size and
+/// upload service uses the prefetched slot instead of requesting a new one.
+///
+/// Prefetched slots are only used within two minutes after requesting them
+/// since servers let unused slots expire.
+///
+/// \param filename name of the file on the server
+/// \param mimeType MIME type of the file
+/// \param fileSize size of the file in bytes
+/// \param uploadServiceJid optionally, the JID of the upload service to
+///        request the slot from
+///
+/// \since QXmpp 1.9
+///
+void QXmppHttpUploadManager::prefetchSlot(const QString &filename, const QMimeType &mimeType, qint64 fileSize, const QString &uploadServiceJid)
+{
+    auto *uploadRequestManager = client()->findExtension<QXmppUploadRequestManager>();
+    if (!uploadRequestManager) {
+        return;
+    }
+
+    auto serviceJid = uploadServiceJid.isEmpty() ? selectUploadService(*uploadRequestManager, fileSize) : uploadServiceJid;
+    if (!serviceJid || serviceJid->isEmpty()) {
+        return;
+    }
+
+    if (d->findPrefetchedSlot(*serviceJid, filename, fileSize, mimeType.name())) {
+        return;
+    }
+
+    if (d->prefetchedSlots.size() >= MAX_PREFETCHED_SLOTS) {
+        d->prefetchedSlots.erase(d->prefetchedSlots.begin());
+    }
+
+    auto slot = std::make_shared<PrefetchedSlot>(PrefetchedSlot {
+        *serviceJid,
+        filename,
+        fileSize,
+        mimeType.name(),
+        QDateTime::currentDateTimeUtc(),
+        {},
+        {},
+    });
+    d->prefetchedSlots.push_back(slot);
+
+    uploadRequestManager->requestSlot(filename, fileSize, mimeType, *serviceJid).then(this, [slot](QXmppUploadRequestManager::SlotResult result) {
+        if (slot->handleResult) {
+            slot->handleResult(std::move(result));
+        } else {
+            slot->result = std::move(result);
+        }
+    });
+}
+
+///
+/// Requests an upload slot for a local file before it is uploaded.
+///
+/// \param fileInfo QFileInfo about a local file
+/// \param filename name of the file on the server, the local filename is
+///        used if it is empty
+/// \param uploadServiceJid optionally, the JID of the upload service to
+///        request the slot from
+///
+/// \see prefetchSlot(const QString &, const QMimeType &, qint64, const QString &)
+///
+/// \since QXmpp 1.9
+///
+void QXmppHttpUploadManager::prefetchSlot(const QFileInfo &fileInfo, const QString &filename, const QString &uploadServiceJid)
+{
+    prefetchSlot(filename.isEmpty() ? fileInfo.fileName() : filename,
+                 QMimeDatabase().mimeTypeForFile(fileInfo),
+                 fileInfo.size(),
+                 uploadServiceJid);
+}
+
 ///
 /// Upload data from a local file.
 ///
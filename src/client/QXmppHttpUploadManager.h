@@ -23,6 +23,7 @@ class QXMPP_EXPORT QXmppHttpUpload : public QObject
     Q_PROPERTY(float progress READ progress NOTIFY progressChanged)
     Q_PROPERTY(quint64 bytesSent READ bytesSent NOTIFY progressChanged)
     Q_PROPERTY(quint64 bytesTotal READ bytesTotal NOTIFY progressChanged)
+    Q_PROPERTY(double throughput READ throughput NOTIFY progressChanged)
 
 public:
     using Result = std::variant<QUrl, QXmpp::Cancelled, QXmppError>;
@@ -32,6 +33,7 @@ public:
     float progress() const;
     quint64 bytesSent() const;
     quint64 bytesTotal() const;
+    double throughput() const;
 
     void cancel();
     bool isFinished() const;
@@ -61,6 +63,15 @@ public:
     std::shared_ptr<QXmppHttpUpload> uploadFile(std::unique_ptr<QIODevice> data, const QString &filename, const QMimeType &mimeType, qint64 fileSize = -1, const QString &uploadServiceJid = {});
     std::shared_ptr<QXmppHttpUpload> uploadFile(const QFileInfo &fileInfo, const QString &filename = {}, const QString &uploadServiceJid = {});
 
+    void prefetchSlot(const QString &filename, const QMimeType &mimeType, qint64 fileSize, const QString &uploadServiceJid = {});
+    void prefetchSlot(const QFileInfo &fileInfo, const QString &filename = {}, const QString &uploadServiceJid = {});
+
+    qint64 chunkSize() const;
+    void setChunkSize(qint64 chunkSize);
+
+    int maxRetries() const;
+    void setMaxRetries(int maxRetries);
+
 private:
     std::unique_ptr<QXmppHttpUploadManagerPrivate> d;
 };
@@ -0,0 +1,98 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#ifndef QXMPPHTTPUPLOADMANAGER_P_H
+#define QXMPPHTTPUPLOADMANAGER_P_H
+
+#include "QXmppError.h"
+#include "QXmppGlobal.h"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <variant>
+
+#include <QNetworkRequest>
+
+class QIODevice;
+class QNetworkAccessManager;
+class QNetworkReply;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+namespace QXmpp::Private {
+
+//
+// Uploads data to one URL with HTTP PUT requests.
+//
+// Non-sequential data can be uploaded in chunks, each chunk with its own
+// request containing a Content-Range header.
+// If the server rejects the first chunk, all data is uploaded with one request.
+//
+// Requests failing because of the connection or the server are repeated with
+// an increasing delay.
+// That way, the upload slot is reused and only the failed chunk is uploaded
+// again.
+//
+// export for tests
+class QXMPP_EXPORT HttpUploader : public std::enable_shared_from_this<HttpUploader>
+{
+public:
+    using Result = std::variant<Success, Cancelled, QXmppError>;
+
+    struct Options {
+        // 0 to upload all data with one request
+        qint64 chunkSize = 0;
+        int maxRetries = 3;
+        // delay before the first retry, doubled for each further one
+        std::chrono::milliseconds retryDelay = std::chrono::seconds(1);
+    };
+
+    HttpUploader(QNetworkAccessManager *netManager, QNetworkRequest request, std::unique_ptr<QIODevice> data, qint64 size, Options options);
+    ~HttpUploader();
+
+    void start();
+    void cancel();
+
+    // count of repeated requests
+    int retries() const { return m_totalRetries; }
+
+    std::function<void(quint64 bytesSent, quint64 bytesTotal)> reportProgress;
+    std::function<void(Result)> reportFinished;
+
+private:
+    void sendRequest();
+    void handleFinished(QNetworkReply *reply);
+    void finish(Result &&result);
+
+    QNetworkAccessManager *m_netManager;
+    QNetworkRequest m_request;
+    std::unique_ptr<QIODevice> m_data;
+    qint64 m_size;
+    Options m_options;
+    bool m_chunked;
+    // begin and exclusive end of the chunk being uploaded
+    qint64 m_chunkBegin = 0;
+    qint64 m_chunkEnd = 0;
+    int m_retries = 0;
+    int m_totalRetries = 0;
+    QNetworkReply *m_reply = nullptr;
+    bool m_started = false;
+    bool m_cancelled = false;
+    bool m_finished = false;
+};
+
+}  // namespace QXmpp::Private
+
+#endif  // QXMPPHTTPUPLOADMANAGER_P_H
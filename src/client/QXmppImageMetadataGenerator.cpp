@@ -0,0 +1,367 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "QXmppImageMetadataGenerator.h"
+
+#include "StringLiterals.h"
+
+#include <deque>
+
+#include <QBuffer>
+#include <QCache>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureInterface>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QMimeDatabase>
+#include <QMutex>
+#include <QThread>
+#include <QThreadPool>
+
+using MetadataGeneratorResult = QXmppFileSharingManager::MetadataGeneratorResult;
+using MetadataThumbnail = QXmppFileSharingManager::MetadataThumbnail;
+
+constexpr QSize DEFAULT_THUMBNAIL_SIZE = { 128, 128 };
+constexpr int DEFAULT_MAX_CACHE_SIZE = 100;
+
+// Metadata cached by the content of the image
+struct ImageMetadata {
+    QSize dimensions;
+    QVector<MetadataThumbnail> thumbnails;
+};
+
+struct ImageMetadataJob {
+    std::unique_ptr<QIODevice> data;
+    QFutureInterface<QXmppImageMetadataGenerator::Result> interface;
+};
+
+//
+// Reads the dimensions of an image and creates a thumbnail fitting into 'thumbnailSize'.
+//
+// Data that is no image is detected by its header without reading it completely.
+// Only the header of the image is read for its dimensions.
+// Decoders supporting it (e.g., for JPEG) scale the image while decoding it instead of decoding it
+// in full resolution first.
+//
+static ImageMetadata readImageMetadata(QIODevice &device, QSize thumbnailSize)
+{
+    ImageMetadata metadata;
+
+    QImageReader reader(&device);
+    reader.setAutoTransform(true);
+
+    if (!reader.canRead()) {
+        // no image or unsupported format
+        return metadata;
+    }
+
+    const auto size = reader.size();
+    if (!size.isValid()) {
+        return metadata;
+    }
+
+    // The size is reported without the orientation being applied but the thumbnail is rotated.
+    const auto isRotated = reader.transformation() & QImageIOHandler::TransformationRotate90;
+    metadata.dimensions = isRotated ? size.transposed() : size;
+
+    const auto maxSize = isRotated ? thumbnailSize.transposed() : thumbnailSize;
+    if (size.width() > maxSize.width() || size.height() > maxSize.height()) {
+        reader.setScaledSize(size.scaled(maxSize, Qt::KeepAspectRatio));
+    }
+
+    const auto image = reader.read();
+    if (image.isNull()) {
+        return metadata;
+    }
+
+    // JPEG is used for smaller thumbnails if no transparency needs to be kept.
+    const auto format = image.hasAlphaChannel() || !QImageWriter::supportedImageFormats().contains("jpeg") ? "png" : "jpeg";
+
+    QByteArray thumbnailData;
+    QBuffer thumbnailBuffer(&thumbnailData);
+    thumbnailBuffer.open(QIODevice::WriteOnly);
+
+    if (image.save(&thumbnailBuffer, format)) {
+        metadata.thumbnails.append({
+            uint32_t(image.width()),
+            uint32_t(image.height()),
+            std::move(thumbnailData),
+            QMimeDatabase().mimeTypeForName(u"image/"_s + QString::fromLatin1(format)),
+        });
+    }
+
+    return metadata;
+}
+
+class QXmppImageMetadataGeneratorPrivate : public std::enable_shared_from_this<QXmppImageMetadataGeneratorPrivate>
+{
+public:
+    QFuture<QXmppImageMetadataGenerator::Result> generate(std::unique_ptr<QIODevice> data);
+    void startJobs();
+    void runJob(ImageMetadataJob &job);
+
+    // protects all members since the jobs are run in other threads
+    QMutex mutex;
+    QSize thumbnailSize = DEFAULT_THUMBNAIL_SIZE;
+    int maxThreadCount = QThread::idealThreadCount();
+    int runningJobsCount = 0;
+    std::deque<std::shared_ptr<ImageMetadataJob>> queuedJobs;
+    QCache<QByteArray, ImageMetadata> cache { DEFAULT_MAX_CACHE_SIZE };
+};
+
+QFuture<QXmppImageMetadataGenerator::Result> QXmppImageMetadataGeneratorPrivate::generate(std::unique_ptr<QIODevice> data)
+{
+    auto job = std::make_shared<ImageMetadataJob>();
+    job->data = std::move(data);
+    job->interface.reportStarted();
+    auto future = job->interface.future();
+
+    QMutexLocker locker(&mutex);
+    queuedJobs.push_back(std::move(job));
+    startJobs();
+
+    return future;
+}
+
+//
+// Starts queued jobs on the global thread pool as long as fewer than 'maxThreadCount' jobs are
+// running.
+//
+// The mutex must be locked.
+//
+void QXmppImageMetadataGeneratorPrivate::startJobs()
+{
+    while (runningJobsCount < maxThreadCount && !queuedJobs.empty()) {
+        auto job = std::move(queuedJobs.front());
+        queuedJobs.pop_front();
+        runningJobsCount++;
+
+        QThreadPool::globalInstance()->start([self = shared_from_this(), job = std::move(job)]() {
+            self->runJob(*job);
+
+            QMutexLocker locker(&self->mutex);
+            self->runningJobsCount--;
+            self->startJobs();
+        });
+    }
+}
+
+void QXmppImageMetadataGeneratorPrivate::runJob(ImageMetadataJob &job)
+{
+    // jobs of cancelled uploads are skipped
+    if (job.interface.isCanceled()) {
+        job.interface.reportFinished();
+        return;
+    }
+
+    auto *file = qobject_cast<QFile *>(job.data.get());
+
+    // The same file may be shared multiple times.
+    // Other data is not cached because it would need to be read completely for a key.
+    QByteArray cacheKey;
+    if (file && !file->fileName().isEmpty()) {
+        const QFileInfo fileInfo(*file);
+        cacheKey = fileInfo.absoluteFilePath().toUtf8() + '\n' +
+            QByteArray::number(fileInfo.size()) + '\n' +
+            QByteArray::number(fileInfo.lastModified().toMSecsSinceEpoch()) + '\n';
+    }
+
+    std::optional<ImageMetadata> metadata;
+    QSize currentThumbnailSize;
+    {
+        QMutexLocker locker(&mutex);
+        currentThumbnailSize = thumbnailSize;
+
+        // the thumbnail depends on the size
+        if (!cacheKey.isEmpty()) {
+            cacheKey += QByteArray::number(currentThumbnailSize.width()) + 'x' + QByteArray::number(currentThumbnailSize.height());
+
+            if (auto *cachedMetadata = cache.object(cacheKey)) {
+                metadata = *cachedMetadata;
+            }
+        }
+    }
+
+    if (!metadata && !job.interface.isCanceled()) {
+        // Local files are mapped into memory instead of reading them.
+        uchar *mappedData = nullptr;
+        if (file && file->size() > 0) {
+            mappedData = file->map(0, file->size());
+        }
+
+        if (mappedData) {
+            QBuffer mappedBuffer;
+            mappedBuffer.setData(QByteArray::fromRawData(reinterpret_cast<const char *>(mappedData), file->size()));
+            mappedBuffer.open(QIODevice::ReadOnly);
+            metadata = readImageMetadata(mappedBuffer, currentThumbnailSize);
+            mappedBuffer.close();
+            file->unmap(mappedData);
+        } else {
+            metadata = readImageMetadata(*job.data, currentThumbnailSize);
+        }
+
+        if (!cacheKey.isEmpty()) {
+            QMutexLocker locker(&mutex);
+            cache.insert(cacheKey, new ImageMetadata(*metadata));
+        }
+    }
+
+    job.data.reset();
+
+    if (metadata && !job.interface.isCanceled()) {
+        auto result = std::make_shared<MetadataGeneratorResult>();
+        if (metadata->dimensions.isValid()) {
+            result->dimensions = metadata->dimensions;
+        }
+        result->thumbnails = std::move(metadata->thumbnails);
+        job.interface.reportResult(std::move(result));
+    }
+    job.interface.reportFinished();
+}
+
+///
+/// \class QXmppImageMetadataGenerator
+///
+/// Generates the metadata and thumbnails of images being shared via the QXmppFileSharingManager.
+///
+/// The images are processed in the background with a limited number of
+/// threads.
+/// That way, sharing many images at once does not decode all of them at the
+/// same time.
+/// Only the header of an image is read for its dimensions and the thumbnail is
+/// decoded in a scaled-down size if the image format supports it.
+///
+/// The results of local files are cached by their paths, sizes and
+/// modification times.
+///
+/// If the upload of a file is cancelled, its metadata generation is cancelled
+/// as well.
+///
+/// \code
+/// QXmppImageMetadataGenerator generator;
+/// generator.setMaxThreadCount(2);
+/// fileSharingManager->setMetadataGenerator(generator.metadataGenerator());
+/// \endcode
+///
+/// This class is only available if QXmpp is built with Qt GUI support.
+///
+/// \since QXmpp 1.9
+///
+
+///
+/// \typedef QXmppImageMetadataGenerator::Result
+///
+/// Result of a metadata generation
+///
+
+QXmppImageMetadataGenerator::QXmppImageMetadataGenerator()
+    : d(std::make_shared<QXmppImageMetadataGeneratorPrivate>())
+{
+}
+
+QXmppImageMetadataGenerator::~QXmppImageMetadataGenerator() = default;
+
+///
+/// Returns the maximum size of generated thumbnails.
+///
+/// The thumbnails keep the aspect ratio of the images.
+/// Images smaller than the size are not scaled.
+///
+/// By default, thumbnails fit into 128 x 128 pixels.
+///
+QSize QXmppImageMetadataGenerator::thumbnailSize() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->thumbnailSize;
+}
+
+///
+/// Sets the maximum size of generated thumbnails.
+///
+/// \param size maximum size of thumbnails
+///
+void QXmppImageMetadataGenerator::setThumbnailSize(const QSize &size)
+{
+    QMutexLocker locker(&d->mutex);
+    d->thumbnailSize = size;
+}
+
+///
+/// Returns the maximum number of images processed at the same time.
+///
+/// By default, it is the number of CPU cores.
+///
+int QXmppImageMetadataGenerator::maxThreadCount() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->maxThreadCount;
+}
+
+///
+/// Sets the maximum number of images processed at the same time.
+///
+/// Further images are queued until a thread is free.
+///
+/// \param maxThreadCount maximum number of threads, at least 1
+///
+void QXmppImageMetadataGenerator::setMaxThreadCount(int maxThreadCount)
+{
+    QMutexLocker locker(&d->mutex);
+    d->maxThreadCount = std::max(maxThreadCount, 1);
+    d->startJobs();
+}
+
+///
+/// Returns the maximum number of cached results.
+///
+/// Only the results of local files are cached.
+/// Results of other devices such as QBuffer or QNetworkReply are never cached since those devices
+/// would need to be read completely to identify their images.
+///
+/// By default, the results of 100 images are cached.
+///
+int QXmppImageMetadataGenerator::maxCacheSize() const
+{
+    QMutexLocker locker(&d->mutex);
+    return int(d->cache.maxCost());
+}
+
+///
+/// Sets the maximum number of cached results.
+///
+/// \param maxCacheSize maximum number of cached results, 0 to disable caching
+///
+void QXmppImageMetadataGenerator::setMaxCacheSize(int maxCacheSize)
+{
+    QMutexLocker locker(&d->mutex);
+    d->cache.setMaxCost(maxCacheSize);
+}
+
+///
+/// Generates the metadata of an image.
+///
+/// The future is finished without a result if it is cancelled.
+///
+/// \param data open device containing the image
+/// \return the metadata with the dimensions and a thumbnail if the data is an
+///         image with a supported format, otherwise empty metadata
+///
+QFuture<QXmppImageMetadataGenerator::Result> QXmppImageMetadataGenerator::generate(std::unique_ptr<QIODevice> data)
+{
+    return d->generate(std::move(data));
+}
+
+///
+/// Returns a metadata generator for QXmppFileSharingManager::setMetadataGenerator().
+///
+/// The generator can be used after this object has been destroyed.
+///
+QXmppFileSharingManager::MetadataGenerator QXmppImageMetadataGenerator::metadataGenerator() const
+{
+    return [d = d](std::unique_ptr<QIODevice> data) {
+        return d->generate(std::move(data));
+    };
+}
@@ -0,0 +1,37 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#ifndef QXMPPIMAGEMETADATAGENERATOR_H
+#define QXMPPIMAGEMETADATAGENERATOR_H
+
+#include "QXmppFileSharingManager.h"
+
+class QXmppImageMetadataGeneratorPrivate;
+
+class QXMPP_EXPORT QXmppImageMetadataGenerator
+{
+public:
+    using Result = std::shared_ptr<QXmppFileSharingManager::MetadataGeneratorResult>;
+
+    QXmppImageMetadataGenerator();
+    ~QXmppImageMetadataGenerator();
+
+    QSize thumbnailSize() const;
+    void setThumbnailSize(const QSize &size);
+
+    int maxThreadCount() const;
+    void setMaxThreadCount(int maxThreadCount);
+
+    int maxCacheSize() const;
+    void setMaxCacheSize(int maxCacheSize);
+
+    QFuture<Result> generate(std::unique_ptr<QIODevice> data);
+    QXmppFileSharingManager::MetadataGenerator metadataGenerator() const;
+
+private:
+    // shared with the generation jobs which may outlive this object
+    std::shared_ptr<QXmppImageMetadataGeneratorPrivate> d;
+};
+
+#endif  // QXMPPIMAGEMETADATAGENERATOR_H
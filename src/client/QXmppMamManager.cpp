@@ -25,12 +25,6 @@
 using namespace QXmpp;
 using namespace QXmpp::Private;
 
-template<typename T>
-auto sum(const T &c)
-{
-    return std::accumulate(c.begin(), c.end(), 0);
-}
-
 struct MamMessage {
     QDomElement element;
     std::optional<QDateTime> delay;
@@ -84,7 +78,6 @@ struct RetrieveRequestState {
     QXmppMamResultIq iq;
     QVector<MamMessage> messages;
     QVector<QXmppMessage> processedMessages;
-    uint runningDecryptionJobs = 0;
 
     void finish()
     {
@@ -311,52 +304,55 @@ QXmppTask<QXmppMamManager::RetrieveResult> QXmppMamManager::retrieveMessages(con
         // decrypt encrypted messages
         if (auto *e2eeExt = client()->encryptionExtension()) {
             // initialize processed messages (we need random access because
-            // decryptMessage() may finish in random order)
+            // encrypted messages are inserted after their decryption)
             state.processedMessages.resize(state.messages.size());
 
             // check for encrypted messages (once)
-            auto messagesEncrypted = transform<std::vector<bool>>(state.messages, [&](const auto &m) {
-                return e2eeExt->isEncrypted(m.element);
-            });
-            auto encryptedCount = sum(messagesEncrypted);
-
-            // We can't do this on the fly (with ++ and --) in the for loop
-            // because some decryptMessage() jobs could finish instantly
-            state.runningDecryptionJobs = encryptedCount;
+            QVector<int> encryptedIndexes;
+            QVector<QXmppMessage> encryptedMessages;
 
             int size = state.messages.size();
             for (auto i = 0; i < size; i++) {
-                if (!messagesEncrypted[i]) {
-                    continue;
+                if (e2eeExt->isEncrypted(state.messages.at(i).element)) {
+                    encryptedIndexes.append(i);
+                    encryptedMessages.append(parseMamMessage(state.messages.at(i), Encrypted));
+                } else {
+                    state.processedMessages[i] = parseMamMessage(state.messages.at(i), Unencrypted);
                 }
+            }
 
-                e2eeExt->decryptMessage(parseMamMessage(state.messages.at(i), Encrypted)).then(this, [this, i, queryId](auto result) {
+            if (!encryptedMessages.isEmpty()) {
+                // decrypt all messages at once so that the encryption can process them in a batch
+                e2eeExt->decryptMessages(std::move(encryptedMessages)).then(this, [this, encryptedIndexes, queryId](QVector<QXmppE2eeExtension::MessageDecryptResult> &&results) {
                     auto itr = d->ongoingRequests.find(queryId.toStdString());
                     Q_ASSERT(itr != d->ongoingRequests.end());
 
                     auto &state = itr->second;
 
-                    // store decrypted message, fallback to encrypted message
-                    if (std::holds_alternative<QXmppMessage>(result)) {
-                        state.processedMessages[i] = std::get<QXmppMessage>(std::move(result));
-                    } else {
-                        warning(u"Error decrypting message."_s);
-                        state.processedMessages[i] = parseMamMessage(state.messages[i], Unencrypted);
+                    for (qsizetype i = 0; i < encryptedIndexes.size(); i++) {
+                        const auto index = encryptedIndexes.at(i);
+                        auto &result = results[i];
+
+                        // store decrypted message, fallback to encrypted message
+                        if (std::holds_alternative<QXmppMessage>(result)) {
+                            state.processedMessages[index] = std::get<QXmppMessage>(std::move(result));
+                        } else {
+                            warning(u"Error decrypting message."_s);
+                            state.processedMessages[index] = parseMamMessage(state.messages[index], Unencrypted);
+                        }
                     }
 
-                    // finish promise if this was the last job
-                    state.runningDecryptionJobs--;
-                    if (state.runningDecryptionJobs == 0) {
-                        state.finish();
-                        d->ongoingRequests.erase(itr);
-                    }
+                    state.finish();
+                    d->ongoingRequests.erase(itr);
                 });
-            }
 
-            // finishing the promise is done after decryptMessage()
-            if (encryptedCount > 0) {
+                // finishing the promise is done after decryptMessages()
                 return;
             }
+
+            state.finish();
+            d->ongoingRequests.erase(itr);
+            return;
         }
 
         // for the case without decryption, finish here
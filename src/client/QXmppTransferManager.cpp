@@ -17,6 +17,8 @@
 
 #include "StringLiterals.h"
 
+#include <algorithm>
+
 #include <QCryptographicHash>
 #include <QDomElement>
 #include <QElapsedTimer>
@@ -26,10 +28,16 @@
 #include <QHostAddress>
 #include <QMetaMethod>
 #include <QNetworkInterface>
+#include <QSocketNotifier>
 #include <QTime>
 #include <QTimer>
 #include <QUrl>
 
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <sys/sendfile.h>
+#endif
+
 using namespace QXmpp::Private;
 
 // time to try to connect to a SOCKS host (7 seconds)
@@ -236,6 +244,9 @@ public:
     // for socks5 bytestreams
     QTcpSocket *socksSocket;
     QXmppByteStreamIq::StreamHost socksProxy;
+    int socksBufferSize;
+    // reused for all blocks instead of allocating one per block
+    QByteArray socksBlock;
 };
 
 QXmppTransferJobPrivate::QXmppTransferJobPrivate()
@@ -250,8 +261,18 @@ QXmppTransferJobPrivate::QXmppTransferJobPrivate()
       state(QXmppTransferJob::OfferState),
       deviceIsOwn(false),
       ibbSequence(0),
-      socksSocket(nullptr)
+      socksSocket(nullptr),
+      socksBufferSize(0)
+{
+}
+
+// Sets the kernel buffer sizes of a SOCKS5 bytestream socket, 0 keeps the system defaults.
+static void setSocketBufferSizes(QTcpSocket *socket, int size)
 {
+    if (size > 0) {
+        socket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, size);
+        socket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, size);
+    }
 }
 
 ///
@@ -550,6 +571,7 @@ void QXmppTransferIncomingJob::_q_candidateReady()
     m_candidateClient = nullptr;
     m_candidateTimer->deleteLater();
     m_candidateTimer = nullptr;
+    setSocketBufferSizes(d->socksSocket, d->socksBufferSize);
 
     connect(d->socksSocket, &QIODevice::readyRead, this, &QXmppTransferIncomingJob::_q_receiveData);
     connect(d->socksSocket, &QAbstractSocket::disconnected, this, &QXmppTransferIncomingJob::_q_disconnected);
@@ -595,9 +617,16 @@ void QXmppTransferIncomingJob::_q_receiveData()
         return;
     }
 
-    // receive data block
+    // receive data blocks into the reused buffer
     if (d->direction == QXmppTransferJob::IncomingDirection) {
-        writeData(d->socksSocket->readAll());
+        d->socksBlock.resize(d->blockSize);
+        while (d->socksSocket->bytesAvailable() > 0) {
+            const qint64 length = d->socksSocket->read(d->socksBlock.data(), d->socksBlock.size());
+            if (length <= 0) {
+                break;
+            }
+            writeData(QByteArray::fromRawData(d->socksBlock.constData(), int(length)));
+        }
 
         // if we have received all the data, stop here
         if (fileSize() && d->done >= fileSize()) {
@@ -607,7 +636,9 @@ void QXmppTransferIncomingJob::_q_receiveData()
 }
 
 QXmppTransferOutgoingJob::QXmppTransferOutgoingJob(const QString &jid, QXmppClient *client, QObject *parent)
-    : QXmppTransferJob(jid, OutgoingDirection, client, parent)
+    : QXmppTransferJob(jid, OutgoingDirection, client, parent),
+      m_sendFileNotifier(nullptr),
+      m_sendFileOffset(0)
 {
 }
 
@@ -631,6 +662,11 @@ void QXmppTransferOutgoingJob::connectToProxy()
 void QXmppTransferOutgoingJob::startSending()
 {
     setState(QXmppTransferJob::TransferState);
+    setSocketBufferSizes(d->socksSocket, d->socksBufferSize);
+
+    if (startSendFile()) {
+        return;
+    }
 
     connect(d->socksSocket, &QIODevice::bytesWritten, this, &QXmppTransferOutgoingJob::_q_sendData);
     connect(d->iodevice, &QIODevice::readyRead, this, &QXmppTransferOutgoingJob::_q_sendData);
@@ -638,6 +674,93 @@ void QXmppTransferOutgoingJob::startSending()
     _q_sendData();
 }
 
+//
+// Sends local files with sendfile() on Linux so that the data is passed from the page cache to
+// the socket without being copied through user space.
+//
+// Returns false if the device is not a local file or the socket still has data to write, e.g., from
+// the SOCKS5 handshake.
+//
+bool QXmppTransferOutgoingJob::startSendFile()
+{
+#ifdef Q_OS_LINUX
+    auto *file = qobject_cast<QFile *>(d->iodevice);
+    if (!file || file->handle() < 0 || file->isSequential() || d->fileInfo.size() <= 0 ||
+        d->socksSocket->socketDescriptor() < 0 || d->socksSocket->bytesToWrite() > 0) {
+        return false;
+    }
+
+    m_sendFileOffset = file->pos();
+    m_sendFileNotifier = new QSocketNotifier(d->socksSocket->socketDescriptor(), QSocketNotifier::Write, this);
+    connect(m_sendFileNotifier, &QSocketNotifier::activated, this, &QXmppTransferOutgoingJob::sendFileData);
+
+    // the descriptor must not be watched anymore once the socket is closed
+    auto disableNotifier = [notifier = m_sendFileNotifier]() {
+        notifier->setEnabled(false);
+    };
+    connect(d->socksSocket, &QIODevice::aboutToClose, m_sendFileNotifier, disableNotifier);
+    connect(d->socksSocket, &QAbstractSocket::disconnected, m_sendFileNotifier, disableNotifier);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void QXmppTransferOutgoingJob::sendFileData()
+{
+#ifdef Q_OS_LINUX
+    auto stop = [this]() {
+        m_sendFileNotifier->setEnabled(false);
+        m_sendFileNotifier->deleteLater();
+        m_sendFileNotifier = nullptr;
+    };
+
+    if (d->state != QXmppTransferJob::TransferState) {
+        stop();
+        return;
+    }
+
+    auto *file = static_cast<QFile *>(d->iodevice);
+    off_t offset = m_sendFileOffset;
+    const auto length = ::sendfile(int(d->socksSocket->socketDescriptor()),
+                                   file->handle(),
+                                   &offset,
+                                   size_t(std::min(d->fileInfo.size() - d->done, qint64(d->blockSize))));
+    if (length < 0) {
+        const auto error = errno;
+        if (error == EAGAIN || error == EINTR) {
+            return;
+        }
+        stop();
+
+        // the file system does not support sendfile(), continue the regular way
+        if ((error == EINVAL || error == ENOSYS) && file->seek(m_sendFileOffset)) {
+            connect(d->socksSocket, &QIODevice::bytesWritten, this, &QXmppTransferOutgoingJob::_q_sendData);
+            _q_sendData();
+            return;
+        }
+
+        terminate(QXmppTransferJob::ProtocolError);
+        return;
+    }
+    if (length == 0) {
+        // the file is smaller than announced
+        stop();
+        terminate(QXmppTransferJob::FileAccessError);
+        return;
+    }
+
+    m_sendFileOffset = offset;
+    d->done += length;
+    Q_EMIT progress(d->done, fileSize());
+
+    if (d->done >= d->fileInfo.size()) {
+        stop();
+        terminate(QXmppTransferJob::NoError);
+    }
+#endif
+}
+
 void QXmppTransferOutgoingJob::_q_disconnected()
 {
     if (d->state == QXmppTransferJob::FinishedState) {
@@ -670,11 +793,6 @@ void QXmppTransferOutgoingJob::_q_sendData()
         return;
     }
 
-    // don't saturate the outgoing socket
-    if (d->socksSocket->bytesToWrite() > 2 * d->blockSize) {
-        return;
-    }
-
     // check whether we have written the whole file
     if (d->fileInfo.size() && d->done >= d->fileInfo.size()) {
         if (!d->socksSocket->bytesToWrite()) {
@@ -683,16 +801,24 @@ void QXmppTransferOutgoingJob::_q_sendData()
         return;
     }
 
-    char *buffer = new char[d->blockSize];
-    qint64 length = d->iodevice->read(buffer, d->blockSize);
-    if (length < 0) {
-        delete[] buffer;
-        terminate(QXmppTransferJob::FileAccessError);
-        return;
-    } else {
-        d->socksSocket->write(buffer, length);
-        delete[] buffer;
+    // keep up to two blocks queued without saturating the outgoing socket
+    const qint64 done = d->done;
+    d->socksBlock.resize(d->blockSize);
+    while (d->socksSocket->bytesToWrite() < 2 * d->blockSize &&
+           (!d->fileInfo.size() || d->done < d->fileInfo.size())) {
+        const qint64 length = d->iodevice->read(d->socksBlock.data(), d->blockSize);
+        if (length < 0) {
+            terminate(QXmppTransferJob::FileAccessError);
+            return;
+        }
+        if (length == 0) {
+            break;
+        }
+        d->socksSocket->write(d->socksBlock.constData(), length);
         d->done += length;
+    }
+
+    if (d->done != done) {
         Q_EMIT progress(d->done, fileSize());
     }
 }
@@ -711,6 +837,8 @@ public:
     QList<QXmppTransferJob *> jobs;
     QString proxy;
     bool proxyOnly;
+    int socksBlockSize;
+    int socksBufferSize;
     QXmppSocksServer *socksServer;
     QXmppTransferJob::Methods supportedMethods;
 
@@ -721,6 +849,8 @@ private:
 QXmppTransferManagerPrivate::QXmppTransferManagerPrivate()
     : ibbBlockSize(4096),
       proxyOnly(false),
+      socksBlockSize(256 * 1024),
+      socksBufferSize(0),
       socksServer(nullptr),
       supportedMethods(QXmppTransferJob::AnyMethod)
 {
@@ -1466,6 +1596,9 @@ void QXmppTransferManager::streamInitiationResultReceived(const QXmppStreamIniti
         job->d->requestId = openIq.id();
         client()->sendPacket(openIq);
     } else if (job->method() == QXmppTransferJob::SocksMethod) {
+        job->d->blockSize = d->socksBlockSize;
+        job->d->socksBufferSize = d->socksBufferSize;
+
         if (!d->proxy.isEmpty()) {
             job->d->socksProxy.setJid(d->proxy);
 
@@ -1543,6 +1676,8 @@ void QXmppTransferManager::streamInitiationSetReceived(const QXmppStreamInitiati
     int sharedMethods = (offeredMethods & d->supportedMethods);
     if (sharedMethods & QXmppTransferJob::SocksMethod) {
         job->d->method = QXmppTransferJob::SocksMethod;
+        job->d->blockSize = d->socksBlockSize;
+        job->d->socksBufferSize = d->socksBufferSize;
     } else if (sharedMethods & QXmppTransferJob::InBandMethod) {
         job->d->method = QXmppTransferJob::InBandMethod;
     } else {
@@ -1605,6 +1740,47 @@ void QXmppTransferManager::setProxyOnly(bool proxyOnly)
     d->proxyOnly = proxyOnly;
 }
 
+int QXmppTransferManager::socksBlockSize() const
+{
+    return d->socksBlockSize;
+}
+
+///
+/// Set the size of the blocks read from and written to SOCKS5 bytestreams.
+///
+/// Larger blocks reduce the number of read and write calls per transfer at
+/// the cost of memory per transfer.
+///
+/// \since QXmpp 1.9
+///
+void QXmppTransferManager::setSocksBlockSize(int blockSize)
+{
+    d->socksBlockSize = std::max(blockSize, 1024);
+}
+
+int QXmppTransferManager::socksBufferSize() const
+{
+    return d->socksBufferSize;
+}
+
+///
+/// Set the size of the kernel send and receive buffers of SOCKS5 bytestream
+/// sockets.
+///
+/// Larger buffers can improve the throughput on connections with a high
+/// latency.
+/// Setting a size disables the automatic buffer tuning of some operating
+/// systems.
+///
+/// \param bufferSize size in bytes, 0 to keep the system defaults
+///
+/// \since QXmpp 1.9
+///
+void QXmppTransferManager::setSocksBufferSize(int bufferSize)
+{
+    d->socksBufferSize = std::max(bufferSize, 0);
+}
+
 QXmppTransferJob::Methods QXmppTransferManager::supportedMethods() const
 {
     return d->supportedMethods;
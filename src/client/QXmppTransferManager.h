@@ -199,6 +199,10 @@ class QXMPP_EXPORT QXmppTransferManager : public QXmppClientExtension
     Q_PROPERTY(bool proxyOnly READ proxyOnly WRITE setProxyOnly)
     /// The supported stream methods
     Q_PROPERTY(QXmppTransferJob::Methods supportedMethods READ supportedMethods WRITE setSupportedMethods)
+    /// The size of the blocks transferred over SOCKS5 bytestreams
+    Q_PROPERTY(int socksBlockSize READ socksBlockSize WRITE setSocksBlockSize)
+    /// The size of the socket buffers of SOCKS5 bytestreams
+    Q_PROPERTY(int socksBufferSize READ socksBufferSize WRITE setSocksBufferSize)
 
 public:
     QXmppTransferManager();
@@ -222,6 +226,25 @@ public:
     QXmppTransferJob::Methods supportedMethods() const;
     void setSupportedMethods(QXmppTransferJob::Methods methods);
 
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Return the size of the blocks read from and written to SOCKS5
+    /// bytestreams.
+    ///
+    /// By default, it is 256 KiB.
+    ///
+    /// \since QXmpp 1.9
+    int socksBlockSize() const;
+    void setSocksBlockSize(int blockSize);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Return the size of the kernel buffers of SOCKS5 bytestream sockets.
+    ///
+    /// By default, it is 0 and the system defaults are used.
+    ///
+    /// \since QXmpp 1.9
+    int socksBufferSize() const;
+    void setSocksBufferSize(int bufferSize);
+
     /// \cond
     QStringList discoveryFeatures() const override;
     bool handleStanza(const QDomElement &element) override;
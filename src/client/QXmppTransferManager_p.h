@@ -19,6 +19,7 @@
 // We mean it.
 //
 
+class QSocketNotifier;
 class QTimer;
 class QXmppSocksClient;
 
@@ -64,6 +65,13 @@ public Q_SLOTS:
 private Q_SLOTS:
     void _q_proxyReady();
     void _q_sendData();
+
+private:
+    bool startSendFile();
+    void sendFileData();
+
+    QSocketNotifier *m_sendFileNotifier;
+    qint64 m_sendFileOffset;
 };
 
 #endif
@@ -22,12 +22,82 @@ using namespace QXmpp::Private;
 /// \since QXmpp 1.5
 ///
 
-struct Key {
-    QByteArray id;
-    QString ownerJid;
-    TrustLevel trustLevel;
+// Keys of one encryption protocol indexed by their owners and by their trust
+// levels.
+//
+// The indexes are updated on each change so that lookups do not need to scan
+// all keys.
+// Since Qt's containers are implicitly shared, the indexes are returned as
+// snapshots without copying them until they are modified again.
+struct EncryptionKeys {
+    bool insert(const QString &ownerJid, const QByteArray &keyId, TrustLevel trustLevel);
+    void remove(const QString &ownerJid, const QByteArray &keyId);
+    void removeFromTrustLevel(TrustLevel trustLevel, const QString &ownerJid, const QByteArray &keyId);
+
+    // key owner JIDs mapped to key IDs mapped to trust levels
+    QHash<QString, QHash<QByteArray, TrustLevel>> keysByOwner;
+    // trust levels mapped to key owner JIDs mapped to key IDs
+    QHash<TrustLevel, QMultiHash<QString, QByteArray>> keysByTrustLevel;
+    // key IDs mapped to key owner JIDs
+    QMultiHash<QByteArray, QString> ownersByKeyId;
 };
 
+// Adds a key or updates its trust level.
+//
+// Returns whether the key has been added or its trust level has been changed.
+bool EncryptionKeys::insert(const QString &ownerJid, const QByteArray &keyId, TrustLevel trustLevel)
+{
+    auto &ownerKeys = keysByOwner[ownerJid];
+
+    if (auto itr = ownerKeys.find(keyId); itr != ownerKeys.end()) {
+        if (itr.value() == trustLevel) {
+            return false;
+        }
+
+        removeFromTrustLevel(itr.value(), ownerJid, keyId);
+        itr.value() = trustLevel;
+    } else {
+        ownerKeys.insert(keyId, trustLevel);
+        ownersByKeyId.insert(keyId, ownerJid);
+    }
+
+    keysByTrustLevel[trustLevel].insert(ownerJid, keyId);
+    return true;
+}
+
+void EncryptionKeys::remove(const QString &ownerJid, const QByteArray &keyId)
+{
+    auto ownerItr = keysByOwner.find(ownerJid);
+    if (ownerItr == keysByOwner.end()) {
+        return;
+    }
+
+    auto keyItr = ownerItr->find(keyId);
+    if (keyItr == ownerItr->end()) {
+        return;
+    }
+
+    removeFromTrustLevel(keyItr.value(), ownerJid, keyId);
+    ownersByKeyId.remove(keyId, ownerJid);
+
+    ownerItr->erase(keyItr);
+    if (ownerItr->isEmpty()) {
+        keysByOwner.erase(ownerItr);
+    }
+}
+
+void EncryptionKeys::removeFromTrustLevel(TrustLevel trustLevel, const QString &ownerJid, const QByteArray &keyId)
+{
+    if (auto itr = keysByTrustLevel.find(trustLevel); itr != keysByTrustLevel.end()) {
+        itr->remove(ownerJid, keyId);
+
+        // Trust levels without keys must not be part of the results.
+        if (itr->isEmpty()) {
+            keysByTrustLevel.erase(itr);
+        }
+    }
+}
+
 class QXmppTrustMemoryStoragePrivate
 {
 public:
@@ -38,7 +108,7 @@ public:
     QMap<QString, QByteArray> ownKeys;
 
     // encryption protocols mapped to keys with specified trust levels
-    QMultiHash<QString, Key> keys;
+    QHash<QString, EncryptionKeys> keys;
 };
 
 ///
@@ -89,12 +159,10 @@ QXmppTask<QByteArray> QXmppTrustMemoryStorage::ownKey(const QString &encryption)
 
 QXmppTask<void> QXmppTrustMemoryStorage::addKeys(const QString &encryption, const QString &keyOwnerJid, const QList<QByteArray> &keyIds, TrustLevel trustLevel)
 {
+    auto &encryptionKeys = d->keys[encryption];
+
     for (const auto &keyId : keyIds) {
-        Key key;
-        key.id = keyId;
-        key.ownerJid = keyOwnerJid;
-        key.trustLevel = trustLevel;
-        d->keys.insert(encryption, key);
+        encryptionKeys.insert(keyOwnerJid, keyId, trustLevel);
     }
 
     return makeReadyTask();
@@ -102,12 +170,14 @@ QXmppTask<void> QXmppTrustMemoryStorage::addKeys(const QString &encryption, cons
 
 QXmppTask<void> QXmppTrustMemoryStorage::removeKeys(const QString &encryption, const QList<QByteArray> &keyIds)
 {
-    for (auto itr = d->keys.find(encryption);
-         itr != d->keys.end() && itr.key() == encryption;) {
-        if (keyIds.contains(itr.value().id)) {
-            itr = d->keys.erase(itr);
-        } else {
-            ++itr;
+    if (auto itr = d->keys.find(encryption); itr != d->keys.end()) {
+        auto &encryptionKeys = itr.value();
+
+        for (const auto &keyId : keyIds) {
+            const auto keyOwnerJids = encryptionKeys.ownersByKeyId.values(keyId);
+            for (const auto &keyOwnerJid : keyOwnerJids) {
+                encryptionKeys.remove(keyOwnerJid, keyId);
+            }
         }
     }
 
@@ -116,12 +186,12 @@ QXmppTask<void> QXmppTrustMemoryStorage::removeKeys(const QString &encryption, c
 
 QXmppTask<void> QXmppTrustMemoryStorage::removeKeys(const QString &encryption, const QString &keyOwnerJid)
 {
-    for (auto itr = d->keys.find(encryption);
-         itr != d->keys.end() && itr.key() == encryption;) {
-        if (itr.value().ownerJid == keyOwnerJid) {
-            itr = d->keys.erase(itr);
-        } else {
-            ++itr;
+    if (auto itr = d->keys.find(encryption); itr != d->keys.end()) {
+        auto &encryptionKeys = itr.value();
+
+        const auto keyIds = encryptionKeys.keysByOwner.value(keyOwnerJid).keys();
+        for (const auto &keyId : keyIds) {
+            encryptionKeys.remove(keyOwnerJid, keyId);
         }
     }
 
@@ -136,13 +206,22 @@ QXmppTask<void> QXmppTrustMemoryStorage::removeKeys(const QString &encryption)
 
 QXmppTask<QHash<TrustLevel, QMultiHash<QString, QByteArray>>> QXmppTrustMemoryStorage::keys(const QString &encryption, TrustLevels trustLevels)
 {
+    const auto itr = d->keys.constFind(encryption);
+    if (itr == d->keys.constEnd()) {
+        return makeReadyTask(QHash<TrustLevel, QMultiHash<QString, QByteArray>>());
+    }
+
+    const auto &keysByTrustLevel = itr->keysByTrustLevel;
+
+    if (!trustLevels) {
+        return makeReadyTask(QHash<TrustLevel, QMultiHash<QString, QByteArray>>(keysByTrustLevel));
+    }
+
     QHash<TrustLevel, QMultiHash<QString, QByteArray>> keys;
 
-    const auto storedKeys = d->keys.values(encryption);
-    for (const auto &key : storedKeys) {
-        const auto trustLevel = key.trustLevel;
-        if (trustLevels.testFlag(trustLevel) || !trustLevels) {
-            keys[trustLevel].insert(key.ownerJid, key.id);
+    for (auto trustLevelItr = keysByTrustLevel.cbegin(); trustLevelItr != keysByTrustLevel.cend(); ++trustLevelItr) {
+        if (trustLevels.testFlag(trustLevelItr.key())) {
+            keys.insert(trustLevelItr.key(), trustLevelItr.value());
         }
     }
 
@@ -153,12 +232,34 @@ QXmppTask<QHash<QString, QHash<QByteArray, TrustLevel>>> QXmppTrustMemoryStorage
 {
     QHash<QString, QHash<QByteArray, TrustLevel>> keys;
 
-    const auto storedKeys = d->keys.values(encryption);
-    for (const auto &key : storedKeys) {
-        const auto keyOwnerJid = key.ownerJid;
-        const auto trustLevel = key.trustLevel;
-        if (keyOwnerJids.contains(keyOwnerJid) && (trustLevels.testFlag(trustLevel) || !trustLevels)) {
-            keys[keyOwnerJid].insert(key.id, trustLevel);
+    const auto itr = d->keys.constFind(encryption);
+    if (itr == d->keys.constEnd()) {
+        return makeReadyTask(std::move(keys));
+    }
+
+    const auto &keysByOwner = itr->keysByOwner;
+
+    for (const auto &keyOwnerJid : keyOwnerJids) {
+        const auto ownerItr = keysByOwner.constFind(keyOwnerJid);
+        if (ownerItr == keysByOwner.constEnd()) {
+            continue;
+        }
+
+        if (!trustLevels) {
+            keys.insert(keyOwnerJid, ownerItr.value());
+            continue;
+        }
+
+        QHash<QByteArray, TrustLevel> ownerKeys;
+
+        for (auto keyItr = ownerItr->cbegin(); keyItr != ownerItr->cend(); ++keyItr) {
+            if (trustLevels.testFlag(keyItr.value())) {
+                ownerKeys.insert(keyItr.key(), keyItr.value());
+            }
+        }
+
+        if (!ownerKeys.isEmpty()) {
+            keys.insert(keyOwnerJid, ownerKeys);
         }
     }
 
@@ -167,10 +268,13 @@ QXmppTask<QHash<QString, QHash<QByteArray, TrustLevel>>> QXmppTrustMemoryStorage
 
 QXmppTask<bool> QXmppTrustMemoryStorage::hasKey(const QString &encryption, const QString &keyOwnerJid, TrustLevels trustLevels)
 {
-    const auto storedKeys = d->keys.values(encryption);
-    for (const auto &key : storedKeys) {
-        if (key.ownerJid == keyOwnerJid && trustLevels.testFlag(key.trustLevel)) {
-            return makeReadyTask(std::move(true));
+    if (const auto itr = d->keys.constFind(encryption); itr != d->keys.constEnd()) {
+        if (const auto ownerItr = itr->keysByOwner.constFind(keyOwnerJid); ownerItr != itr->keysByOwner.constEnd()) {
+            for (const auto trustLevel : ownerItr.value()) {
+                if (trustLevels.testFlag(trustLevel)) {
+                    return makeReadyTask(std::move(true));
+                }
+            }
         }
     }
 
@@ -180,36 +284,15 @@ QXmppTask<bool> QXmppTrustMemoryStorage::hasKey(const QString &encryption, const
 QXmppTask<QHash<QString, QMultiHash<QString, QByteArray>>> QXmppTrustMemoryStorage::setTrustLevel(const QString &encryption, const QMultiHash<QString, QByteArray> &keyIds, TrustLevel trustLevel)
 {
     QHash<QString, QMultiHash<QString, QByteArray>> modifiedKeys;
+    auto &encryptionKeys = d->keys[encryption];
 
     for (auto itr = keyIds.constBegin(); itr != keyIds.constEnd(); ++itr) {
         const auto keyOwnerJid = itr.key();
         const auto keyId = itr.value();
 
-        auto isKeyFound = false;
-
-        for (auto itrKeys = d->keys.find(encryption);
-             itrKeys != d->keys.end() && itrKeys.key() == encryption;
-             ++itrKeys) {
-            auto &key = itrKeys.value();
-            if (key.id == keyId && key.ownerJid == keyOwnerJid) {
-                // Update the stored trust level if it differs from the new one.
-                if (key.trustLevel != trustLevel) {
-                    key.trustLevel = trustLevel;
-                    modifiedKeys[encryption].insert(keyOwnerJid, keyId);
-                }
-
-                isKeyFound = true;
-                break;
-            }
-        }
-
-        // Create a new entry and store it if there is no such entry yet.
-        if (!isKeyFound) {
-            Key key;
-            key.id = keyId;
-            key.ownerJid = keyOwnerJid;
-            key.trustLevel = trustLevel;
-            d->keys.insert(encryption, key);
+        // Create a new entry if there is no such entry yet or update the stored
+        // trust level if it differs from the new one.
+        if (encryptionKeys.insert(keyOwnerJid, keyId, trustLevel)) {
             modifiedKeys[encryption].insert(keyOwnerJid, keyId);
         }
     }
@@ -221,12 +304,21 @@ QXmppTask<QHash<QString, QMultiHash<QString, QByteArray>>> QXmppTrustMemoryStora
 {
     QHash<QString, QMultiHash<QString, QByteArray>> modifiedKeys;
 
-    for (auto itr = d->keys.find(encryption); itr != d->keys.end() && itr.key() == encryption; ++itr) {
-        auto &key = itr.value();
-        auto keyOwnerJid = key.ownerJid;
-        if (keyOwnerJids.contains(keyOwnerJid) && key.trustLevel == oldTrustLevel) {
-            key.trustLevel = newTrustLevel;
-            modifiedKeys[encryption].insert(keyOwnerJid, key.id);
+    const auto itr = d->keys.find(encryption);
+    if (itr == d->keys.end()) {
+        return makeReadyTask(std::move(modifiedKeys));
+    }
+
+    auto &encryptionKeys = itr.value();
+
+    for (const auto &keyOwnerJid : keyOwnerJids) {
+        const auto ownerKeys = encryptionKeys.keysByOwner.value(keyOwnerJid);
+
+        for (auto keyItr = ownerKeys.cbegin(); keyItr != ownerKeys.cend(); ++keyItr) {
+            if (keyItr.value() == oldTrustLevel) {
+                encryptionKeys.insert(keyOwnerJid, keyItr.key(), newTrustLevel);
+                modifiedKeys[encryption].insert(keyOwnerJid, keyItr.key());
+            }
         }
     }
 
@@ -235,10 +327,11 @@ QXmppTask<QHash<QString, QMultiHash<QString, QByteArray>>> QXmppTrustMemoryStora
 
 QXmppTask<TrustLevel> QXmppTrustMemoryStorage::trustLevel(const QString &encryption, const QString &keyOwnerJid, const QByteArray &keyId)
 {
-    const auto keys = d->keys.values(encryption);
-    for (const auto &key : keys) {
-        if (key.id == keyId && key.ownerJid == keyOwnerJid) {
-            return makeReadyTask(std::move(TrustLevel(key.trustLevel)));
+    if (const auto itr = d->keys.constFind(encryption); itr != d->keys.constEnd()) {
+        if (const auto ownerItr = itr->keysByOwner.constFind(keyOwnerJid); ownerItr != itr->keysByOwner.constEnd()) {
+            if (const auto keyItr = ownerItr->constFind(keyId); keyItr != ownerItr->constEnd()) {
+                return makeReadyTask(TrustLevel(keyItr.value()));
+            }
         }
     }
 
@@ -14,11 +14,19 @@
 
 #include "StringLiterals.h"
 
+#include <algorithm>
+#include <chrono>
+
+#include <QDateTime>
 #include <QDomElement>
 #include <QFileInfo>
 #include <QMimeDatabase>
 
 using namespace QXmpp::Private;
+using namespace std::chrono_literals;
+
+// time after which the discovered upload services are not reused on a new connection
+constexpr auto UPLOAD_SERVICES_CACHE_TTL = 24h;
 
 class QXmppUploadServicePrivate : public QSharedData
 {
@@ -78,6 +86,9 @@ class QXmppUploadRequestManagerPrivate : public QSharedData
 {
 public:
     QVector<QXmppUploadService> uploadServices;
+    // domain of the account the services have been discovered for
+    QString uploadServicesDomain;
+    QDateTime uploadServicesDiscoveryTime;
 };
 
 ///
@@ -311,7 +322,18 @@ void QXmppUploadRequestManager::handleDiscoInfo(const QXmppDiscoveryIq &iq)
                 }
             }
 
-            d->uploadServices.append(service);
+            // update a service discovered again
+            auto itr = std::find_if(d->uploadServices.begin(), d->uploadServices.end(), [&](const auto &uploadService) {
+                return uploadService.jid() == service.jid();
+            });
+            if (itr != d->uploadServices.end()) {
+                *itr = service;
+            } else {
+                d->uploadServices.append(service);
+            }
+
+            d->uploadServicesDomain = client()->configuration().domain();
+            d->uploadServicesDiscoveryTime = QDateTime::currentDateTimeUtc();
             Q_EMIT serviceFoundChanged();
         }
     }
@@ -327,10 +349,14 @@ void QXmppUploadRequestManager::onRegistered(QXmppClient *client)
         connect(disco, &QXmppDiscoveryManager::infoReceived,
                 this, &QXmppUploadRequestManager::handleDiscoInfo);
 
-        // on client disconnect remove all upload services
-        connect(client, &QXmppClient::disconnected, this, [this]() {
-            d->uploadServices.clear();
-            Q_EMIT serviceFoundChanged();
+        // The upload services are reused after reconnecting to the same server for some time.
+        // That way, uploads do not need to wait for the services to be discovered again.
+        connect(client, &QXmppClient::connected, this, [this]() {
+            const auto isCacheExpired = d->uploadServicesDiscoveryTime.addSecs(std::chrono::seconds(UPLOAD_SERVICES_CACHE_TTL).count()) < QDateTime::currentDateTimeUtc();
+            if (!d->uploadServices.isEmpty() && (d->uploadServicesDomain != this->client()->configuration().domain() || isCacheExpired)) {
+                d->uploadServices.clear();
+                Q_EMIT serviceFoundChanged();
+            }
         });
     }
 }
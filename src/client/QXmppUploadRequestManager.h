@@ -67,6 +67,9 @@ private:
 /// services and add them to the list of discovered services
 /// \c uploadServices().
 ///
+/// The discovered services are kept if the client reconnects to the same
+/// server within a day (since QXmpp 1.9).
+///
 /// Keep in mind that theoretically any XMPP entity could promote to be an
 /// upload service and so is recognized by this manager. A potential attacker
 /// could exploit this vulnerability, so the client could be uploading files to
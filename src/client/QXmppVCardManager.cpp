@@ -150,6 +150,11 @@ QStringList QXmppVCardManager::discoveryFeatures() const
     };
 }
 
+QList<QXmppClientExtension::StanzaFilter> QXmppVCardManager::stanzaFilters() const
+{
+    return { { u"iq"_s, ns_vcard.toString() } };
+}
+
 bool QXmppVCardManager::handleStanza(const QDomElement &element)
 {
     if (element.tagName() == u"iq" && QXmppVCardIq::isVCard(element)) {
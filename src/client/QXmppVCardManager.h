@@ -65,6 +65,7 @@ public:
 
     /// \cond
     QStringList discoveryFeatures() const override;
+    QList<StanzaFilter> stanzaFilters() const override;
     bool handleStanza(const QDomElement &element) override;
     /// \endcond
 
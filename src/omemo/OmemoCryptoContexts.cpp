@@ -0,0 +1,123 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "OmemoCryptoContexts.h"
+
+#include "QXmppOmemoManager_p.h"
+
+namespace QXmpp::Omemo::Private {
+
+//
+// Returns a cipher set up with a key and an initialization vector.
+//
+// \param type type of the cipher (e.g., "aes256")
+// \param mode mode of the cipher
+// \param padding padding of the cipher
+// \param direction whether to encrypt or decrypt
+// \param key key used by the cipher
+// \param initializationVector initialization vector used by the cipher
+//
+// \return the cipher ready to process data
+//
+QCA::Cipher &CryptoContext::cipher(const QString &type,
+                                   QCA::Cipher::Mode mode,
+                                   QCA::Cipher::Padding padding,
+                                   QCA::Direction direction,
+                                   const QCA::SymmetricKey &key,
+                                   const QCA::InitializationVector &initializationVector)
+{
+    auto &cipher = m_ciphers[QCA::Cipher::withAlgorithms(type, mode, padding)];
+
+    if (cipher) {
+        cipher->setup(direction, key, initializationVector);
+    } else {
+        cipher = std::make_unique<QCA::Cipher>(type, mode, padding, direction, key, initializationVector);
+    }
+
+    return *cipher;
+}
+
+//
+// Returns an HMAC-SHA256 generator set up with a key.
+//
+// \param key key used for generating the message authentication code
+//
+// \return the message authentication code generator ready to process data
+//
+QCA::MessageAuthenticationCode &CryptoContext::messageAuthenticationCode(const QCA::SymmetricKey &key)
+{
+    if (m_messageAuthenticationCode) {
+        m_messageAuthenticationCode->setup(key);
+    } else {
+        m_messageAuthenticationCode = std::make_unique<QCA::MessageAuthenticationCode>(PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE.toString(), key);
+    }
+
+    return *m_messageAuthenticationCode;
+}
+
+//
+// Returns the HKDF used for deriving keys.
+//
+QCA::HKDF &CryptoContext::hkdf()
+{
+    if (!m_hkdf) {
+        m_hkdf = std::make_unique<QCA::HKDF>();
+    }
+
+    return *m_hkdf;
+}
+
+CryptoContextHandle::CryptoContextHandle(const CryptoContextPool *pool, std::unique_ptr<CryptoContext> context)
+    : m_pool(pool), m_context(std::move(context))
+{
+}
+
+CryptoContextHandle::~CryptoContextHandle()
+{
+    if (m_context) {
+        m_pool->release(std::move(m_context));
+    }
+}
+
+CryptoContextPool::CryptoContextPool()
+    : m_isMessageAuthenticationCodeSupported(QCA::MessageAuthenticationCode::supportedTypes().contains(PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE))
+{
+}
+
+void CryptoContextPool::setCachingEnabled(bool enabled)
+{
+    QMutexLocker locker(&m_mutex);
+    m_isCachingEnabled = enabled;
+    m_unusedContexts.clear();
+}
+
+//
+// Returns an unused crypto context or creates a new one.
+//
+// \return the handle giving exclusive access to the context until it is
+//         destroyed
+//
+CryptoContextHandle CryptoContextPool::acquire() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (m_unusedContexts.empty()) {
+        return { this, std::make_unique<CryptoContext>() };
+    }
+
+    auto context = std::move(m_unusedContexts.back());
+    m_unusedContexts.pop_back();
+    return { this, std::move(context) };
+}
+
+void CryptoContextPool::release(std::unique_ptr<CryptoContext> context) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (m_isCachingEnabled) {
+        m_unusedContexts.push_back(std::move(context));
+    }
+}
+
+}  // namespace QXmpp::Omemo::Private
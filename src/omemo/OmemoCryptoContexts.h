@@ -0,0 +1,97 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#ifndef OMEMOCRYPTOCONTEXTS_H
+#define OMEMOCRYPTOCONTEXTS_H
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <QMutex>
+#include <QtCrypto>
+
+namespace QXmpp::Omemo::Private {
+
+//
+// Crypto objects that are reused for multiple encryptions and decryptions.
+//
+// Constructing QCA objects requires looking up a provider each time.
+// Instead, the objects are constructed once and set up with new keys and
+// initialization vectors before each use.
+//
+// A context must only be used by one thread at a time.
+//
+class CryptoContext
+{
+public:
+    QCA::Cipher &cipher(const QString &type,
+                        QCA::Cipher::Mode mode,
+                        QCA::Cipher::Padding padding,
+                        QCA::Direction direction,
+                        const QCA::SymmetricKey &key,
+                        const QCA::InitializationVector &initializationVector);
+    QCA::MessageAuthenticationCode &messageAuthenticationCode(const QCA::SymmetricKey &key);
+    QCA::HKDF &hkdf();
+
+private:
+    std::unordered_map<QString, std::unique_ptr<QCA::Cipher>> m_ciphers;
+    std::unique_ptr<QCA::MessageAuthenticationCode> m_messageAuthenticationCode;
+    std::unique_ptr<QCA::HKDF> m_hkdf;
+};
+
+class CryptoContextPool;
+
+//
+// Gives exclusive access to a crypto context and returns it to its pool on
+// destruction.
+//
+class CryptoContextHandle
+{
+public:
+    CryptoContextHandle(const CryptoContextPool *pool, std::unique_ptr<CryptoContext> context);
+    CryptoContextHandle(CryptoContextHandle &&) = default;
+    CryptoContextHandle &operator=(CryptoContextHandle &&) = delete;
+    ~CryptoContextHandle();
+
+    CryptoContext *operator->() const { return m_context.get(); }
+
+private:
+    const CryptoContextPool *m_pool;
+    std::unique_ptr<CryptoContext> m_context;
+};
+
+//
+// Provides a crypto context to each thread that currently encrypts or decrypts.
+//
+// The support of the message authentication code is determined once on
+// construction.
+//
+class CryptoContextPool
+{
+public:
+    CryptoContextPool();
+
+    bool isMessageAuthenticationCodeSupported() const { return m_isMessageAuthenticationCodeSupported; }
+
+    // Disabling the caching is only intended for benchmarks.
+    bool isCachingEnabled() const { return m_isCachingEnabled; }
+    void setCachingEnabled(bool enabled);
+
+    CryptoContextHandle acquire() const;
+
+private:
+    friend class CryptoContextHandle;
+    void release(std::unique_ptr<CryptoContext> context) const;
+
+    bool m_isMessageAuthenticationCodeSupported;
+    bool m_isCachingEnabled = true;
+
+    mutable QMutex m_mutex;
+    mutable std::vector<std::unique_ptr<CryptoContext>> m_unusedContexts;
+};
+
+}  // namespace QXmpp::Omemo::Private
+
+#endif  // OMEMOCRYPTOCONTEXTS_H
@@ -10,6 +10,7 @@
 
 #include "StringLiterals.h"
 
+#include <QThread>
 #include <QtCrypto>
 
 using namespace QXmpp::Private;
@@ -19,6 +20,27 @@ inline QXmppOmemoManagerPrivate *managerPrivate(void *ptr)
     return reinterpret_cast<QXmppOmemoManagerPrivate *>(ptr);
 }
 
+//
+// Logs a warning if it is called on the manager's thread.
+//
+// The crypto provider is also used by worker threads (e.g., for creating OMEMO envelopes in
+// parallel) which must not access the manager's logger.
+// Failures on those threads are only reported by the returned error codes.
+//
+static void warning(QXmppOmemoManagerPrivate *d, const QString &message)
+{
+    if (QThread::currentThread() == d->q->thread()) {
+        d->warning(message);
+    }
+}
+
+// Message authentication code generator used by the OMEMO library between the
+// initialization and cleanup of an HMAC context.
+struct HmacContext {
+    CryptoContextHandle cryptoContext;
+    QCA::MessageAuthenticationCode *messageAuthenticationCodeGenerator;
+};
+
 static int random_func(uint8_t *data, size_t len, void *)
 {
     generateRandomBytes(data, len);
@@ -29,19 +51,21 @@ int hmac_sha256_init_func(void **hmac_context, const uint8_t *key, size_t key_le
 {
     auto *d = managerPrivate(user_data);
 
-    if (!QCA::MessageAuthenticationCode::supportedTypes().contains(PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE)) {
-        d->warning(u"Message authentication code type '" + PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE + u"' is not supported by this system");
+    if (!d->cryptoContexts.isMessageAuthenticationCodeSupported()) {
+        warning(d, u"Message authentication code type '" + PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE + u"' is not supported by this system");
         return -1;
     }
 
     QCA::SymmetricKey authenticationKey(QByteArray(reinterpret_cast<const char *>(key), key_len));
-    *hmac_context = new QCA::MessageAuthenticationCode(PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE.toString(), authenticationKey);
+    auto cryptoContext = d->cryptoContexts.acquire();
+    auto &messageAuthenticationCodeGenerator = cryptoContext->messageAuthenticationCode(authenticationKey);
+    *hmac_context = new HmacContext { std::move(cryptoContext), &messageAuthenticationCodeGenerator };
     return 0;
 }
 
 int hmac_sha256_update_func(void *hmac_context, const uint8_t *data, size_t data_len, void *)
 {
-    auto *messageAuthenticationCodeGenerator = reinterpret_cast<QCA::MessageAuthenticationCode *>(hmac_context);
+    auto *messageAuthenticationCodeGenerator = reinterpret_cast<HmacContext *>(hmac_context)->messageAuthenticationCodeGenerator;
     messageAuthenticationCodeGenerator->update(QCA::MemoryRegion(QByteArray(reinterpret_cast<const char *>(data), data_len)));
     return 0;
 }
@@ -49,11 +73,11 @@ int hmac_sha256_update_func(void *hmac_context, const uint8_t *data, size_t data
 int hmac_sha256_final_func(void *hmac_context, signal_buffer **output, void *user_data)
 {
     auto *d = managerPrivate(user_data);
-    auto *messageAuthenticationCodeGenerator = reinterpret_cast<QCA::MessageAuthenticationCode *>(hmac_context);
+    auto *messageAuthenticationCodeGenerator = reinterpret_cast<HmacContext *>(hmac_context)->messageAuthenticationCodeGenerator;
 
     auto messageAuthenticationCode = messageAuthenticationCodeGenerator->final();
     if (!(*output = signal_buffer_create(reinterpret_cast<const uint8_t *>(messageAuthenticationCode.constData()), messageAuthenticationCode.size()))) {
-        d->warning(u"Message authentication code could not be loaded"_s);
+        warning(d, u"Message authentication code could not be loaded"_s);
         return -1;
     }
 
@@ -62,8 +86,7 @@ int hmac_sha256_final_func(void *hmac_context, signal_buffer **output, void *use
 
 void hmac_sha256_cleanup_func(void *hmac_context, void *)
 {
-    auto *messageAuthenticationCodeGenerator = reinterpret_cast<QCA::MessageAuthenticationCode *>(hmac_context);
-    delete messageAuthenticationCodeGenerator;
+    delete reinterpret_cast<HmacContext *>(hmac_context);
 }
 
 int sha512_digest_init_func(void **digest_context, void *)
@@ -86,7 +109,7 @@ int sha512_digest_final_func(void *digest_context, signal_buffer **output, void
 
     auto hash = hashGenerator->result();
     if (!(*output = signal_buffer_create(reinterpret_cast<const uint8_t *>(hash.constData()), hash.size()))) {
-        d->warning(u"Hash could not be loaded"_s);
+        warning(d, u"Hash could not be loaded"_s);
         return -1;
     }
 
@@ -142,7 +165,8 @@ int encrypt_func(signal_buffer **output,
 
     const auto encryptionKey = QCA::SymmetricKey(QByteArray(reinterpret_cast<const char *>(key), key_len));
     const auto initializationVector = QCA::InitializationVector(QByteArray(reinterpret_cast<const char *>(iv), iv_len));
-    QCA::Cipher encryptionCipher(cipherName, mode, padding, QCA::Encode, encryptionKey, initializationVector);
+    const auto cryptoContext = d->cryptoContexts.acquire();
+    auto &encryptionCipher = cryptoContext->cipher(cipherName, mode, padding, QCA::Encode, encryptionKey, initializationVector);
 
     auto encryptedData = encryptionCipher.process(QCA::MemoryRegion(QByteArray(reinterpret_cast<const char *>(plaintext), plaintext_len)));
 
@@ -151,7 +175,7 @@ int encrypt_func(signal_buffer **output,
     }
 
     if (!(*output = signal_buffer_create(reinterpret_cast<const uint8_t *>(encryptedData.constData()), encryptedData.size()))) {
-        d->warning(u"Encrypted data could not be loaded"_s);
+        warning(d, u"Encrypted data could not be loaded"_s);
         return -4;
     }
 
@@ -201,7 +225,8 @@ int decrypt_func(signal_buffer **output,
 
     const auto encryptionKey = QCA::SymmetricKey(QByteArray(reinterpret_cast<const char *>(key), key_len));
     const auto initializationVector = QCA::InitializationVector(QByteArray(reinterpret_cast<const char *>(iv), iv_len));
-    QCA::Cipher decryptionCipher(cipherName, mode, padding, QCA::Decode, encryptionKey, initializationVector);
+    const auto cryptoContext = d->cryptoContexts.acquire();
+    auto &decryptionCipher = cryptoContext->cipher(cipherName, mode, padding, QCA::Decode, encryptionKey, initializationVector);
 
     auto decryptedData = decryptionCipher.process(QCA::MemoryRegion(QByteArray(reinterpret_cast<const char *>(ciphertext), ciphertext_len)));
 
@@ -210,7 +235,7 @@ int decrypt_func(signal_buffer **output,
     }
 
     if (!(*output = signal_buffer_create(reinterpret_cast<const uint8_t *>(decryptedData.constData()), decryptedData.size()))) {
-        d->warning(u"Decrypted data could not be loaded"_s);
+        warning(d, u"Decrypted data could not be loaded"_s);
         return -4;
     }
 
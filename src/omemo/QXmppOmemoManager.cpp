@@ -13,6 +13,7 @@
 #include "QXmppUtils.h"
 #include "QXmppUtils_p.h"
 
+#include "Algorithms.h"
 #include "StringLiterals.h"
 
 #include <QStringBuilder>
@@ -248,6 +249,11 @@ void QXmppOmemoDevice::setTrustLevel(TrustLevel trustLevel)
 /// QXmppTrustStorage *trustStorage = new QXmppTrustMemoryStorage;
 /// \endcode
 ///
+/// Changes of devices caused by encrypting or decrypting stanzas (e.g., sessions and counters of
+/// unresponded stanzas) are collected for a short time and passed to
+/// QXmppOmemoStorage::addDevices() in one batch.
+/// Pending changes are also stored when the client is disconnected.
+///
 /// A trust manager using its storage must be added to the client:
 /// \code
 /// client->addNewExtension<QXmppAtmManager>(trustStorage);
@@ -338,7 +344,11 @@ QXmppOmemoManager::QXmppOmemoManager(QXmppOmemoStorage *omemoStorage)
     d->schedulePeriodicTasks();
 }
 
-QXmppOmemoManager::~QXmppOmemoManager() = default;
+QXmppOmemoManager::~QXmppOmemoManager()
+{
+    // Store the changed devices collected for the next batch.
+    d->storePendingDevices();
+}
 
 ///
 /// Loads all locally stored OMEMO data.
@@ -357,7 +367,12 @@ QXmppTask<bool> Manager::load()
 {
     QXmppPromise<bool> interface;
 
-    auto future = d->omemoStorage->allData();
+    // Sessions are only loaded on demand if the cache size is limited.
+    d->areSessionsLoadedOnDemand = d->sessionCacheSize > 0;
+    d->sessionsLastUsed.clear();
+    d->sessionUsageTimer.start();
+
+    auto future = d->areSessionsLoadedOnDemand ? d->omemoStorage->allDataWithoutSessions() : d->omemoStorage->allData();
     future.then(this, [=, this](QXmppOmemoStorage::OmemoData omemoData) mutable {
         const auto &optionalOwnDevice = omemoData.ownDevice;
         if (optionalOwnDevice) {
@@ -388,6 +403,7 @@ QXmppTask<bool> Manager::load()
         }
 
         d->devices = omemoData.devices;
+        d->deviceLists = omemoData.deviceLists;
         d->removeDevicesRemovedFromServer();
 
         d->isStarted = true;
@@ -400,6 +416,10 @@ QXmppTask<bool> Manager::load()
 ///
 /// Sets up all OMEMO data locally and on the server.
 ///
+/// If this device has already been set up and published before (e.g., it has
+/// been loaded via load()), no new keys are generated.
+/// Its data is only published again if it changed since its last publication.
+///
 /// The user must be logged in while calling this.
 ///
 /// \return whether everything is set up successfully
@@ -408,6 +428,18 @@ QXmppTask<bool> Manager::setUp()
 {
     QXmppPromise<bool> interface;
 
+    // A device that has already been set up and published (e.g., loaded via load()) keeps its
+    // keys.
+    // Its data is only published again if it changed since its last publication.
+    if (!d->ownDevice.publishedDataHash.isEmpty() && d->restoreDeviceBundle()) {
+        auto future = d->publishOmemoData();
+        future.then(this, [=, this](bool isPublished) mutable {
+            d->isStarted = isPublished;
+            interface.finish(std::move(isPublished));
+        });
+        return interface.task();
+    }
+
     auto future = d->setUpDeviceId();
     future.then(this, [=, this](bool isDeviceIdSetUp) mutable {
         if (isDeviceIdSetUp) {
@@ -560,9 +592,124 @@ void Manager::setMaximumDevicesPerStanza(int maximum)
     d->maximumDevicesPerStanza = maximum;
 }
 
+///
+/// Returns the maximum count of JIDs whose sessions are kept in memory.
+///
+/// \return the session cache size, 0 if all sessions are kept in memory
+///
+/// \since QXmpp 1.9
+///
+int Manager::sessionCacheSize() const
+{
+    return d->sessionCacheSize;
+}
+
+///
+/// Sets the maximum count of JIDs whose sessions are kept in memory.
+///
+/// By default (0), load() loads the sessions of all devices and keeps them in
+/// memory.
+/// For accounts with many contacts, that can slow down the start and use a lot
+/// of memory.
+///
+/// If a size is set, load() only loads the other data via
+/// QXmppOmemoStorage::allDataWithoutSessions().
+/// The storage must override that method and QXmppOmemoStorage::sessions().
+/// Otherwise, all data is loaded each time.
+/// The sessions of a JID's devices are loaded via QXmppOmemoStorage::sessions()
+/// when they are first needed for encrypting or decrypting.
+/// If the sessions of more JIDs are loaded, the least recently used ones are
+/// removed from memory again.
+///
+/// This must be called before load().
+///
+/// \param size maximum count of JIDs whose sessions are kept in memory or 0 for
+///        no limit
+///
+/// \since QXmpp 1.9
+///
+void Manager::setSessionCacheSize(int size)
+{
+    d->sessionCacheSize = std::max(size, 0);
+}
+
+///
+/// Returns the maximum count of threads used for creating the OMEMO envelopes of
+/// a stanza in parallel.
+///
+/// \return the count of threads, 0 if the envelopes are created sequentially
+///
+/// \since QXmpp 1.9
+///
+int Manager::envelopeEncryptionThreadCount() const
+{
+    return d->envelopeEncryptionThreadCount;
+}
+
+///
+/// Sets the maximum count of threads used for creating the OMEMO envelopes of a
+/// stanza in parallel.
+///
+/// A stanza contains an OMEMO envelope for each recipient device.
+/// By default (0), those envelopes are created one after another while the
+/// OMEMO library is locked globally.
+/// For recipients with many devices, that increases the time until the stanza
+/// can be sent.
+///
+/// If a count is set, each envelope is created via a separate OMEMO library
+/// context that only locks the session of its device.
+/// Thus, the envelopes for multiple devices can be created in parallel.
+/// The stanza is sent once all envelopes are created.
+///
+/// \param count maximum count of threads or 0 for creating the envelopes
+///        sequentially
+///
+/// \since QXmpp 1.9
+///
+void Manager::setEnvelopeEncryptionThreadCount(int count)
+{
+    d->envelopeEncryptionThreadCount = std::max(count, 0);
+}
+
+///
+/// Returns statistics about this device's keys and the device lists.
+///
+/// The statistics contain the following entries:
+/// \li \c pre-key-pairs count of pre key pairs currently available
+/// \li \c generated-pre-key-pairs count of pre key pairs generated since the
+///     manager's construction
+/// \li \c device-bundle-publications count of publications of this device's
+///     bundle since the manager's construction
+/// \li \c device-list-requests count of requests of contacts' device lists
+///     since the manager's construction
+///
+/// \since QXmpp 1.9
+///
+QVariantMap Manager::statistics() const
+{
+    QVariantMap stats;
+    stats[u"pre-key-pairs"_s] = d->preKeyPairs.size();
+    stats[u"generated-pre-key-pairs"_s] = d->generatedPreKeyPairsCount;
+    stats[u"device-bundle-publications"_s] = d->deviceBundlePublicationsCount;
+    stats[u"device-list-requests"_s] = d->deviceListRequestsCount;
+    return stats;
+}
+
 ///
 /// Requests device lists from contacts and stores them locally.
 ///
+/// Device lists whose changes have been received via PEP notifications
+/// during the current connection are not requested again because they are up
+/// to date.
+/// That is the case for contacts with presence subscription once their device
+/// lists have been pushed and for device lists subscribed via
+/// subscribeToDeviceLists().
+///
+/// Device lists whose PubSub item and content have not changed since they
+/// were received last are not processed again.
+/// That also applies to device lists received before a restart if the
+/// storage supports QXmppOmemoStorage::addDeviceList().
+///
 /// The user must be logged in while calling this.
 /// The JID of the current user must not be passed.
 ///
@@ -587,11 +734,8 @@ QXmppTask<QVector<Manager::DevicesResult>> Manager::requestDeviceLists(const QLi
             Q_ASSERT_X(jid != d->ownBareJid(), "Requesting contact's device list", "Own JID passed");
 
             auto future = d->requestDeviceList(jid);
-            future.then(this, [jid, state](auto result) mutable {
-                state->devicesResults << DevicesResult {
-                    jid,
-                    mapSuccess(std::move(result), [](QXmppOmemoDeviceListItem) { return Success(); })
-                };
+            future.then(this, [jid, state](Result result) mutable {
+                state->devicesResults << DevicesResult { jid, std::move(result) };
 
                 if (++(state->processed) == state->jidsCount) {
                     state->interface.finish(std::move(state->devicesResults));
@@ -769,6 +913,7 @@ QXmppTask<QXmppPubSubManager::Result> Manager::removeContactDevices(const QStrin
             interface.finish(std::move(result));
         } else {
             d->devices.remove(jid);
+            d->deviceLists.remove(jid);
 
             auto future = d->omemoStorage->removeDevices(jid);
             future.then(this, [=, this]() mutable {
@@ -861,6 +1006,16 @@ QXmppTask<void> Manager::buildMissingSessions(const QList<QString> &jids)
 {
     QXmppPromise<void> interface;
 
+    // Existing sessions must be loaded in order to not replace them.
+    if (!std::all_of(jids.cbegin(), jids.cend(), [this](const auto &jid) { return d->areSessionsLoaded(jid); })) {
+        d->loadSessions(jids).then(this, [this, interface, jids]() mutable {
+            buildMissingSessions(jids).then(this, [interface]() mutable {
+                interface.finish();
+            });
+        });
+        return interface.task();
+    }
+
     auto &devices = d->devices;
     auto devicesCount = 0;
 
@@ -1062,6 +1217,34 @@ QXmppTask<QXmppE2eeExtension::MessageDecryptResult> QXmppOmemoManager::decryptMe
     });
 }
 
+QXmppTask<QVector<QXmppE2eeExtension::MessageDecryptResult>> QXmppOmemoManager::decryptMessages(QVector<QXmppMessage> &&messages)
+{
+    if (!d->isStarted) {
+        return makeReadyTask(QVector<MessageDecryptResult>(messages.size(), QXmppError { u"OMEMO manager must be started before decrypting"_s, SendError::EncryptionError }));
+    }
+
+    const auto isEncrypted = transform<QVector<bool>>(messages, [](const QXmppMessage &message) {
+        return message.omemoElement().has_value();
+    });
+
+    return chain<QVector<MessageDecryptResult>>(d->decryptMessages(std::move(messages)), this, [isEncrypted](QVector<std::optional<QXmppMessage>> &&decryptedMessages) {
+        QVector<MessageDecryptResult> results;
+        results.reserve(decryptedMessages.size());
+
+        for (qsizetype i = 0; i < decryptedMessages.size(); ++i) {
+            if (!isEncrypted.at(i)) {
+                results.append(NotEncrypted());
+            } else if (auto &message = decryptedMessages[i]) {
+                results.append(std::move(*message));
+            } else {
+                results.append(QXmppError { u"Couldn't decrypt message"_s, {} });
+            }
+        }
+
+        return results;
+    });
+}
+
 QXmppTask<QXmppE2eeExtension::IqEncryptResult> Manager::encryptIq(QXmppIq &&iq, const std::optional<QXmppSendStanzaParams> &params)
 {
     QXmppPromise<QXmppE2eeExtension::IqEncryptResult> interface;
@@ -1256,6 +1439,14 @@ void Manager::onRegistered(QXmppClient *client)
         qFatal("QXmppPubSubManager is not available, it must be added to the client before adding QXmppOmemoManager");
     }
 
+    // Store changed devices before the application is likely to quit.
+    connect(client, &QXmppClient::disconnected, this, [this]() {
+        d->storePendingDevices();
+
+        // PEP notifications can be missed while being disconnected.
+        d->jidsOfNotifiedDeviceLists.clear();
+    });
+
     connect(d->trustManager, &QXmppTrustManager::trustLevelsChanged, this, [=, this](const QHash<QString, QMultiHash<QString, QByteArray>> &modifiedKeys) {
         const auto &modifiedOmemoKeys = modifiedKeys.value(ns_omemo_2.toString());
 
@@ -1317,8 +1508,8 @@ bool Manager::handlePubSubEvent(const QDomElement &element, const QString &pubSu
                     } else {
                         d->handleIrregularDeviceListChanges(pubSubService);
                     }
-                } else {
-                    d->updateContactDevices(pubSubService, items);
+                } else if (d->updateContactDevices(pubSubService, items)) {
+                    d->jidsOfNotifiedDeviceLists.insert(pubSubService);
                 }
             }
 
@@ -12,6 +12,8 @@
 #include "QXmppTrustSecurityPolicy.h"
 #include "qxmppomemo_export.h"
 
+#include <QVariantMap>
+
 class QXmppOmemoDevicePrivate;
 class QXmppOmemoManagerPrivate;
 class QXmppOmemoOwnDevicePrivate;
@@ -95,6 +97,14 @@ public:
     int maximumDevicesPerStanza() const;
     void setMaximumDevicesPerStanza(int maximum);
 
+    int sessionCacheSize() const;
+    void setSessionCacheSize(int size);
+
+    int envelopeEncryptionThreadCount() const;
+    void setEnvelopeEncryptionThreadCount(int count);
+
+    QVariantMap statistics() const;
+
     QXmppTask<QVector<DevicesResult>> requestDeviceLists(const QList<QString> &jids);
     QXmppTask<QVector<DevicesResult>> subscribeToDeviceLists(const QList<QString> &jids);
     QXmppTask<QVector<DevicesResult>> unsubscribeFromDeviceLists();
@@ -125,6 +135,7 @@ public:
     /// \cond
     QXmppTask<MessageEncryptResult> encryptMessage(QXmppMessage &&message, const std::optional<QXmppSendStanzaParams> &params) override;
     QXmppTask<MessageDecryptResult> decryptMessage(QXmppMessage &&message) override;
+    QXmppTask<QVector<MessageDecryptResult>> decryptMessages(QVector<QXmppMessage> &&messages) override;
 
     QXmppTask<IqEncryptResult> encryptIq(QXmppIq &&iq, const std::optional<QXmppSendStanzaParams> &params) override;
     QXmppTask<IqDecryptResult> decryptIq(const QDomElement &element) override;
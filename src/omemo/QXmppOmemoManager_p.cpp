@@ -25,6 +25,10 @@
 
 #include <protocol.h>
 
+#include <algorithm>
+#include <atomic>
+
+#include <QCryptographicHash>
 #include <QRandomGenerator>
 
 #undef max
@@ -180,12 +184,245 @@ static void replaceChildElements(QDomElement &oldElement, const QDomElement &new
     }
 }
 
+//
+// Encrypts the payload decryption data for a device via its session.
+//
+// \param storeContext store context providing the device's session
+// \param context OMEMO library context used for the encryption
+// \param address address of the device
+// \param payloadDecryptionData data needed to decrypt the payload
+//
+// \return the encrypted and serialized OMEMO envelope data or an error on failure
+//
+static std::variant<QByteArray, QXmppError> encryptPayloadDecryptionData(signal_protocol_store_context *storeContext, signal_context *context, const signal_protocol_address &address, const QCA::SecureArray &payloadDecryptionData)
+{
+    SessionCipherPtr sessionCipher;
+
+    if (session_cipher_create(sessionCipher.ptrRef(), storeContext, &address, context) < 0) {
+        return QXmppError { u"Session cipher could not be created"_s, {} };
+    }
+
+    session_cipher_set_version(sessionCipher.get(), CIPHERTEXT_OMEMO_VERSION);
+
+    RefCountedPtr<ciphertext_message> encryptedOmemoEnvelopeData;
+    if (session_cipher_encrypt(sessionCipher.get(), reinterpret_cast<const uint8_t *>(payloadDecryptionData.constData()), payloadDecryptionData.size(), encryptedOmemoEnvelopeData.ptrRef()) != SG_SUCCESS) {
+        return QXmppError { u"Payload decryption data could not be encrypted"_s, {} };
+    }
+
+    signal_buffer *serializedEncryptedOmemoEnvelopeData = ciphertext_message_get_serialized(encryptedOmemoEnvelopeData.get());
+
+    return QByteArray {
+        reinterpret_cast<const char *>(signal_buffer_data(serializedEncryptedOmemoEnvelopeData)),
+        int(signal_buffer_len(serializedEncryptedOmemoEnvelopeData))
+    };
+}
+
+//
+// Session of a single device used by an OMEMO library context of its own.
+//
+// The context only locks the session's own mutex instead of the manager's global one.
+// That way, OMEMO envelopes for multiple devices can be created in parallel.
+//
+struct IsolatedSession {
+    QString jid;
+    uint32_t deviceId = 0;
+    QByteArray session;
+    bool isSessionModified = false;
+    QRecursiveMutex mutex;
+};
+
+//
+// Creates a session store that only provides the session of an isolated session.
+//
+// \param isolatedSession session being provided
+//
+// \return the session store
+//
+static signal_protocol_session_store createIsolatedSessionStore(IsolatedSession *isolatedSession)
+{
+    signal_protocol_session_store store;
+
+    store.load_session_func = [](signal_buffer **record, signal_buffer **, const signal_protocol_address *address, void *user_data) {
+        const auto *isolatedSession = reinterpret_cast<IsolatedSession *>(user_data);
+        const auto &session = isolatedSession->session;
+
+        if (session.isEmpty() || uint32_t(address->device_id) != isolatedSession->deviceId) {
+            return 0;
+        }
+
+        if (!(*record = signal_buffer_create(reinterpret_cast<const uint8_t *>(session.constData()), size_t(session.size())))) {
+            return -1;
+        }
+
+        return 1;
+    };
+
+    store.get_sub_device_sessions_func = [](signal_int_list **sessions, const char *, size_t, void *) {
+        *sessions = signal_int_list_alloc();
+        return 0;
+    };
+
+    store.store_session_func = [](const signal_protocol_address *, uint8_t *record, size_t record_len, uint8_t *, size_t, void *user_data) {
+        auto *isolatedSession = reinterpret_cast<IsolatedSession *>(user_data);
+        isolatedSession->session = QByteArray(reinterpret_cast<const char *>(record), record_len);
+        isolatedSession->isSessionModified = true;
+        return 0;
+    };
+
+    store.contains_session_func = [](const signal_protocol_address *, void *user_data) {
+        const auto *isolatedSession = reinterpret_cast<IsolatedSession *>(user_data);
+        return isolatedSession->session.isEmpty() ? 0 : 1;
+    };
+
+    store.delete_session_func = [](const signal_protocol_address *, void *user_data) {
+        auto *isolatedSession = reinterpret_cast<IsolatedSession *>(user_data);
+        isolatedSession->session.clear();
+        isolatedSession->isSessionModified = true;
+        return 1;
+    };
+
+    store.delete_all_sessions_func = [](const char *, size_t, void *user_data) {
+        auto *isolatedSession = reinterpret_cast<IsolatedSession *>(user_data);
+        if (isolatedSession->session.isEmpty()) {
+            return 0;
+        }
+        isolatedSession->session.clear();
+        isolatedSession->isSessionModified = true;
+        return 1;
+    };
+
+    store.destroy_func = [](void *) {
+    };
+
+    store.user_data = isolatedSession;
+
+    return store;
+}
+
+//
+// Own identity used by OMEMO library contexts of their own.
+//
+// It is a copy of the own device's identity so that it can be used by worker threads without
+// accessing the manager.
+//
+struct IsolatedIdentity {
+    uint32_t deviceId = 0;
+    QByteArray privateIdentityKey;
+    QByteArray publicIdentityKey;
+};
+
+//
+// Creates an identity key store that only provides an isolated identity.
+//
+// In contrast to the manager's identity key store, it does not log anything.
+// Thus, it can be used by worker threads.
+//
+// \param isolatedIdentity identity being provided
+//
+// \return the identity key store
+//
+static signal_protocol_identity_key_store createIsolatedIdentityKeyStore(const IsolatedIdentity *isolatedIdentity)
+{
+    signal_protocol_identity_key_store store;
+
+    store.get_identity_key_pair = [](signal_buffer **public_data, signal_buffer **private_data, void *user_data) {
+        const auto *isolatedIdentity = reinterpret_cast<const IsolatedIdentity *>(user_data);
+
+        const auto &privateIdentityKey = isolatedIdentity->privateIdentityKey;
+        if (!(*private_data = signal_buffer_create(reinterpret_cast<const uint8_t *>(privateIdentityKey.constData()), privateIdentityKey.size()))) {
+            return -1;
+        }
+
+        const auto &publicIdentityKey = isolatedIdentity->publicIdentityKey;
+        if (!(*public_data = signal_buffer_create(reinterpret_cast<const uint8_t *>(publicIdentityKey.constData()), publicIdentityKey.size()))) {
+            return -1;
+        }
+
+        return 0;
+    };
+
+    store.get_local_registration_id = [](void *user_data, uint32_t *registration_id) {
+        *registration_id = reinterpret_cast<const IsolatedIdentity *>(user_data)->deviceId;
+        return 0;
+    };
+
+    store.save_identity = [](const signal_protocol_address *, uint8_t *, size_t, void *) {
+        // Do not use the OMEMO library's trust management.
+        return 0;
+    };
+
+    store.is_trusted_identity = [](const signal_protocol_address *, uint8_t *, size_t, void *) {
+        // Do not use the OMEMO library's trust management.
+        return 1;
+    };
+
+    store.destroy_func = [](void *) {
+    };
+
+    store.user_data = const_cast<IsolatedIdentity *>(isolatedIdentity);
+
+    return store;
+}
+
+//
+// Creates the OMEMO envelope data for an isolated session.
+//
+// This is thread-safe since only the passed data is used.
+// The crypto provider only logs on the manager's thread.
+//
+// \param isolatedSession session used for the encryption
+// \param isolatedIdentity own identity used for the encryption
+// \param cryptoProvider crypto provider of the manager
+// \param payloadDecryptionData data needed to decrypt the payload
+//
+// \return the encrypted and serialized OMEMO envelope data or an error on failure
+//
+static std::variant<QByteArray, QXmppError> createIsolatedOmemoEnvelopeData(IsolatedSession &isolatedSession,
+                                                                            const IsolatedIdentity &isolatedIdentity,
+                                                                            const signal_crypto_provider &cryptoProvider,
+                                                                            const QCA::SecureArray &payloadDecryptionData)
+{
+    OmemoContextPtr context;
+    if (signal_context_create(context.ptrRef(), &isolatedSession) < 0) {
+        return QXmppError { u"Signal context could not be created"_s, {} };
+    }
+
+    const auto lock = [](void *user_data) {
+        reinterpret_cast<IsolatedSession *>(user_data)->mutex.lock();
+    };
+
+    const auto unlock = [](void *user_data) {
+        reinterpret_cast<IsolatedSession *>(user_data)->mutex.unlock();
+    };
+
+    if (signal_context_set_locking_functions(context.get(), lock, unlock) < 0 ||
+        signal_context_set_crypto_provider(context.get(), &cryptoProvider) < 0) {
+        return QXmppError { u"Signal context could not be initialized"_s, {} };
+    }
+
+    const auto sessionStore = createIsolatedSessionStore(&isolatedSession);
+    const auto identityKeyStore = createIsolatedIdentityKeyStore(&isolatedIdentity);
+
+    StoreContextPtr storeContext;
+    if (signal_protocol_store_context_create(storeContext.ptrRef(), context.get()) < 0) {
+        return QXmppError { u"Store context could not be created"_s, {} };
+    }
+    signal_protocol_store_context_set_identity_key_store(storeContext.get(), &identityKeyStore);
+    signal_protocol_store_context_set_session_store(storeContext.get(), &sessionStore);
+
+    const auto address = Address(isolatedSession.jid, isolatedSession.deviceId);
+    return encryptPayloadDecryptionData(storeContext.get(), context.get(), address.data(), payloadDecryptionData);
+}
+
 QXmppOmemoManagerPrivate::QXmppOmemoManagerPrivate(Manager *parent, QXmppOmemoStorage *omemoStorage)
     : q(parent),
       omemoStorage(omemoStorage),
       signedPreKeyPairsRenewalTimer(parent),
-      deviceRemovalTimer(parent)
+      deviceRemovalTimer(parent),
+      deviceStorageTimer(parent),
+      deviceBundlePublicationTimer(parent)
 {
+    preKeyPairsGenerationThreadPool.setMaxThreadCount(1);
 }
 
 //
@@ -448,12 +685,7 @@ signal_protocol_pre_key_store ManagerPrivate::createPreKeyStore() const
 
     store.remove_pre_key = [](uint32_t pre_key_id, void *user_data) {
         auto *manager = reinterpret_cast<Manager *>(user_data);
-        auto *d = manager->d.get();
-
-        if (!d->renewPreKeyPairs(pre_key_id)) {
-            return -1;
-        }
-
+        manager->d->removePreKeyPair(pre_key_id);
         return 0;
     };
 
@@ -531,9 +763,8 @@ signal_protocol_session_store ManagerPrivate::createSessionStore() const
         const auto jid = extractJid(*address);
         const auto deviceId = int(address->device_id);
 
-        auto &device = d->devices[jid][deviceId];
-        device.session = session;
-        d->omemoStorage->addDevice(jid, deviceId, device);
+        d->devices[jid][deviceId].session = session;
+        d->storeDeviceLater(jid, deviceId);
         return 0;
     };
 
@@ -552,7 +783,7 @@ signal_protocol_session_store ManagerPrivate::createSessionStore() const
         auto &device = d->devices[jid][deviceId];
         if (!device.session.isEmpty()) {
             device.session.clear();
-            d->omemoStorage->addDevice(jid, deviceId, device);
+            d->storeDeviceLater(jid, deviceId);
         }
         return 1;
     };
@@ -568,7 +799,7 @@ signal_protocol_session_store ManagerPrivate::createSessionStore() const
             auto &device = itr.value();
             if (!device.session.isEmpty()) {
                 device.session.clear();
-                d->omemoStorage->addDevice(jid, deviceId, device);
+                d->storeDeviceLater(jid, deviceId);
                 ++deletedSessionsCount;
             }
         }
@@ -705,6 +936,17 @@ void ManagerPrivate::schedulePeriodicTasks()
         removeDevicesRemovedFromServer();
     });
 
+    deviceStorageTimer.setSingleShot(true);
+    deviceStorageTimer.setInterval(DEVICE_STORAGE_DELAY);
+    QObject::connect(&deviceStorageTimer, &QTimer::timeout, q, [this]() mutable {
+        storePendingDevices();
+    });
+
+    deviceBundlePublicationTimer.setSingleShot(true);
+    QObject::connect(&deviceBundlePublicationTimer, &QTimer::timeout, q, [this]() mutable {
+        publishDeviceBundleNow();
+    });
+
     signedPreKeyPairsRenewalTimer.start(SIGNED_PRE_KEY_RENEWAL_CHECK_INTERVAL);
     deviceRemovalTimer.start(DEVICE_REMOVAL_CHECK_INTERVAL);
 }
@@ -799,12 +1041,7 @@ bool ManagerPrivate::updateSignedPreKeyPair(ratchet_identity_key_pair *identityK
     signedPreKeyPairs.insert(latestSignedPreKeyId, signedPreKeyPairForStorage);
     omemoStorage->addSignedPreKeyPair(latestSignedPreKeyId, signedPreKeyPairForStorage);
 
-    BufferPtr signedPublicPreKeyBuffer(ec_public_key_get_mont(ec_key_pair_get_public(session_signed_pre_key_get_key_pair(signedPreKeyPair.get()))));
-    const auto signedPublicPreKeyByteArray = signedPublicPreKeyBuffer.toByteArray();
-
-    deviceBundle.setSignedPublicPreKeyId(latestSignedPreKeyId);
-    deviceBundle.setSignedPublicPreKey(signedPublicPreKeyByteArray);
-    deviceBundle.setSignedPublicPreKeySignature(QByteArray(reinterpret_cast<const char *>(session_signed_pre_key_get_signature_omemo(signedPreKeyPair.get())), session_signed_pre_key_get_signature_omemo_len(signedPreKeyPair.get())));
+    setDeviceBundleSignedPublicPreKey(latestSignedPreKeyId, signedPreKeyPair.get());
 
     ownDevice.latestSignedPreKeyId = latestSignedPreKeyId;
 
@@ -812,34 +1049,167 @@ bool ManagerPrivate::updateSignedPreKeyPair(ratchet_identity_key_pair *identityK
 }
 
 //
-// Deletes a pre key pair and creates a new one.
+// Sets the public part of a signed pre key pair in this device's bundle.
+//
+// \param signedPreKeyId ID of the signed pre key pair
+// \param signedPreKeyPair signed pre key pair whose public part is set
+//
+void ManagerPrivate::setDeviceBundleSignedPublicPreKey(uint32_t signedPreKeyId, session_signed_pre_key *signedPreKeyPair)
+{
+    BufferPtr signedPublicPreKeyBuffer(ec_public_key_get_mont(ec_key_pair_get_public(session_signed_pre_key_get_key_pair(signedPreKeyPair))));
+    const auto signedPublicPreKeyByteArray = signedPublicPreKeyBuffer.toByteArray();
+
+    deviceBundle.setSignedPublicPreKeyId(signedPreKeyId);
+    deviceBundle.setSignedPublicPreKey(signedPublicPreKeyByteArray);
+    deviceBundle.setSignedPublicPreKeySignature(QByteArray(reinterpret_cast<const char *>(session_signed_pre_key_get_signature_omemo(signedPreKeyPair)), session_signed_pre_key_get_signature_omemo_len(signedPreKeyPair)));
+}
+
 //
-// \param keyPairBeingRenewed key pair being replaced by a new one
+// Restores this device's bundle from the loaded keys instead of generating new
+// ones.
 //
 // \return whether it succeeded
 //
-bool ManagerPrivate::renewPreKeyPairs(uint32_t keyPairBeingRenewed)
+bool ManagerPrivate::restoreDeviceBundle()
 {
-    preKeyPairs.remove(keyPairBeingRenewed);
-    omemoStorage->removePreKeyPair(keyPairBeingRenewed);
-    deviceBundle.removePublicPreKey(keyPairBeingRenewed);
+    deviceBundle = QXmppOmemoDeviceBundle();
+    deviceBundle.setPublicIdentityKey(ownDevice.publicIdentityKey);
+
+    const auto signedPreKeyPairData = signedPreKeyPairs.value(ownDevice.latestSignedPreKeyId).data;
+    RefCountedPtr<session_signed_pre_key> signedPreKeyPair;
 
-    if (!updatePreKeyPairs()) {
+    if (session_signed_pre_key_deserialize(signedPreKeyPair.ptrRef(), reinterpret_cast<const uint8_t *>(signedPreKeyPairData.constData()), signedPreKeyPairData.size(), globalContext.get()) < 0) {
+        warning(u"Signed pre key pair could not be deserialized"_s);
         return false;
     }
 
-    // Store the own device containing the new pre key ID.
-    omemoStorage->setOwnDevice(ownDevice);
+    setDeviceBundleSignedPublicPreKey(ownDevice.latestSignedPreKeyId, signedPreKeyPair.get());
 
-    publishDeviceBundleItem([this](bool isPublished) {
-        if (!isPublished) {
-            warning(u"Own device bundle item could not be published during renewal of pre key pairs"_s);
+    for (auto itr = preKeyPairs.cbegin(); itr != preKeyPairs.cend(); ++itr) {
+        RefCountedPtr<session_pre_key> preKeyPair;
+
+        if (session_pre_key_deserialize(preKeyPair.ptrRef(), reinterpret_cast<const uint8_t *>(itr->constData()), itr->size(), globalContext.get()) < 0) {
+            warning(u"Pre key pair could not be deserialized"_s);
+            return false;
         }
-    });
+
+        BufferPtr publicPreKeyBuffer(ec_public_key_get_mont(ec_key_pair_get_public(session_pre_key_get_key_pair(preKeyPair.get()))));
+        deviceBundle.addPublicPreKey(itr.key(), publicPreKeyBuffer.toByteArray());
+    }
 
     return true;
 }
 
+//
+// Generates pre key pairs.
+//
+// This is thread-safe as long as the context is not modified meanwhile.
+//
+// \param context OMEMO library context used for the generation
+// \param firstPreKeyId ID of the first pre key pair
+// \param count number of pre key pairs to generate
+//
+// \return the generated pre key pairs or an error on failure
+//
+static std::variant<GeneratedPreKeyPairs, QXmppError> generatePreKeyPairs(signal_context *context, uint32_t firstPreKeyId, uint32_t count)
+{
+    KeyListNodePtr newPreKeyPairs;
+
+    if (signal_protocol_key_helper_generate_pre_keys(newPreKeyPairs.ptrRef(), firstPreKeyId, count, context) < 0) {
+        return QXmppError { u"Pre key pairs could not be generated"_s, {} };
+    }
+
+    GeneratedPreKeyPairs generatedPreKeyPairs;
+
+    for (auto *node = newPreKeyPairs.get();
+         node != nullptr;
+         node = signal_protocol_key_helper_key_list_next(node)) {
+        BufferSecurePtr preKeyPairBuffer;
+
+        auto preKeyPair = signal_protocol_key_helper_key_list_element(node);
+
+        if (session_pre_key_serialize(preKeyPairBuffer.ptrRef(), preKeyPair) < 0) {
+            return QXmppError { u"Pre key pair could not be serialized"_s, {} };
+        }
+
+        const auto preKeyId = session_pre_key_get_id(preKeyPair);
+
+        generatedPreKeyPairs.preKeyPairs.insert(preKeyId, preKeyPairBuffer.toByteArray());
+
+        BufferPtr publicPreKeyBuffer(ec_public_key_get_mont(ec_key_pair_get_public(session_pre_key_get_key_pair(preKeyPair))));
+        generatedPreKeyPairs.publicPreKeys.insert(preKeyId, publicPreKeyBuffer.toByteArray());
+    }
+
+    return generatedPreKeyPairs;
+}
+
+//
+// Generates pre key pairs on a worker thread.
+//
+// The global context of the manager is not used because the OMEMO library does not
+// support using a context by multiple threads at the same time.
+// Instead, a new context is created with the manager's crypto provider.
+//
+// \param cryptoProvider crypto provider of the manager
+// \param firstPreKeyId ID of the first pre key pair being generated
+// \param count number of pre key pairs being generated
+//
+// \return the generated pre key pairs or an error on failure
+//
+static std::variant<GeneratedPreKeyPairs, QXmppError> generatePreKeyPairsInWorker(const signal_crypto_provider &cryptoProvider, uint32_t firstPreKeyId, uint32_t count)
+{
+    OmemoContextPtr context;
+    if (signal_context_create(context.ptrRef(), nullptr) < 0) {
+        return QXmppError { u"Signal context could not be created"_s, {} };
+    }
+
+    if (signal_context_set_crypto_provider(context.get(), &cryptoProvider) < 0) {
+        return QXmppError { u"Signal context could not be initialized"_s, {} };
+    }
+
+    return generatePreKeyPairs(context.get(), firstPreKeyId, count);
+}
+
+//
+// Deletes a pre key pair after it has been used for building a session.
+//
+// New pre key pairs are generated in the background once fewer than
+// PRE_KEY_LOW_WATER_MARK are left.
+// The device bundle is published soon so that other devices do not use the consumed pre key
+// anymore.
+//
+// \param preKeyId ID of the pre key pair being removed
+//
+void ManagerPrivate::removePreKeyPair(uint32_t preKeyId)
+{
+    preKeyPairs.remove(preKeyId);
+    omemoStorage->removePreKeyPair(preKeyId);
+    deviceBundle.removePublicPreKey(preKeyId);
+
+    replenishPreKeyPairs();
+    publishDeviceBundleSoon();
+}
+
+//
+// Returns the ID of the first pre key pair being generated next.
+//
+// \param count number of pre key pairs being generated
+//
+uint32_t ManagerPrivate::nextPreKeyId(uint32_t count) const
+{
+    auto latestPreKeyId = ownDevice.latestPreKeyId;
+
+    // Ensure that no pre key ID exceeds PRE_KEY_ID_MAX.
+    // Do not increment during setup.
+    if (latestPreKeyId + count > PRE_KEY_ID_MAX) {
+        latestPreKeyId = PRE_KEY_ID_MIN;
+    } else if (latestPreKeyId != PRE_KEY_ID_MIN) {
+        ++latestPreKeyId;
+    }
+
+    return latestPreKeyId;
+}
+
 //
 // Updates the pre key pairs locally.
 //
@@ -860,50 +1230,147 @@ bool ManagerPrivate::renewPreKeyPairs(uint32_t keyPairBeingRenewed)
 //
 bool ManagerPrivate::updatePreKeyPairs(uint32_t count)
 {
-    KeyListNodePtr newPreKeyPairs;
-    auto latestPreKeyId = ownDevice.latestPreKeyId;
+    const auto firstPreKeyId = nextPreKeyId(count);
+    auto result = generatePreKeyPairs(globalContext.get(), firstPreKeyId, count);
 
-    // Ensure that no pre key ID exceeds PRE_KEY_ID_MAX.
-    // Do not increment during setup.
-    if (latestPreKeyId + count > PRE_KEY_ID_MAX) {
-        latestPreKeyId = PRE_KEY_ID_MIN;
-    } else if (latestPreKeyId != PRE_KEY_ID_MIN) {
-        ++latestPreKeyId;
+    if (const auto *error = std::get_if<QXmppError>(&result)) {
+        warning(error->description);
+        return false;
     }
 
-    if (signal_protocol_key_helper_generate_pre_keys(newPreKeyPairs.ptrRef(), latestPreKeyId, count, globalContext.get()) < 0) {
-        warning(u"Pre key pairs could not be generated"_s);
-        return false;
+    addPreKeyPairs(std::get<GeneratedPreKeyPairs>(std::move(result)), firstPreKeyId, count);
+    return true;
+}
+
+//
+// Adds generated pre key pairs to the stored ones and to the device bundle.
+//
+// \param generatedPreKeyPairs pre key pairs being added
+// \param firstPreKeyId ID of the first generated pre key pair
+// \param count number of generated pre key pairs
+//
+void ManagerPrivate::addPreKeyPairs(GeneratedPreKeyPairs &&generatedPreKeyPairs, uint32_t firstPreKeyId, uint32_t count)
+{
+    for (auto itr = generatedPreKeyPairs.publicPreKeys.cbegin(); itr != generatedPreKeyPairs.publicPreKeys.cend(); ++itr) {
+        deviceBundle.addPublicPreKey(itr.key(), itr.value());
     }
 
-    QHash<uint32_t, QByteArray> serializedPreKeyPairs;
+    preKeyPairs.insert(generatedPreKeyPairs.preKeyPairs);
+    omemoStorage->addPreKeyPairs(generatedPreKeyPairs.preKeyPairs);
+    ownDevice.latestPreKeyId = firstPreKeyId - 1 + count;
+    generatedPreKeyPairsCount += int(count);
+}
 
-    for (auto *node = newPreKeyPairs.get();
-         node != nullptr;
-         node = signal_protocol_key_helper_key_list_next(node)) {
-        BufferSecurePtr preKeyPairBuffer;
+//
+// Generates new pre key pairs on a worker thread if fewer than
+// PRE_KEY_LOW_WATER_MARK are left.
+//
+// The pre key pairs are generated ahead of their use so that building new
+// sessions does not wait for the generation.
+// Their count is bounded by PRE_KEY_INITIAL_CREATION_COUNT to limit the size of
+// the device bundle.
+//
+void ManagerPrivate::replenishPreKeyPairs()
+{
+    if (isPreKeyPairsGenerationRunning || preKeyPairs.size() >= PRE_KEY_LOW_WATER_MARK) {
+        return;
+    }
 
-        auto preKeyPair = signal_protocol_key_helper_key_list_element(node);
+    const auto count = PRE_KEY_INITIAL_CREATION_COUNT - uint32_t(preKeyPairs.size());
+    const auto firstPreKeyId = nextPreKeyId(count);
+    isPreKeyPairsGenerationRunning = true;
 
-        if (session_pre_key_serialize(preKeyPairBuffer.ptrRef(), preKeyPair) < 0) {
-            warning(u"Pre key pair could not be serialized"_s);
-            return false;
-        }
+    preKeyPairsGenerationThreadPool.start([this, manager = q, cryptoProvider = cryptoProvider, firstPreKeyId, count, generation = preKeyPairsGeneration]() {
+        auto result = generatePreKeyPairsInWorker(cryptoProvider, firstPreKeyId, count);
 
-        const auto preKeyId = session_pre_key_get_id(preKeyPair);
+        QMetaObject::invokeMethod(
+            manager, [this, result = std::move(result), firstPreKeyId, count, generation]() mutable {
+                // The own device has been reset meanwhile.
+                if (generation != preKeyPairsGeneration) {
+                    return;
+                }
 
-        serializedPreKeyPairs.insert(preKeyId, preKeyPairBuffer.toByteArray());
+                isPreKeyPairsGenerationRunning = false;
 
-        BufferPtr publicPreKeyBuffer(ec_public_key_get_mont(ec_key_pair_get_public(session_pre_key_get_key_pair(preKeyPair))));
-        const auto serializedPublicPreKey = publicPreKeyBuffer.toByteArray();
-        deviceBundle.addPublicPreKey(preKeyId, serializedPublicPreKey);
+                if (const auto *error = std::get_if<QXmppError>(&result)) {
+                    warning(error->description);
+                    return;
+                }
+
+                addPreKeyPairs(std::get<GeneratedPreKeyPairs>(std::move(result)), firstPreKeyId, count);
+
+                // Store the own device containing the new pre key ID.
+                omemoStorage->setOwnDevice(ownDevice);
+
+                publishDeviceBundleLater();
+
+                // Pre key pairs could have been used during the generation.
+                replenishPreKeyPairs();
+            },
+            Qt::QueuedConnection);
+    });
+}
+
+//
+// Publishes the own device bundle once DEVICE_BUNDLE_PUBLICATION_DELAY has
+// passed.
+//
+// Multiple changes of the device bundle during that time are published
+// together.
+//
+void ManagerPrivate::publishDeviceBundleLater()
+{
+    if (!deviceBundlePublicationTimer.isActive()) {
+        deviceBundlePublicationTimer.start(DEVICE_BUNDLE_PUBLICATION_DELAY);
     }
+}
 
-    preKeyPairs.insert(serializedPreKeyPairs);
-    omemoStorage->addPreKeyPairs(serializedPreKeyPairs);
-    ownDevice.latestPreKeyId = latestPreKeyId - 1 + count;
+//
+// Publishes the own device bundle once CONSUMED_PRE_KEYS_PUBLICATION_DELAY has
+// passed.
+//
+// That is used after pre keys have been consumed.
+// Multiple pre keys consumed during that time (e.g., by building sessions for
+// several messages at once) are removed from the published device bundle
+// together.
+// A publication scheduled by publishDeviceBundleLater() is brought forward.
+//
+void ManagerPrivate::publishDeviceBundleSoon()
+{
+    if (!deviceBundlePublicationTimer.isActive() || deviceBundlePublicationTimer.remainingTimeAsDuration() > CONSUMED_PRE_KEYS_PUBLICATION_DELAY) {
+        deviceBundlePublicationTimer.start(CONSUMED_PRE_KEYS_PUBLICATION_DELAY);
+    }
+}
 
-    return true;
+//
+// Publishes the own device bundle right away.
+//
+// If a publication is already running, the device bundle is published again once
+// it is finished.
+// Thus, multiple changes during a publication are published together.
+//
+void ManagerPrivate::publishDeviceBundleNow()
+{
+    deviceBundlePublicationTimer.stop();
+
+    if (isDeviceBundlePublicationRunning) {
+        isDeviceBundlePublicationPending = true;
+        return;
+    }
+
+    isDeviceBundlePublicationRunning = true;
+    publishDeviceBundleItem([this](bool isPublished) {
+        isDeviceBundlePublicationRunning = false;
+
+        if (!isPublished) {
+            warning(u"Own device bundle item could not be published after changing pre key pairs"_s);
+        }
+
+        if (isDeviceBundlePublicationPending) {
+            isDeviceBundlePublicationPending = false;
+            publishDeviceBundleNow();
+        }
+    });
 }
 
 //
@@ -938,6 +1405,200 @@ void ManagerPrivate::removeDevicesRemovedFromServer()
     }
 }
 
+//
+// Marks a device as changed so that it is stored with other changed devices
+// after DEVICE_STORAGE_DELAY.
+//
+// That avoids a storage call per device and message when counters or sessions
+// of many devices are updated at once (e.g., encrypting for a group chat).
+//
+void ManagerPrivate::storeDeviceLater(const QString &jid, uint32_t deviceId)
+{
+    devicesToBeStored[jid].insert(deviceId);
+
+    if (!deviceStorageTimer.isActive()) {
+        deviceStorageTimer.start();
+    }
+}
+
+//
+// Stores all devices marked via storeDeviceLater() in one batch.
+//
+// Devices removed in the meantime are skipped.
+//
+QXmppTask<void> ManagerPrivate::storePendingDevices()
+{
+    deviceStorageTimer.stop();
+
+    QHash<QString, QHash<uint32_t, QXmppOmemoStorage::Device>> changedDevices;
+    for (auto itr = devicesToBeStored.cbegin(); itr != devicesToBeStored.cend(); ++itr) {
+        const auto userDevices = devices.constFind(itr.key());
+        if (userDevices == devices.cend()) {
+            continue;
+        }
+
+        for (const auto deviceId : itr.value()) {
+            if (const auto device = userDevices->constFind(deviceId); device != userDevices->cend()) {
+                changedDevices[itr.key()].insert(deviceId, *device);
+            }
+        }
+    }
+    devicesToBeStored.clear();
+
+    if (changedDevices.isEmpty()) {
+        return makeReadyTask();
+    }
+    return omemoStorage->addDevices(changedDevices);
+}
+
+//
+// Stores a device immediately.
+//
+// If the sessions of the device owner are not loaded, they are loaded first.
+// Otherwise, the stored session would be overwritten by an empty one.
+//
+QXmppTask<void> ManagerPrivate::storeDevice(const QString &jid, uint32_t deviceId)
+{
+    if (areSessionsLoaded(jid)) {
+        return omemoStorage->addDevice(jid, deviceId, devices.value(jid).value(deviceId));
+    }
+
+    QXmppPromise<void> interface;
+
+    loadSessions({ jid }).then(q, [this, interface, jid, deviceId]() mutable {
+        const auto userDevices = devices.constFind(jid);
+        if (userDevices == devices.cend() || !userDevices->contains(deviceId)) {
+            interface.finish();
+            return;
+        }
+
+        omemoStorage->addDevice(jid, deviceId, userDevices->value(deviceId)).then(q, [interface]() mutable {
+            interface.finish();
+        });
+    });
+
+    return interface.task();
+}
+
+//
+// Returns whether the sessions of the devices of a JID are in memory.
+//
+bool ManagerPrivate::areSessionsLoaded(const QString &jid) const
+{
+    return !areSessionsLoadedOnDemand || sessionsLastUsed.contains(jid);
+}
+
+//
+// Loads the sessions of the devices of the given JIDs if they are not loaded
+// yet and marks them as used.
+//
+// Concurrent requests for the same JID are served by one storage call.
+// Sessions created in the meantime are kept because they are newer than the
+// stored ones.
+//
+QXmppTask<void> ManagerPrivate::loadSessions(const QList<QString> &jids)
+{
+    QXmppPromise<void> interface;
+
+    if (!areSessionsLoadedOnDemand) {
+        interface.finish();
+        return interface.task();
+    }
+
+    const auto currentTime = sessionUsageTimer.elapsed();
+    QList<QString> jidsToBeLoaded;
+
+    for (const auto &jid : jids) {
+        if (auto lastUsed = sessionsLastUsed.find(jid); lastUsed != sessionsLastUsed.end()) {
+            *lastUsed = currentTime;
+        } else if (!jidsToBeLoaded.contains(jid)) {
+            jidsToBeLoaded.append(jid);
+        }
+    }
+
+    if (jidsToBeLoaded.isEmpty()) {
+        interface.finish();
+        return interface.task();
+    }
+
+    auto remainingJidsCount = std::make_shared<qsizetype>(jidsToBeLoaded.size());
+
+    for (const auto &jid : std::as_const(jidsToBeLoaded)) {
+        QXmppPromise<void> request;
+        request.task().then(q, [interface, remainingJidsCount]() mutable {
+            if (--(*remainingJidsCount) == 0) {
+                interface.finish();
+            }
+        });
+
+        auto &requests = sessionLoadingRequests[jid];
+        requests.append(request);
+
+        if (requests.size() == 1) {
+            omemoStorage->sessions(jid).then(q, [this, jid](QHash<uint32_t, QByteArray> &&sessions) {
+                if (auto userDevices = devices.find(jid); userDevices != devices.end()) {
+                    for (auto itr = sessions.cbegin(); itr != sessions.cend(); ++itr) {
+                        if (auto device = userDevices->find(itr.key()); device != userDevices->end() && device->session.isEmpty()) {
+                            device->session = itr.value();
+                        }
+                    }
+                }
+
+                sessionsLastUsed.insert(jid, sessionUsageTimer.elapsed());
+
+                const auto requests = sessionLoadingRequests.take(jid);
+                for (auto request : requests) {
+                    request.finish();
+                }
+
+                evictSessions();
+            });
+        }
+    }
+
+    return interface.task();
+}
+
+//
+// Removes the least recently used sessions from memory if the sessions of more
+// JIDs than the session cache size are loaded.
+//
+// Sessions used during the last SESSION_EVICTION_GRACE_PERIOD and sessions
+// with changes not stored yet are kept.
+//
+void ManagerPrivate::evictSessions()
+{
+    if (!areSessionsLoadedOnDemand || sessionsLastUsed.size() <= sessionCacheSize) {
+        return;
+    }
+
+    std::vector<std::pair<qint64, QString>> usage;
+    usage.reserve(sessionsLastUsed.size());
+    for (auto itr = sessionsLastUsed.cbegin(); itr != sessionsLastUsed.cend(); ++itr) {
+        usage.emplace_back(itr.value(), itr.key());
+    }
+    std::sort(usage.begin(), usage.end());
+
+    const auto evictableUsage = sessionUsageTimer.elapsed() - std::chrono::milliseconds(SESSION_EVICTION_GRACE_PERIOD).count();
+
+    for (const auto &[lastUsed, jid] : usage) {
+        if (sessionsLastUsed.size() <= sessionCacheSize || lastUsed > evictableUsage) {
+            break;
+        }
+
+        if (devicesToBeStored.contains(jid)) {
+            continue;
+        }
+
+        if (auto userDevices = devices.find(jid); userDevices != devices.end()) {
+            for (auto &device : *userDevices) {
+                device.session.clear();
+            }
+        }
+        sessionsLastUsed.remove(jid);
+    }
+}
+
 //
 // Encrypts a message for specific recipients.
 //
@@ -1033,6 +1694,17 @@ QXmppTask<std::optional<QXmppOmemoElement>> ManagerPrivate::encryptStanza(const
 
     QXmppPromise<std::optional<QXmppOmemoElement>> interface;
 
+    // Load the sessions of the recipients before they are used by the OMEMO library.
+    if (!std::all_of(recipientJids.cbegin(), recipientJids.cend(), [this](const auto &jid) { return areSessionsLoaded(jid); })) {
+        loadSessions(recipientJids).then(q, [this, interface, stanza, recipientJids, acceptedTrustLevels]() mutable {
+            encryptStanza(stanza, recipientJids, acceptedTrustLevels).then(q, [interface](std::optional<QXmppOmemoElement> &&omemoElement) mutable {
+                interface.finish(std::move(omemoElement));
+            });
+        });
+        return interface.task();
+    }
+    loadSessions(recipientJids);
+
     if (const auto optionalPayloadEncryptionResult = encryptPayload(createSceEnvelope(stanza))) {
         const auto &payloadEncryptionResult = *optionalPayloadEncryptionResult;
 
@@ -1050,7 +1722,7 @@ QXmppTask<std::optional<QXmppOmemoElement>> ManagerPrivate::encryptStanza(const
         }
 
         if (devicesCount) {
-            auto omemoElement = std::make_shared<QXmppOmemoElement>();
+            auto envelopeRequests = std::make_shared<QVector<OmemoEnvelopeRequest>>();
             auto processedDevicesCount = std::make_shared<int>(0);
             auto successfullyProcessedDevicesCount = std::make_shared<int>(0);
             auto skippedDevicesCount = std::make_shared<int>(0);
@@ -1073,11 +1745,54 @@ QXmppTask<std::optional<QXmppOmemoElement>> ManagerPrivate::encryptStanza(const
                                 warning(u"OMEMO element could not be created because no recipient "
                                         "devices with keys having accepted trust levels could be found"_s);
                                 interface.finish(std::nullopt);
-                            } else {
-                                omemoElement->setSenderDeviceId(ownDevice.id);
-                                omemoElement->setPayload(payloadEncryptionResult.encryptedPayload);
-                                interface.finish(*omemoElement);
+                                return;
                             }
+
+                            // Create the envelopes for all devices at once so that they can be
+                            // created in parallel.
+                            createOmemoEnvelopesData(*envelopeRequests, payloadEncryptionResult.decryptionData).then(q, [=, this](QVector<QByteArray> &&envelopesData) mutable {
+                                QXmppOmemoElement omemoElement;
+                                auto envelopesCount = 0;
+
+                                for (qsizetype i = 0; i < envelopeRequests->size(); ++i) {
+                                    const auto &request = envelopeRequests->at(i);
+                                    const auto &data = envelopesData.at(i);
+
+                                    // Add an OMEMO envelope only if its data could be created and the
+                                    // corresponding device has not been removed by another method in
+                                    // the meantime.
+                                    if (data.isEmpty()) {
+                                        warning(u"OMEMO envelope for recipient JID '" + request.jid + u"' and device ID '" + QString::number(request.deviceId) + u"' could not be created because its data could not be encrypted");
+                                    } else if (devices.value(request.jid).contains(request.deviceId)) {
+                                        auto &deviceBeingModified = devices[request.jid][request.deviceId];
+                                        deviceBeingModified.unrespondedReceivedStanzasCount = 0;
+
+                                        if (auto &unrespondedSentStanzasCount = deviceBeingModified.unrespondedSentStanzasCount; unrespondedSentStanzasCount + 1 <= UNRESPONDED_STANZAS_UNTIL_ENCRYPTION_IS_STOPPED) {
+                                            ++unrespondedSentStanzasCount;
+                                        }
+
+                                        storeDeviceLater(request.jid, request.deviceId);
+
+                                        QXmppOmemoEnvelope omemoEnvelope;
+                                        omemoEnvelope.setRecipientDeviceId(request.deviceId);
+                                        if (request.isKeyExchange) {
+                                            omemoEnvelope.setIsUsedForKeyExchange(true);
+                                        }
+                                        omemoEnvelope.setData(data);
+                                        omemoElement.addEnvelope(request.jid, omemoEnvelope);
+                                        ++envelopesCount;
+                                    }
+                                }
+
+                                if (envelopesCount == 0) {
+                                    warning(u"OMEMO element could not be created because no OMEMO envelope could be created"_s);
+                                    interface.finish(std::nullopt);
+                                } else {
+                                    omemoElement.setSenderDeviceId(ownDevice.id);
+                                    omemoElement.setPayload(payloadEncryptionResult.encryptedPayload);
+                                    interface.finish(std::move(omemoElement));
+                                }
+                            });
                         }
                     };
 
@@ -1096,32 +1811,11 @@ QXmppTask<std::optional<QXmppOmemoElement>> ManagerPrivate::encryptStanza(const
 
                     const auto address = Address(jid, deviceId);
 
-                    auto addOmemoEnvelope = [this, payloadEncryptionResult, omemoElement, address, jid, deviceId, controlDeviceProcessing](bool isKeyExchange = false) mutable {
-                        // Create and add an OMEMO envelope only if its data could be created
-                        // and the corresponding device has not been removed by another method
-                        // in the meantime.
-                        if (const auto data = createOmemoEnvelopeData(address.data(), payloadEncryptionResult.decryptionData); data.isEmpty()) {
-                            warning(u"OMEMO envelope for recipient JID '" + jid + u"' and device ID '" + QString::number(deviceId) + u"' could not be created because its data could not be encrypted");
-                            controlDeviceProcessing(false);
-                        } else if (devices.value(jid).contains(deviceId)) {
-                            auto &deviceBeingModified = devices[jid][deviceId];
-                            deviceBeingModified.unrespondedReceivedStanzasCount = 0;
-
-                            if (auto &unrespondedSentStanzasCount = deviceBeingModified.unrespondedSentStanzasCount; unrespondedSentStanzasCount + 1 <= UNRESPONDED_STANZAS_UNTIL_ENCRYPTION_IS_STOPPED) {
-                                ++unrespondedSentStanzasCount;
-                            }
-
-                            omemoStorage->addDevice(jid, deviceId, deviceBeingModified);
-
-                            QXmppOmemoEnvelope omemoEnvelope;
-                            omemoEnvelope.setRecipientDeviceId(deviceId);
-                            if (isKeyExchange) {
-                                omemoEnvelope.setIsUsedForKeyExchange(true);
-                            }
-                            omemoEnvelope.setData(data);
-                            omemoElement->addEnvelope(jid, omemoEnvelope);
-                            controlDeviceProcessing();
-                        }
+                    // Only remember the device since the envelopes are created once all devices
+                    // are processed.
+                    auto addOmemoEnvelope = [envelopeRequests, jid, deviceId, controlDeviceProcessing](bool isKeyExchange = false) mutable {
+                        envelopeRequests->append({ jid, deviceId, isKeyExchange });
+                        controlDeviceProcessing();
                     };
 
                     auto buildSessionDependingOnTrustLevel = [this, jid, deviceId, address, acceptedTrustLevels, controlDeviceProcessing, addOmemoEnvelope](const QXmppOmemoDeviceBundle &deviceBundle, TrustLevel trustLevel) mutable {
@@ -1161,12 +1855,12 @@ QXmppTask<std::optional<QXmppOmemoElement>> ManagerPrivate::encryptStanza(const
                                     if (trustLevel == TrustLevel::Undecided) {
                                         auto future = storeKeyDependingOnSecurityPolicy(jid, deviceBeingModified.keyId);
                                         future.then(q, [this, jid, deviceId, deviceBundle, deviceBeingModified, buildSessionDependingOnTrustLevel](TrustLevel trustLevel) mutable {
-                                            omemoStorage->addDevice(jid, deviceId, deviceBeingModified);
+                                            storeDevice(jid, deviceId);
                                             Q_EMIT q->deviceChanged(jid, deviceId);
                                             buildSessionDependingOnTrustLevel(deviceBundle, trustLevel);
                                         });
                                     } else {
-                                        omemoStorage->addDevice(jid, deviceId, deviceBeingModified);
+                                        storeDevice(jid, deviceId);
                                         Q_EMIT q->deviceChanged(jid, deviceId);
                                         buildSessionDependingOnTrustLevel(deviceBundle, trustLevel);
                                     }
@@ -1230,10 +1924,17 @@ template QXmppTask<std::optional<QXmppOmemoElement>> ManagerPrivate::encryptStan
 //
 std::optional<PayloadEncryptionResult> ManagerPrivate::encryptPayload(const QByteArray &payload) const
 {
+    if (!cryptoContexts.isMessageAuthenticationCodeSupported()) {
+        warning(u"Message authentication code type '" + PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE.toString() + u"' is not supported by this system");
+        return {};
+    }
+
+    const auto cryptoContext = cryptoContexts.acquire();
+
     auto hkdfKey = QCA::SecureArray(QCA::Random::randomArray(HKDF_KEY_SIZE));
     const auto hkdfSalt = QCA::InitializationVector(QCA::SecureArray(HKDF_SALT_SIZE));
     const auto hkdfInfo = QCA::InitializationVector(QCA::SecureArray(HKDF_INFO));
-    auto hkdfOutput = QCA::HKDF().makeKey(hkdfKey, hkdfSalt, hkdfInfo, HKDF_OUTPUT_SIZE);
+    auto hkdfOutput = cryptoContext->hkdf().makeKey(hkdfKey, hkdfSalt, hkdfInfo, HKDF_OUTPUT_SIZE);
 
     // first part of hkdfKey
     auto encryptionKey = QCA::SymmetricKey(hkdfOutput);
@@ -1249,7 +1950,7 @@ std::optional<PayloadEncryptionResult> ManagerPrivate::encryptPayload(const QByt
     const auto initializationVectorOffset = hkdfOutput.data() + PAYLOAD_KEY_SIZE + PAYLOAD_AUTHENTICATION_KEY_SIZE;
     std::copy(initializationVectorOffset, initializationVectorOffset + PAYLOAD_INITIALIZATION_VECTOR_SIZE, initializationVector.data());
 
-    QCA::Cipher cipher(PAYLOAD_CIPHER_TYPE.toString(), PAYLOAD_CIPHER_MODE, PAYLOAD_CIPHER_PADDING, QCA::Encode, encryptionKey, initializationVector);
+    auto &cipher = cryptoContext->cipher(PAYLOAD_CIPHER_TYPE.toString(), PAYLOAD_CIPHER_MODE, PAYLOAD_CIPHER_PADDING, QCA::Encode, encryptionKey, initializationVector);
     auto encryptedPayload = cipher.process(QCA::MemoryRegion(payload));
 
     if (encryptedPayload.isEmpty()) {
@@ -1257,12 +1958,7 @@ std::optional<PayloadEncryptionResult> ManagerPrivate::encryptPayload(const QByt
         return {};
     }
 
-    if (!QCA::MessageAuthenticationCode::supportedTypes().contains(PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE)) {
-        warning(u"Message authentication code type '" + PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE.toString() + u"' is not supported by this system");
-        return {};
-    }
-
-    auto messageAuthenticationCodeGenerator = QCA::MessageAuthenticationCode(PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE.toString(), authenticationKey);
+    auto &messageAuthenticationCodeGenerator = cryptoContext->messageAuthenticationCode(authenticationKey);
     auto messageAuthenticationCode = QCA::SecureArray(messageAuthenticationCodeGenerator.process(encryptedPayload));
     messageAuthenticationCode.resize(PAYLOAD_MESSAGE_AUTHENTICATION_CODE_SIZE);
 
@@ -1329,27 +2025,166 @@ QByteArray ManagerPrivate::createSceEnvelope(const T &stanza)
 //
 QByteArray ManagerPrivate::createOmemoEnvelopeData(const signal_protocol_address &address, const QCA::SecureArray &payloadDecryptionData) const
 {
-    SessionCipherPtr sessionCipher;
+    auto result = encryptPayloadDecryptionData(storeContext.get(), globalContext.get(), address, payloadDecryptionData);
 
-    if (session_cipher_create(sessionCipher.ptrRef(), storeContext.get(), &address, globalContext.get()) < 0) {
-        warning(u"Session cipher could not be created"_s);
+    if (const auto *error = std::get_if<QXmppError>(&result)) {
+        warning(error->description);
         return {};
     }
 
-    session_cipher_set_version(sessionCipher.get(), CIPHERTEXT_OMEMO_VERSION);
+    return std::get<QByteArray>(std::move(result));
+}
+
+//
+// Creates the OMEMO envelope data for multiple devices.
+//
+// If QXmppOmemoManager::setEnvelopeEncryptionThreadCount() is used, the data is created in
+// parallel.
+// Otherwise, it is created sequentially via the global context.
+//
+// \param requests devices for whom the envelope data is created
+// \param payloadDecryptionData data needed to decrypt the payload
+//
+// \return the encrypted and serialized OMEMO envelope data in the order of the requests, a
+//         default-constructed byte array for each failure
+//
+QXmppTask<QVector<QByteArray>> ManagerPrivate::createOmemoEnvelopesData(const QVector<OmemoEnvelopeRequest> &requests, const QCA::SecureArray &payloadDecryptionData)
+{
+    if (envelopeEncryptionThreadCount > 0 && requests.size() > 1) {
+        return createOmemoEnvelopesDataInParallel(requests, payloadDecryptionData);
+    }
+
+    QVector<QByteArray> envelopesData;
+    envelopesData.reserve(requests.size());
+
+    for (const auto &request : requests) {
+        const auto address = Address(request.jid, request.deviceId);
+        envelopesData.append(createOmemoEnvelopeData(address.data(), payloadDecryptionData));
+    }
+
+    return makeReadyTask(std::move(envelopesData));
+}
+
+//
+// Creates the OMEMO envelope data for multiple devices in parallel.
+//
+// Each device's session is copied into an isolated session with its own OMEMO library context.
+// Thus, the tasks only lock their own sessions instead of the global context and the manager's
+// thread is not blocked.
+//
+// Once all tasks are finished, the modified sessions are taken over on the manager's thread.
+// If a session has been modified by another method in the meantime, the envelope data for that
+// device is created again via the global context so that the newer session is not overwritten.
+//
+// \param requests devices for whom the envelope data is created
+// \param payloadDecryptionData data needed to decrypt the payload
+//
+// \return the encrypted and serialized OMEMO envelope data in the order of the requests, a
+//         default-constructed byte array for each failure
+//
+QXmppTask<QVector<QByteArray>> ManagerPrivate::createOmemoEnvelopesDataInParallel(const QVector<OmemoEnvelopeRequest> &requests, const QCA::SecureArray &payloadDecryptionData)
+{
+    // State shared between the tasks and the final processing on the manager's thread.
+    struct ParallelEnvelopeEncryption {
+        IsolatedIdentity identity;
+        std::vector<IsolatedSession> isolatedSessions;
+        std::vector<QByteArray> originalSessions;
+        std::vector<std::variant<QByteArray, QXmppError>> results;
+        QCA::SecureArray payloadDecryptionData;
+        std::atomic<size_t> remainingCount;
+    };
+
+    if (!envelopeEncryptionThreadPool) {
+        envelopeEncryptionThreadPool = std::make_unique<QThreadPool>();
+    }
+    envelopeEncryptionThreadPool->setMaxThreadCount(envelopeEncryptionThreadCount);
+
+    const auto requestsCount = size_t(requests.size());
+
+    auto state = std::make_shared<ParallelEnvelopeEncryption>();
+    state->identity = { ownDevice.id, ownDevice.privateIdentityKey, ownDevice.publicIdentityKey };
+    state->isolatedSessions = std::vector<IsolatedSession>(requestsCount);
+    state->originalSessions.reserve(requestsCount);
+    state->results.resize(requestsCount);
+    state->payloadDecryptionData = payloadDecryptionData;
+    state->remainingCount = requestsCount;
+
+    for (size_t i = 0; i < requestsCount; ++i) {
+        const auto &request = requests.at(i);
+        auto &isolatedSession = state->isolatedSessions[i];
+        isolatedSession.jid = request.jid;
+        isolatedSession.deviceId = request.deviceId;
+        isolatedSession.session = devices.value(request.jid).value(request.deviceId).session;
+        state->originalSessions.push_back(isolatedSession.session);
+    }
+
+    QXmppPromise<QVector<QByteArray>> interface;
+
+    // Called on the manager's thread once all envelope data is created.
+    auto finish = [this, interface, state]() mutable {
+        QVector<QByteArray> envelopesData;
+        envelopesData.reserve(int(state->results.size()));
+
+        for (size_t i = 0; i < state->results.size(); ++i) {
+            const auto &isolatedSession = state->isolatedSessions[i];
+
+            if (const auto *error = std::get_if<QXmppError>(&state->results[i])) {
+                warning(error->description);
+                envelopesData.append({});
+                continue;
+            }
+
+            const auto jidDevices = devices.value(isolatedSession.jid);
+            const auto isDeviceAvailable = jidDevices.contains(isolatedSession.deviceId);
+
+            if (isDeviceAvailable && jidDevices.value(isolatedSession.deviceId).session != state->originalSessions[i]) {
+                const auto address = Address(isolatedSession.jid, isolatedSession.deviceId);
+                envelopesData.append(createOmemoEnvelopeData(address.data(), state->payloadDecryptionData));
+                continue;
+            }
+
+            if (isolatedSession.isSessionModified && isDeviceAvailable) {
+                devices[isolatedSession.jid][isolatedSession.deviceId].session = isolatedSession.session;
+                storeDeviceLater(isolatedSession.jid, isolatedSession.deviceId);
+            }
+
+            envelopesData.append(std::get<QByteArray>(std::move(state->results[i])));
+        }
+
+        interface.finish(std::move(envelopesData));
+    };
+
+    for (size_t i = 0; i < requestsCount; ++i) {
+        envelopeEncryptionThreadPool->start([this, i, state, finish, cryptoProvider = cryptoProvider]() {
+            state->results[i] = createIsolatedOmemoEnvelopeData(state->isolatedSessions[i], state->identity, cryptoProvider, state->payloadDecryptionData);
+
+            if (--state->remainingCount == 0) {
+                QMetaObject::invokeMethod(q, finish, Qt::QueuedConnection);
+            }
+        });
+    }
+
+    return interface.task();
+}
 
-    RefCountedPtr<ciphertext_message> encryptedOmemoEnvelopeData;
-    if (session_cipher_encrypt(sessionCipher.get(), reinterpret_cast<const uint8_t *>(payloadDecryptionData.constData()), payloadDecryptionData.size(), encryptedOmemoEnvelopeData.ptrRef()) != SG_SUCCESS) {
-        warning(u"Payload decryption data could not be encrypted"_s);
-        return {};
-    }
+//
+// Sets the decrypted content of a message stanza.
+//
+// \param stanza message stanza whose OMEMO element is replaced by the decrypted content
+// \param decryptionResult result of the stanza's decryption
+//
+static void setDecryptedContent(QXmppMessage &stanza, DecryptionResult &&decryptionResult)
+{
+    // prevent that public fallback markers are used on the private body
+    stanza.setFallbackMarkers({});
 
-    signal_buffer *serializedEncryptedOmemoEnvelopeData = ciphertext_message_get_serialized(encryptedOmemoEnvelopeData.get());
+    stanza.parseExtensions(decryptionResult.sceContent, SceSensitive);
 
-    return {
-        reinterpret_cast<const char *>(signal_buffer_data(serializedEncryptedOmemoEnvelopeData)),
-        int(signal_buffer_len(serializedEncryptedOmemoEnvelopeData))
-    };
+    // Remove the OMEMO element from the message because it is not needed
+    // anymore after decryption.
+    stanza.setOmemoElement({});
+
+    stanza.setE2eeMetadata(decryptionResult.e2eeMetadata);
 }
 
 //
@@ -1397,18 +2232,7 @@ QXmppTask<std::optional<QXmppMessage>> ManagerPrivate::decryptMessage(QXmppMessa
             auto future = decryptStanza(stanza, senderJid, senderDeviceId, *omemoEnvelope, omemoPayload);
             future.then(q, [=](std::optional<DecryptionResult> optionalDecryptionResult) mutable {
                 if (optionalDecryptionResult) {
-                    // prevent that public fallback markers are used on the private body
-                    stanza.setFallbackMarkers({});
-
-                    const auto decryptionResult = std::move(*optionalDecryptionResult);
-                    stanza.parseExtensions(decryptionResult.sceContent, SceSensitive);
-
-                    // Remove the OMEMO element from the message because it is not needed
-                    // anymore after decryption.
-                    stanza.setOmemoElement({});
-
-                    stanza.setE2eeMetadata(decryptionResult.e2eeMetadata);
-
+                    setDecryptedContent(stanza, std::move(*optionalDecryptionResult));
                     interface.finish(stanza);
                 } else {
                     interface.finish(std::nullopt);
@@ -1422,6 +2246,155 @@ QXmppTask<std::optional<QXmppMessage>> ManagerPrivate::decryptMessage(QXmppMessa
     }
 }
 
+//
+// Decrypts multiple message stanzas in a batch (e.g., after retrieving them from an archive).
+//
+// The sessions of all senders are loaded at once.
+// The data for decrypting the payloads is extracted in the order of the stanzas grouped by their
+// sending devices since it depends on the devices' sessions.
+// Afterwards, the payloads are decrypted in parallel.
+// The changes of all devices are stored once for the whole batch.
+//
+// \param stanzas message stanzas to be decrypted
+//
+// \return the decrypted stanzas in the order of the passed ones, std::nullopt for each stanza that
+//         could not be decrypted
+//
+QXmppTask<QVector<std::optional<QXmppMessage>>> ManagerPrivate::decryptMessages(QVector<QXmppMessage> stanzas)
+{
+    QXmppPromise<QVector<std::optional<QXmppMessage>>> interface;
+
+    struct EncryptedStanza {
+        qsizetype index;
+        QString senderJid;
+        uint32_t senderDeviceId;
+        QXmppOmemoEnvelope omemoEnvelope;
+        QByteArray omemoPayload;
+        std::optional<QCA::SecureArray> payloadDecryptionData;
+        QByteArray serializedSceEnvelope;
+    };
+
+    auto encryptedStanzas = std::make_shared<std::vector<EncryptedStanza>>();
+    QList<QString> senderJids;
+
+    for (qsizetype i = 0; i < stanzas.size(); ++i) {
+        const auto &stanza = stanzas.at(i);
+
+        if (const auto omemoElement = stanza.omemoElement()) {
+            if (const auto omemoEnvelope = omemoElement->searchEnvelope(ownBareJid(), ownDevice.id)) {
+                const auto mixUserJid = stanza.mixUserJid();
+                const auto senderJid = mixUserJid.isEmpty() ? QXmppUtils::jidToBareJid(stanza.from()) : mixUserJid;
+                encryptedStanzas->push_back({ i, senderJid, omemoElement->senderDeviceId(), *omemoEnvelope, omemoElement->payload(), {}, {} });
+
+                if (!senderJids.contains(senderJid)) {
+                    senderJids.append(senderJid);
+                }
+            }
+        }
+    }
+
+    if (encryptedStanzas->empty()) {
+        interface.finish(QVector<std::optional<QXmppMessage>>(stanzas.size()));
+        return interface.task();
+    }
+
+    // Load the sessions of all senders before they are used by the OMEMO library.
+    if (!std::all_of(senderJids.cbegin(), senderJids.cend(), [this](const auto &jid) { return areSessionsLoaded(jid); })) {
+        loadSessions(senderJids).then(q, [this, interface, stanzas]() mutable {
+            decryptMessages(stanzas).then(q, [interface](QVector<std::optional<QXmppMessage>> &&decryptedStanzas) mutable {
+                interface.finish(std::move(decryptedStanzas));
+            });
+        });
+        return interface.task();
+    }
+
+    // Process the stanzas of each sending device in their original order.
+    std::stable_sort(encryptedStanzas->begin(), encryptedStanzas->end(), [](const EncryptedStanza &a, const EncryptedStanza &b) {
+        return std::tie(a.senderJid, a.senderDeviceId) < std::tie(b.senderJid, b.senderDeviceId);
+    });
+
+    auto decryptPayloads = [this, interface, stanzas, encryptedStanzas]() mutable {
+        auto stanzasWithPayloads = std::make_shared<QVector<EncryptedStanza *>>();
+        for (auto &encryptedStanza : *encryptedStanzas) {
+            if (encryptedStanza.payloadDecryptionData && !encryptedStanza.omemoPayload.isEmpty()) {
+                stanzasWithPayloads->append(&encryptedStanza);
+            }
+        }
+
+        auto results = std::make_shared<std::vector<std::variant<QByteArray, QXmppError>>>(stanzasWithPayloads->size());
+
+        // Called on the manager's thread once all payloads are decrypted.
+        auto finish = [this, interface, stanzas, encryptedStanzas, stanzasWithPayloads, results]() mutable {
+            for (qsizetype i = 0; i < stanzasWithPayloads->size(); ++i) {
+                if (const auto *error = std::get_if<QXmppError>(&(*results)[i])) {
+                    warning(error->description);
+                } else {
+                    stanzasWithPayloads->at(i)->serializedSceEnvelope = std::get<QByteArray>(std::move((*results)[i]));
+                }
+            }
+
+            QVector<std::optional<QXmppMessage>> decryptedStanzas(stanzas.size());
+
+            for (const auto &encryptedStanza : std::as_const(*encryptedStanzas)) {
+                if (encryptedStanza.omemoPayload.isEmpty()) {
+                    // Empty OMEMO messages are only processed for their sessions.
+                    continue;
+                }
+
+                auto stanza = stanzas.at(encryptedStanza.index);
+
+                if (auto decryptionResult = readSceEnvelope(stanza, encryptedStanza.senderJid, encryptedStanza.senderDeviceId, encryptedStanza.serializedSceEnvelope, true)) {
+                    setDecryptedContent(stanza, std::move(*decryptionResult));
+                    decryptedStanzas[encryptedStanza.index] = std::move(stanza);
+                }
+            }
+
+            storePendingDevices();
+            interface.finish(std::move(decryptedStanzas));
+        };
+
+        if (stanzasWithPayloads->isEmpty()) {
+            finish();
+            return;
+        }
+
+        // The payloads are decrypted in parallel without blocking the manager's thread.
+        auto remainingCount = std::make_shared<std::atomic<qsizetype>>(stanzasWithPayloads->size());
+
+        for (qsizetype i = 0; i < stanzasWithPayloads->size(); ++i) {
+            payloadDecryptionThreadPool.start([this, i, stanzasWithPayloads, results, remainingCount, finish]() {
+                const auto *encryptedStanza = stanzasWithPayloads->at(i);
+                (*results)[i] = decryptPayloadData(cryptoContexts, *encryptedStanza->payloadDecryptionData, encryptedStanza->omemoPayload);
+
+                if (--(*remainingCount) == 0) {
+                    QMetaObject::invokeMethod(q, finish, Qt::QueuedConnection);
+                }
+            });
+        }
+    };
+
+    auto remainingCount = std::make_shared<size_t>(encryptedStanzas->size());
+    QSet<DeviceKey> senderDevices;
+
+    for (auto &encryptedStanza : *encryptedStanzas) {
+        if (const auto senderDevice = DeviceKey { encryptedStanza.senderJid, encryptedStanza.senderDeviceId }; !senderDevices.contains(senderDevice)) {
+            subscribeToNewDeviceLists(encryptedStanza.senderJid, encryptedStanza.senderDeviceId);
+            senderDevices.insert(senderDevice);
+        }
+
+        auto future = extractPayloadDecryptionData(encryptedStanza.senderJid, encryptedStanza.senderDeviceId, encryptedStanza.omemoEnvelope);
+        future.then(q, [&encryptedStanza, remainingCount, decryptPayloads](std::optional<QCA::SecureArray> &&payloadDecryptionData) mutable {
+            encryptedStanza.payloadDecryptionData = std::move(payloadDecryptionData);
+
+            if (--(*remainingCount) == 0) {
+                decryptPayloads();
+            }
+        });
+    }
+
+    return interface.task();
+}
+
 //
 // Decrypts an IQ stanza.
 //
@@ -1460,6 +2433,66 @@ QXmppTask<std::optional<IqDecryptionResult>> ManagerPrivate::decryptIq(const QDo
     return makeReadyTask<Result>(std::nullopt);
 }
 
+//
+// Reads the SCE envelope extracted from a message or IQ stanza and updates the sending device.
+//
+// \param stanza message or IQ stanza being decrypted
+// \param senderJid JID of the stanza's sender
+// \param senderDeviceId device ID of the stanza's sender
+// \param serializedSceEnvelope decrypted SCE envelope
+// \param isMessageStanza whether the received stanza is a message stanza
+//
+// \return the result of the decryption if the SCE envelope is valid
+//
+template<typename T>
+std::optional<DecryptionResult> ManagerPrivate::readSceEnvelope(const T &stanza, const QString &senderJid, uint32_t senderDeviceId, const QByteArray &serializedSceEnvelope, bool isMessageStanza)
+{
+    if (serializedSceEnvelope.isEmpty()) {
+        warning(u"SCE envelope could not be extracted"_s);
+        return std::nullopt;
+    }
+
+    QDomDocument document;
+    document.setContent(serializedSceEnvelope, true);
+    QXmppSceEnvelopeReader sceEnvelopeReader(document.documentElement());
+
+    if (sceEnvelopeReader.from() != senderJid) {
+        q->info(u"Sender '" + senderJid + u"' of stanza does not match SCE 'from' affix element '" + sceEnvelopeReader.from() + u"'");
+    }
+
+    if (isMessageStanza) {
+        // For messages from group chats, their "from" element corresponds to the SCE affix element "to".
+        if (const auto &message = dynamic_cast<const QXmppMessage &>(stanza); message.type() == QXmppMessage::GroupChat && (sceEnvelopeReader.to() != QXmppUtils::jidToBareJid(stanza.from()))) {
+            warning(u"Recipient of group chat message does not match SCE affix element '<to/>'"_s);
+            return std::nullopt;
+        }
+    } else if (sceEnvelopeReader.to() != QXmppUtils::jidToBareJid(stanza.to())) {
+        q->info(u"Recipient of IQ does not match SCE affix element '<to/>'"_s);
+    }
+
+    auto &device = devices[senderJid][senderDeviceId];
+    device.unrespondedSentStanzasCount = 0;
+
+    // Send a heartbeat message to the sender if too many stanzas were
+    // received responding to none.
+    if (device.unrespondedReceivedStanzasCount == UNRESPONDED_STANZAS_UNTIL_HEARTBEAT_MESSAGE_IS_SENT) {
+        sendEmptyMessage(senderJid, senderDeviceId);
+        device.unrespondedReceivedStanzasCount = 0;
+    } else {
+        ++device.unrespondedReceivedStanzasCount;
+    }
+
+    storeDeviceLater(senderJid, senderDeviceId);
+
+    QXmppE2eeMetadata e2eeMetadata;
+    e2eeMetadata.setSceTimestamp(sceEnvelopeReader.timestamp());
+    e2eeMetadata.setEncryption(QXmpp::Omemo2);
+    const auto &senderDevice = devices.value(senderJid).value(senderDeviceId);
+    e2eeMetadata.setSenderKey(senderDevice.keyId);
+
+    return DecryptionResult { sceEnvelopeReader.contentElement(), e2eeMetadata };
+}
+
 //
 // Decrypts a message or IQ stanza.
 //
@@ -1484,49 +2517,7 @@ QXmppTask<std::optional<DecryptionResult>> ManagerPrivate::decryptStanza(T stanz
 
     auto future = extractSceEnvelope(senderJid, senderDeviceId, omemoEnvelope, omemoPayload, isMessageStanza);
     future.then(q, [=, this](QByteArray serializedSceEnvelope) mutable {
-        if (serializedSceEnvelope.isEmpty()) {
-            warning(u"SCE envelope could not be extracted"_s);
-            interface.finish(std::nullopt);
-        } else {
-            QDomDocument document;
-            document.setContent(serializedSceEnvelope, true);
-            QXmppSceEnvelopeReader sceEnvelopeReader(document.documentElement());
-
-            if (sceEnvelopeReader.from() != senderJid) {
-                q->info(u"Sender '" + senderJid + u"' of stanza does not match SCE 'from' affix element '" + sceEnvelopeReader.from() + u"'");
-            }
-
-            if (isMessageStanza) {
-                // For messages from group chats, their "from" element corresponds to the SCE affix element "to".
-                if (const auto &message = dynamic_cast<const QXmppMessage &>(stanza); message.type() == QXmppMessage::GroupChat && (sceEnvelopeReader.to() != QXmppUtils::jidToBareJid(stanza.from()))) {
-                    warning(u"Recipient of group chat message does not match SCE affix element '<to/>'"_s);
-                    interface.finish(std::nullopt);
-                    return;
-                }
-            } else if (sceEnvelopeReader.to() != QXmppUtils::jidToBareJid(stanza.to())) {
-                q->info(u"Recipient of IQ does not match SCE affix element '<to/>'"_s);
-            }
-
-            auto &device = devices[senderJid][senderDeviceId];
-            device.unrespondedSentStanzasCount = 0;
-
-            // Send a heartbeat message to the sender if too many stanzas were
-            // received responding to none.
-            if (device.unrespondedReceivedStanzasCount == UNRESPONDED_STANZAS_UNTIL_HEARTBEAT_MESSAGE_IS_SENT) {
-                sendEmptyMessage(senderJid, senderDeviceId);
-                device.unrespondedReceivedStanzasCount = 0;
-            } else {
-                ++device.unrespondedReceivedStanzasCount;
-            }
-
-            QXmppE2eeMetadata e2eeMetadata;
-            e2eeMetadata.setSceTimestamp(sceEnvelopeReader.timestamp());
-            e2eeMetadata.setEncryption(QXmpp::Omemo2);
-            const auto &senderDevice = devices.value(senderJid).value(senderDeviceId);
-            e2eeMetadata.setSenderKey(senderDevice.keyId);
-
-            interface.finish(DecryptionResult { sceEnvelopeReader.contentElement(), e2eeMetadata });
-        }
+        interface.finish(readSceEnvelope(stanza, senderJid, senderDeviceId, serializedSceEnvelope, isMessageStanza));
     });
 
     return interface.task();
@@ -1580,6 +2571,17 @@ QXmppTask<std::optional<QCA::SecureArray>> ManagerPrivate::extractPayloadDecrypt
 {
     QXmppPromise<std::optional<QCA::SecureArray>> interface;
 
+    // Load the sender's sessions before they are used by the OMEMO library.
+    if (!areSessionsLoaded(senderJid)) {
+        loadSessions({ senderJid }).then(q, [this, interface, senderJid, senderDeviceId, omemoEnvelope, isMessageStanza]() mutable {
+            extractPayloadDecryptionData(senderJid, senderDeviceId, omemoEnvelope, isMessageStanza).then(q, [interface](std::optional<QCA::SecureArray> &&payloadDecryptionData) mutable {
+                interface.finish(std::move(payloadDecryptionData));
+            });
+        });
+        return interface.task();
+    }
+    loadSessions({ senderJid });
+
     SessionCipherPtr sessionCipher;
     const auto address = Address(senderJid, senderDeviceId);
     const auto addressData = address.data();
@@ -1635,7 +2637,7 @@ QXmppTask<std::optional<QCA::SecureArray>> ManagerPrivate::extractPayloadDecrypt
                 // Store the key if its ID has changed.
                 if (storedKeyId != key) {
                     storedKeyId = key;
-                    omemoStorage->addDevice(senderJid, senderDeviceId, device);
+                    storeDevice(senderJid, senderDeviceId);
                     Q_EMIT q->deviceChanged(senderJid, senderDeviceId);
                 }
 
@@ -1733,18 +2735,27 @@ QXmppTask<std::optional<QCA::SecureArray>> ManagerPrivate::extractPayloadDecrypt
 //
 // Decrypts the OMEMO payload.
 //
+// This is thread-safe.
+//
+// \param cryptoContexts pool providing the crypto context used for the decryption
 // \param payloadDecryptionData data needed to decrypt the payload
 // \param payload payload to be decrypted
 //
-// \return the decrypted payload or a default-constructed byte array on failure
+// \return the decrypted payload or an error on failure
 //
-QByteArray ManagerPrivate::decryptPayload(const QCA::SecureArray &payloadDecryptionData, const QByteArray &payload) const
+static std::variant<QByteArray, QXmppError> decryptPayloadData(const CryptoContextPool &cryptoContexts, const QCA::SecureArray &payloadDecryptionData, const QByteArray &payload)
 {
+    if (!cryptoContexts.isMessageAuthenticationCodeSupported()) {
+        return QXmppError { u"Message authentication code type '" + PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE + u"' is not supported by this system", {} };
+    }
+
+    const auto cryptoContext = cryptoContexts.acquire();
+
     auto hkdfKey = QCA::SecureArray(payloadDecryptionData);
     hkdfKey.resize(HKDF_KEY_SIZE);
     const auto hkdfSalt = QCA::InitializationVector(QCA::SecureArray(HKDF_SALT_SIZE));
     const auto hkdfInfo = QCA::InitializationVector(QCA::SecureArray(HKDF_INFO));
-    auto hkdfOutput = QCA::HKDF().makeKey(hkdfKey, hkdfSalt, hkdfInfo, HKDF_OUTPUT_SIZE);
+    auto hkdfOutput = cryptoContext->hkdf().makeKey(hkdfKey, hkdfSalt, hkdfInfo, HKDF_OUTPUT_SIZE);
 
     // first part of hkdfKey
     auto encryptionKey = QCA::SymmetricKey(hkdfOutput);
@@ -1760,33 +2771,46 @@ QByteArray ManagerPrivate::decryptPayload(const QCA::SecureArray &payloadDecrypt
     const auto initializationVectorOffset = hkdfOutput.data() + PAYLOAD_KEY_SIZE + PAYLOAD_AUTHENTICATION_KEY_SIZE;
     std::copy(initializationVectorOffset, initializationVectorOffset + PAYLOAD_INITIALIZATION_VECTOR_SIZE, initializationVector.data());
 
-    if (!QCA::MessageAuthenticationCode::supportedTypes().contains(PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE)) {
-        warning(u"Message authentication code type '" + PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE + u"' is not supported by this system");
-        return {};
-    }
-
-    auto messageAuthenticationCodeGenerator = QCA::MessageAuthenticationCode(PAYLOAD_MESSAGE_AUTHENTICATION_CODE_TYPE.toString(), authenticationKey);
+    auto &messageAuthenticationCodeGenerator = cryptoContext->messageAuthenticationCode(authenticationKey);
     auto messageAuthenticationCode = QCA::SecureArray(messageAuthenticationCodeGenerator.process(payload));
     messageAuthenticationCode.resize(PAYLOAD_MESSAGE_AUTHENTICATION_CODE_SIZE);
 
     auto expectedMessageAuthenticationCode = QCA::SecureArray(payloadDecryptionData.toByteArray().right(PAYLOAD_MESSAGE_AUTHENTICATION_CODE_SIZE));
 
     if (messageAuthenticationCode != expectedMessageAuthenticationCode) {
-        warning(u"Message authentication code does not match expected one"_s);
-        return {};
+        return QXmppError { u"Message authentication code does not match expected one"_s, {} };
     }
 
-    QCA::Cipher cipher(PAYLOAD_CIPHER_TYPE.toString(), PAYLOAD_CIPHER_MODE, PAYLOAD_CIPHER_PADDING, QCA::Decode, encryptionKey, initializationVector);
+    auto &cipher = cryptoContext->cipher(PAYLOAD_CIPHER_TYPE.toString(), PAYLOAD_CIPHER_MODE, PAYLOAD_CIPHER_PADDING, QCA::Decode, encryptionKey, initializationVector);
     auto decryptedPayload = cipher.process(QCA::MemoryRegion(payload));
 
     if (decryptedPayload.isEmpty()) {
-        warning(u"Following payload could not be decrypted: " + QString::fromUtf8(payload));
-        return {};
+        return QXmppError { u"Following payload could not be decrypted: " + QString::fromUtf8(payload), {} };
     }
 
     return decryptedPayload.toByteArray();
 }
 
+//
+// Decrypts the OMEMO payload.
+//
+// \param payloadDecryptionData data needed to decrypt the payload
+// \param payload payload to be decrypted
+//
+// \return the decrypted payload or a default-constructed byte array on failure
+//
+QByteArray ManagerPrivate::decryptPayload(const QCA::SecureArray &payloadDecryptionData, const QByteArray &payload) const
+{
+    auto result = decryptPayloadData(cryptoContexts, payloadDecryptionData, payload);
+
+    if (const auto *error = std::get_if<QXmppError>(&result)) {
+        warning(error->description);
+        return {};
+    }
+
+    return std::get<QByteArray>(std::move(result));
+}
+
 //
 // Publishes the OMEMO data for this device.
 //
@@ -1794,6 +2818,13 @@ QByteArray ManagerPrivate::decryptPayload(const QCA::SecureArray &payloadDecrypt
 //
 QXmppTask<bool> ManagerPrivate::publishOmemoData()
 {
+    // Nothing is published if this device's bundle and device element have not changed since
+    // their last publication.
+    if (!ownDevice.publishedDataHash.isEmpty() && ownDevice.publishedDataHash == ownDataHash()) {
+        q->debug(u"Device bundle and device element are not published because they have not changed since their last publication"_s);
+        return makeReadyTask(true);
+    }
+
     QXmppPromise<bool> interface;
 
     auto future = pubSubManager->requestOwnPepFeatures();
@@ -1849,7 +2880,9 @@ QXmppTask<bool> ManagerPrivate::publishOmemoData()
                                                      isCreationSupported,
                                                      isConfigurationSupported,
                                                      [=, this](bool isPublished) mutable {
-                                                         if (!isPublished) {
+                                                         if (isPublished) {
+                                                             storePublishedDataHash();
+                                                         } else {
                                                              warning(u"Device element could not be published"_s);
                                                          }
                                                          interface.finish(std::move(isPublished));
@@ -2139,7 +3172,22 @@ void ManagerPrivate::configureDeviceBundlesNode(bool isConfigNodeMaxSupported, F
 template<typename Function>
 void ManagerPrivate::publishDeviceBundleItem(Function continuation)
 {
-    publishItem(ns_omemo_2_bundles.toString(), deviceBundleItem(), continuation);
+    // The item is not published if it has not changed since its last publication.
+    // The hash is only updated once the device element has been published as well by
+    // publishOmemoData().
+    const auto isDataPublished = !ownDevice.publishedDataHash.isEmpty();
+    if (isDataPublished && ownDevice.publishedDataHash == ownDataHash()) {
+        continuation(true);
+        return;
+    }
+
+    ++deviceBundlePublicationsCount;
+    publishItem(ns_omemo_2_bundles.toString(), deviceBundleItem(), [=, this](bool isPublished) mutable {
+        if (isPublished && isDataPublished) {
+            storePublishedDataHash();
+        }
+        continuation(isPublished);
+    });
 }
 
 //
@@ -2160,6 +3208,7 @@ void ManagerPrivate::publishDeviceBundleItem(Function continuation)
 template<typename Function>
 void ManagerPrivate::publishDeviceBundleItemWithOptions(Function continuation)
 {
+    ++deviceBundlePublicationsCount;
     publishItem(ns_omemo_2_bundles.toString(), deviceBundleItem(), deviceBundlesNodePublishOptions(), [=, this](bool isPublished) mutable {
         if (isPublished) {
             continuation(true);
@@ -2195,30 +3244,122 @@ QXmppOmemoDeviceBundleItem ManagerPrivate::deviceBundleItem() const
     return item;
 }
 
+//
+// Calculates a hash of this device's bundle and device element.
+//
+// \return the hash of the data published for this device
+//
+QByteArray ManagerPrivate::ownDataHash() const
+{
+    QXmppOmemoDeviceElement deviceElement;
+    deviceElement.setId(ownDevice.id);
+    deviceElement.setLabel(ownDevice.label);
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(serializeXml(deviceBundleItem()));
+    hash.addData(serializeXml(deviceElement));
+    return hash.result();
+}
+
+//
+// Stores the hash of the data published for this device in order to skip
+// publishing the same data again.
+//
+void ManagerPrivate::storePublishedDataHash()
+{
+    ownDevice.publishedDataHash = ownDataHash();
+    omemoStorage->setOwnDevice(ownDevice);
+}
+
 //
 // Requests a device bundle from a PEP service.
 //
+// Fetched device bundles are reused for DEVICE_BUNDLE_CACHE_TTL.
+// Simultaneous requests for the same device bundle are served by a single request to the PEP
+// service.
+// At most DEVICE_BUNDLE_REQUESTS_MAX device bundles are fetched at the same time, the others are
+// fetched as soon as previous requests are finished.
+//
 // \param deviceOwnerJid bare JID of the device's owner
 // \param deviceId ID of the device whose bundle is requested
 //
 // \return the device bundle on success, otherwise a nullptr
 //
-QXmppTask<std::optional<QXmppOmemoDeviceBundle>> ManagerPrivate::requestDeviceBundle(const QString &deviceOwnerJid, uint32_t deviceId) const
+QXmppTask<std::optional<QXmppOmemoDeviceBundle>> ManagerPrivate::requestDeviceBundle(const QString &deviceOwnerJid, uint32_t deviceId)
 {
+    const DeviceKey device { deviceOwnerJid, deviceId };
+
+    if (auto itr = cachedDeviceBundles.find(device); itr != cachedDeviceBundles.end()) {
+        if (!itr->expiry.hasExpired()) {
+            return makeReadyTask<std::optional<QXmppOmemoDeviceBundle>>(itr->deviceBundle);
+        }
+        cachedDeviceBundles.erase(itr);
+    }
+
     QXmppPromise<std::optional<QXmppOmemoDeviceBundle>> interface;
 
-    auto future = pubSubManager->requestItem<QXmppOmemoDeviceBundleItem>(deviceOwnerJid, ns_omemo_2_bundles.toString(), QString::number(deviceId));
-    future.then(q, [=, this](QXmppPubSubManager::ItemResult<QXmppOmemoDeviceBundleItem> result) mutable {
+    // Fetch the device bundle only if it is not already being fetched.
+    auto &requests = deviceBundleRequests[device];
+    requests.append(interface);
+
+    if (requests.size() == 1) {
+        queuedDeviceBundleRequests.enqueue(device);
+        fetchQueuedDeviceBundles();
+    }
+
+    return interface.task();
+}
+
+//
+// Fetches a device bundle from a PEP service and finishes all requests waiting for it.
+//
+// \param device JID and ID of the device whose bundle is fetched
+//
+void ManagerPrivate::fetchDeviceBundle(const DeviceKey &device)
+{
+    ++runningDeviceBundleRequestsCount;
+
+    auto future = pubSubManager->requestItem<QXmppOmemoDeviceBundleItem>(device.first, ns_omemo_2_bundles.toString(), QString::number(device.second));
+    future.then(q, [this, device](QXmppPubSubManager::ItemResult<QXmppOmemoDeviceBundleItem> result) mutable {
+        const auto &[deviceOwnerJid, deviceId] = device;
+        --runningDeviceBundleRequestsCount;
+
+        std::optional<QXmppOmemoDeviceBundle> optionalDeviceBundle;
+
         if (const auto error = std::get_if<QXmppError>(&result)) {
             warning(u"Device bundle for JID '" + deviceOwnerJid + u"' and device ID '" + QString::number(deviceId) + u"' could not be retrieved: " + errorToString(*error));
-            interface.finish(std::nullopt);
         } else {
-            const auto &item = std::get<QXmppOmemoDeviceBundleItem>(result);
-            interface.finish(item.deviceBundle());
+            optionalDeviceBundle = std::get<QXmppOmemoDeviceBundleItem>(result).deviceBundle();
+
+            // Remove expired device bundles before caching the new one.
+            for (auto itr = cachedDeviceBundles.begin(); itr != cachedDeviceBundles.end();) {
+                if (itr->expiry.hasExpired()) {
+                    itr = cachedDeviceBundles.erase(itr);
+                } else {
+                    ++itr;
+                }
+            }
+
+            cachedDeviceBundles.insert(device, { *optionalDeviceBundle, QDeadlineTimer(DEVICE_BUNDLE_CACHE_TTL) });
+        }
+
+        fetchQueuedDeviceBundles();
+
+        const auto requests = deviceBundleRequests.take(device);
+        for (auto request : requests) {
+            request.finish(optionalDeviceBundle);
         }
     });
+}
 
-    return interface.task();
+//
+// Fetches queued device bundles as long as the maximum of simultaneous requests is not reached.
+//
+void ManagerPrivate::fetchQueuedDeviceBundles()
+{
+    while (runningDeviceBundleRequestsCount < DEVICE_BUNDLE_REQUESTS_MAX && !queuedDeviceBundleRequests.isEmpty()) {
+        fetchDeviceBundle(queuedDeviceBundleRequests.dequeue());
+    }
 }
 
 //
@@ -2539,7 +3680,7 @@ void ManagerPrivate::updateOwnDevicesLocally(bool isDeviceListNodeExistent, Func
                             auto &device = devices[jid][deviceId];
                             device.label = deviceElement.label();
 
-                            auto future = omemoStorage->addDevice(jid, deviceId, device);
+                            auto future = storeDevice(jid, deviceId);
                             future.then(q, [=, this, &device]() mutable {
                                 auto future = buildSessionForNewDevice(jid, deviceId, device);
                                 future.then(q, [=, this](auto) mutable {
@@ -2578,7 +3719,7 @@ std::optional<QXmppOmemoDeviceListItem> QXmppOmemoManagerPrivate::updateContactD
         });
 
         if (itr != deviceListItems.cend()) {
-            updateDevices(deviceOwnerJid, *itr);
+            updateContactDeviceList(deviceOwnerJid, *itr);
             return *itr;
         } else {
             warning(u"Device list for JID '" + deviceOwnerJid + u"' could not be updated because the node contains more than one item but none with the singleton node's specific ID '" + QXmppPubSubManager::standardItemIdToString(QXmppPubSubManager::Current) + u"'");
@@ -2588,10 +3729,59 @@ std::optional<QXmppOmemoDeviceListItem> QXmppOmemoManagerPrivate::updateContactD
     }
 
     const auto &item = deviceListItems.constFirst();
-    updateDevices(deviceOwnerJid, item);
+    updateContactDeviceList(deviceOwnerJid, item);
     return item;
 }
 
+//
+// Calculates a hash of a device list's content.
+//
+// The devices are sorted by their IDs so that the hash does not depend on
+// their order.
+//
+// \param deviceList device list whose hash is calculated
+//
+// \return the hash of the device list
+//
+static QByteArray deviceListHash(QXmppOmemoDeviceList deviceList)
+{
+    std::sort(deviceList.begin(), deviceList.end(), [](const QXmppOmemoDeviceElement &a, const QXmppOmemoDeviceElement &b) {
+        return a.id() < b.id();
+    });
+
+    return QCryptographicHash::hash(serializeXml(deviceList), QCryptographicHash::Sha256);
+}
+
+//
+// Updates all locally stored devices of a contact if the contact's device list
+// changed since it was received last and stores the device list's state.
+//
+// The PubSub item ID and the content's hash are compared because OMEMO device
+// list nodes are singletons whose item ID is usually \c QXmppPubSubManager::Current.
+// The stored state is used to skip processing an unchanged device list, even
+// after a restart.
+//
+// \param deviceOwnerJid bare JID of the devices' owner
+// \param deviceListItem PEP item containing the device list
+//
+void ManagerPrivate::updateContactDeviceList(const QString &deviceOwnerJid, const QXmppOmemoDeviceListItem &deviceListItem)
+{
+    const QXmppOmemoStorage::DeviceList deviceList {
+        deviceListItem.id(),
+        deviceListHash(deviceListItem.deviceList())
+    };
+
+    const auto itr = deviceLists.constFind(deviceOwnerJid);
+    if (itr != deviceLists.cend() && itr->itemId == deviceList.itemId && itr->hash == deviceList.hash) {
+        return;
+    }
+
+    updateDevices(deviceOwnerJid, deviceListItem);
+
+    deviceLists.insert(deviceOwnerJid, deviceList);
+    omemoStorage->addDeviceList(deviceOwnerJid, deviceList);
+}
+
 //
 // Updates all locally stored devices by a passed device list item.
 //
@@ -2662,7 +3852,7 @@ void ManagerPrivate::updateDevices(const QString &deviceOwnerJid, const QXmppOme
 
         if (!isDeviceFound) {
             device.removalFromDeviceListDate = QDateTime::currentDateTimeUtc();
-            omemoStorage->addDevice(deviceOwnerJid, deviceId, device);
+            storeDevice(deviceOwnerJid, deviceId);
         }
     }
 
@@ -2696,7 +3886,7 @@ void ManagerPrivate::updateDevices(const QString &deviceOwnerJid, const QXmppOme
 
                 // Store the modifications.
                 if (isDeviceModified) {
-                    omemoStorage->addDevice(deviceOwnerJid, deviceId, device);
+                    storeDevice(deviceOwnerJid, deviceId);
 
                     if (isDeviceLabelModified) {
                         Q_EMIT q->deviceChanged(deviceOwnerJid, deviceId);
@@ -2714,7 +3904,7 @@ void ManagerPrivate::updateDevices(const QString &deviceOwnerJid, const QXmppOme
             const auto deviceId = deviceElement.id();
             auto &device = ownerDevices[deviceId];
             device.label = deviceElement.label();
-            omemoStorage->addDevice(deviceOwnerJid, deviceId, device);
+            storeDevice(deviceOwnerJid, deviceId);
 
             auto future = buildSessionForNewDevice(deviceOwnerJid, deviceId, device);
             future.then(q, [=, this](auto) {
@@ -2784,6 +3974,8 @@ void ManagerPrivate::handleIrregularDeviceListChanges(const QString &deviceOwner
             }
         });
     } else {
+        jidsOfNotifiedDeviceLists.remove(deviceOwnerJid);
+
         auto &ownerDevices = devices[deviceOwnerJid];
 
         // Set a timestamp for locally stored contact devices being removed
@@ -2796,7 +3988,7 @@ void ManagerPrivate::handleIrregularDeviceListChanges(const QString &deviceOwner
             device.removalFromDeviceListDate = QDateTime::currentDateTimeUtc();
 
             // Store the modification.
-            omemoStorage->addDevice(deviceOwnerJid, deviceId, device);
+            storeDevice(deviceOwnerJid, deviceId);
         }
     }
 }
@@ -2989,9 +4181,15 @@ QXmppTask<bool> ManagerPrivate::changeDeviceLabel(const QString &deviceLabel)
 //
 // \return the result of the request
 //
-QXmppTask<QXmppPubSubManager::ItemResult<QXmppOmemoDeviceListItem>> ManagerPrivate::requestDeviceList(const QString &jid)
+QXmppTask<QXmppPubSubManager::Result> ManagerPrivate::requestDeviceList(const QString &jid)
 {
-    QXmppPromise<QXmppPubSubManager::ItemResult<QXmppOmemoDeviceListItem>> interface;
+    // Changes of device lists that are up to date are received via PEP notifications.
+    if (isDeviceListUpToDate(jid)) {
+        return makeReadyTask(Result(Success()));
+    }
+
+    QXmppPromise<Result> interface;
+    ++deviceListRequestsCount;
 
     // Since the usage of the item ID \c QXmppPubSubManager::Current is only RECOMMENDED by
     // \xep{0060, Publish-Subscribe} (PubSub) but not obligatory, all items are requested even if
@@ -3005,8 +4203,8 @@ QXmppTask<QXmppPubSubManager::ItemResult<QXmppOmemoDeviceListItem>> ManagerPriva
             QString errorMessage = u"Device list for JID '" + jid + u"' could not be retrieved because the node does not contain any item";
             warning(errorMessage);
             interface.finish(QXmppError { errorMessage, {} });
-        } else if (const auto item = updateContactDevices(jid, items); item) {
-            interface.finish(*item);
+        } else if (updateContactDevices(jid, items)) {
+            interface.finish(Success());
         } else {
             interface.finish(QXmppError { u"Device list for JID '" + jid + u"' could not be retrieved because the node does not contain an appropriate item", {} });
         }
@@ -3014,6 +4212,25 @@ QXmppTask<QXmppPubSubManager::ItemResult<QXmppOmemoDeviceListItem>> ManagerPriva
     return interface.task();
 }
 
+//
+// Returns whether the device list of a contact does not need to be requested.
+//
+// That is the case if the device list has been received and its changes are received via PEP
+// notifications during the current connection.
+// Those are either received because of the contact's presence subscription or because the
+// device list has been subscribed manually.
+// Notifications sent while being disconnected can be missed.
+// Thus, the device lists are requested again after a reconnection.
+//
+// \param jid JID of the contact whose device list is checked
+//
+// \return whether the stored device list is up to date
+//
+bool ManagerPrivate::isDeviceListUpToDate(const QString &jid) const
+{
+    return jidsOfNotifiedDeviceLists.contains(jid) && deviceLists.contains(jid);
+}
+
 //
 // Subscribes to the device list of a contact if the contact's device is not stored yet.
 //
@@ -3051,8 +4268,12 @@ QXmppTask<QXmppPubSubManager::Result> ManagerPrivate::subscribeToDeviceList(cons
             jidsOfManuallySubscribedDevices.append(jid);
 
             auto future = requestDeviceList(jid);
-            future.then(q, [=](auto result) mutable {
-                interface.finish(mapToSuccess(std::move(result)));
+            future.then(q, [=, this](Result result) mutable {
+                if (std::holds_alternative<Success>(result)) {
+                    jidsOfNotifiedDeviceLists.insert(jid);
+                }
+
+                interface.finish(std::move(result));
             });
         }
     });
@@ -3120,6 +4341,7 @@ QXmppTask<QXmppPubSubManager::Result> ManagerPrivate::unsubscribeFromDeviceList(
             warning(u"Device list for JID '" + jid + u"' could not be unsubscribed: " + errorToString(*error));
         } else {
             jidsOfManuallySubscribedDevices.removeAll(jid);
+            jidsOfNotifiedDeviceLists.remove(jid);
         }
 
         interface.finish(std::move(result));
@@ -3145,6 +4367,7 @@ QXmppTask<bool> ManagerPrivate::resetOwnDevice()
                         signedPreKeyPairs.clear();
                         deviceBundle = {};
                         devices.clear();
+                        sessionsLastUsed.clear();
 
                         Q_EMIT q->allDevicesRemoved();
                     }
@@ -3167,6 +4390,17 @@ QXmppTask<void> QXmppOmemoManagerPrivate::resetOwnDeviceLocally()
 
     isStarted = false;
 
+    deviceStorageTimer.stop();
+    devicesToBeStored.clear();
+    cachedDeviceBundles.clear();
+    deviceLists.clear();
+    jidsOfNotifiedDeviceLists.clear();
+    ownDevice.publishedDataHash.clear();
+    deviceBundlePublicationTimer.stop();
+    isDeviceBundlePublicationPending = false;
+    isPreKeyPairsGenerationRunning = false;
+    ++preKeyPairsGeneration;
+
     auto future = trustManager->resetAll(ns_omemo_2.toString());
     future.then(q, [this, interface]() mutable {
         auto future = omemoStorage->resetAll();
@@ -3195,6 +4429,7 @@ QXmppTask<bool> ManagerPrivate::resetAll()
                         signedPreKeyPairs.clear();
                         deviceBundle = {};
                         devices.clear();
+                        sessionsLastUsed.clear();
 
                         Q_EMIT q->allDevicesRemoved();
                     }
@@ -3347,6 +4582,16 @@ bool ManagerPrivate::buildSession(signal_protocol_address address, const QXmppOm
         return false;
     }
 
+    // Do not reuse the consumed pre key when building another session via the cached device
+    // bundle.
+    if (auto itr = cachedDeviceBundles.find({ extractJid(address), uint32_t(address.device_id) }); itr != cachedDeviceBundles.end()) {
+        itr->deviceBundle.removePublicPreKey(publicPreKeyId);
+
+        if (itr->deviceBundle.publicPreKeys().isEmpty()) {
+            cachedDeviceBundles.erase(itr);
+        }
+    }
+
     return true;
 }
 
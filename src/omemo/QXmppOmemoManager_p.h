@@ -11,12 +11,18 @@
 #include "QXmppOmemoDeviceBundle_p.h"
 #include "QXmppOmemoManager.h"
 #include "QXmppOmemoStorage.h"
+#include "QXmppPromise.h"
 #include "QXmppPubSubManager.h"
 
+#include "OmemoCryptoContexts.h"
 #include "OmemoLibWrappers.h"
 #include "QcaInitializer_p.h"
 
+#include <QDeadlineTimer>
 #include <QDomElement>
+#include <QElapsedTimer>
+#include <QQueue>
+#include <QThreadPool>
 #include <QTimer>
 #include <QtCrypto>
 
@@ -63,6 +69,17 @@ constexpr uint32_t PRE_KEY_ID_MAX = std::numeric_limits<int32_t>::max();
 constexpr uint32_t SIGNED_PRE_KEY_ID_MAX = std::numeric_limits<int32_t>::max();
 constexpr uint32_t PRE_KEY_INITIAL_CREATION_COUNT = 100;
 
+// count of pre key pairs below which new ones are generated in the background up to
+// PRE_KEY_INITIAL_CREATION_COUNT
+constexpr int PRE_KEY_LOW_WATER_MARK = 90;
+
+// delay for collecting generated pre keys of the own device bundle before publishing it once
+constexpr auto DEVICE_BUNDLE_PUBLICATION_DELAY = 10s;
+
+// delay for collecting pre keys consumed by sessions being built at once before publishing the
+// own device bundle without them
+constexpr auto CONSUMED_PRE_KEYS_PUBLICATION_DELAY = 500ms;
+
 // maximum count of devices stored per JID
 constexpr int DEVICES_PER_JID_MAX = 200;
 
@@ -81,6 +98,18 @@ constexpr auto DEVICE_REMOVAL_INTERVAL = 24h * 7 * 12;
 // interval to check for devices removed from their servers
 constexpr auto DEVICE_REMOVAL_CHECK_INTERVAL = 24h;
 
+// delay for collecting changed devices before storing them in one batch
+constexpr auto DEVICE_STORAGE_DELAY = 100ms;
+
+// time since their last use during which sessions loaded on demand are not evicted
+constexpr auto SESSION_EVICTION_GRACE_PERIOD = 1min;
+
+// time during which fetched device bundles are reused
+constexpr auto DEVICE_BUNDLE_CACHE_TTL = 5min;
+
+// maximum count of device bundle requests running at the same time
+constexpr int DEVICE_BUNDLE_REQUESTS_MAX = 10;
+
 constexpr QStringView PAYLOAD_CIPHER_TYPE = u"aes256";
 constexpr QCA::Cipher::Mode PAYLOAD_CIPHER_MODE = QCA::Cipher::CBC;
 constexpr QCA::Cipher::Padding PAYLOAD_CIPHER_PADDING = QCA::Cipher::PKCS7;
@@ -101,11 +130,33 @@ constexpr uint32_t PAYLOAD_AUTHENTICATION_KEY_SIZE = 32;
 constexpr uint32_t SCE_RPAD_SIZE_MIN = 0;
 constexpr uint32_t SCE_RPAD_SIZE_MAX = 200;
 
+struct GeneratedPreKeyPairs {
+    // pre key IDs mapped to serialized pre key pairs
+    QHash<uint32_t, QByteArray> preKeyPairs;
+    // pre key IDs mapped to serialized public pre keys
+    QHash<uint32_t, QByteArray> publicPreKeys;
+};
+
 struct PayloadEncryptionResult {
     QCA::SecureArray decryptionData;
     QByteArray encryptedPayload;
 };
 
+// JID and ID of a device
+using DeviceKey = std::pair<QString, uint32_t>;
+
+struct CachedDeviceBundle {
+    QXmppOmemoDeviceBundle deviceBundle;
+    QDeadlineTimer expiry;
+};
+
+// device for whom an OMEMO envelope is created
+struct OmemoEnvelopeRequest {
+    QString jid;
+    uint32_t deviceId = 0;
+    bool isKeyExchange = false;
+};
+
 struct DecryptionResult {
     QDomElement sceContent;
     QXmppE2eeMetadata e2eeMetadata;
@@ -136,8 +187,11 @@ public:
     QXmppPubSubManager *pubSubManager = nullptr;
 
     QcaInitializer cryptoLibInitializer;
+    CryptoContextPool cryptoContexts;
     QTimer signedPreKeyPairsRenewalTimer;
     QTimer deviceRemovalTimer;
+    QTimer deviceStorageTimer;
+    QTimer deviceBundlePublicationTimer;
 
     TrustLevels acceptedSessionBuildingTrustLevels = ACCEPTED_TRUST_LEVELS;
 
@@ -152,6 +206,47 @@ public:
     // recipient JID mapped to device ID mapped to device
     QHash<QString, QHash<uint32_t, QXmppOmemoStorage::Device>> devices;
 
+    // JIDs mapped to IDs of devices with changes not stored yet
+    QHash<QString, QSet<uint32_t>> devicesToBeStored;
+
+    // sessions loaded on demand (see QXmppOmemoManager::setSessionCacheSize())
+    int sessionCacheSize = 0;
+    bool areSessionsLoadedOnDemand = false;
+    QElapsedTimer sessionUsageTimer;
+    // JIDs whose sessions are loaded mapped to the time of their last use
+    QHash<QString, qint64> sessionsLastUsed;
+    // JIDs whose sessions are being loaded mapped to the waiting requests
+    QHash<QString, QList<QXmppPromise<void>>> sessionLoadingRequests;
+
+    // fetched device bundles which have not expired yet
+    QHash<DeviceKey, CachedDeviceBundle> cachedDeviceBundles;
+    // devices whose bundles are being fetched mapped to the waiting requests
+    QHash<DeviceKey, QList<QXmppPromise<std::optional<QXmppOmemoDeviceBundle>>>> deviceBundleRequests;
+    // devices whose bundles are fetched once fewer requests are running
+    QQueue<DeviceKey> queuedDeviceBundleRequests;
+    int runningDeviceBundleRequestsCount = 0;
+
+    // contact JIDs mapped to the states of their received device lists
+    QHash<QString, QXmppOmemoStorage::DeviceList> deviceLists;
+    // contact JIDs whose device lists are kept up to date via PEP notifications during the
+    // current connection
+    QSet<QString> jidsOfNotifiedDeviceLists;
+    int deviceListRequestsCount = 0;
+
+    // pre key pairs generated in the background (see replenishPreKeyPairs())
+    bool isPreKeyPairsGenerationRunning = false;
+    // incremented on reset to discard pre key pairs generated for the previous device
+    uint32_t preKeyPairsGeneration = 0;
+    int generatedPreKeyPairsCount = 0;
+    int deviceBundlePublicationsCount = 0;
+    // device bundle publication after a pre key pair has been consumed (see
+    // publishDeviceBundleNow())
+    bool isDeviceBundlePublicationRunning = false;
+    bool isDeviceBundlePublicationPending = false;
+
+    // envelopes created in parallel (see QXmppOmemoManager::setEnvelopeEncryptionThreadCount())
+    int envelopeEncryptionThreadCount = 0;
+
     QList<QString> jidsOfManuallySubscribedDevices;
 
     OmemoContextPtr globalContext;
@@ -164,6 +259,16 @@ public:
     signal_protocol_signed_pre_key_store signedPreKeyStore;
     signal_protocol_session_store sessionStore;
 
+    // Declared last to wait for running generations before the crypto provider's data is
+    // destroyed.
+    QThreadPool preKeyPairsGenerationThreadPool;
+    // Declared last to wait for running payload decryptions of decryptMessages() before the
+    // crypto contexts are destroyed.
+    QThreadPool payloadDecryptionThreadPool;
+    // Declared last to wait for running envelope encryptions of
+    // createOmemoEnvelopesDataInParallel() before the crypto contexts are destroyed.
+    std::unique_ptr<QThreadPool> envelopeEncryptionThreadPool;
+
     QXmppOmemoManagerPrivate(QXmppOmemoManager *parent, QXmppOmemoStorage *omemoStorage);
 
     void init();
@@ -185,9 +290,24 @@ public:
     void schedulePeriodicTasks();
     void renewSignedPreKeyPairs();
     bool updateSignedPreKeyPair(ratchet_identity_key_pair *identityKeyPair);
-    bool renewPreKeyPairs(uint32_t keyPairBeingRenewed);
+    void setDeviceBundleSignedPublicPreKey(uint32_t signedPreKeyId, session_signed_pre_key *signedPreKeyPair);
+    bool restoreDeviceBundle();
+    void removePreKeyPair(uint32_t preKeyId);
+    uint32_t nextPreKeyId(uint32_t count) const;
     bool updatePreKeyPairs(uint32_t count = 1);
+    void addPreKeyPairs(GeneratedPreKeyPairs &&generatedPreKeyPairs, uint32_t firstPreKeyId, uint32_t count);
+    void replenishPreKeyPairs();
+    void publishDeviceBundleLater();
+    void publishDeviceBundleSoon();
+    void publishDeviceBundleNow();
     void removeDevicesRemovedFromServer();
+    void storeDeviceLater(const QString &jid, uint32_t deviceId);
+    QXmppTask<void> storePendingDevices();
+    QXmppTask<void> storeDevice(const QString &jid, uint32_t deviceId);
+
+    bool areSessionsLoaded(const QString &jid) const;
+    QXmppTask<void> loadSessions(const QList<QString> &jids);
+    void evictSessions();
 
     QXmppTask<QXmppE2eeExtension::MessageEncryptResult> encryptMessageForRecipients(QXmppMessage &&message,
                                                                                     QVector<QString> recipientJids,
@@ -198,8 +318,11 @@ public:
     template<typename T>
     QByteArray createSceEnvelope(const T &stanza);
     QByteArray createOmemoEnvelopeData(const signal_protocol_address &address, const QCA::SecureArray &payloadDecryptionData) const;
+    QXmppTask<QVector<QByteArray>> createOmemoEnvelopesData(const QVector<OmemoEnvelopeRequest> &requests, const QCA::SecureArray &payloadDecryptionData);
+    QXmppTask<QVector<QByteArray>> createOmemoEnvelopesDataInParallel(const QVector<OmemoEnvelopeRequest> &requests, const QCA::SecureArray &payloadDecryptionData);
 
     QXmppTask<std::optional<QXmppMessage>> decryptMessage(QXmppMessage stanza);
+    QXmppTask<QVector<std::optional<QXmppMessage>>> decryptMessages(QVector<QXmppMessage> stanzas);
     QXmppTask<std::optional<IqDecryptionResult>> decryptIq(const QDomElement &iqElement);
     template<typename T>
     QXmppTask<std::optional<DecryptionResult>> decryptStanza(T stanza,
@@ -208,6 +331,12 @@ public:
                                                              const QXmppOmemoEnvelope &omemoEnvelope,
                                                              const QByteArray &omemoPayload,
                                                              bool isMessageStanza = true);
+    template<typename T>
+    std::optional<DecryptionResult> readSceEnvelope(const T &stanza,
+                                                    const QString &senderJid,
+                                                    uint32_t senderDeviceId,
+                                                    const QByteArray &serializedSceEnvelope,
+                                                    bool isMessageStanza);
     QXmppTask<QByteArray> extractSceEnvelope(const QString &senderJid,
                                              uint32_t senderDeviceId,
                                              const QXmppOmemoEnvelope &omemoEnvelope,
@@ -250,7 +379,11 @@ public:
     template<typename Function>
     void publishDeviceBundleItemWithOptions(Function continuation);
     QXmppOmemoDeviceBundleItem deviceBundleItem() const;
-    QXmppTask<std::optional<QXmppOmemoDeviceBundle>> requestDeviceBundle(const QString &deviceOwnerJid, uint32_t deviceId) const;
+    QByteArray ownDataHash() const;
+    void storePublishedDataHash();
+    QXmppTask<std::optional<QXmppOmemoDeviceBundle>> requestDeviceBundle(const QString &deviceOwnerJid, uint32_t deviceId);
+    void fetchDeviceBundle(const DeviceKey &device);
+    void fetchQueuedDeviceBundles();
     template<typename Function>
     void deleteDeviceBundle(Function continuation);
 
@@ -284,6 +417,7 @@ public:
     template<typename Function>
     void updateOwnDevicesLocally(bool isDeviceListNodeExistent, Function continuation);
     std::optional<QXmppOmemoDeviceListItem> updateContactDevices(const QString &deviceOwnerJid, const QVector<QXmppOmemoDeviceListItem> &deviceListItems);
+    void updateContactDeviceList(const QString &deviceOwnerJid, const QXmppOmemoDeviceListItem &deviceListItem);
     void updateDevices(const QString &deviceOwnerJid, const QXmppOmemoDeviceListItem &deviceListItem);
     void handleIrregularDeviceListChanges(const QString &deviceOwnerJid);
     template<typename Function>
@@ -310,7 +444,8 @@ public:
 
     QXmppTask<bool> changeDeviceLabel(const QString &deviceLabel);
 
-    QXmppTask<QXmppPubSubManager::ItemResult<QXmppOmemoDeviceListItem>> requestDeviceList(const QString &jid);
+    bool isDeviceListUpToDate(const QString &jid) const;
+    QXmppTask<Result> requestDeviceList(const QString &jid);
     void subscribeToNewDeviceLists(const QString &jid, uint32_t deviceId);
     QXmppTask<Result> subscribeToDeviceList(const QString &jid);
     QXmppTask<QVector<QXmppOmemoManager::DevicesResult>> unsubscribeFromDeviceLists(const QList<QString> &jids);
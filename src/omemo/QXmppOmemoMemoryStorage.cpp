@@ -32,10 +32,44 @@ public:
     // IDs of signed pre key pairs mapped to signed pre key pairs
     QHash<uint32_t, QXmppOmemoStorage::SignedPreKeyPair> signedPreKeyPairs;
 
-    // recipient JID mapped to device ID mapped to device
+    // recipient JID mapped to device ID mapped to device without its session
     QHash<QString, QHash<uint32_t, QXmppOmemoStorage::Device>> devices;
+
+    // recipient JID mapped to device ID mapped to session
+    //
+    // The sessions are stored separately so that allDataWithoutSessions() and
+    // sessions() do not need to copy or filter the devices.
+    QHash<QString, QHash<uint32_t, QByteArray>> sessions;
+
+    // contact JID mapped to the state of the contact's device list
+    QHash<QString, QXmppOmemoStorage::DeviceList> deviceLists;
+
+    void addDevice(const QString &jid, uint32_t deviceId, QXmppOmemoStorage::Device device);
+    void removeSession(const QString &jid, uint32_t deviceId);
 };
 
+void QXmppOmemoMemoryStoragePrivate::addDevice(const QString &jid, uint32_t deviceId, QXmppOmemoStorage::Device device)
+{
+    if (device.session.isEmpty()) {
+        removeSession(jid, deviceId);
+    } else {
+        sessions[jid].insert(deviceId, device.session);
+        device.session.clear();
+    }
+
+    devices[jid].insert(deviceId, device);
+}
+
+void QXmppOmemoMemoryStoragePrivate::removeSession(const QString &jid, uint32_t deviceId)
+{
+    if (auto userSessions = sessions.find(jid); userSessions != sessions.end()) {
+        userSessions->remove(deviceId);
+        if (userSessions->isEmpty()) {
+            sessions.erase(userSessions);
+        }
+    }
+}
+
 ///
 /// Constructs an OMEMO memory storage.
 ///
@@ -48,11 +82,34 @@ QXmppOmemoMemoryStorage::~QXmppOmemoMemoryStorage() = default;
 
 /// \cond
 QXmppTask<QXmppOmemoStorage::OmemoData> QXmppOmemoMemoryStorage::allData()
+{
+    auto devices = d->devices;
+    for (auto itr = d->sessions.cbegin(); itr != d->sessions.cend(); ++itr) {
+        auto &userDevices = devices[itr.key()];
+        for (auto sessionItr = itr->cbegin(); sessionItr != itr->cend(); ++sessionItr) {
+            userDevices[sessionItr.key()].session = sessionItr.value();
+        }
+    }
+
+    return makeReadyTask(std::move(OmemoData { d->ownDevice,
+                                               d->signedPreKeyPairs,
+                                               d->preKeyPairs,
+                                               devices,
+                                               d->deviceLists }));
+}
+
+QXmppTask<QXmppOmemoStorage::OmemoData> QXmppOmemoMemoryStorage::allDataWithoutSessions()
 {
     return makeReadyTask(std::move(OmemoData { d->ownDevice,
                                                d->signedPreKeyPairs,
                                                d->preKeyPairs,
-                                               d->devices }));
+                                               d->devices,
+                                               d->deviceLists }));
+}
+
+QXmppTask<QHash<uint32_t, QByteArray>> QXmppOmemoMemoryStorage::sessions(const QString &jid)
+{
+    return makeReadyTask(d->sessions.value(jid));
 }
 
 QXmppTask<void> QXmppOmemoMemoryStorage::setOwnDevice(const std::optional<OwnDevice> &device)
@@ -87,7 +144,17 @@ QXmppTask<void> QXmppOmemoMemoryStorage::removePreKeyPair(const uint32_t keyId)
 
 QXmppTask<void> QXmppOmemoMemoryStorage::addDevice(const QString &jid, const uint32_t deviceId, const QXmppOmemoStorage::Device &device)
 {
-    d->devices[jid].insert(deviceId, device);
+    d->addDevice(jid, deviceId, device);
+    return makeReadyTask();
+}
+
+QXmppTask<void> QXmppOmemoMemoryStorage::addDevices(const QHash<QString, QHash<uint32_t, Device>> &devices)
+{
+    for (auto itr = devices.cbegin(); itr != devices.cend(); ++itr) {
+        for (auto deviceItr = itr->cbegin(); deviceItr != itr->cend(); ++deviceItr) {
+            d->addDevice(itr.key(), deviceItr.key(), deviceItr.value());
+        }
+    }
     return makeReadyTask();
 }
 
@@ -95,6 +162,7 @@ QXmppTask<void> QXmppOmemoMemoryStorage::removeDevice(const QString &jid, const
 {
     auto &devices = d->devices[jid];
     devices.remove(deviceId);
+    d->removeSession(jid, deviceId);
 
     // Remove the container for the passed JID if the container stores no
     // devices anymore.
@@ -108,6 +176,14 @@ QXmppTask<void> QXmppOmemoMemoryStorage::removeDevice(const QString &jid, const
 QXmppTask<void> QXmppOmemoMemoryStorage::removeDevices(const QString &jid)
 {
     d->devices.remove(jid);
+    d->sessions.remove(jid);
+    d->deviceLists.remove(jid);
+    return makeReadyTask();
+}
+
+QXmppTask<void> QXmppOmemoMemoryStorage::addDeviceList(const QString &jid, const DeviceList &deviceList)
+{
+    d->deviceLists.insert(jid, deviceList);
     return makeReadyTask();
 }
 
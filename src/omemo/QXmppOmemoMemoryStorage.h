@@ -21,6 +21,8 @@ public:
 
     /// \cond
     QXmppTask<OmemoData> allData() override;
+    QXmppTask<OmemoData> allDataWithoutSessions() override;
+    QXmppTask<QHash<uint32_t, QByteArray>> sessions(const QString &jid) override;
 
     QXmppTask<void> setOwnDevice(const std::optional<OwnDevice> &device) override;
 
@@ -31,9 +33,12 @@ public:
     QXmppTask<void> removePreKeyPair(uint32_t keyId) override;
 
     QXmppTask<void> addDevice(const QString &jid, uint32_t deviceId, const Device &device) override;
+    QXmppTask<void> addDevices(const QHash<QString, QHash<uint32_t, Device>> &devices) override;
     QXmppTask<void> removeDevice(const QString &jid, uint32_t deviceId) override;
     QXmppTask<void> removeDevices(const QString &jid) override;
 
+    QXmppTask<void> addDeviceList(const QString &jid, const DeviceList &deviceList) override;
+
     QXmppTask<void> resetAll() override;
     /// \endcond
 
@@ -2,6 +2,12 @@
 //
 // SPDX-License-Identifier: LGPL-2.1-or-later
 
+#include "QXmppOmemoStorage.h"
+
+#include "QXmppFutureUtils_p.h"
+
+using namespace QXmpp::Private;
+
 ///
 /// \class QXmppOmemoStorage
 ///
@@ -87,6 +93,9 @@
 /// Removes all devices of a passed JID from the other devices (i.e., all
 /// devices but the own one).
 ///
+/// The state of the JID's device list stored via addDeviceList() must be
+/// removed as well.
+///
 /// \param jid JID of the device owner
 ///
 
@@ -95,3 +104,129 @@
 ///
 /// Resets all data.
 ///
+
+///
+/// Adds or updates multiple other devices (i.e., all devices but the own one)
+/// at once.
+///
+/// QXmppOmemoManager collects changes of devices (e.g., updated sessions or
+/// counters of unresponded stanzas) and stores them with this method in one
+/// batch. Storages with transactions should override it to write all devices
+/// in one transaction.
+///
+/// The default implementation calls addDevice() for each device.
+///
+/// \param devices JIDs of the device owners mapped to device IDs mapped to the
+/// devices being added
+///
+/// \since QXmpp 1.9
+///
+QXmppTask<void> QXmppOmemoStorage::addDevices(const QHash<QString, QHash<uint32_t, Device>> &devices)
+{
+    qsizetype count = 0;
+    for (const auto &userDevices : devices) {
+        count += userDevices.size();
+    }
+
+    QXmppPromise<void> interface;
+    if (count == 0) {
+        interface.finish();
+        return interface.task();
+    }
+
+    auto remainingCount = std::make_shared<qsizetype>(count);
+
+    for (auto itr = devices.cbegin(); itr != devices.cend(); ++itr) {
+        for (auto deviceItr = itr->cbegin(); deviceItr != itr->cend(); ++deviceItr) {
+            thenWithoutContext(addDevice(itr.key(), deviceItr.key(), deviceItr.value()), [interface, remainingCount]() mutable {
+                if (--(*remainingCount) == 0) {
+                    interface.finish();
+                }
+            });
+        }
+    }
+
+    return interface.task();
+}
+
+///
+/// Returns all data used by OMEMO except the sessions of the other devices.
+///
+/// QXmppOmemoManager uses this method instead of allData() if the sessions are
+/// loaded on demand (see QXmppOmemoManager::setSessionCacheSize()).
+///
+/// Storages must override it together with sessions() in order to support
+/// loading sessions on demand.
+/// The default implementation returns allData() and thus loads all sessions at
+/// once, which is only meant as a fallback for storages not overriding it.
+///
+/// \return the OMEMO data with empty sessions of the other devices
+///
+/// \since QXmpp 1.9
+///
+QXmppTask<QXmppOmemoStorage::OmemoData> QXmppOmemoStorage::allDataWithoutSessions()
+{
+    return allData();
+}
+
+///
+/// Returns the sessions of all devices of a JID.
+///
+/// QXmppOmemoManager uses this method to load the sessions of a contact on
+/// demand before encrypting or decrypting (see
+/// QXmppOmemoManager::setSessionCacheSize()).
+///
+/// Storages must override it together with allDataWithoutSessions() in order
+/// to support loading sessions on demand.
+/// The default implementation extracts the sessions from allData(), which
+/// loads all data for each call and is only meant as a fallback for storages
+/// not overriding it.
+///
+/// \param jid JID of the device owner
+///
+/// \return device IDs mapped to their sessions (devices without sessions can be
+///         omitted)
+///
+/// \since QXmpp 1.9
+///
+QXmppTask<QHash<uint32_t, QByteArray>> QXmppOmemoStorage::sessions(const QString &jid)
+{
+    QXmppPromise<QHash<uint32_t, QByteArray>> interface;
+
+    thenWithoutContext(allData(), [interface, jid](OmemoData &&data) mutable {
+        QHash<uint32_t, QByteArray> sessions;
+        const auto userDevices = data.devices.value(jid);
+        for (auto itr = userDevices.cbegin(); itr != userDevices.cend(); ++itr) {
+            if (!itr->session.isEmpty()) {
+                sessions.insert(itr.key(), itr->session);
+            }
+        }
+        interface.finish(std::move(sessions));
+    });
+
+    return interface.task();
+}
+
+///
+/// Adds or updates the state of a contact's device list.
+///
+/// QXmppOmemoManager uses the stored states after a restart to skip processing
+/// device lists that have not changed.
+///
+/// The default implementation does not store anything.
+/// In that case, all device lists are processed again after each restart.
+///
+/// \param jid JID of the device list's owner
+/// \param deviceList state of the device list
+///
+/// \since QXmpp 1.9
+///
+QXmppTask<void> QXmppOmemoStorage::addDeviceList(const QString &jid, const DeviceList &deviceList)
+{
+    Q_UNUSED(jid)
+    Q_UNUSED(deviceList)
+
+    QXmppPromise<void> interface;
+    interface.finish();
+    return interface.task();
+}
@@ -60,6 +60,15 @@ public:
         /// \c std::numeric_limits<int32_t>::max().
         ///
         uint32_t latestPreKeyId = 1;
+
+        ///
+        /// Hash of the device bundle and device element published last
+        ///
+        /// It is used to skip publishing them again if they have not changed.
+        ///
+        /// \since QXmpp 1.9
+        ///
+        QByteArray publishedDataHash;
     };
 
     ///
@@ -123,6 +132,24 @@ public:
         QByteArray data;
     };
 
+    ///
+    /// Contains the state of a contact's device list fetched from the
+    /// contact's server.
+    ///
+    /// \since QXmpp 1.9
+    ///
+    struct DeviceList {
+        ///
+        /// ID of the PubSub item containing the device list
+        ///
+        QString itemId;
+
+        ///
+        /// Hash of the device list's content used to detect changes
+        ///
+        QByteArray hash;
+    };
+
     ///
     /// Contains all OMEMO data.
     ///
@@ -147,6 +174,13 @@ public:
         /// devices (i.e., all devices except the own one)
         ///
         QHash<QString, QHash<uint32_t, Device>> devices;
+
+        ///
+        /// JIDs of the contacts mapped to the states of their device lists
+        ///
+        /// \since QXmpp 1.9
+        ///
+        QHash<QString, DeviceList> deviceLists;
     };
 
     virtual ~QXmppOmemoStorage() = default;
@@ -166,6 +200,13 @@ public:
     virtual QXmppTask<void> removeDevices(const QString &jid) = 0;
 
     virtual QXmppTask<void> resetAll() = 0;
+
+    virtual QXmppTask<void> addDevices(const QHash<QString, QHash<uint32_t, Device>> &devices);
+
+    virtual QXmppTask<OmemoData> allDataWithoutSessions();
+    virtual QXmppTask<QHash<uint32_t, QByteArray>> sessions(const QString &jid);
+
+    virtual QXmppTask<void> addDeviceList(const QString &jid, const DeviceList &deviceList);
 };
 
 #endif  // QXMPPOMEMOSTORAGE_H
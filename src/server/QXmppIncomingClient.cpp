@@ -6,6 +6,7 @@
 
 #include "QXmppBindIq.h"
 #include "QXmppConstants_p.h"
+#include "QXmppIncomingClient_p.h"
 #include "QXmppPasswordChecker.h"
 #include "QXmppSasl_p.h"
 #include "QXmppStreamFeatures.h"
@@ -14,7 +15,6 @@
 
 #include "Stream.h"
 #include "StringLiterals.h"
-#include "XmppSocket.h"
 
 #include <QDomElement>
 #include <QHostAddress>
@@ -26,32 +26,6 @@ using namespace QXmpp::Private;
 
 constexpr uint RESOURCE_RANDOM_SUFFIX_LENGTH = 8;
 
-class QXmppIncomingClientPrivate
-{
-public:
-    QXmppIncomingClientPrivate(QXmppIncomingClient *qq);
-
-    QTimer *idleTimer = nullptr;
-    XmppSocket socket;
-
-    QString domain;
-    QString jid;
-    QString resource;
-    QXmppPasswordChecker *passwordChecker = nullptr;
-    std::unique_ptr<QXmppSaslServer> saslServer;
-    enum {
-        Sasl,
-        Sasl2
-    } saslVersion = Sasl;
-    std::optional<Sasl2::Authenticate> sasl2AuthRequest;
-
-    void checkCredentials(const QByteArray &response);
-    QString origin() const;
-
-private:
-    QXmppIncomingClient *q;
-};
-
 QXmppIncomingClientPrivate::QXmppIncomingClientPrivate(QXmppIncomingClient *qq)
     : socket(qq),
       q(qq)
@@ -78,7 +52,63 @@ void QXmppIncomingClientPrivate::checkCredentials(const QByteArray &response)
         reply->setProperty("__sasl_raw", response);
         QObject::connect(reply, &QXmppPasswordReply::finished,
                          q, &QXmppIncomingClient::onDigestReply);
+    } else if (auto *scramServer = qobject_cast<QXmppSaslServerScram *>(saslServer.get())) {
+        auto *scramChecker = dynamic_cast<QXmppScramPasswordChecker *>(passwordChecker);
+        if (!scramChecker) {
+            // the mechanism is only offered for SCRAM password checkers
+            auto *reply = new QXmppScramCredentialsReply(q);
+            reply->setError(QXmppPasswordReply::AuthorizationError);
+            reply->setProperty("__sasl_raw", response);
+            QObject::connect(reply, &QXmppPasswordReply::finished,
+                             q, &QXmppIncomingClient::onDigestReply);
+            reply->finishLater();
+            return;
+        }
+
+        QXmppPasswordReply *reply = scramChecker->getScramCredentials(request, scramServer->algorithm());
+        reply->setParent(q);
+        reply->setProperty("__sasl_raw", response);
+        QObject::connect(reply, &QXmppPasswordReply::finished,
+                         q, &QXmppIncomingClient::onDigestReply);
+    }
+}
+
+// Stops reading from the socket until the rate limits allow new data again.
+void QXmppIncomingClientPrivate::checkRateLimit()
+{
+    if (socket.isReadingPaused()) {
+        return;
+    }
+
+    auto delay = rateLimiter.delay();
+    if (bareJidRateLimiter) {
+        delay = std::max(delay, bareJidRateLimiter->delay());
+    }
+
+    if (delay.count() > 0) {
+        socket.setReadingPaused(true);
+        rateLimitTimer->start(delay);
+        Q_EMIT q->updateCounter(u"incoming-client.rate-limited"_s);
+        Q_EMIT q->updateCounter(u"incoming-client.rate-limited-ms"_s, delay.count());
+    } else {
+        socket.setMaximumReadSize(maximumReadSize());
+    }
+}
+
+// Returns how many bytes may be read without exceeding the byte rate limits,
+// 0 if bytes are not limited.
+qint64 QXmppIncomingClientPrivate::maximumReadSize()
+{
+    auto size = rateLimiter.availableBytes();
+    if (bareJidRateLimiter) {
+        const auto sharedSize = bareJidRateLimiter->availableBytes();
+        if (size < 0 || (sharedSize >= 0 && sharedSize < size)) {
+            size = sharedSize;
+        }
     }
+
+    // read at least one byte, reading is paused once the limit is exceeded
+    return size < 0 ? 0 : std::max(size, qint64(1));
 }
 
 QString QXmppIncomingClientPrivate::origin() const
@@ -106,6 +136,13 @@ QXmppIncomingClient::QXmppIncomingClient(QSslSocket *socket, const QString &doma
     connect(&d->socket, &XmppSocket::stanzaReceived, this, &QXmppIncomingClient::handleStanza);
     connect(&d->socket, &XmppSocket::streamReceived, this, &QXmppIncomingClient::handleStream);
     connect(&d->socket, &XmppSocket::streamClosed, this, &QXmppIncomingClient::disconnectFromHost);
+    connect(&d->socket, &XmppSocket::bytesReceived, this, [this](qint64 bytes) {
+        d->rateLimiter.consumeBytes(bytes);
+        if (d->bareJidRateLimiter) {
+            d->bareJidRateLimiter->consumeBytes(bytes);
+        }
+        d->checkRateLimit();
+    });
 
     d->domain = domain;
 
@@ -123,6 +160,14 @@ QXmppIncomingClient::QXmppIncomingClient(QSslSocket *socket, const QString &doma
     d->idleTimer->setSingleShot(true);
     connect(d->idleTimer, &QTimer::timeout,
             this, &QXmppIncomingClient::onTimeout);
+
+    // resume reading once the rate limits allow it
+    d->rateLimitTimer = new QTimer(this);
+    d->rateLimitTimer->setSingleShot(true);
+    connect(d->rateLimitTimer, &QTimer::timeout, this, [this]() {
+        d->socket.setReadingPaused(false);
+        d->checkRateLimit();
+    });
 }
 
 QXmppIncomingClient::~QXmppIncomingClient() = default;
@@ -184,6 +229,20 @@ void QXmppIncomingClient::setPasswordChecker(QXmppPasswordChecker *checker)
     d->passwordChecker = checker;
 }
 
+///
+/// Limits the stanzas and bytes per second read from this client.
+///
+/// Once a limit is exceeded, no more data is read from the socket until enough
+/// time has passed. A value of 0 disables the respective limit.
+///
+/// \since QXmpp 1.9
+///
+void QXmppIncomingClient::setRateLimit(int stanzasPerSecond, qint64 bytesPerSecond)
+{
+    d->rateLimiter = RateLimiter(stanzasPerSecond, double(bytesPerSecond));
+    d->checkRateLimit();
+}
+
 /// \cond
 void QXmppIncomingClient::handleStart()
 {
@@ -239,6 +298,9 @@ void QXmppIncomingClient::sendStreamFeatures()
         features.setSessionMode(QXmppStreamFeatures::Enabled);
     } else if (d->passwordChecker) {
         QStringList mechanisms;
+        if (dynamic_cast<QXmppScramPasswordChecker *>(d->passwordChecker)) {
+            mechanisms << u"SCRAM-SHA-512"_s << u"SCRAM-SHA-256"_s;
+        }
         mechanisms << u"PLAIN"_s;
         if (d->passwordChecker->hasGetPassword()) {
             mechanisms << u"DIGEST-MD5"_s;
@@ -262,6 +324,14 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
         d->idleTimer->start();
     }
 
+    if (!nodeRecv.isNull()) {
+        d->rateLimiter.consumeStanza();
+        if (d->bareJidRateLimiter) {
+            d->bareJidRateLimiter->consumeStanza();
+        }
+        d->checkRateLimit();
+    }
+
     if (StarttlsRequest::fromDom(nodeRecv)) {
         sendData(serializeXml(StarttlsProceed()));
         d->socket.socket()->flush();
@@ -320,6 +390,17 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
                 info(u"Authentication succeeded for '%1' from %2"_s.arg(d->jid, d->origin()));
                 Q_EMIT updateCounter(u"incoming-client.auth.success"_s);
                 onSasl2Authenticated();
+            } else if (auto *scramServer = qobject_cast<QXmppSaslServerScram *>(d->saslServer.get());
+                       result == QXmppSaslServer::Challenge && scramServer && scramServer->isClientVerified()) {
+                // SASL 2 sends the server-final-message as additional data of the success
+                // element instead of waiting for an empty response to another challenge
+                d->jid = u"%1@%2"_s.arg(d->saslServer->username(), d->domain);
+                info(u"Authentication succeeded for '%1' from %2"_s.arg(d->jid, d->origin()));
+                Q_EMIT updateCounter(u"incoming-client.auth.success"_s);
+                d->sasl2SuccessData = challenge;
+                onSasl2Authenticated();
+            } else if (result == QXmppSaslServer::Challenge) {
+                sendData(serializeXml(Sasl2::Challenge { challenge }));
             } else {
                 d->sasl2AuthRequest.reset();
                 sendData(serializeXml(Sasl2::Failure { Sasl::ErrorCondition::NotAuthorized, {} }));
@@ -383,6 +464,8 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
                 Q_EMIT updateCounter(u"incoming-client.auth.success"_s);
                 sendData(serializeXml(Sasl::Success()));
                 handleStart();
+            } else if (result == QXmppSaslServer::Challenge) {
+                sendData(serializeXml(Sasl::Challenge { challenge }));
             } else {
                 // FIXME: what condition?
                 sendData(serializeXml(Sasl::Failure()));
@@ -479,7 +562,13 @@ void QXmppIncomingClient::onDigestReply()
     }
 
     QByteArray challenge;
-    d->saslServer->setPasswordDigest(reply->digest());
+    if (auto *scramServer = qobject_cast<QXmppSaslServerScram *>(d->saslServer.get())) {
+        const auto *scramReply = qobject_cast<QXmppScramCredentialsReply *>(reply);
+        const auto credentials = scramReply ? scramReply->scramCredentials() : QXmppScramCredentials();
+        scramServer->setCredentials(credentials.salt, credentials.iterations, credentials.storedKey, credentials.serverKey);
+    } else {
+        d->saslServer->setPasswordDigest(reply->digest());
+    }
 
     QXmppSaslServer::Response result = d->saslServer->respond(reply->property("__sasl_raw").toByteArray(), challenge);
     if (result != QXmppSaslServer::Challenge) {
@@ -567,6 +656,7 @@ void QXmppIncomingClient::onTimeout()
 void QXmppIncomingClient::onSasl2Authenticated()
 {
     Q_ASSERT(d->sasl2AuthRequest);
+    const auto additionalData = std::exchange(d->sasl2SuccessData, std::nullopt);
 
     if (d->sasl2AuthRequest->bindRequest) {
         // resource binding
@@ -578,12 +668,12 @@ void QXmppIncomingClient::onSasl2Authenticated()
         }
         d->jid = u"%1/%2"_s.arg(QXmppUtils::jidToBareJid(d->jid), d->resource);
 
-        sendData(serializeXml(Sasl2::Success { {}, d->jid, Bind2Bound {} }));
+        sendData(serializeXml(Sasl2::Success { additionalData, d->jid, Bind2Bound {} }));
 
         // resource is bound now
         Q_EMIT connected();
     } else {
-        sendData(serializeXml(Sasl2::Success { {}, d->jid, {} }));
+        sendData(serializeXml(Sasl2::Success { additionalData, d->jid, {} }));
     }
     // clean up
     d->sasl2AuthRequest.reset();
@@ -35,6 +35,7 @@ public:
 
     void setInactivityTimeout(int secs);
     void setPasswordChecker(QXmppPasswordChecker *checker);
+    void setRateLimit(int stanzasPerSecond, qint64 bytesPerSecond);
 
     /// This signal is emitted when an element is received.
     Q_SIGNAL void elementReceived(const QDomElement &element);
@@ -0,0 +1,66 @@
+// SPDX-FileCopyrightText: 2010 Jeremy Lainé <jeremy.laine@m4x.org>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#ifndef QXMPPINCOMINGCLIENT_P_H
+#define QXMPPINCOMINGCLIENT_P_H
+
+#include "QXmppIncomingClient.h"
+#include "QXmppRateLimiter_p.h"
+#include "QXmppSasl_p.h"
+
+#include "XmppSocket.h"
+
+#include <optional>
+
+class QTimer;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+class QXmppIncomingClientPrivate
+{
+public:
+    QXmppIncomingClientPrivate(QXmppIncomingClient *qq);
+
+    static QXmppIncomingClientPrivate *get(QXmppIncomingClient *client) { return client->d.get(); }
+
+    QTimer *idleTimer = nullptr;
+    QTimer *rateLimitTimer = nullptr;
+    QXmpp::Private::XmppSocket socket;
+    QXmpp::Private::RateLimiter rateLimiter;
+    // shared by all connections of the same bare JID
+    std::shared_ptr<QXmpp::Private::RateLimiter> bareJidRateLimiter;
+
+    QString domain;
+    QString jid;
+    QString resource;
+    QXmppPasswordChecker *passwordChecker = nullptr;
+    std::unique_ptr<QXmppSaslServer> saslServer;
+    enum {
+        Sasl,
+        Sasl2
+    } saslVersion = Sasl;
+    std::optional<QXmpp::Private::Sasl2::Authenticate> sasl2AuthRequest;
+    // server-final-message of SCRAM, sent as additional data of the SASL 2 success
+    std::optional<QByteArray> sasl2SuccessData;
+
+    void checkCredentials(const QByteArray &response);
+    void checkRateLimit();
+    qint64 maximumReadSize();
+    QString origin() const;
+
+private:
+    QXmppIncomingClient *q;
+};
+
+#endif  // QXMPPINCOMINGCLIENT_P_H
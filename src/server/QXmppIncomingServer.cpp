@@ -15,13 +15,71 @@
 #include "StringLiterals.h"
 #include "XmppSocket.h"
 
+#include <chrono>
+
+#include <QDeadlineTimer>
 #include <QDomElement>
 #include <QHostAddress>
+#include <QMutex>
 #include <QSslKey>
 #include <QSslSocket>
 
+using namespace std::chrono_literals;
 using namespace QXmpp::Private;
 
+// Verified dialback keys are trusted for this time, so a peer repeating its
+// dialback result does not need another verification round trip.
+constexpr auto VERIFIED_DIALBACK_KEY_LIFETIME = 1h;
+
+// Keys are bound to the stream they were verified on, so a key cannot be
+// replayed on another stream.
+class VerifiedDialbackKeys
+{
+public:
+    static VerifiedDialbackKeys &instance()
+    {
+        static VerifiedDialbackKeys keys;
+        return keys;
+    }
+
+    bool contains(const QString &localDomain, const QString &remoteDomain, const QString &streamId, const QString &key)
+    {
+        QMutexLocker locker(&m_mutex);
+        const auto itr = m_keys.find(cacheKey(localDomain, remoteDomain, streamId, key));
+        if (itr == m_keys.end()) {
+            return false;
+        }
+        if (itr->hasExpired()) {
+            m_keys.erase(itr);
+            return false;
+        }
+        return true;
+    }
+
+    void insert(const QString &localDomain, const QString &remoteDomain, const QString &streamId, const QString &key)
+    {
+        QMutexLocker locker(&m_mutex);
+        // drop expired entries, so the cache cannot grow without limit
+        for (auto itr = m_keys.begin(); itr != m_keys.end();) {
+            if (itr->hasExpired()) {
+                itr = m_keys.erase(itr);
+            } else {
+                ++itr;
+            }
+        }
+        m_keys.insert(cacheKey(localDomain, remoteDomain, streamId, key), QDeadlineTimer(VERIFIED_DIALBACK_KEY_LIFETIME));
+    }
+
+private:
+    static QString cacheKey(const QString &localDomain, const QString &remoteDomain, const QString &streamId, const QString &key)
+    {
+        return localDomain + u' ' + remoteDomain + u' ' + streamId + u' ' + key;
+    }
+
+    QMutex m_mutex;
+    QHash<QString, QDeadlineTimer> m_keys;
+};
+
 class QXmppIncomingServerPrivate
 {
 public:
@@ -30,6 +88,7 @@ public:
 
     XmppSocket socket;
     QSet<QString> authenticated;
+    QHash<QString, QString> pendingKeys;
     QString domain;
     QString localStreamId;
 
@@ -171,12 +230,30 @@ void QXmppIncomingServer::handleStanza(const QDomElement &stanza)
         if (request.command() == QXmppDialback::Result) {
             debug(u"Received a dialback result from '%1' on %2"_s.arg(domain, d->origin()));
 
+            if (VerifiedDialbackKeys::instance().contains(d->domain, domain, d->localStreamId, request.key())) {
+                info(u"Accepted previously verified key of incoming domain '%1' on %2"_s.arg(domain, d->origin()));
+                QXmppDialback response;
+                response.setCommand(QXmppDialback::Result);
+                response.setTo(domain);
+                response.setFrom(d->domain);
+                response.setType(u"valid"_s);
+                sendPacket(response);
+
+                const bool wasConnected = !d->authenticated.isEmpty();
+                d->authenticated.insert(domain);
+                if (!wasConnected) {
+                    Q_EMIT connected();
+                }
+                return;
+            }
+
             // establish dialback connection
             auto *stream = new QXmppOutgoingServer(d->domain, this);
             connect(stream, &QXmppOutgoingServer::dialbackResponseReceived,
                     this, &QXmppIncomingServer::slotDialbackResponseReceived);
             stream->setVerify(d->localStreamId, request.key());
             stream->connectToHost(domain);
+            d->pendingKeys.insert(domain, request.key());
         } else if (request.command() == QXmppDialback::Verify) {
             debug(u"Received a dialback verify from '%1' on %2"_s.arg(domain, d->origin()));
             Q_EMIT dialbackRequestReceived(request);
@@ -213,6 +290,7 @@ void QXmppIncomingServer::slotDialbackResponseReceived(const QXmppDialback &dial
     // check for success
     if (response.type() == u"valid") {
         info(u"Verified incoming domain '%1' on %2"_s.arg(dialback.from(), d->origin()));
+        VerifiedDialbackKeys::instance().insert(d->domain, dialback.from(), d->localStreamId, d->pendingKeys.take(dialback.from()));
         const bool wasConnected = !d->authenticated.isEmpty();
         d->authenticated.insert(dialback.from());
         if (!wasConnected) {
@@ -220,6 +298,7 @@ void QXmppIncomingServer::slotDialbackResponseReceived(const QXmppDialback &dial
         }
     } else {
         warning(u"Failed to verify incoming domain '%1' on %2"_s.arg(dialback.from(), d->origin()));
+        d->pendingKeys.remove(dialback.from());
         disconnectFromHost();
     }
 
@@ -34,6 +34,8 @@ public:
 
     XmppSocket socket;
     QList<QByteArray> dataQueue;
+    qint64 queuedBytes = 0;
+    qint64 queueLimit = 0;
     QDnsLookup dns;
     QString localDomain;
     QString localStreamKey;
@@ -41,6 +43,7 @@ public:
     QString verifyId;
     QString verifyKey;
     QTimer *dialbackTimer;
+    QTimer *idleTimer;
     bool ready;
 };
 
@@ -78,6 +81,11 @@ QXmppOutgoingServer::QXmppOutgoingServer(const QString &domain, QObject *parent)
     d->dialbackTimer->setSingleShot(true);
     connect(d->dialbackTimer, &QTimer::timeout, this, &QXmppOutgoingServer::sendDialback);
 
+    // create inactivity timer
+    d->idleTimer = new QTimer(this);
+    d->idleTimer->setSingleShot(true);
+    connect(d->idleTimer, &QTimer::timeout, this, &QXmppOutgoingServer::onTimeout);
+
     d->localDomain = domain;
     d->ready = false;
 
@@ -131,9 +139,16 @@ void QXmppOutgoingServer::onDnsLookupFinished()
 void QXmppOutgoingServer::onSocketDisconnected()
 {
     debug(u"Socket disconnected"_s);
+    d->idleTimer->stop();
     Q_EMIT disconnected();
 }
 
+void QXmppOutgoingServer::onTimeout()
+{
+    info(u"Closing idle outgoing server stream to %1"_s.arg(d->remoteDomain));
+    disconnectFromHost();
+}
+
 void QXmppOutgoingServer::handleStart()
 {
     QString data = u"<?xml version='1.0'?><stream:stream"
@@ -159,6 +174,10 @@ void QXmppOutgoingServer::handleStream(const QDomElement &streamElement)
 
 void QXmppOutgoingServer::handleStanza(const QDomElement &stanza)
 {
+    if (d->ready && d->idleTimer->interval()) {
+        d->idleTimer->start();
+    }
+
     if (QXmppStreamFeatures::isStreamFeatures(stanza)) {
         QXmppStreamFeatures features;
         features.parse(stanza);
@@ -203,11 +222,20 @@ void QXmppOutgoingServer::handleStanza(const QDomElement &stanza)
                 info(u"Outgoing server stream to %1 is ready"_s.arg(response.from()));
                 d->ready = true;
 
-                // send queued data
-                for (const auto &data : std::as_const(d->dataQueue)) {
-                    sendData(data);
+                // send queued data in one write
+                if (!d->dataQueue.isEmpty()) {
+                    QByteArray batch;
+                    batch.reserve(d->queuedBytes);
+                    for (const auto &data : std::as_const(d->dataQueue)) {
+                        batch.append(data);
+                    }
+                    d->dataQueue.clear();
+                    d->queuedBytes = 0;
+                    sendData(batch);
+                }
+                if (d->idleTimer->interval()) {
+                    d->idleTimer->start();
                 }
-                d->dataQueue.clear();
 
                 // emit signal
                 Q_EMIT connected();
@@ -233,6 +261,9 @@ void QXmppOutgoingServer::disconnectFromHost()
 /// Sends raw data to the peer.
 bool QXmppOutgoingServer::sendData(const QByteArray &data)
 {
+    if (d->ready && d->idleTimer->interval()) {
+        d->idleTimer->start();
+    }
     return d->socket.sendData(data);
 }
 
@@ -261,13 +292,72 @@ void QXmppOutgoingServer::setVerify(const QString &id, const QString &key)
     d->verifyKey = key;
 }
 
+///
 /// Sends or queues data until connected.
-void QXmppOutgoingServer::queueData(const QByteArray &data)
+///
+/// Returns false if the data was dropped because the queue limit would have been exceeded.
+///
+bool QXmppOutgoingServer::queueData(const QByteArray &data)
 {
     if (isConnected()) {
-        sendData(data);
-    } else {
-        d->dataQueue.append(data);
+        return sendData(data);
+    }
+
+    if (d->queueLimit > 0 && d->queuedBytes + data.size() > d->queueLimit) {
+        warning(u"Outgoing queue for %1 is full, dropping data"_s.arg(d->remoteDomain));
+        return false;
+    }
+
+    d->dataQueue.append(data);
+    d->queuedBytes += data.size();
+    return true;
+}
+
+///
+/// Returns the maximum number of bytes queued until the stream is ready.
+///
+/// A limit of 0 means the queue is unbounded.
+///
+/// \since QXmpp 1.9
+///
+qint64 QXmppOutgoingServer::queueLimit() const
+{
+    return d->queueLimit;
+}
+
+///
+/// Sets the maximum number of bytes queued until the stream is ready.
+///
+/// \since QXmpp 1.9
+///
+void QXmppOutgoingServer::setQueueLimit(qint64 bytes)
+{
+    d->queueLimit = bytes;
+}
+
+///
+/// Returns the number of bytes waiting for the stream to become ready.
+///
+/// \since QXmpp 1.9
+///
+qint64 QXmppOutgoingServer::queuedBytes() const
+{
+    return d->queuedBytes;
+}
+
+///
+/// Sets the number of seconds after which an idle stream is closed.
+///
+/// The timer only runs once the stream is ready. A value of 0 disables the timeout.
+///
+/// \since QXmpp 1.9
+///
+void QXmppOutgoingServer::setInactivityTimeout(int secs)
+{
+    d->idleTimer->stop();
+    d->idleTimer->setInterval(secs * 1000);
+    if (d->ready && d->idleTimer->interval()) {
+        d->idleTimer->start();
     }
 }
 
@@ -31,7 +31,13 @@ public:
     bool isConnected() const;
     Q_SLOT void connectToHost(const QString &domain);
     void disconnectFromHost();
-    Q_SLOT void queueData(const QByteArray &data);
+    Q_SLOT bool queueData(const QByteArray &data);
+
+    qint64 queueLimit() const;
+    void setQueueLimit(qint64 bytes);
+    qint64 queuedBytes() const;
+
+    void setInactivityTimeout(int secs);
 
     /// This signal is emitted when the stream is connected.
     Q_SIGNAL void connected();
@@ -57,6 +63,7 @@ private:
 
     void onDnsLookupFinished();
     void onSocketDisconnected();
+    void onTimeout();
     void sendDialback();
     void slotSslErrors(const QList<QSslError> &errors);
     void socketError(QAbstractSocket::SocketError error);
@@ -4,9 +4,37 @@
 
 #include "QXmppPasswordChecker.h"
 
+#include "QXmppUtils.h"
+
 #include <QCryptographicHash>
+#include <QMessageAuthenticationCode>
+#include <QPasswordDigestor>
 #include <QTimer>
 
+// Iteration count used when SCRAM credentials are derived from a plain password
+constexpr int DEFAULT_SCRAM_ITERATIONS = 4096;
+constexpr int DEFAULT_SCRAM_SALT_SIZE = 16;
+
+///
+/// Derives the SCRAM credentials for \a password.
+///
+/// This is meant to be called when the password is set, so the result can be stored by the
+/// password backend instead of the password.
+///
+QXmppScramCredentials QXmppScramCredentials::fromPassword(QCryptographicHash::Algorithm algorithm, const QString &password, const QByteArray &salt, int iterations)
+{
+    const auto saltedPassword = QPasswordDigestor::deriveKeyPbkdf2(
+        algorithm, password.toUtf8(), salt, iterations, QCryptographicHash::hashLength(algorithm));
+    const auto clientKey = QMessageAuthenticationCode::hash(QByteArrayLiteral("Client Key"), saltedPassword, algorithm);
+
+    return QXmppScramCredentials {
+        salt,
+        iterations,
+        QCryptographicHash::hash(clientKey, algorithm),
+        QMessageAuthenticationCode::hash(QByteArrayLiteral("Server Key"), saltedPassword, algorithm),
+    };
+}
+
 /// Returns the requested domain.
 
 QString QXmppPasswordRequest::domain() const
@@ -178,3 +206,60 @@ bool QXmppPasswordChecker::hasGetPassword() const
 {
     return false;
 }
+
+///
+/// Constructs a new QXmppScramCredentialsReply.
+///
+/// \since QXmpp 1.9
+///
+QXmppScramCredentialsReply::QXmppScramCredentialsReply(QObject *parent)
+    : QXmppPasswordReply(parent)
+{
+}
+
+///
+/// Returns the received SCRAM credentials.
+///
+/// \since QXmpp 1.9
+///
+QXmppScramCredentials QXmppScramCredentialsReply::scramCredentials() const
+{
+    return m_scramCredentials;
+}
+
+///
+/// Sets the received SCRAM credentials.
+///
+/// \since QXmpp 1.9
+///
+void QXmppScramCredentialsReply::setScramCredentials(const QXmppScramCredentials &credentials)
+{
+    m_scramCredentials = credentials;
+}
+
+///
+/// Retrieves the SCRAM credentials for the given username and hash \a algorithm.
+///
+/// Reimplement this method if your backend stores SCRAM credentials (see
+/// QXmppScramCredentials::fromPassword()). The base implementation derives them from
+/// getPassword() with a random salt, which costs a full PBKDF2 run per login.
+///
+/// \since QXmpp 1.9
+///
+QXmppScramCredentialsReply *QXmppScramPasswordChecker::getScramCredentials(const QXmppPasswordRequest &request, QCryptographicHash::Algorithm algorithm)
+{
+    auto *reply = new QXmppScramCredentialsReply;
+
+    QString secret;
+    QXmppPasswordReply::Error error = getPassword(request, secret);
+    if (error == QXmppPasswordReply::NoError) {
+        reply->setScramCredentials(QXmppScramCredentials::fromPassword(
+            algorithm, secret, QXmppUtils::generateRandomBytes(DEFAULT_SCRAM_SALT_SIZE), DEFAULT_SCRAM_ITERATIONS));
+    } else {
+        reply->setError(error);
+    }
+
+    // reply is finished
+    reply->finishLater();
+    return reply;
+}
@@ -7,8 +7,34 @@
 
 #include "QXmppGlobal.h"
 
+#include <QCryptographicHash>
 #include <QObject>
 
+///
+/// \brief The QXmppScramCredentials class holds the salted credentials a server stores for
+/// SCRAM authentication (RFC 5802, section 3).
+///
+/// Storing these instead of the plain password allows the server to verify SCRAM logins without
+/// deriving the salted password (PBKDF2) on every login.
+///
+/// \since QXmpp 1.9
+///
+struct QXMPP_EXPORT QXmppScramCredentials {
+    static QXmppScramCredentials fromPassword(QCryptographicHash::Algorithm algorithm, const QString &password, const QByteArray &salt, int iterations);
+
+    /// Returns whether the credentials are empty.
+    bool isNull() const { return storedKey.isEmpty() || serverKey.isEmpty(); }
+
+    /// The salt used for deriving the salted password
+    QByteArray salt;
+    /// The iteration count used for deriving the salted password
+    int iterations = 0;
+    /// StoredKey := H(HMAC(SaltedPassword, "Client Key"))
+    QByteArray storedKey;
+    /// ServerKey := HMAC(SaltedPassword, "Server Key")
+    QByteArray serverKey;
+};
+
 /// \brief The QXmppPasswordRequest class represents a password request.
 ///
 class QXMPP_EXPORT QXmppPasswordRequest
@@ -76,6 +102,26 @@ private:
     bool m_isFinished;
 };
 
+///
+/// \brief The QXmppScramCredentialsReply class represents a reply containing SCRAM
+/// credentials.
+///
+/// \since QXmpp 1.9
+///
+class QXMPP_EXPORT QXmppScramCredentialsReply : public QXmppPasswordReply
+{
+    Q_OBJECT
+
+public:
+    QXmppScramCredentialsReply(QObject *parent = nullptr);
+
+    QXmppScramCredentials scramCredentials() const;
+    void setScramCredentials(const QXmppScramCredentials &credentials);
+
+private:
+    QXmppScramCredentials m_scramCredentials;
+};
+
 /// \brief The QXmppPasswordChecker class represents an abstract password checker.
 ///
 
@@ -90,4 +136,19 @@ protected:
     virtual QXmppPasswordReply::Error getPassword(const QXmppPasswordRequest &request, QString &password);
 };
 
+///
+/// \brief The QXmppScramPasswordChecker class represents a password checker that can provide
+/// SCRAM credentials.
+///
+/// SCRAM-SHA-256 and SCRAM-SHA-512 are only offered to clients if the server's password checker
+/// is a QXmppScramPasswordChecker.
+///
+/// \since QXmpp 1.9
+///
+class QXMPP_EXPORT QXmppScramPasswordChecker : public QXmppPasswordChecker
+{
+public:
+    virtual QXmppScramCredentialsReply *getScramCredentials(const QXmppPasswordRequest &request, QCryptographicHash::Algorithm algorithm);
+};
+
 #endif
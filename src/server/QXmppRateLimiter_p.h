@@ -0,0 +1,114 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#ifndef QXMPPRATELIMITER_P_H
+#define QXMPPRATELIMITER_P_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <QElapsedTimer>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+namespace QXmpp::Private {
+
+//
+// Token bucket which is refilled continuously with 'rate' tokens per second
+// and allows bursts of up to one second worth of tokens.
+//
+// Consuming more tokens than available puts the bucket into debt, the caller
+// is expected to wait for delay() before consuming again.
+//
+class TokenBucket
+{
+public:
+    TokenBucket() = default;
+    explicit TokenBucket(double rate)
+        : m_rate(rate), m_tokens(rate)
+    {
+        m_timer.start();
+    }
+
+    bool isEnabled() const { return m_rate > 0; }
+
+    void consume(double tokens)
+    {
+        if (isEnabled()) {
+            refill();
+            m_tokens -= tokens;
+        }
+    }
+
+    // Returns the whole tokens available now, or -1 if the bucket is disabled.
+    qint64 availableTokens()
+    {
+        if (!isEnabled()) {
+            return -1;
+        }
+        refill();
+        return std::max(qint64(0), qint64(m_tokens));
+    }
+
+    std::chrono::milliseconds delay()
+    {
+        if (!isEnabled()) {
+            return std::chrono::milliseconds(0);
+        }
+        refill();
+        if (m_tokens >= 0) {
+            return std::chrono::milliseconds(0);
+        }
+        return std::chrono::milliseconds(qint64(std::ceil(-m_tokens / m_rate * 1000.0)));
+    }
+
+private:
+    void refill()
+    {
+        m_tokens = std::min(m_rate, m_tokens + m_rate * double(m_timer.restart()) / 1000.0);
+    }
+
+    double m_rate = 0;
+    double m_tokens = 0;
+    QElapsedTimer m_timer;
+};
+
+// Limits stanzas and bytes per second, a rate of 0 disables the limit.
+class RateLimiter
+{
+public:
+    RateLimiter() = default;
+    RateLimiter(double stanzasPerSecond, double bytesPerSecond)
+        : m_stanzas(stanzasPerSecond), m_bytes(bytesPerSecond)
+    {
+    }
+
+    bool isEnabled() const { return m_stanzas.isEnabled() || m_bytes.isEnabled(); }
+
+    void consumeStanza() { m_stanzas.consume(1); }
+    void consumeBytes(qint64 bytes) { m_bytes.consume(double(bytes)); }
+    // -1 if bytes are not limited
+    qint64 availableBytes() { return m_bytes.availableTokens(); }
+
+    std::chrono::milliseconds delay() { return std::max(m_stanzas.delay(), m_bytes.delay()); }
+
+private:
+    TokenBucket m_stanzas;
+    TokenBucket m_bytes;
+};
+
+}  // namespace QXmpp::Private
+
+#endif  // QXMPPRATELIMITER_P_H
@@ -7,15 +7,20 @@
 #include "QXmppConstants_p.h"
 #include "QXmppDialback.h"
 #include "QXmppIncomingClient.h"
+#include "QXmppIncomingClient_p.h"
 #include "QXmppIncomingServer.h"
 #include "QXmppIq.h"
+#include "QXmppMessage.h"
 #include "QXmppOutgoingServer.h"
+#include "QXmppRateLimiter_p.h"
 #include "QXmppServerExtension.h"
 #include "QXmppServerPlugin.h"
 #include "QXmppUtils.h"
 
 #include "StringLiterals.h"
 
+#include <algorithm>
+
 #include <QCoreApplication>
 #include <QDomElement>
 #include <QFileInfo>
@@ -24,6 +29,12 @@
 #include <QSslConfiguration>
 #include <QSslKey>
 #include <QSslSocket>
+#include <QThread>
+
+// Maximum number of bytes buffered per remote domain until its S2S stream is ready
+constexpr qint64 OUTGOING_SERVER_QUEUE_LIMIT = 1024 * 1024;
+// Idle S2S streams are closed after this number of seconds and reopened on demand
+constexpr int OUTGOING_SERVER_INACTIVITY_TIMEOUT = 300;
 
 static void helperToXmlAddDomElement(QXmlStreamWriter *stream, const QDomElement &element, const QVector<QStringView> &omitNamespaces)
 {
@@ -56,9 +67,15 @@ static void helperToXmlAddDomElement(QXmlStreamWriter *stream, const QDomElement
 class QXmppServerPrivate
 {
 public:
+    using StanzaFilter = QXmppServerExtension::StanzaFilter;
+    using DispatchKey = std::pair<QString, QString>;
+
     QXmppServerPrivate(QXmppServer *qq);
     void loadExtensions(QXmppServer *server);
-    bool routeData(const QString &to, const QByteArray &data);
+    void buildDispatchIndex();
+    bool dispatchToExtensions(const QDomElement &element);
+    bool routeData(const QString &to, const QByteArray &data, const QDomElement &element = {});
+    QXmppOutgoingServer *createOutgoingServer(const QString &toDomain);
     void startExtensions();
     void stopExtensions();
 
@@ -76,9 +93,16 @@ public:
     QHash<QString, QSet<QXmppIncomingClient *>> incomingClientsByBareJid;
     QSet<QXmppSslServer *> serversForClients;
 
+    // rate limits (0 = unlimited)
+    int clientStanzaRate = 0;
+    qint64 clientByteRate = 0;
+    int bareJidStanzaRate = 0;
+    qint64 bareJidByteRate = 0;
+    QHash<QString, std::shared_ptr<QXmpp::Private::RateLimiter>> bareJidRateLimiters;
+
     // server-to-server
     QSet<QXmppIncomingServer *> incomingServers;
-    QSet<QXmppOutgoingServer *> outgoingServers;
+    QHash<QString, QXmppOutgoingServer *> outgoingServers;
     QSet<QXmppSslServer *> serversForServers;
 
     // ssl
@@ -86,7 +110,15 @@ public:
     QSslCertificate localCertificate;
     QSslKey privateKey;
 
+    // stanza dispatch index, rebuilt when extensions are added
+    QHash<QXmppServerExtension *, QList<StanzaFilter>> stanzaFilters;
+    QSet<QString> dispatchTags;
+    QSet<QString> dispatchChildNamespaces;
+    QHash<DispatchKey, QList<QXmppServerExtension *>> dispatchIndex;
+    bool dispatchIndexValid = false;
+
 private:
+
     bool loaded;
     bool started;
     QXmppServer *q;
@@ -101,13 +133,47 @@ QXmppServerPrivate::QXmppServerPrivate(QXmppServer *qq)
 {
 }
 
+// Lets the sender know that a stanza could not be delivered in time.
+static void sendRemoteServerTimeout(QXmppServer *server, const QDomElement &element)
+{
+    const QXmppStanza::Error error(QXmppStanza::Error::Wait, QXmppStanza::Error::RemoteServerTimeout);
+
+    if (element.tagName() == u"iq") {
+        QXmppIq request;
+        request.parse(element);
+
+        if (request.type() != QXmppIq::Error && request.type() != QXmppIq::Result) {
+            QXmppIq response(QXmppIq::Error);
+            response.setId(request.id());
+            response.setFrom(request.to());
+            response.setTo(request.from());
+            response.setError(error);
+            server->sendPacket(response);
+        }
+    } else if (element.tagName() == u"message") {
+        QXmppMessage request;
+        request.parse(element);
+
+        if (request.type() != QXmppMessage::Error) {
+            QXmppMessage response;
+            response.setType(QXmppMessage::Error);
+            response.setId(request.id());
+            response.setFrom(request.to());
+            response.setTo(request.from());
+            response.setError(error);
+            server->sendPacket(response);
+        }
+    }
+}
+
 /// Routes XMPP data to the given recipient.
 ///
 /// \param to
 /// \param data
+/// \param element the stanza to bounce if it does not fit into the queue of an outgoing server
 ///
 
-bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
+bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data, const QDomElement &element)
 {
     // refuse to route packets to empty destination, own domain or sub-domains
     const QString toDomain = QXmppUtils::jidToDomain(to);
@@ -138,33 +204,37 @@ bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
 
     } else if (!serversForServers.isEmpty()) {
 
-        // look for an outgoing S2S connection
-        for (auto *conn : std::as_const(outgoingServers)) {
-            if (conn->remoteDomain() == toDomain) {
-                // send or queue data
-                QMetaObject::invokeMethod(conn, "queueData", Q_ARG(QByteArray, data));
-                return true;
-            }
-        }
-
-        // if we did not find an outgoing server,
+        // look for an outgoing S2S connection, if there is none
         // we need to establish the S2S connection
-        auto *conn = new QXmppOutgoingServer(domain, nullptr);
-        conn->setLocalStreamKey(QXmppUtils::generateStanzaHash());
-        conn->moveToThread(q->thread());
-        conn->setParent(q);
+        auto *conn = outgoingServers.value(toDomain);
+        const bool created = !conn;
+        if (created) {
+            conn = createOutgoingServer(toDomain);
+        }
 
-        QObject::connect(conn, &QXmppOutgoingServer::disconnected,
-                         q, &QXmppServer::_q_outgoingServerDisconnected);
+        // send or queue data, stanzas which do not fit into the queue are bounced
+        auto queueData = [this, conn, data, element]() {
+            if (!conn->queueData(data)) {
+                Q_EMIT q->updateCounter(u"outgoing-server.queue-overflow"_s);
+                if (!element.isNull()) {
+                    sendRemoteServerTimeout(q, element);
+                }
+                return false;
+            }
+            return true;
+        };
 
-        // add stream
-        outgoingServers.insert(conn);
-        Q_EMIT q->setGauge(u"outgoing-server.count"_s, outgoingServers.size());
+        bool queued = true;
+        if (conn->thread() == QThread::currentThread()) {
+            queued = queueData();
+        } else {
+            QMetaObject::invokeMethod(conn, queueData);
+        }
 
-        // queue data and connect to remote server
-        QMetaObject::invokeMethod(conn, "queueData", Q_ARG(QByteArray, data));
-        QMetaObject::invokeMethod(conn, "connectToHost", Q_ARG(QString, toDomain));
-        return true;
+        if (created) {
+            QMetaObject::invokeMethod(conn, "connectToHost", Q_ARG(QString, toDomain));
+        }
+        return queued || !element.isNull();
 
     } else {
 
@@ -173,17 +243,28 @@ bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
     }
 }
 
+QXmppOutgoingServer *QXmppServerPrivate::createOutgoingServer(const QString &toDomain)
+{
+    // every stream gets its own dialback key
+    auto *conn = new QXmppOutgoingServer(domain, nullptr);
+    conn->setLocalStreamKey(QXmppUtils::generateStanzaHash());
+    conn->setQueueLimit(OUTGOING_SERVER_QUEUE_LIMIT);
+    conn->setInactivityTimeout(OUTGOING_SERVER_INACTIVITY_TIMEOUT);
+    conn->moveToThread(q->thread());
+    conn->setParent(q);
+
+    QObject::connect(conn, &QXmppOutgoingServer::disconnected,
+                     q, &QXmppServer::_q_outgoingServerDisconnected);
+
+    // add stream
+    outgoingServers.insert(toDomain, conn);
+    Q_EMIT q->setGauge(u"outgoing-server.count"_s, outgoingServers.size());
+    return conn;
+}
+
 /// Handles an incoming XML element.
 static void handleStanza(QXmppServer *server, const QDomElement &element)
 {
-    // try extensions
-    const auto &extensions = server->extensions();
-    for (auto *extension : extensions) {
-        if (extension->handleStanza(element)) {
-            return;
-        }
-    }
-
     // default handlers
     const QString domain = server->domain();
     const QString to = element.attribute(u"to"_s);
@@ -258,6 +339,110 @@ void QXmppServerPrivate::loadExtensions(QXmppServer *server)
     }
 }
 
+static bool filterMatches(const QXmppServerExtension::StanzaFilter &filter, const QString &tagName, const QString &childXmlns)
+{
+    return (filter.tagName.isEmpty() || filter.tagName == tagName) &&
+        (filter.childXmlns.isEmpty() || filter.childXmlns == childXmlns);
+}
+
+static bool filterMatches(const QXmppServerExtension::StanzaFilter &filter, const QString &tagName, const QString &xmlns, const QString &childXmlns)
+{
+    return filterMatches(filter, tagName, childXmlns) &&
+        (filter.xmlns.isEmpty() || filter.xmlns == xmlns);
+}
+
+///
+/// Builds the stanza dispatch index.
+///
+/// For every combination of declared tag name and child namespace (an empty
+/// string standing for any undeclared value) the list of candidate extensions
+/// is computed once in priority order. Extensions without stanza filters are
+/// candidates for every stanza.
+///
+void QXmppServerPrivate::buildDispatchIndex()
+{
+    stanzaFilters.clear();
+    dispatchTags.clear();
+    dispatchChildNamespaces.clear();
+    dispatchIndex.clear();
+
+    for (auto *extension : std::as_const(extensions)) {
+        const auto filters = extension->stanzaFilters();
+        if (filters.isEmpty()) {
+            continue;
+        }
+        stanzaFilters.insert(extension, filters);
+        for (const auto &filter : filters) {
+            if (!filter.tagName.isEmpty()) {
+                dispatchTags.insert(filter.tagName);
+            }
+            if (!filter.childXmlns.isEmpty()) {
+                dispatchChildNamespaces.insert(filter.childXmlns);
+            }
+        }
+    }
+
+    auto tags = dispatchTags.values();
+    tags << QString();
+    auto childNamespaces = dispatchChildNamespaces.values();
+    childNamespaces << QString();
+
+    for (const auto &tag : std::as_const(tags)) {
+        for (const auto &childXmlns : std::as_const(childNamespaces)) {
+            QList<QXmppServerExtension *> candidates;
+            for (auto *extension : std::as_const(extensions)) {
+                const auto filters = stanzaFilters.constFind(extension);
+                if (filters == stanzaFilters.constEnd() ||
+                    std::any_of(filters->cbegin(), filters->cend(), [&](const auto &filter) {
+                        return filterMatches(filter, tag, childXmlns);
+                    })) {
+                    candidates << extension;
+                }
+            }
+            dispatchIndex.insert({ tag, childXmlns }, candidates);
+        }
+    }
+    dispatchIndexValid = true;
+}
+
+///
+/// Passes the element to the extensions handling it until one of them accepts
+/// it. Returns true if the element was handled.
+///
+bool QXmppServerPrivate::dispatchToExtensions(const QDomElement &element)
+{
+    // the index is only rebuilt after extensions have been added
+    if (!dispatchIndexValid) {
+        loadExtensions(q);
+        buildDispatchIndex();
+    }
+
+    const auto tagName = element.tagName();
+    const auto xmlns = element.namespaceURI();
+    const auto childXmlns = element.firstChildElement().namespaceURI();
+
+    const DispatchKey key {
+        dispatchTags.contains(tagName) ? tagName : QString(),
+        dispatchChildNamespaces.contains(childXmlns) ? childXmlns : QString(),
+    };
+
+    // copy (implicitly shared), extensions may be added while handling the stanza
+    const auto candidates = dispatchIndex.value(key);
+    for (auto *extension : candidates) {
+        const auto filters = stanzaFilters.constFind(extension);
+        if (filters != stanzaFilters.constEnd() &&
+            std::none_of(filters->cbegin(), filters->cend(), [&](const auto &filter) {
+                return filterMatches(filter, tagName, xmlns, childXmlns);
+            })) {
+            continue;
+        }
+        if (extension->handleStanza(element)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /// Start the server's extensions.
 void QXmppServerPrivate::startExtensions()
 {
@@ -304,6 +489,7 @@ void QXmppServer::addExtension(QXmppServerExtension *extension)
     d->info(u"Added extension %1"_s.arg(extension->extensionName()));
     extension->setParent(this);
     extension->setServer(this);
+    d->dispatchIndexValid = false;
 
     // keep extensions sorted by priority
     for (int i = 0; i < d->extensions.size(); ++i) {
@@ -379,6 +565,38 @@ void QXmppServer::setPasswordChecker(QXmppPasswordChecker *checker)
     d->passwordChecker = checker;
 }
 
+///
+/// Limits the stanzas and bytes per second read from each client connection.
+///
+/// Once a limit is exceeded, the server stops reading from the connection
+/// until enough time has passed, so a single client cannot monopolize the
+/// server. A value of 0 disables the respective limit.
+///
+/// This only applies to connections established afterwards.
+///
+/// \since QXmpp 1.9
+///
+void QXmppServer::setClientRateLimit(int stanzasPerSecond, qint64 bytesPerSecond)
+{
+    d->clientStanzaRate = stanzasPerSecond;
+    d->clientByteRate = bytesPerSecond;
+}
+
+///
+/// Limits the stanzas and bytes per second read from all connections of
+/// the same bare JID together.
+///
+/// A value of 0 disables the respective limit. This only applies to
+/// connections established afterwards.
+///
+/// \since QXmpp 1.9
+///
+void QXmppServer::setBareJidRateLimit(int stanzasPerSecond, qint64 bytesPerSecond)
+{
+    d->bareJidStanzaRate = stanzasPerSecond;
+    d->bareJidByteRate = bytesPerSecond;
+}
+
 /// Returns the statistics for the server.
 QVariantMap QXmppServer::statistics() const
 {
@@ -607,8 +825,8 @@ bool QXmppServer::sendElement(const QDomElement &element)
     QXmlStreamWriter xmlStream(&data);
     helperToXmlAddDomElement(&xmlStream, element, { ns_client, ns_server });
 
-    // route data
-    return d->routeData(element.attribute(u"to"_s), data);
+    // route data, the sender gets an error if the stanza is dropped
+    return d->routeData(element.attribute(u"to"_s), data, element);
 }
 
 /// Route an XMPP packet.
@@ -633,6 +851,7 @@ void QXmppServer::addIncomingClient(QXmppIncomingClient *stream)
 {
 
     stream->setPasswordChecker(d->passwordChecker);
+    stream->setRateLimit(d->clientStanzaRate, d->clientByteRate);
 
     connect(stream, &QXmppIncomingClient::connected, this, &QXmppServer::_q_clientConnected);
     connect(stream, &QXmppIncomingClient::disconnected, this, &QXmppServer::_q_clientDisconnected);
@@ -678,6 +897,17 @@ void QXmppServer::_q_clientConnected()
     d->incomingClientsByJid.insert(jid, client);
     d->incomingClientsByBareJid[QXmppUtils::jidToBareJid(jid)].insert(client);
 
+    // share one limiter between all connections of the account
+    if (d->bareJidStanzaRate > 0 || d->bareJidByteRate > 0) {
+        auto &limiter = d->bareJidRateLimiters[QXmppUtils::jidToBareJid(jid)];
+        if (!limiter) {
+            limiter = std::make_shared<QXmpp::Private::RateLimiter>(d->bareJidStanzaRate, double(d->bareJidByteRate));
+        }
+        auto *clientPrivate = QXmppIncomingClientPrivate::get(client);
+        clientPrivate->bareJidRateLimiter = limiter;
+        clientPrivate->checkRateLimit();
+    }
+
     // emit signal
     Q_EMIT clientConnected(jid);
 }
@@ -702,6 +932,7 @@ void QXmppServer::_q_clientDisconnected()
                 d->incomingClientsByBareJid[bareJid].remove(client);
                 if (d->incomingClientsByBareJid[bareJid].isEmpty()) {
                     d->incomingClientsByBareJid.remove(bareJid);
+                    d->bareJidRateLimiters.remove(bareJid);
                 }
             }
         }
@@ -727,28 +958,26 @@ void QXmppServer::_q_dialbackRequestReceived(const QXmppDialback &dialback)
     }
 
     if (dialback.command() == QXmppDialback::Verify) {
-        // handle a verify request
-        for (auto *out : std::as_const(d->outgoingServers)) {
-            if (out->remoteDomain() != dialback.from()) {
-                continue;
-            }
-
-            bool isValid = dialback.key() == out->localStreamKey();
-            QXmppDialback verify;
-            verify.setCommand(QXmppDialback::Verify);
-            verify.setId(dialback.id());
-            verify.setTo(dialback.from());
-            verify.setFrom(d->domain);
-            verify.setType(isValid ? u"valid"_s : u"invalid"_s);
-            stream->sendPacket(verify);
-            return;
-        }
+        // handle a verify request, keys of closed streams are not valid anymore
+        auto *out = d->outgoingServers.value(dialback.from());
+        const bool isValid = out && !out->localStreamKey().isEmpty() && dialback.key() == out->localStreamKey();
+
+        QXmppDialback verify;
+        verify.setCommand(QXmppDialback::Verify);
+        verify.setId(dialback.id());
+        verify.setTo(dialback.from());
+        verify.setFrom(d->domain);
+        verify.setType(isValid ? u"valid"_s : u"invalid"_s);
+        stream->sendPacket(verify);
     }
 }
 
 /// Handle an incoming XML element.
 void QXmppServer::handleElement(const QDomElement &element)
 {
+    if (d->dispatchToExtensions(element)) {
+        return;
+    }
     handleStanza(this, element);
 }
 
@@ -760,7 +989,9 @@ void QXmppServer::_q_outgoingServerDisconnected()
         return;
     }
 
-    if (d->outgoingServers.remove(outgoing)) {
+    const auto itr = d->outgoingServers.find(outgoing->remoteDomain());
+    if (itr != d->outgoingServers.end() && *itr == outgoing) {
+        d->outgoingServers.erase(itr);
         outgoing->deleteLater();
         Q_EMIT setGauge(u"outgoing-server.count"_s, d->outgoingServers.size());
     }
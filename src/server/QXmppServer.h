@@ -61,6 +61,9 @@ public:
     QXmppPasswordChecker *passwordChecker();
     void setPasswordChecker(QXmppPasswordChecker *checker);
 
+    void setClientRateLimit(int stanzasPerSecond, qint64 bytesPerSecond);
+    void setBareJidRateLimit(int stanzasPerSecond, qint64 bytesPerSecond);
+
     QVariantMap statistics() const;
 
     void addCaCertificates(const QString &caCertificates);
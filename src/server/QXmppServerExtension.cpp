@@ -107,6 +107,25 @@ void QXmppServerExtension::stop()
 {
 }
 
+///
+/// Returns the stanzas this extension handles.
+///
+/// QXmppServer only passes matching stanzas to handleStanza() and looks them
+/// up in a precomputed index, so the cost of dispatching a stanza does not grow
+/// with the number of loaded extensions. The filters are only queried when the
+/// index is rebuilt after an extension has been added, so they must not change
+/// afterwards.
+///
+/// The default implementation returns an empty list, which means that all
+/// stanzas are passed to handleStanza().
+///
+/// \since QXmpp 1.9
+///
+QList<QXmppServerExtension::StanzaFilter> QXmppServerExtension::stanzaFilters() const
+{
+    return {};
+}
+
 /// Returns the server which loaded this extension.
 QXmppServer *QXmppServerExtension::server() const
 {
@@ -30,6 +30,22 @@ class QXMPP_EXPORT QXmppServerExtension : public QXmppLoggable
     Q_OBJECT
 
 public:
+    ///
+    /// \brief Describes stanzas an extension wants to handle.
+    ///
+    /// Empty members match any value.
+    ///
+    /// \since QXmpp 1.9
+    ///
+    struct StanzaFilter {
+        /// Tag name of the stanza, e.g. "iq"
+        QString tagName;
+        /// Namespace of the stanza element
+        QString xmlns;
+        /// Namespace of the first child element, e.g. the payload of an IQ
+        QString childXmlns;
+    };
+
     QXmppServerExtension();
     ~QXmppServerExtension() override;
     virtual QString extensionName() const;
@@ -44,6 +60,8 @@ public:
     virtual bool start();
     virtual void stop();
 
+    virtual QList<StanzaFilter> stanzaFilters() const;
+
 protected:
     QXmppServer *server() const;
 
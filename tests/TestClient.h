@@ -23,6 +23,7 @@ public:
         // clear extensions
         qDeleteAll(d->extensions);
         d->extensions.clear();
+        d->dispatchIndex.invalidate();
         // enable stream management (so IQ requests are not stopped)
         d->stream->enableStreamManagement(true);
         // setup logging (for expect())
@@ -0,0 +1,145 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#ifndef TESTHTTPSERVER_H
+#define TESTHTTPSERVER_H
+
+#include "util.h"
+
+#include <QTcpServer>
+#include <QTcpSocket>
+
+//
+// Minimal HTTP server serving one file to GET requests with support for the Range header and
+// storing the data of PUT requests, optionally with a Content-Range header.
+//
+class TestHttpServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    explicit TestHttpServer(QByteArray data = {})
+        : data(std::move(data))
+    {
+    }
+
+    QUrl url() const
+    {
+        return QUrl(u"http://127.0.0.1:%1/file"_s.arg(serverPort()));
+    }
+
+    // served by GET requests and replaced by PUT requests
+    QByteArray data;
+    // whether Range headers of GET and Content-Range headers of PUT requests are supported
+    bool rangesSupported = true;
+    // count of next GET responses that are interrupted after half of their body
+    int interruptedResponses = 0;
+    // indexes of requests answered with "503 Service Unavailable"
+    QList<int> failingRequests;
+    bool allRequestsFailing = false;
+    // Range headers of GET and Content-Range headers of PUT requests
+    QList<QByteArray> requestedRanges;
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override
+    {
+        auto *socket = new QTcpSocket(this);
+        socket->setSocketDescriptor(socketDescriptor);
+
+        auto request = std::make_shared<QByteArray>();
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket, request]() {
+            *request += socket->readAll();
+
+            const auto headerEnd = request->indexOf("\r\n\r\n");
+            if (headerEnd < 0) {
+                return;
+            }
+
+            QByteArray range;
+            qint64 contentLength = 0;
+            const auto lines = request->left(headerEnd).split('\n');
+            for (const auto &line : lines) {
+                const auto lowerLine = line.toLower();
+                if (lowerLine.startsWith("range:")) {
+                    range = line.mid(6).trimmed();
+                } else if (lowerLine.startsWith("content-range:")) {
+                    range = line.mid(14).trimmed();
+                } else if (lowerLine.startsWith("content-length:")) {
+                    contentLength = line.mid(15).trimmed().toLongLong();
+                }
+            }
+
+            const auto body = request->mid(headerEnd + 4);
+            if (body.size() < contentLength) {
+                return;
+            }
+
+            const auto index = int(requestedRanges.size());
+            requestedRanges.append(range);
+
+            if (allRequestsFailing || failingRequests.contains(index)) {
+                socket->write("HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                socket->disconnectFromHost();
+            } else if (request->startsWith("PUT ")) {
+                respondToUpload(socket, range, body);
+            } else {
+                respondToDownload(socket, range);
+            }
+            request->clear();
+        });
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    }
+
+private:
+    void respondToUpload(QTcpSocket *socket, const QByteArray &contentRange, const QByteArray &body)
+    {
+        QByteArray status = "201 Created";
+        if (contentRange.isEmpty()) {
+            data = body;
+        } else if (!rangesSupported) {
+            status = "501 Not Implemented";
+        } else {
+            // "bytes 0-99/1000"
+            const auto begin = contentRange.mid(6, contentRange.indexOf('-') - 6).toLongLong();
+            const auto total = contentRange.mid(contentRange.indexOf('/') + 1).toLongLong();
+            data.resize(int(total));
+            std::copy(body.cbegin(), body.cend(), data.begin() + begin);
+        }
+
+        socket->write("HTTP/1.1 " + status + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        socket->disconnectFromHost();
+    }
+
+    void respondToDownload(QTcpSocket *socket, const QByteArray &range)
+    {
+        // end is exclusive
+        qint64 begin = 0;
+        qint64 end = data.size();
+        QByteArray header;
+        if (rangesSupported && range.startsWith("bytes=")) {
+            const auto positions = range.mid(6).split('-');
+            begin = positions.at(0).toLongLong();
+            if (!positions.at(1).isEmpty()) {
+                end = std::min(positions.at(1).toLongLong() + 1, qint64(data.size()));
+            }
+            header = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes " +
+                QByteArray::number(begin) + '-' + QByteArray::number(end - 1) + '/' + QByteArray::number(data.size()) + "\r\n";
+        } else {
+            header = "HTTP/1.1 200 OK\r\n";
+        }
+
+        auto body = data.mid(begin, end - begin);
+        header += "Content-Length: " + QByteArray::number(body.size()) + "\r\nConnection: close\r\n\r\n";
+
+        if (interruptedResponses > 0) {
+            --interruptedResponses;
+            body.truncate(body.size() / 2);
+        }
+
+        socket->write(header + body);
+        socket->disconnectFromHost();
+    }
+};
+
+#endif  // TESTHTTPSERVER_H
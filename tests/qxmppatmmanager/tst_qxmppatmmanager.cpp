@@ -46,6 +46,10 @@ private:
     Q_SLOT void testMakeTrustDecisions();
     Q_SLOT void testHandleMessage_data();
     Q_SLOT void testHandleMessage();
+    Q_SLOT void testHandleMessagesBatched();
+    Q_SLOT void testSendTrustMessagesBatched();
+    Q_SLOT void testHandleMessagesBatchedNewestDecision();
+    Q_SLOT void testBatchFinishedOnDestruction();
     Q_SLOT void testMakeTrustDecisionsNoKeys();
     Q_SLOT void testMakeTrustDecisionsOwnKeys();
     Q_SLOT void testMakeTrustDecisionsOwnKeysNoOwnEndpoints();
@@ -997,6 +1001,231 @@ void tst_QXmppAtmManager::testHandleMessage()
     }
 }
 
+void tst_QXmppAtmManager::testHandleMessagesBatched()
+{
+    clearTrustStorage();
+    m_manager.setBatchingEnabled(true);
+
+    const auto senderKey = QByteArray::fromBase64(QByteArrayLiteral("RwyI/3m9l4wgju9JduFxb5MEJvBNRDfPfo1Ewhl1DEI="));
+    m_manager.addKeys(ns_omemo, u"alice@example.org"_s, { senderKey }, TrustLevel::Authenticated);
+
+    QXmppE2eeMetadata e2eeMetadata;
+    e2eeMetadata.setSenderKey(senderKey);
+
+    QXmppTrustMessageKeyOwner keyOwnerAlice;
+    keyOwnerAlice.setJid(u"alice@example.org"_s);
+    keyOwnerAlice.setTrustedKeys({ QByteArray::fromBase64(QByteArrayLiteral("YHiLgLpE3dvoy4MayxycR+BABFY9w6D/rKZjUnu2jSY=")) });
+
+    QXmppTrustMessageKeyOwner keyOwnerBob;
+    keyOwnerBob.setJid(u"bob@example.com"_s);
+    keyOwnerBob.setTrustedKeys({ QByteArray::fromBase64(QByteArrayLiteral("nKT6zqFRNDq6GpWQIV/CwbA65fqN9Bo4qVxMfFjwl1w=")) });
+    keyOwnerBob.setDistrustedKeys({ QByteArray::fromBase64(QByteArrayLiteral("b3EsvoNBgUpiQD9KRHmosP/rR7T+3BA84MQw4N6eZmU=")) });
+
+    QXmppTrustMessageElement trustMessageElement;
+    trustMessageElement.setUsage(ns_atm);
+    trustMessageElement.setEncryption(ns_omemo);
+    trustMessageElement.setKeyOwners({ keyOwnerAlice });
+
+    QXmppMessage message1;
+    message1.setFrom(u"alice@example.org/desktop"_s);
+    message1.setE2eeMetadata(e2eeMetadata);
+    message1.setTrustMessageElement(trustMessageElement);
+
+    trustMessageElement.setKeyOwners({ keyOwnerBob });
+
+    QXmppMessage message2 = message1;
+    message2.setTrustMessageElement(trustMessageElement);
+
+    int trustLevelsChangedCount = 0;
+    QHash<QString, QMultiHash<QString, QByteArray>> modifiedKeys;
+    const QObject context;
+    connect(&m_manager, &QXmppTrustManager::trustLevelsChanged, &context, [&](const QHash<QString, QMultiHash<QString, QByteArray>> &keys) {
+        ++trustLevelsChangedCount;
+        modifiedKeys = keys;
+    });
+
+    auto future1 = m_manager.handleMessage(message1);
+    auto future2 = m_manager.handleMessage(message2);
+    QVERIFY(!future1.isFinished());
+    QVERIFY(!future2.isFinished());
+
+    QTRY_VERIFY(future1.isFinished() && future2.isFinished());
+
+    m_manager.setBatchingEnabled(false);
+    m_manager.removeKeys(ns_omemo, QList { senderKey });
+
+    QMultiHash<QString, QByteArray> authenticatedKeys = { { u"alice@example.org"_s,
+                                                            QByteArray::fromBase64(QByteArrayLiteral("YHiLgLpE3dvoy4MayxycR+BABFY9w6D/rKZjUnu2jSY=")) },
+                                                          { u"bob@example.com"_s,
+                                                            QByteArray::fromBase64(QByteArrayLiteral("nKT6zqFRNDq6GpWQIV/CwbA65fqN9Bo4qVxMfFjwl1w=")) } };
+    QMultiHash<QString, QByteArray> manuallyDistrustedKeys = { { u"bob@example.com"_s,
+                                                                 QByteArray::fromBase64(QByteArrayLiteral("b3EsvoNBgUpiQD9KRHmosP/rR7T+3BA84MQw4N6eZmU=")) } };
+
+    auto future = m_manager.keys(ns_omemo);
+    QVERIFY(future.isFinished());
+    QCOMPARE(
+        future.result(),
+        QHash({ std::pair(
+                    TrustLevel::Authenticated,
+                    authenticatedKeys),
+                std::pair(
+                    TrustLevel::ManuallyDistrusted,
+                    manuallyDistrustedKeys) }));
+
+    // all trust decisions are notified at once
+    QCOMPARE(trustLevelsChangedCount, 1);
+    QCOMPARE(modifiedKeys.value(ns_omemo).size(), 3);
+}
+
+void tst_QXmppAtmManager::testSendTrustMessagesBatched()
+{
+    m_manager.setBatchingEnabled(true);
+
+    QXmppTrustMessageKeyOwner keyOwnerAlice;
+    keyOwnerAlice.setJid(u"alice@example.org"_s);
+    keyOwnerAlice.setTrustedKeys({ QByteArray::fromBase64(QByteArrayLiteral("0RcVsGk3LnpEFsqqztTzAgCDgVXlfa03paSqJFOOWOU=")) });
+    keyOwnerAlice.setDistrustedKeys({ QByteArray::fromBase64(QByteArrayLiteral("eIpA0OrlpAQJ1Gh6NtMQa742GXGuwCRVmFcee2Ke3Gs=")) });
+
+    QXmppTrustMessageKeyOwner keyOwnerAlice2;
+    keyOwnerAlice2.setJid(u"alice@example.org"_s);
+    keyOwnerAlice2.setTrustedKeys({ QByteArray::fromBase64(QByteArrayLiteral("tYn/wcIOxBSoW4W1UfPr/zgbLipBK2KsFfC7F1bzut0=")),
+                                    QByteArray::fromBase64(QByteArrayLiteral("eIpA0OrlpAQJ1Gh6NtMQa742GXGuwCRVmFcee2Ke3Gs=")) });
+
+    QXmppTrustMessageKeyOwner keyOwnerBob;
+    keyOwnerBob.setJid(u"bob@example.com"_s);
+    keyOwnerBob.setDistrustedKeys({ QByteArray::fromBase64(QByteArrayLiteral("tsIeERvU+e0G7gSFyzAr8SOOkLiZhqBAYeSNSd2+lcs=")) });
+
+    int sentMessagesCount = 0;
+    const QObject context;
+
+    connect(&m_logger, &QXmppLogger::message, &context, [&](QXmppLogger::MessageType type, const QString &text) {
+        if (type == QXmppLogger::SentMessage) {
+            ++sentMessagesCount;
+
+            QXmppMessage message;
+            parsePacket(message, text.toUtf8());
+
+            const auto trustMessageElement = message.trustMessageElement();
+            QVERIFY(trustMessageElement);
+
+            const auto sentKeyOwners = trustMessageElement->keyOwners();
+            QCOMPARE(sentKeyOwners.size(), 2);
+
+            for (const auto &sentKeyOwner : sentKeyOwners) {
+                if (sentKeyOwner.jid() == keyOwnerAlice.jid()) {
+                    // The newer trust decision for a key replaces the older one.
+                    QCOMPARE(sentKeyOwner.trustedKeys(),
+                             QList({ QByteArray::fromBase64(QByteArrayLiteral("0RcVsGk3LnpEFsqqztTzAgCDgVXlfa03paSqJFOOWOU=")),
+                                     QByteArray::fromBase64(QByteArrayLiteral("tYn/wcIOxBSoW4W1UfPr/zgbLipBK2KsFfC7F1bzut0=")),
+                                     QByteArray::fromBase64(QByteArrayLiteral("eIpA0OrlpAQJ1Gh6NtMQa742GXGuwCRVmFcee2Ke3Gs=")) }));
+                    QVERIFY(sentKeyOwner.distrustedKeys().isEmpty());
+                } else if (sentKeyOwner.jid() == keyOwnerBob.jid()) {
+                    QCOMPARE(sentKeyOwner.distrustedKeys(), keyOwnerBob.distrustedKeys());
+                } else {
+                    QFAIL("Unexpected key owner sent!");
+                }
+            }
+        }
+    });
+
+    auto future1 = m_manager.sendTrustMessage(ns_omemo, { keyOwnerAlice }, u"alice@example.org"_s);
+    auto future2 = m_manager.sendTrustMessage(ns_omemo, { keyOwnerAlice2, keyOwnerBob }, u"alice@example.org"_s);
+    QCOMPARE(sentMessagesCount, 0);
+
+    QTRY_VERIFY(future1.isFinished() && future2.isFinished());
+
+    m_manager.setBatchingEnabled(false);
+
+    QCOMPARE(sentMessagesCount, 1);
+}
+
+void tst_QXmppAtmManager::testHandleMessagesBatchedNewestDecision()
+{
+    clearTrustStorage();
+    m_manager.setBatchingEnabled(true);
+
+    const auto senderKey = QByteArray::fromBase64(QByteArrayLiteral("RwyI/3m9l4wgju9JduFxb5MEJvBNRDfPfo1Ewhl1DEI="));
+    const auto key = QByteArray::fromBase64(QByteArrayLiteral("nKT6zqFRNDq6GpWQIV/CwbA65fqN9Bo4qVxMfFjwl1w="));
+    m_manager.addKeys(ns_omemo, u"alice@example.org"_s, { senderKey }, TrustLevel::Authenticated);
+
+    QXmppE2eeMetadata e2eeMetadata;
+    e2eeMetadata.setSenderKey(senderKey);
+
+    QXmppTrustMessageKeyOwner keyOwner;
+    keyOwner.setJid(u"bob@example.com"_s);
+    keyOwner.setTrustedKeys({ key });
+
+    QXmppTrustMessageElement trustMessageElement;
+    trustMessageElement.setUsage(ns_atm);
+    trustMessageElement.setEncryption(ns_omemo);
+    trustMessageElement.setKeyOwners({ keyOwner });
+
+    QXmppMessage message1;
+    message1.setFrom(u"alice@example.org/desktop"_s);
+    message1.setE2eeMetadata(e2eeMetadata);
+    message1.setTrustMessageElement(trustMessageElement);
+
+    // the key is distrusted by the newer trust message
+    keyOwner.setTrustedKeys({});
+    keyOwner.setDistrustedKeys({ key });
+    trustMessageElement.setKeyOwners({ keyOwner });
+
+    QXmppMessage message2 = message1;
+    message2.setTrustMessageElement(trustMessageElement);
+
+    auto future1 = m_manager.handleMessage(message1);
+    auto future2 = m_manager.handleMessage(message2);
+
+    QTRY_VERIFY(future1.isFinished() && future2.isFinished());
+
+    m_manager.setBatchingEnabled(false);
+    m_manager.removeKeys(ns_omemo, QList { senderKey });
+
+    auto future = m_manager.keys(ns_omemo);
+    QVERIFY(future.isFinished());
+    QCOMPARE(
+        future.result(),
+        QHash({ std::pair(
+            TrustLevel::ManuallyDistrusted,
+            QMultiHash<QString, QByteArray> { { u"bob@example.com"_s, key } }) }));
+}
+
+void tst_QXmppAtmManager::testBatchFinishedOnDestruction()
+{
+    QXmppClient client;
+    client.configuration().setJid("alice@example.org/phone");
+
+    QXmppAtmTrustMemoryStorage trustStorage;
+    auto *manager = new QXmppAtmManager(&trustStorage);
+    client.addExtension(manager);
+    manager->setBatchingEnabled(true);
+
+    QXmppTrustMessageKeyOwner keyOwner;
+    keyOwner.setJid(u"bob@example.com"_s);
+    keyOwner.setTrustedKeys({ QByteArray::fromBase64(QByteArrayLiteral("nKT6zqFRNDq6GpWQIV/CwbA65fqN9Bo4qVxMfFjwl1w=")) });
+
+    QXmppTrustMessageElement trustMessageElement;
+    trustMessageElement.setUsage(ns_atm);
+    trustMessageElement.setEncryption(ns_omemo);
+    trustMessageElement.setKeyOwners({ keyOwner });
+
+    QXmppMessage message;
+    message.setFrom(u"bob@example.com/desktop"_s);
+    message.setTrustMessageElement(trustMessageElement);
+
+    auto receivingFuture = manager->handleMessage(message);
+    auto sendingFuture = manager->sendTrustMessage(ns_omemo, { keyOwner }, u"bob@example.com"_s);
+    QVERIFY(!receivingFuture.isFinished());
+    QVERIFY(!sendingFuture.isFinished());
+
+    // the collected trust messages are not processed anymore
+    client.removeExtension(manager);
+
+    QVERIFY(receivingFuture.isFinished());
+    QVERIFY(sendingFuture.isFinished());
+    expectFutureVariant<QXmppError>(sendingFuture);
+}
+
 void tst_QXmppAtmManager::testMakeTrustDecisionsNoKeys()
 {
     clearTrustStorage();
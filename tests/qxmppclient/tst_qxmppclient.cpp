@@ -4,6 +4,7 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 
 #include "QXmppClient.h"
+#include "QXmppClientExtension.h"
 #include "QXmppCredentials.h"
 #include "QXmppE2eeExtension.h"
 #include "QXmppFutureUtils_p.h"
@@ -32,6 +33,7 @@ class tst_QXmppClient : public QObject
 private:
     Q_SLOT void testSendMessage();
     Q_SLOT void testIndexOfExtension();
+    Q_SLOT void testStanzaDispatch();
     Q_SLOT void testE2eeExtension();
     Q_SLOT void testTaskDirect();
     Q_SLOT void testTaskStore();
@@ -94,6 +96,62 @@ void tst_QXmppClient::testIndexOfExtension()
     QCOMPARE(client->indexOfExtension<QXmppVCardManager>(), 1);
 }
 
+class DispatchExtension : public QXmppClientExtension
+{
+public:
+    DispatchExtension(QList<StanzaFilter> filters, bool accept)
+        : m_filters(std::move(filters)), m_accept(accept)
+    {
+    }
+
+    QList<StanzaFilter> stanzaFilters() const override { return m_filters; }
+    bool handleStanza(const QDomElement &) override
+    {
+        handled++;
+        return m_accept;
+    }
+
+    int handled = 0;
+
+private:
+    QList<StanzaFilter> m_filters;
+    bool m_accept;
+};
+
+void tst_QXmppClient::testStanzaDispatch()
+{
+    TestClient client;
+    auto *observer = client.addNewExtension<DispatchExtension>(QList<QXmppClientExtension::StanzaFilter>(), false);
+    auto *version = client.addNewExtension<DispatchExtension>(QList<QXmppClientExtension::StanzaFilter> { { u"iq"_s, u"jabber:iq:version"_s } }, true);
+    auto *messages = client.addNewExtension<DispatchExtension>(QList<QXmppClientExtension::StanzaFilter> { { u"message"_s, {} } }, false);
+
+    auto receive = [&](const QString &xml) {
+        bool handled = false;
+        Q_EMIT client.stream()->elementReceived(xmlToDom(xml), handled);
+        return handled;
+    };
+
+    QVERIFY(receive(u"<iq type='get' id='1'><query xmlns='jabber:iq:version'/></iq>"_s));
+    QCOMPARE(observer->handled, 1);
+    QCOMPARE(version->handled, 1);
+    QCOMPARE(messages->handled, 0);
+
+    QVERIFY(!receive(u"<iq type='result' id='2'><query xmlns='jabber:iq:last'/></iq>"_s));
+    QCOMPARE(observer->handled, 2);
+    QCOMPARE(version->handled, 1);
+
+    QVERIFY(!receive(u"<message type='chat'><body>Hi</body></message>"_s));
+    QCOMPARE(observer->handled, 3);
+    QCOMPARE(messages->handled, 1);
+
+    // the index is rebuilt after extensions changed
+    client.removeExtension(observer);
+    auto *last = client.addNewExtension<DispatchExtension>(QList<QXmppClientExtension::StanzaFilter> { { u"iq"_s, u"jabber:iq:last"_s } }, true);
+    QVERIFY(receive(u"<iq type='result' id='3'><query xmlns='jabber:iq:last'/></iq>"_s));
+    QCOMPARE(last->handled, 1);
+    QCOMPARE(version->handled, 1);
+}
+
 class EncryptionExtension : public QXmppE2eeExtension
 {
 public:
@@ -165,6 +223,14 @@ void tst_QXmppClient::testE2eeExtension()
     client.sendSensitiveIq(createRequest());
     QVERIFY(encrypter.iqCalled);
     encrypter.iqCalled = false;
+
+    // default batch decryption via decryptMessage()
+    auto decryptTask = encrypter.decryptMessages({ QXmppMessage(), QXmppMessage() });
+    QVERIFY(decryptTask.isFinished());
+    const auto decryptResults = decryptTask.result();
+    QCOMPARE(decryptResults.size(), 2);
+    QVERIFY(std::holds_alternative<QXmppError>(decryptResults.at(0)));
+    QVERIFY(std::holds_alternative<QXmppError>(decryptResults.at(1)));
 }
 
 void tst_QXmppClient::testTaskDirect()
@@ -0,0 +1,288 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "QXmppFileCache.h"
+#include "QXmppFileMetadata.h"
+#include "QXmppFileSharingManager.h"
+#include "QXmppHttpFileSource.h"
+
+#include "util.h"
+
+#include <QDir>
+#include <QObject>
+#include <QTemporaryDir>
+
+using namespace QXmpp;
+
+//
+// Provider keeping uploaded files in memory.
+//
+class TestProvider : public QXmppFileSharingProvider
+{
+public:
+    using SourceType = QXmppHttpFileSource;
+
+    auto downloadFile(const std::any &source,
+                      std::unique_ptr<QIODevice> target,
+                      std::function<void(quint64, quint64)>,
+                      std::function<void(DownloadResult)> reportFinished) -> std::shared_ptr<Download> override
+    {
+        downloadCount++;
+        target->write(files.value(std::any_cast<QXmppHttpFileSource>(source).url()));
+        target.reset();
+        reportFinished(Success());
+        return {};
+    }
+
+    auto uploadFile(std::unique_ptr<QIODevice> source,
+                    const QXmppFileMetadata &,
+                    std::function<void(quint64, quint64)>,
+                    std::function<void(UploadResult)> reportFinished) -> std::shared_ptr<Upload> override
+    {
+        uploadCount++;
+        const auto url = QUrl(u"https://upload.example.org/%1"_s.arg(uploadCount));
+        files.insert(url, source->readAll());
+        reportFinished(std::any(QXmppHttpFileSource(url)));
+        return {};
+    }
+
+    QMap<QUrl, QByteArray> files;
+    int uploadCount = 0;
+    int downloadCount = 0;
+};
+
+class tst_QXmppFileCache : public QObject
+{
+    Q_OBJECT
+
+private:
+    Q_SLOT void init();
+
+    Q_SLOT void testUploadReused();
+    Q_SLOT void testUploadNotStored();
+    Q_SLOT void testSourceLifetime();
+    Q_SLOT void testDownloadFromCache();
+    Q_SLOT void testDownloadStored();
+    Q_SLOT void testModifiedFile();
+    Q_SLOT void testEviction();
+
+    QString writeFile(const QString &name, const QByteArray &data);
+    QXmppFileShare upload(const QString &filePath);
+    QXmppFileDownload::Result download(const QXmppFileShare &fileShare, const QString &filePath);
+    QByteArray readFile(const QString &filePath);
+
+    QTemporaryDir filesDir;
+    QTemporaryDir cacheDir;
+    std::shared_ptr<TestProvider> provider;
+    std::unique_ptr<QXmppFileSharingManager> manager;
+    std::unique_ptr<QXmppFileCache> cache;
+};
+
+void tst_QXmppFileCache::init()
+{
+    QVERIFY(filesDir.isValid());
+    QVERIFY(cacheDir.isValid());
+    QDir(cacheDir.path()).removeRecursively();
+
+    provider = std::make_shared<TestProvider>();
+    cache = std::make_unique<QXmppFileCache>(cacheDir.path());
+    QVERIFY(!cache->storeUploadedFiles());
+    cache->setStoreUploadedFiles(true);
+    manager = std::make_unique<QXmppFileSharingManager>();
+    manager->registerProvider(provider);
+    manager->setFileCache(cache.get());
+    QCOMPARE(manager->fileCache(), cache.get());
+}
+
+void tst_QXmppFileCache::testUploadReused()
+{
+    const auto filePath = writeFile(u"first.txt"_s, "Hello World!");
+    const auto copyPath = writeFile(u"copy.txt"_s, "Hello World!");
+
+    const auto first = upload(filePath);
+    QCOMPARE(provider->uploadCount, 1);
+    QVERIFY(!first.metadata().hashes().isEmpty());
+
+    // the file is copied into the cache while it is hashed
+    QCOMPARE(cache->size(), qint64(12));
+    QCOMPARE(QDir(cacheDir.path()).entryList(QDir::Files).size(), 1);
+
+    // the source of the first upload is reused for a file with the same content
+    const auto hits = cache->hits();
+    const auto second = upload(copyPath);
+    QCOMPARE(provider->uploadCount, 1);
+    QCOMPARE(cache->hits(), hits + 1);
+    QCOMPARE(second.httpSources().constFirst().url(), first.httpSources().constFirst().url());
+
+    // the copy of a file that is already stored is discarded
+    QCOMPARE(cache->size(), qint64(12));
+    QCOMPARE(QDir(cacheDir.path()).entryList(QDir::Files).size(), 1);
+
+    // other content is uploaded
+    upload(writeFile(u"other.txt"_s, "Hello Moon!"));
+    QCOMPARE(provider->uploadCount, 2);
+}
+
+void tst_QXmppFileCache::testUploadNotStored()
+{
+    cache->setStoreUploadedFiles(false);
+
+    const auto filePath = writeFile(u"first.txt"_s, "Hello World!");
+    const auto first = upload(filePath);
+    QCOMPARE(provider->uploadCount, 1);
+    QCOMPARE(cache->size(), qint64(0));
+    QCOMPARE(QDir(cacheDir.path()).entryList(QDir::Files).size(), 0);
+
+    // the source is reused nevertheless
+    const auto second = upload(writeFile(u"copy.txt"_s, "Hello World!"));
+    QCOMPARE(provider->uploadCount, 1);
+    QCOMPARE(second.httpSources().constFirst().url(), first.httpSources().constFirst().url());
+}
+
+void tst_QXmppFileCache::testSourceLifetime()
+{
+    using namespace std::chrono_literals;
+
+    QCOMPARE(cache->sourceLifetime(), std::chrono::seconds(24h));
+
+    upload(writeFile(u"first.txt"_s, "Hello World!"));
+    QCOMPARE(provider->uploadCount, 1);
+
+    // expired sources are not reused
+    cache->setSourceLifetime(0s);
+    QCOMPARE(cache->sourceLifetime(), 0s);
+    const auto misses = cache->misses();
+    upload(writeFile(u"copy.txt"_s, "Hello World!"));
+    QCOMPARE(provider->uploadCount, 2);
+    QCOMPARE(cache->misses(), misses + 1);
+}
+
+void tst_QXmppFileCache::testDownloadFromCache()
+{
+    const auto fileShare = upload(writeFile(u"file.txt"_s, "Hello World!"));
+    QTRY_COMPARE(cache->size(), qint64(12));
+
+    const auto outputPath = filesDir.filePath(u"download.txt"_s);
+    auto result = download(fileShare, outputPath);
+    QCOMPARE(expectVariant<QXmppFileDownload::Downloaded>(result).hashVerificationResult, QXmppFileDownload::HashVerified);
+    QCOMPARE(provider->downloadCount, 0);
+    QCOMPARE(readFile(outputPath), QByteArray("Hello World!"));
+}
+
+void tst_QXmppFileCache::testDownloadStored()
+{
+    const auto fileShare = upload(writeFile(u"file.txt"_s, "Hello World!"));
+
+    // a new cache does not know the source but the stored file
+    QTRY_COMPARE(cache->size(), qint64(12));
+    manager->setFileCache(nullptr);
+    cache = std::make_unique<QXmppFileCache>(cacheDir.path());
+    cache->setStoreUploadedFiles(true);
+    manager->setFileCache(cache.get());
+    QCOMPARE(cache->size(), qint64(12));
+
+    auto result = download(fileShare, filesDir.filePath(u"download.txt"_s));
+    QVERIFY(std::holds_alternative<QXmppFileDownload::Downloaded>(result));
+    QCOMPARE(provider->downloadCount, 0);
+
+    // downloaded files are stored
+    cache->clear();
+    QCOMPARE(cache->size(), qint64(0));
+    result = download(fileShare, filesDir.filePath(u"download2.txt"_s));
+    QVERIFY(std::holds_alternative<QXmppFileDownload::Downloaded>(result));
+    QCOMPARE(provider->downloadCount, 1);
+    QTRY_COMPARE(cache->size(), qint64(12));
+
+    result = download(fileShare, filesDir.filePath(u"download3.txt"_s));
+    QVERIFY(std::holds_alternative<QXmppFileDownload::Downloaded>(result));
+    QCOMPARE(provider->downloadCount, 1);
+    QCOMPARE(readFile(filesDir.filePath(u"download3.txt"_s)), QByteArray("Hello World!"));
+}
+
+void tst_QXmppFileCache::testModifiedFile()
+{
+    const auto fileShare = upload(writeFile(u"file.txt"_s, "Hello World!"));
+    QTRY_COMPARE(cache->size(), qint64(12));
+
+    // modify the stored file
+    const auto storedFiles = QDir(cacheDir.path()).entryInfoList(QDir::Files);
+    QCOMPARE(storedFiles.size(), 1);
+    QFile storedFile(storedFiles.constFirst().absoluteFilePath());
+    QVERIFY(storedFile.open(QIODevice::WriteOnly));
+    storedFile.write("Hello Moon!!");
+    storedFile.close();
+
+    // the file is downloaded instead
+    const auto outputPath = filesDir.filePath(u"download.txt"_s);
+    auto result = download(fileShare, outputPath);
+    QCOMPARE(expectVariant<QXmppFileDownload::Downloaded>(result).hashVerificationResult, QXmppFileDownload::HashVerified);
+    QCOMPARE(provider->downloadCount, 1);
+    QCOMPARE(readFile(outputPath), QByteArray("Hello World!"));
+}
+
+void tst_QXmppFileCache::testEviction()
+{
+    cache->setMaxSize(20);
+    QCOMPARE(cache->maxSize(), qint64(20));
+
+    const auto first = upload(writeFile(u"first.txt"_s, "0123456789"));
+    QTRY_COMPARE(cache->size(), qint64(10));
+    const auto firstStoredFile = QDir(cacheDir.path()).entryInfoList(QDir::Files).constFirst().absoluteFilePath();
+    upload(writeFile(u"second.txt"_s, "abcdefghij"));
+    QTRY_COMPARE(cache->size(), qint64(20));
+
+    // the least recently used file is removed
+    upload(writeFile(u"third.txt"_s, "ABCDEFGHIJ"));
+    QTRY_VERIFY(!QFile::exists(firstStoredFile));
+    QCOMPARE(QDir(cacheDir.path()).entryList(QDir::Files).size(), 2);
+    QCOMPARE(cache->size(), qint64(20));
+
+    const auto misses = cache->misses();
+    download(first, filesDir.filePath(u"download.txt"_s));
+    QCOMPARE(provider->downloadCount, 1);
+    QCOMPARE(cache->misses(), misses + 1);
+
+    // files larger than the maximum size are not stored
+    cache->setMaxSize(5);
+    QCOMPARE(cache->size(), qint64(0));
+    upload(writeFile(u"fourth.txt"_s, "0123456789abcdef"));
+    QTest::qWait(50);
+    QTRY_COMPARE(QDir(cacheDir.path()).entryList(QDir::Files).size(), 0);
+}
+
+QString tst_QXmppFileCache::writeFile(const QString &name, const QByteArray &data)
+{
+    const auto filePath = filesDir.filePath(name);
+    QFile file(filePath);
+    file.open(QIODevice::WriteOnly);
+    file.write(data);
+    return filePath;
+}
+
+QXmppFileShare tst_QXmppFileCache::upload(const QString &filePath)
+{
+    auto upload = manager->uploadFile(provider, filePath);
+    VERIFY2(QTest::qWaitFor([&]() { return upload->isFinished(); }), "Upload is still running!");
+    return expectVariant<QXmppFileUpload::FileResult>(upload->result()).fileShare;
+}
+
+QXmppFileDownload::Result tst_QXmppFileCache::download(const QXmppFileShare &fileShare, const QString &filePath)
+{
+    auto output = std::make_unique<QFile>(filePath);
+    output->open(QIODevice::WriteOnly);
+
+    auto download = manager->downloadFile(fileShare, std::move(output));
+    VERIFY2(QTest::qWaitFor([&]() { return download->isFinished(); }), "Download is still running!");
+    return download->result();
+}
+
+QByteArray tst_QXmppFileCache::readFile(const QString &filePath)
+{
+    QFile file(filePath);
+    file.open(QIODevice::ReadOnly);
+    return file.readAll();
+}
+
+QTEST_MAIN(tst_QXmppFileCache)
+#include "tst_qxmppfilecache.moc"
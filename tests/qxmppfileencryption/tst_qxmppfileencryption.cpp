@@ -3,6 +3,7 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 
 #include "QXmppFileEncryption.h"
+#include "QXmppHashing_p.h"
 
 #include "QcaInitializer_p.h"
 
@@ -22,7 +23,11 @@ private:
     Q_SLOT void deviceEncrypt();
     Q_SLOT void deviceDecrypt_data();
     Q_SLOT void deviceDecrypt();
+    Q_SLOT void deviceEncryptFile_data();
+    Q_SLOT void deviceEncryptFile();
     Q_SLOT void paddingSize();
+    Q_SLOT void benchmarkEncryption_data();
+    Q_SLOT void benchmarkEncryption();
 };
 
 void tst_QXmppFileEncryption::basic()
@@ -124,6 +129,59 @@ void tst_QXmppFileEncryption::deviceDecrypt()
     QCOMPARE(decrypted, data);
 }
 
+void tst_QXmppFileEncryption::deviceEncryptFile_data()
+{
+    deviceDecrypt_data();
+}
+
+void tst_QXmppFileEncryption::deviceEncryptFile()
+{
+    QFETCH(int, cipherId);
+    QFETCH(QByteArray, key);
+    auto cipher = Cipher(cipherId);
+
+    QcaInitializer encInit;
+
+    QByteArray iv = "12345678901234567890123456789012";
+    QByteArray data;
+    for (int i = 0; data.size() < 100 * 1024; i++) {
+        data += QByteArray::number(i);
+    }
+
+    QTemporaryFile tempFile;
+    QVERIFY(tempFile.open());
+    QCOMPARE(tempFile.write(data), qint64(data.size()));
+    QVERIFY(tempFile.flush());
+
+    // local files are encrypted from the mapped memory
+    auto file = std::make_unique<QFile>(tempFile.fileName());
+    QVERIFY(file->open(QIODevice::ReadOnly));
+    EncryptionDevice encDevice(std::move(file), cipher, key, iv);
+
+    // read in chunks not aligned to the block size
+    QByteArray encrypted;
+    for (int chunkSize = 1;; chunkSize = chunkSize % 5000 + 777) {
+        auto chunk = encDevice.read(chunkSize);
+        if (chunk.isEmpty()) {
+            break;
+        }
+        encrypted += chunk;
+    }
+
+    QCOMPARE(encrypted, process(data, cipher, Encode, key, iv));
+
+    // files wrapped by a hashing device are mapped as well and still hashed
+    file = std::make_unique<QFile>(tempFile.fileName());
+    QVERIFY(file->open(QIODevice::ReadOnly));
+    auto hasher = std::make_shared<StreamHasher>(std::vector { HashAlgorithm::Sha256 });
+    EncryptionDevice hashedEncDevice(std::make_unique<HashingDevice>(std::move(file), hasher), cipher, key, iv);
+    QCOMPARE(hashedEncDevice.readAll(), encrypted);
+
+    const auto hashes = hasher->result();
+    QVERIFY(hashes);
+    QCOMPARE(hashes->front().hash(), QCryptographicHash::hash(data, QCryptographicHash::Sha256));
+}
+
 void tst_QXmppFileEncryption::paddingSize()
 {
     constexpr auto MAX_BYTES_TEST = 1024;
@@ -149,5 +207,106 @@ void tst_QXmppFileEncryption::paddingSize()
     }
 }
 
+void tst_QXmppFileEncryption::benchmarkEncryption_data()
+{
+    QTest::addColumn<int>("cipherId");
+    QTest::addColumn<int>("direction");
+    QTest::addColumn<bool>("isFile");
+    // 0 to process all data at once without a device
+    QTest::addColumn<qint64>("chunkSize");
+
+    const std::vector<std::pair<const char *, Cipher>> ciphers = {
+        { "aes128-gcm", Aes128GcmNoPad },
+        { "aes256-gcm", Aes256GcmNoPad },
+        { "aes256-cbc", Aes256CbcPkcs7 },
+    };
+
+    for (const auto &[name, cipher] : ciphers) {
+        QTest::addRow("%s-encrypt-process", name) << int(cipher) << int(Encode) << false << qint64(0);
+        QTest::addRow("%s-encrypt-device-16k", name) << int(cipher) << int(Encode) << false << qint64(16 * 1024);
+        QTest::addRow("%s-encrypt-device-1m", name) << int(cipher) << int(Encode) << false << qint64(1024 * 1024);
+        QTest::addRow("%s-encrypt-file-1m", name) << int(cipher) << int(Encode) << true << qint64(1024 * 1024);
+        QTest::addRow("%s-decrypt-process", name) << int(cipher) << int(Decode) << false << qint64(0);
+        QTest::addRow("%s-decrypt-device-16k", name) << int(cipher) << int(Decode) << false << qint64(16 * 1024);
+        QTest::addRow("%s-decrypt-device-1m", name) << int(cipher) << int(Decode) << false << qint64(1024 * 1024);
+    }
+}
+
+void tst_QXmppFileEncryption::benchmarkEncryption()
+{
+    QFETCH(int, cipherId);
+    QFETCH(int, direction);
+    QFETCH(bool, isFile);
+    QFETCH(qint64, chunkSize);
+    auto cipher = Cipher(cipherId);
+
+    QcaInitializer encInit;
+    if (!isSupported(cipher)) {
+        QSKIP("Cipher is not supported by QCA.");
+    }
+
+    const auto key = generateKey(cipher);
+    const auto iv = generateInitializationVector(cipher);
+
+    // small enough to run with the other tests, larger data can be encrypted by setting the size in MiB
+    const auto sizeMiB = qEnvironmentVariableIntValue("QXMPP_BENCHMARK_ENCRYPTION_SIZE_MIB");
+    const QByteArray plaintext((sizeMiB > 0 ? sizeMiB : 4) * 1024 * 1024, 'a');
+    const auto data = direction == Encode ? plaintext : process(plaintext, cipher, Encode, key, iv);
+
+    QTemporaryFile file;
+    if (isFile) {
+        QVERIFY(file.open());
+        QCOMPARE(file.write(data), qint64(data.size()));
+        QVERIFY(file.flush());
+    }
+
+    QByteArray chunk(chunkSize, Qt::Uninitialized);
+    QElapsedTimer timer;
+    qint64 elapsedNanoseconds = 0;
+    constexpr int iterations = 3;
+
+    for (int i = 0; i < iterations; i++) {
+        qint64 processedSize = 0;
+        timer.start();
+
+        if (chunkSize == 0) {
+            processedSize = process(data, cipher, Direction(direction), key, iv).size();
+        } else if (direction == Encode) {
+            std::unique_ptr<QIODevice> input;
+            if (isFile) {
+                input = std::make_unique<QFile>(file.fileName());
+            } else {
+                auto buffer = std::make_unique<QBuffer>();
+                buffer->setData(data);
+                input = std::move(buffer);
+            }
+            input->open(QIODevice::ReadOnly);
+
+            EncryptionDevice device(std::move(input), cipher, key, iv);
+            for (qint64 read = 0; (read = device.read(chunk.data(), chunkSize)) > 0;) {
+                processedSize += read;
+            }
+        } else {
+            QByteArray decrypted;
+            decrypted.reserve(data.size());
+            auto output = std::make_unique<QBuffer>(&decrypted);
+            output->open(QIODevice::WriteOnly);
+
+            DecryptionDevice device(std::move(output), cipher, key, iv);
+            for (qint64 written = 0; written < data.size(); written += chunkSize) {
+                device.write(data.constData() + written, std::min(chunkSize, qint64(data.size()) - written));
+            }
+            device.close();
+            processedSize = decrypted.size();
+        }
+
+        elapsedNanoseconds += timer.nsecsElapsed();
+        QVERIFY(processedSize >= plaintext.size());
+    }
+
+    const auto bytesPerSecond = double(data.size()) * iterations / (double(std::max(elapsedNanoseconds, qint64(1))) / 1e9);
+    QTest::setBenchmarkResult(bytesPerSecond, QTest::BytesPerSecond);
+}
+
 QTEST_MAIN(tst_QXmppFileEncryption)
 #include "tst_qxmppfileencryption.moc"
@@ -0,0 +1,132 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "QXmppHashing_p.h"
+#include "QXmppHttpFileSharingProvider.h"
+
+#include "TestHttpServer.h"
+#include "util.h"
+
+#include <QNetworkAccessManager>
+
+using namespace QXmpp;
+using namespace QXmpp::Private;
+
+using DownloadResult = QXmppFileSharingProvider::DownloadResult;
+
+class tst_QXmppHttpFileSharingProvider : public QObject
+{
+    Q_OBJECT
+
+private:
+    Q_SLOT void initTestCase();
+    Q_SLOT void testParallelDownload();
+    Q_SLOT void testParallelDownloadResumed();
+    Q_SLOT void testParallelDownloadWithoutRanges();
+
+    void download(TestHttpServer &server, std::unique_ptr<QIODevice> target, std::optional<DownloadResult> &result, quint64 *lastBytesReceived = nullptr);
+
+    QByteArray m_data;
+};
+
+void tst_QXmppHttpFileSharingProvider::initTestCase()
+{
+    for (int i = 0; m_data.size() < 10000; i++) {
+        m_data += QByteArray::number(i);
+    }
+    m_data.truncate(10000);
+}
+
+void tst_QXmppHttpFileSharingProvider::download(TestHttpServer &server, std::unique_ptr<QIODevice> target, std::optional<DownloadResult> &result, quint64 *lastBytesReceived)
+{
+    QNetworkAccessManager netManager;
+    QXmppHttpFileSharingProvider provider(nullptr, &netManager);
+    provider.setParallelDownloadConnections(3);
+    provider.setParallelDownloadRangeSize(1000);
+
+    auto reportProgress = [=](quint64 bytesReceived, quint64) {
+        if (lastBytesReceived) {
+            *lastBytesReceived = bytesReceived;
+        }
+    };
+    auto reportFinished = [&result](DownloadResult downloadResult) {
+        result = std::move(downloadResult);
+    };
+
+    auto providerDownload = provider.downloadFile(QXmppHttpFileSource(server.url()), std::move(target), std::move(reportProgress), std::move(reportFinished));
+    QTRY_VERIFY(result.has_value());
+}
+
+void tst_QXmppHttpFileSharingProvider::testParallelDownload()
+{
+    TestHttpServer server(m_data);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QByteArray downloaded;
+    auto buffer = std::make_unique<QBuffer>(&downloaded);
+    QVERIFY(buffer->open(QIODevice::WriteOnly));
+
+    // ranges received out of order are hashed once the data in front of them is complete
+    auto hasher = std::make_shared<StreamHasher>(std::vector { HashAlgorithm::Sha256 });
+    auto target = std::make_unique<HashingDevice>(std::move(buffer), hasher);
+
+    quint64 bytesReceived = 0;
+    std::optional<DownloadResult> result;
+    download(server, std::move(target), result, &bytesReceived);
+    QVERIFY(result);
+    QVERIFY(std::holds_alternative<Success>(*result));
+    QCOMPARE(downloaded, m_data);
+    QCOMPARE(bytesReceived, quint64(m_data.size()));
+
+    // one request per range
+    QCOMPARE(server.requestedRanges.size(), 10);
+    QCOMPARE(server.requestedRanges.first(), QByteArray("bytes=0-999"));
+    QVERIFY(server.requestedRanges.contains("bytes=9000-9999"));
+
+    auto hashes = hasher->result();
+    QVERIFY(hashes);
+    QCOMPARE(hashes->front().hash(), QCryptographicHash::hash(m_data, QCryptographicHash::Sha256));
+}
+
+void tst_QXmppHttpFileSharingProvider::testParallelDownloadResumed()
+{
+    TestHttpServer server(m_data);
+    server.interruptedResponses = 3;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QByteArray downloaded;
+    auto buffer = std::make_unique<QBuffer>(&downloaded);
+    QVERIFY(buffer->open(QIODevice::WriteOnly));
+
+    std::optional<DownloadResult> result;
+    download(server, std::move(buffer), result);
+    QVERIFY(result);
+    QVERIFY(std::holds_alternative<Success>(*result));
+    QCOMPARE(downloaded, m_data);
+
+    // interrupted ranges are continued after the received data
+    QCOMPARE(server.requestedRanges.size(), 13);
+    QVERIFY(server.requestedRanges.contains("bytes=500-999"));
+}
+
+void tst_QXmppHttpFileSharingProvider::testParallelDownloadWithoutRanges()
+{
+    TestHttpServer server(m_data);
+    server.rangesSupported = false;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QByteArray downloaded;
+    auto buffer = std::make_unique<QBuffer>(&downloaded);
+    QVERIFY(buffer->open(QIODevice::WriteOnly));
+
+    std::optional<DownloadResult> result;
+    download(server, std::move(buffer), result);
+    QVERIFY(result);
+    QVERIFY(std::holds_alternative<Success>(*result));
+    QCOMPARE(downloaded, m_data);
+    QCOMPARE(server.requestedRanges.size(), 1);
+}
+
+QTEST_MAIN(tst_QXmppHttpFileSharingProvider)
+#include "tst_qxmpphttpfilesharingprovider.moc"
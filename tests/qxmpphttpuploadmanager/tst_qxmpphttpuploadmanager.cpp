@@ -7,14 +7,17 @@
 #include "QXmppDiscoveryManager.h"
 #include "QXmppHttpUploadIq.h"
 #include "QXmppHttpUploadManager.h"
+#include "QXmppHttpUploadManager_p.h"
 #include "QXmppUploadRequestManager.h"
 
 #include "Algorithms.h"
 #include "IntegrationTesting.h"
 #include "TestClient.h"
+#include "TestHttpServer.h"
 #include "util.h"
 
 #include <QMimeDatabase>
+#include <QNetworkAccessManager>
 
 using namespace QXmpp::Private;
 
@@ -63,11 +66,30 @@ private:
     Q_SLOT void testSendingFuture_data();
     Q_SLOT void testSendingFuture();
     Q_SLOT void testUploadService();
+    Q_SLOT void testUploadServicesCached();
 
     // HttpUploadManager
     Q_SLOT void testUpload();
+    Q_SLOT void testUploadInChunks();
+    Q_SLOT void testUploadRetried();
+    Q_SLOT void testUploadWithoutPartialUploads();
+    Q_SLOT void testUploadFailing();
+    Q_SLOT void testPrefetchSlot();
+    Q_SLOT void testUploadTooLarge();
+
+    void upload(TestHttpServer &server, HttpUploader::Options options, std::optional<HttpUploader::Result> &result, quint64 *lastBytesSent = nullptr);
 };
 
+static QByteArray generateUploadData()
+{
+    QByteArray data;
+    for (int i = 0; data.size() < 10000; i++) {
+        data += QByteArray::number(i);
+    }
+    data.truncate(10000);
+    return data;
+}
+
 void tst_QXmppHttpUploadManager::testHandleStanza_data()
 {
     QTest::addColumn<QByteArray>("xml");
@@ -360,6 +382,93 @@ void tst_QXmppHttpUploadManager::testUploadService()
     QCOMPARE(service.jid(), u"upload.shakespeare.lit"_s);
 }
 
+void tst_QXmppHttpUploadManager::testUploadServicesCached()
+{
+    TestClient test;
+    test.addNewExtension<QXmppDiscoveryManager>();
+    auto *manager = test.addNewExtension<QXmppUploadRequestManager>();
+    test.configuration().setDomain(u"montague.tld"_s);
+
+    addUploadService(test);
+    QCOMPARE(manager->uploadServices().size(), 1);
+
+    // services are kept when reconnecting to the same server
+    Q_EMIT test.disconnected();
+    Q_EMIT test.connected();
+    QVERIFY(manager->serviceFound());
+
+    // rediscovered services are not added again
+    addUploadService(test);
+    QCOMPARE(manager->uploadServices().size(), 1);
+
+    // services are removed when connecting to another server
+    test.configuration().setDomain(u"capulet.tld"_s);
+    Q_EMIT test.connected();
+    QVERIFY(!manager->serviceFound());
+}
+
+void tst_QXmppHttpUploadManager::testPrefetchSlot()
+{
+    TestClient test;
+    test.addNewExtension<QXmppDiscoveryManager>();
+    test.addNewExtension<QXmppUploadRequestManager>();
+    auto *uploadManager = test.addNewExtension<QXmppHttpUploadManager>();
+
+    addUploadService(test);
+
+    uploadManager->prefetchSlot(QFileInfo(u":/test.svg"_s));
+
+    QXmppHttpUploadRequestIq iq;
+    parsePacket(iq, test.takePacket().toUtf8());
+    QCOMPARE(iq.to(), UPLOAD_SERVICE_NAME);
+    QCOMPARE(iq.fileName(), u"test.svg"_s);
+
+    // a slot is only requested once
+    uploadManager->prefetchSlot(QFileInfo(u":/test.svg"_s));
+    test.expectNoPacket();
+
+    // the insecure URL lets the upload fail before any HTTP request is sent
+    test.inject(
+        "<iq from='" + iq.to().toUtf8() + "' id='" + iq.id().toUtf8() + "' type='result'>"
+        "<slot xmlns='urn:xmpp:http:upload:0'>"
+        "<put url='http://upload.montague.tld/test.svg'/>"
+        "<get url='http://download.montague.tld/test.svg'/>"
+        "</slot>"
+        "</iq>");
+
+    // the prefetched slot is used instead of requesting a new one
+    auto upload = uploadManager->uploadFile(QFileInfo(u":/test.svg"_s));
+    test.expectNoPacket();
+    QVERIFY(upload->isFinished());
+    auto error = expectVariant<QXmppError>(*upload->result());
+    QVERIFY(error.description.contains(u"insecure"_s));
+
+    // the slot is not used for a second upload
+    upload = uploadManager->uploadFile(QFileInfo(u":/test.svg"_s));
+    parsePacket(iq, test.takePacket().toUtf8());
+    QCOMPARE(iq.fileName(), u"test.svg"_s);
+    QVERIFY(!upload->isFinished());
+}
+
+void tst_QXmppHttpUploadManager::testUploadTooLarge()
+{
+    TestClient test;
+    test.addNewExtension<QXmppDiscoveryManager>();
+    test.addNewExtension<QXmppUploadRequestManager>();
+    auto *uploadManager = test.addNewExtension<QXmppHttpUploadManager>();
+
+    addUploadService(test);
+
+    auto buffer = std::make_unique<QBuffer>();
+    buffer->open(QIODevice::ReadOnly);
+
+    // the file is rejected without requesting a slot
+    auto upload = uploadManager->uploadFile(std::move(buffer), u"large.bin"_s, QMimeDatabase().mimeTypeForName(u"application/octet-stream"_s), qint64(MAX_FILE_SIZE) + 1);
+    test.expectNoPacket();
+    QVERIFY(upload->isFinished());
+    expectVariant<QXmppError>(*upload->result());
+}
+
 void tst_QXmppHttpUploadManager::testUpload()
 {
     using DiscoInfoResult = QXmppDiscoveryManager::InfoResult;
@@ -436,5 +545,99 @@ void tst_QXmppHttpUploadManager::testUpload()
     qDebug() << "Uploaded file to" << url.toDisplayString();
 }
 
+void tst_QXmppHttpUploadManager::upload(TestHttpServer &server, HttpUploader::Options options, std::optional<HttpUploader::Result> &result, quint64 *lastBytesSent)
+{
+    const auto data = generateUploadData();
+    auto buffer = std::make_unique<QBuffer>();
+    buffer->setData(data);
+    QVERIFY(buffer->open(QIODevice::ReadOnly));
+
+    QNetworkAccessManager netManager;
+    auto uploader = std::make_shared<HttpUploader>(&netManager, QNetworkRequest(server.url()), std::move(buffer), data.size(), options);
+    uploader->reportProgress = [=](quint64 bytesSent, quint64) {
+        if (lastBytesSent) {
+            *lastBytesSent = bytesSent;
+        }
+    };
+    uploader->reportFinished = [&result](HttpUploader::Result uploadResult) {
+        result = std::move(uploadResult);
+    };
+    uploader->start();
+
+    QTRY_VERIFY(result.has_value());
+}
+
+void tst_QXmppHttpUploadManager::testUploadInChunks()
+{
+    TestHttpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    std::optional<HttpUploader::Result> result;
+    quint64 bytesSent = 0;
+    upload(server, { 3000, 3, std::chrono::milliseconds(10) }, result, &bytesSent);
+    QVERIFY(result);
+    QVERIFY(std::holds_alternative<Success>(*result));
+    QCOMPARE(server.data, generateUploadData());
+    QCOMPARE(bytesSent, quint64(10000));
+    QCOMPARE(server.requestedRanges,
+             (QList<QByteArray> { "bytes 0-2999/10000", "bytes 3000-5999/10000", "bytes 6000-8999/10000", "bytes 9000-9999/10000" }));
+}
+
+void tst_QXmppHttpUploadManager::testUploadRetried()
+{
+    TestHttpServer server;
+    server.failingRequests = { 1, 2 };
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    // only the failed chunk is uploaded again
+    std::optional<HttpUploader::Result> result;
+    upload(server, { 3000, 3, std::chrono::milliseconds(10) }, result);
+    QVERIFY(result);
+    QVERIFY(std::holds_alternative<Success>(*result));
+    QCOMPARE(server.data, generateUploadData());
+    QCOMPARE(server.requestedRanges.size(), 6);
+    QCOMPARE(server.requestedRanges.at(1), QByteArray("bytes 3000-5999/10000"));
+    QCOMPARE(server.requestedRanges.at(2), QByteArray("bytes 3000-5999/10000"));
+    QCOMPARE(server.requestedRanges.at(3), QByteArray("bytes 3000-5999/10000"));
+
+    // all data is uploaded again without chunks
+    server.data.clear();
+    server.requestedRanges.clear();
+    server.failingRequests = { 0 };
+    result.reset();
+    upload(server, { 0, 3, std::chrono::milliseconds(10) }, result);
+    QVERIFY(result);
+    QVERIFY(std::holds_alternative<Success>(*result));
+    QCOMPARE(server.data, generateUploadData());
+    QCOMPARE(server.requestedRanges.size(), 2);
+}
+
+void tst_QXmppHttpUploadManager::testUploadWithoutPartialUploads()
+{
+    TestHttpServer server;
+    server.rangesSupported = false;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    std::optional<HttpUploader::Result> result;
+    upload(server, { 3000, 3, std::chrono::milliseconds(10) }, result);
+    QVERIFY(result);
+    QVERIFY(std::holds_alternative<Success>(*result));
+    QCOMPARE(server.data, generateUploadData());
+    QCOMPARE(server.requestedRanges, (QList<QByteArray> { "bytes 0-2999/10000", {} }));
+}
+
+void tst_QXmppHttpUploadManager::testUploadFailing()
+{
+    TestHttpServer server;
+    server.allRequestsFailing = true;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    std::optional<HttpUploader::Result> result;
+    upload(server, { 3000, 2, std::chrono::milliseconds(10) }, result);
+    QVERIFY(result);
+    QVERIFY(std::holds_alternative<QXmppError>(*result));
+    QCOMPARE(server.requestedRanges.size(), 3);
+}
+
 QTEST_MAIN(tst_QXmppHttpUploadManager)
 #include "tst_qxmpphttpuploadmanager.moc"
@@ -0,0 +1,151 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "QXmppImageMetadataGenerator.h"
+
+#include "util.h"
+
+#include <QBuffer>
+#include <QImage>
+#include <QObject>
+#include <QTemporaryFile>
+
+static QByteArray generateImage(QSize size)
+{
+    QImage image(size, QImage::Format_RGB32);
+    image.fill(Qt::darkCyan);
+
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer, "png");
+    return data;
+}
+
+static std::unique_ptr<QIODevice> openBuffer(const QByteArray &data)
+{
+    auto buffer = std::make_unique<QBuffer>();
+    buffer->setData(data);
+    buffer->open(QIODevice::ReadOnly);
+    return buffer;
+}
+
+static std::unique_ptr<QIODevice> openFile(const QString &filePath)
+{
+    auto file = std::make_unique<QFile>(filePath);
+    file->open(QIODevice::ReadOnly);
+    return file;
+}
+
+class tst_QXmppImageMetadataGenerator : public QObject
+{
+    Q_OBJECT
+
+private:
+    Q_SLOT void testGenerate();
+    Q_SLOT void testGenerateFromFile();
+    Q_SLOT void testNoImage();
+    Q_SLOT void testCache();
+    Q_SLOT void testCancel();
+};
+
+void tst_QXmppImageMetadataGenerator::testGenerate()
+{
+    QXmppImageMetadataGenerator generator;
+    QCOMPARE(generator.thumbnailSize(), QSize(128, 128));
+
+    auto result = wait(generator.generate(openBuffer(generateImage({ 400, 200 }))));
+    QVERIFY(result);
+    QCOMPARE(*result->dimensions, QSize(400, 200));
+    QVERIFY(!result->length);
+    QCOMPARE(result->thumbnails.size(), 1);
+
+    const auto &thumbnail = result->thumbnails.constFirst();
+    QCOMPARE(thumbnail.width, 128u);
+    QCOMPARE(thumbnail.height, 64u);
+    QVERIFY(thumbnail.mimeType.name().startsWith(u"image/"_s));
+    QCOMPARE(QImage::fromData(thumbnail.data).size(), QSize(128, 64));
+}
+
+void tst_QXmppImageMetadataGenerator::testGenerateFromFile()
+{
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(generateImage({ 50, 40 }));
+    QVERIFY(file.flush());
+
+    auto device = std::make_unique<QFile>(file.fileName());
+    QVERIFY(device->open(QIODevice::ReadOnly));
+
+    // small images are not scaled
+    QXmppImageMetadataGenerator generator;
+    auto result = wait(generator.generate(std::move(device)));
+    QVERIFY(result);
+    QCOMPARE(*result->dimensions, QSize(50, 40));
+    QCOMPARE(result->thumbnails.size(), 1);
+    QCOMPARE(result->thumbnails.constFirst().width, 50u);
+    QCOMPARE(result->thumbnails.constFirst().height, 40u);
+}
+
+void tst_QXmppImageMetadataGenerator::testNoImage()
+{
+    QXmppImageMetadataGenerator generator;
+    auto result = wait(generator.generate(openBuffer("This is not an image.")));
+    QVERIFY(result);
+    QVERIFY(!result->dimensions);
+    QVERIFY(result->thumbnails.isEmpty());
+}
+
+void tst_QXmppImageMetadataGenerator::testCache()
+{
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(generateImage({ 300, 300 }));
+    QVERIFY(file.flush());
+
+    QXmppImageMetadataGenerator generator;
+    generator.setMaxThreadCount(1);
+    QCOMPARE(generator.maxThreadCount(), 1);
+
+    auto first = wait(generator.generate(openFile(file.fileName())));
+    auto second = wait(generator.generate(openFile(file.fileName())));
+    QCOMPARE(*second->dimensions, *first->dimensions);
+    QCOMPARE(second->thumbnails.constFirst().data, first->thumbnails.constFirst().data);
+
+    // the cached thumbnail is not used for another size
+    generator.setThumbnailSize({ 64, 64 });
+    auto third = wait(generator.generate(openFile(file.fileName())));
+    QCOMPARE(third->thumbnails.constFirst().width, 64u);
+
+    // the cached metadata is not used for a modified file
+    QVERIFY(file.resize(0));
+    file.write(generateImage({ 200, 100 }));
+    QVERIFY(file.flush());
+    auto fourth = wait(generator.generate(openFile(file.fileName())));
+    QCOMPARE(*fourth->dimensions, QSize(200, 100));
+
+    // the metadata generator can be used after the generator is destroyed
+    auto metadataGenerator = std::make_unique<QXmppImageMetadataGenerator>()->metadataGenerator();
+    auto fifth = wait(metadataGenerator(openBuffer(generateImage({ 300, 300 }))));
+    QCOMPARE(*fifth->dimensions, QSize(300, 300));
+}
+
+void tst_QXmppImageMetadataGenerator::testCancel()
+{
+    QXmppImageMetadataGenerator generator;
+    generator.setMaxThreadCount(1);
+
+    // the second job is queued while the first one is running
+    auto first = generator.generate(openBuffer(generateImage({ 4000, 4000 })));
+    auto second = generator.generate(openBuffer(generateImage({ 100, 100 })));
+    second.cancel();
+
+    QVERIFY(wait(first));
+    QTRY_VERIFY(second.isFinished());
+    QVERIFY(second.isCanceled());
+    QCOMPARE(second.resultCount(), 0);
+}
+
+QTEST_GUILESS_MAIN(tst_QXmppImageMetadataGenerator)
+#include "tst_qxmppimagemetadatagenerator.moc"
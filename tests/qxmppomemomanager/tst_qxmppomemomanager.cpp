@@ -17,11 +17,17 @@
 #include "QXmppPubSubManager.h"
 
 #include "IntegrationTesting.h"
+#include "TestClient.h"
 #include "util.h"
 
 #include <QObject>
 
+#include <algorithm>
+
 #if BUILD_INTERNAL_TESTS
+#include "QXmppOmemoDeviceElement_p.h"
+#include "QXmppOmemoEnvelope_p.h"
+#include "QXmppOmemoItems_p.h"
 #include "QXmppOmemoManager_p.h"
 #endif
 
@@ -86,6 +92,17 @@ private:
     Q_SLOT void testLoad();
     Q_SLOT void testSendMessage();
     Q_SLOT void testSendIq();
+    Q_SLOT void testDeviceBundleCache();
+    Q_SLOT void testPreKeyPairsReplenishment();
+    Q_SLOT void testDeviceListCache();
+    Q_SLOT void testOwnDataPublicationSkipped();
+    Q_SLOT void testDeviceStorageBatched();
+    Q_SLOT void testSessionsLoadedOnDemand();
+    Q_SLOT void testDecryptMessages();
+    Q_SLOT void benchmarkEnvelopeEncryption_data();
+    Q_SLOT void benchmarkEnvelopeEncryption();
+    Q_SLOT void benchmarkPayloadEncryption_data();
+    Q_SLOT void benchmarkPayloadEncryption();
     Q_SLOT void finish(OmemoUser &omemoUser);
 
     OmemoUser m_alice1;
@@ -482,6 +499,525 @@ void tst_QXmppOmemoManager::testSendIq()
     finish(m_alice2);
 }
 
+void tst_QXmppOmemoManager::testDeviceBundleCache()
+{
+#if BUILD_INTERNAL_TESTS
+    QXmppAtmTrustMemoryStorage trustStorage;
+    QXmppOmemoMemoryStorage omemoStorage;
+    TestClient client;
+    client.addNewExtension<QXmppPubSubManager>();
+    client.addNewExtension<QXmppAtmManager>(&trustStorage);
+    auto *manager = client.addNewExtension<QXmppOmemoManager>(&omemoStorage);
+
+    auto *d = manager->d.get();
+    const auto jid = u"bob@example.org"_s;
+    const DeviceKey device { jid, 1 };
+
+    auto itemNotFound = [&]() {
+        client.inject(u"<iq id='qxmpp1' from='%1' type='error'>"
+                      "<error type='cancel'><item-not-found xmlns='urn:ietf:params:xml:ns:xmpp-stanzas'/></error>"
+                      "</iq>"_s
+                          .arg(jid));
+    };
+
+    QXmppOmemoDeviceBundle deviceBundle;
+    deviceBundle.setPublicIdentityKey(QByteArray::fromBase64(QByteArrayLiteral("9E51lG3vVmUn8CM7/AIcmIlLP2HPl6Ao0/VSf4VT/oA=")));
+    d->cachedDeviceBundles.insert(device, { deviceBundle, QDeadlineTimer(DEVICE_BUNDLE_CACHE_TTL) });
+
+    // cached device bundle
+    auto future = d->requestDeviceBundle(device.first, device.second);
+    QVERIFY(future.isFinished());
+    const auto result = future.result();
+    QVERIFY(result);
+    QCOMPARE(result->publicIdentityKey(), deviceBundle.publicIdentityKey());
+    client.expectNoPacket();
+
+    // expired device bundle requested simultaneously
+    d->cachedDeviceBundles[device].expiry = QDeadlineTimer(0);
+    auto future1 = d->requestDeviceBundle(device.first, device.second);
+    auto future2 = d->requestDeviceBundle(device.first, device.second);
+    QVERIFY(!d->cachedDeviceBundles.contains(device));
+    QVERIFY(!future1.isFinished());
+    QVERIFY(!future2.isFinished());
+    QVERIFY(client.takePacket().contains(u"<item id=\"1\"/>"));
+    client.expectNoPacket();
+
+    itemNotFound();
+    QVERIFY(future1.isFinished());
+    QVERIFY(future2.isFinished());
+    QVERIFY(!future1.result());
+    QVERIFY(!future2.result());
+    QCOMPARE(d->runningDeviceBundleRequestsCount, 0);
+
+    // more device bundles than can be fetched at the same time
+    QVector<QXmppTask<std::optional<QXmppOmemoDeviceBundle>>> futures;
+    for (auto deviceId = 1; deviceId <= DEVICE_BUNDLE_REQUESTS_MAX + 1; ++deviceId) {
+        futures.append(d->requestDeviceBundle(jid, uint32_t(deviceId)));
+    }
+
+    QCOMPARE(d->runningDeviceBundleRequestsCount, DEVICE_BUNDLE_REQUESTS_MAX);
+    QCOMPARE(d->queuedDeviceBundleRequests.size(), qsizetype(1));
+    for (auto i = 0; i < DEVICE_BUNDLE_REQUESTS_MAX; ++i) {
+        client.takePacket();
+    }
+    client.expectNoPacket();
+
+    // The queued device bundle is fetched once a running request is finished.
+    itemNotFound();
+    QVERIFY(futures.constFirst().isFinished());
+    QCOMPARE(d->runningDeviceBundleRequestsCount, DEVICE_BUNDLE_REQUESTS_MAX);
+    QVERIFY(d->queuedDeviceBundleRequests.isEmpty());
+    QVERIFY(client.takePacket().contains(u"<item id=\"%1\"/>"_s.arg(DEVICE_BUNDLE_REQUESTS_MAX + 1)));
+    client.expectNoPacket();
+#else
+    QSKIP("Requires internal tests");
+#endif
+}
+
+void tst_QXmppOmemoManager::testPreKeyPairsReplenishment()
+{
+#if BUILD_INTERNAL_TESTS
+    OmemoUser omemoUser;
+    initOmemoUser(omemoUser);
+
+    auto *d = omemoUser.manager->d.get();
+    d->schedulePeriodicTasks();
+    QVERIFY(d->updatePreKeyPairs(PRE_KEY_INITIAL_CREATION_COUNT));
+
+    auto preKeyIds = d->preKeyPairs.keys();
+    std::sort(preKeyIds.begin(), preKeyIds.end());
+
+    // pre key pairs above the low-water mark
+    for (auto i = 0; i < int(PRE_KEY_INITIAL_CREATION_COUNT) - PRE_KEY_LOW_WATER_MARK; ++i) {
+        d->removePreKeyPair(preKeyIds.at(i));
+    }
+
+    QVERIFY(!d->isPreKeyPairsGenerationRunning);
+
+    // consumed pre keys are removed from the published device bundle together shortly afterwards
+    QVERIFY(d->deviceBundlePublicationTimer.isActive());
+    QVERIFY(d->deviceBundlePublicationTimer.remainingTimeAsDuration() <= CONSUMED_PRE_KEYS_PUBLICATION_DELAY);
+    QCOMPARE(d->deviceBundlePublicationsCount, 0);
+    QTRY_COMPARE(d->deviceBundlePublicationsCount, 1);
+
+    // pre key pairs below the low-water mark
+    d->removePreKeyPair(preKeyIds.at(int(PRE_KEY_INITIAL_CREATION_COUNT) - PRE_KEY_LOW_WATER_MARK));
+    QVERIFY(d->isPreKeyPairsGenerationRunning);
+    QVERIFY(d->deviceBundlePublicationTimer.isActive());
+    d->deviceBundlePublicationTimer.stop();
+
+    QTRY_VERIFY(!d->isPreKeyPairsGenerationRunning);
+    QCOMPARE(d->preKeyPairs.size(), int(PRE_KEY_INITIAL_CREATION_COUNT));
+    QCOMPARE(d->deviceBundle.publicPreKeys().size(), int(PRE_KEY_INITIAL_CREATION_COUNT));
+    QCOMPARE(d->generatedPreKeyPairsCount, int(PRE_KEY_INITIAL_CREATION_COUNT) * 2 - PRE_KEY_LOW_WATER_MARK + 1);
+
+    // generated pre keys are published later together
+    QVERIFY(d->deviceBundlePublicationTimer.isActive());
+    QVERIFY(d->deviceBundlePublicationTimer.remainingTimeAsDuration() > CONSUMED_PRE_KEYS_PUBLICATION_DELAY);
+    QCOMPARE(omemoUser.manager->statistics().value(u"device-bundle-publications"_s).toInt(), d->deviceBundlePublicationsCount);
+
+    d->deviceBundlePublicationTimer.stop();
+#else
+    QSKIP("Requires internal tests");
+#endif
+}
+
+void tst_QXmppOmemoManager::testDeviceListCache()
+{
+#if BUILD_INTERNAL_TESTS
+    OmemoUser omemoUser;
+    initOmemoUser(omemoUser);
+
+    auto *d = omemoUser.manager->d.get();
+    const auto jid = u"bob@example.com"_s;
+
+    QXmppOmemoDeviceElement deviceElement1;
+    deviceElement1.setId(1);
+    deviceElement1.setLabel(u"Desktop"_s);
+
+    QXmppOmemoDeviceElement deviceElement2;
+    deviceElement2.setId(2);
+    deviceElement2.setLabel(u"Phone"_s);
+
+    QXmppOmemoDeviceList deviceList;
+    deviceList << deviceElement1 << deviceElement2;
+
+    QXmppOmemoDeviceListItem item;
+    item.setId(QXmppPubSubManager::standardItemIdToString(QXmppPubSubManager::Current));
+    item.setDeviceList(deviceList);
+
+    QVERIFY(d->updateContactDevices(jid, { item }));
+    QCOMPARE(d->devices.value(jid).size(), 2);
+    QVERIFY(d->deviceLists.contains(jid));
+    QCOMPARE(omemoUser.omemoStorage->allData().result().deviceLists.value(jid).hash, d->deviceLists.value(jid).hash);
+
+    // The device list is requested again because its changes are not received via notifications.
+    d->requestDeviceList(jid);
+    QCOMPARE(omemoUser.manager->statistics().value(u"device-list-requests"_s).toInt(), 1);
+
+    // The device list is not requested again while its changes are received via notifications.
+    const auto event = xmlToDom(u"<message from='bob@example.com'>"
+                                "<event xmlns='http://jabber.org/protocol/pubsub#event'>"
+                                "<items node='urn:xmpp:omemo:2:devices'>"
+                                "<item id='current'>"
+                                "<devices xmlns='urn:xmpp:omemo:2'><device id='1' label='Desktop'/><device id='2' label='Phone'/></devices>"
+                                "</item>"
+                                "</items>"
+                                "</event>"
+                                "</message>"_s);
+    QVERIFY(omemoUser.manager->handlePubSubEvent(event, jid, ns_omemo_2_devices.toString()));
+    QVERIFY(d->isDeviceListUpToDate(jid));
+    auto future = d->requestDeviceList(jid);
+    QVERIFY(future.isFinished());
+    QCOMPARE(omemoUser.manager->statistics().value(u"device-list-requests"_s).toInt(), 1);
+
+    // Notifications can be missed while being disconnected.
+    Q_EMIT omemoUser.client.disconnected();
+    QVERIFY(!d->isDeviceListUpToDate(jid));
+    d->requestDeviceList(jid);
+    QCOMPARE(omemoUser.manager->statistics().value(u"device-list-requests"_s).toInt(), 2);
+
+    // The same device list in a different order is not processed again.
+    const auto hash = d->deviceLists.value(jid).hash;
+    d->devices[jid].remove(2);
+    std::reverse(deviceList.begin(), deviceList.end());
+    item.setDeviceList(deviceList);
+    d->updateContactDevices(jid, { item });
+    QCOMPARE(d->deviceLists.value(jid).hash, hash);
+    QCOMPARE(d->devices.value(jid).size(), 1);
+
+    // A changed device list is processed.
+    deviceList.removeLast();
+    item.setDeviceList(deviceList);
+    d->updateContactDevices(jid, { item });
+    QVERIFY(d->deviceLists.value(jid).hash != hash);
+    QVERIFY(d->devices.value(jid).contains(2));
+
+    // A device list with another item ID is processed.
+    d->devices[jid].remove(2);
+    item.setId(u"other"_s);
+    d->updateContactDevices(jid, { item });
+    QCOMPARE(d->deviceLists.value(jid).itemId, u"other"_s);
+    QVERIFY(d->devices.value(jid).contains(2));
+#else
+    QSKIP("Requires internal tests");
+#endif
+}
+
+void tst_QXmppOmemoManager::testOwnDataPublicationSkipped()
+{
+#if BUILD_INTERNAL_TESTS
+    OmemoUser omemoUser;
+    initOmemoUser(omemoUser);
+
+    auto *d = omemoUser.manager->d.get();
+    d->ownDevice.id = 1;
+
+    RefCountedPtr<ratchet_identity_key_pair> identityKeyPair;
+    QVERIFY(d->setUpIdentityKeyPair(identityKeyPair.ptrRef()));
+    QVERIFY(d->updateSignedPreKeyPair(identityKeyPair.get()));
+    QVERIFY(d->updatePreKeyPairs(PRE_KEY_INITIAL_CREATION_COUNT));
+
+    d->storePublishedDataHash();
+    QCOMPARE(omemoUser.omemoStorage->allData().result().ownDevice->publishedDataHash, d->ownDataHash());
+
+    // The device bundle is restored from the stored keys instead of setting up a new device.
+    const auto ownDataHash = d->ownDataHash();
+    d->deviceBundle = QXmppOmemoDeviceBundle();
+
+    // unchanged data
+    auto future = omemoUser.manager->setUp();
+    QVERIFY(future.isFinished());
+    QVERIFY(future.result());
+    QCOMPARE(d->ownDevice.id, uint32_t(1));
+    QCOMPARE(d->ownDataHash(), ownDataHash);
+    QCOMPARE(d->deviceBundlePublicationsCount, 0);
+
+    // changed data
+    d->removePreKeyPair(d->preKeyPairs.constBegin().key());
+    QVERIFY(d->ownDevice.publishedDataHash != d->ownDataHash());
+#else
+    QSKIP("Requires internal tests");
+#endif
+}
+
+void tst_QXmppOmemoManager::testDeviceStorageBatched()
+{
+#if BUILD_INTERNAL_TESTS
+    auto omemoStorage = std::make_unique<QXmppOmemoMemoryStorage>();
+    auto manager = std::make_unique<QXmppOmemoManager>(omemoStorage.get());
+    auto *d = manager->d.get();
+    d->schedulePeriodicTasks();
+
+    const auto bob = u"bob@example.org"_s;
+    const auto carol = u"carol@example.org"_s;
+    d->devices[bob].insert(1, { u"Desktop"_s });
+    d->devices[bob].insert(2, { u"Phone"_s });
+    d->devices[carol].insert(3, { u"Tablet"_s });
+
+    // changes are collected
+    d->storeDeviceLater(bob, 1);
+    d->storeDeviceLater(bob, 2);
+    d->storeDeviceLater(carol, 3);
+    d->storeDeviceLater(bob, 1);
+    QVERIFY(d->deviceStorageTimer.isActive());
+    QVERIFY(omemoStorage->allData().result().devices.isEmpty());
+
+    // and stored at once
+    QTRY_VERIFY(!d->deviceStorageTimer.isActive());
+    QVERIFY(d->devicesToBeStored.isEmpty());
+    auto storedDevices = omemoStorage->allData().result().devices;
+    QCOMPARE(storedDevices.value(bob).size(), 2);
+    QCOMPARE(storedDevices.value(carol).value(3).label, u"Tablet"_s);
+
+    // removed devices are skipped
+    d->storeDeviceLater(carol, 4);
+    d->storePendingDevices();
+    QVERIFY(!omemoStorage->allData().result().devices.value(carol).contains(4));
+
+    // pending changes are stored when the manager is destroyed
+    d->devices[bob][1].label = u"Notebook"_s;
+    d->storeDeviceLater(bob, 1);
+    manager.reset();
+    storedDevices = omemoStorage->allData().result().devices;
+    QCOMPARE(storedDevices.value(bob).value(1).label, u"Notebook"_s);
+#else
+    QSKIP("Requires internal tests");
+#endif
+}
+
+void tst_QXmppOmemoManager::testSessionsLoadedOnDemand()
+{
+#if BUILD_INTERNAL_TESTS
+    const auto bob = u"bob@example.org"_s;
+    const auto carol = u"carol@example.org"_s;
+
+    auto omemoStorage = std::make_unique<QXmppOmemoMemoryStorage>();
+    omemoStorage->setOwnDevice(QXmppOmemoStorage::OwnDevice { 1,
+                                                              u"notebook"_s,
+                                                              QByteArray::fromBase64(QByteArrayLiteral("OU5HM3loYnFjZVVaYmpSbHdab0FPTDhJVHRzUFVUcFMK")),
+                                                              QByteArray::fromBase64(QByteArrayLiteral("TkhodEZ6cnFDeGtENWRuT1ZZdUsyaGIwQkRPdHFRSE8K")),
+                                                              2,
+                                                              3 });
+    omemoStorage->addSignedPreKeyPair(2,
+                                      { QDateTime::currentDateTimeUtc(),
+                                        QByteArray::fromBase64(QByteArrayLiteral("VEZBOTZFRjNQSVRzVE1OcnIzYmV2ZFFuM0R3WmduUWwK")) });
+    omemoStorage->addPreKeyPairs({ { 3, QByteArray::fromBase64(QByteArrayLiteral("RmVmQ0RTTzB0Z2R2T0ZjckQ4N29PN01VTGFFMVZjUmIK")) } });
+    omemoStorage->addDevice(bob, 1, { u"Desktop"_s, QByteArrayLiteral("key1"), QByteArrayLiteral("session1") });
+    omemoStorage->addDevice(carol, 2, { u"Phone"_s, QByteArrayLiteral("key2"), QByteArrayLiteral("session2") });
+
+    auto manager = std::make_unique<QXmppOmemoManager>(omemoStorage.get());
+    manager->setSessionCacheSize(1);
+    QCOMPARE(manager->sessionCacheSize(), 1);
+
+    auto future = manager->load();
+    QVERIFY(future.isFinished());
+    QVERIFY(future.result());
+
+    // only the devices' metadata is loaded
+    auto *d = manager->d.get();
+    QCOMPARE(d->devices.value(bob).value(1).label, u"Desktop"_s);
+    QVERIFY(d->devices.value(bob).value(1).session.isEmpty());
+    QVERIFY(!d->areSessionsLoaded(bob));
+
+    // sessions are loaded on demand
+    QVERIFY(d->loadSessions({ bob }).isFinished());
+    QVERIFY(d->areSessionsLoaded(bob));
+    QCOMPARE(d->devices.value(bob).value(1).session, QByteArrayLiteral("session1"));
+
+    // recently used sessions are kept even if the cache size is exceeded
+    QVERIFY(d->loadSessions({ carol }).isFinished());
+    QVERIFY(d->areSessionsLoaded(bob));
+    QVERIFY(d->areSessionsLoaded(carol));
+
+    // the least recently used sessions are evicted
+    d->sessionsLastUsed[bob] = d->sessionUsageTimer.elapsed() - std::chrono::milliseconds(SESSION_EVICTION_GRACE_PERIOD).count() - 1;
+    d->evictSessions();
+    QVERIFY(!d->areSessionsLoaded(bob));
+    QVERIFY(d->devices.value(bob).value(1).session.isEmpty());
+    QCOMPARE(d->devices.value(carol).value(2).session, QByteArrayLiteral("session2"));
+
+    // storing a device with evicted sessions does not overwrite its stored session
+    d->devices[bob][1].label = u"Notebook"_s;
+    QVERIFY(d->storeDevice(bob, 1).isFinished());
+    const auto storedDevice = omemoStorage->allData().result().devices.value(bob).value(1);
+    QCOMPARE(storedDevice.label, u"Notebook"_s);
+    QCOMPARE(storedDevice.session, QByteArrayLiteral("session1"));
+#else
+    QSKIP("Requires internal tests");
+#endif
+}
+
+void tst_QXmppOmemoManager::testDecryptMessages()
+{
+#if BUILD_INTERNAL_TESTS
+    const auto alice = u"alice@example.org"_s;
+    const auto bob = u"bob@example.org"_s;
+    const uint32_t aliceDeviceId = 1;
+    const uint32_t bobDeviceId = 2;
+
+    OmemoUser sender;
+    initOmemoUser(sender);
+    OmemoUser recipient;
+    initOmemoUser(recipient);
+
+    auto *d = sender.manager->d.get();
+    auto *recipientD = recipient.manager->d.get();
+    recipient.client.configuration().setJid(bob);
+    recipientD->ownDevice.id = bobDeviceId;
+    recipientD->isStarted = true;
+
+    RefCountedPtr<ratchet_identity_key_pair> identityKeyPair;
+    QVERIFY(d->setUpIdentityKeyPair(identityKeyPair.ptrRef()));
+    RefCountedPtr<ratchet_identity_key_pair> recipientIdentityKeyPair;
+    QVERIFY(recipientD->setUpIdentityKeyPair(recipientIdentityKeyPair.ptrRef()));
+    QVERIFY(recipientD->updateSignedPreKeyPair(recipientIdentityKeyPair.get()));
+    QVERIFY(recipientD->updatePreKeyPairs(1));
+
+    const auto serializedBob = bob.toUtf8();
+    d->devices[bob].insert(bobDeviceId, {});
+    QVERIFY(d->buildSession({ serializedBob.constData(), size_t(serializedBob.size()), int(bobDeviceId) }, recipientD->deviceBundle));
+
+    auto encryptMessage = [&](const QString &body) {
+        const auto sceEnvelope = u"<envelope xmlns='urn:xmpp:sce:1'><content><body xmlns='jabber:client'>%1</body></content>"
+                                 "<from jid='%2'/></envelope>"_s
+                                     .arg(body, alice)
+                                     .toUtf8();
+        const auto payloadEncryptionResult = d->encryptPayload(sceEnvelope);
+
+        QXmppOmemoEnvelope omemoEnvelope;
+        omemoEnvelope.setRecipientDeviceId(bobDeviceId);
+        omemoEnvelope.setIsUsedForKeyExchange(true);
+        omemoEnvelope.setData(d->createOmemoEnvelopesData({ { bob, bobDeviceId, true } }, payloadEncryptionResult->decryptionData).result().constFirst());
+
+        QXmppOmemoElement omemoElement;
+        omemoElement.setSenderDeviceId(aliceDeviceId);
+        omemoElement.setPayload(payloadEncryptionResult->encryptedPayload);
+        omemoElement.addEnvelope(bob, omemoEnvelope);
+
+        QXmppMessage message(alice + u"/notebook"_s, bob);
+        message.setOmemoElement(omemoElement);
+        return message;
+    };
+
+    QVector<QXmppMessage> messages;
+    messages << encryptMessage(u"Hello 1"_s)
+             << QXmppMessage(alice, bob, u"Not encrypted"_s)
+             << encryptMessage(u"Hello 2"_s)
+             << encryptMessage(u"Hello 3"_s);
+
+    auto task = recipient.manager->decryptMessages(std::move(messages));
+
+    // The payloads are decrypted in the background.
+    QTRY_VERIFY(task.isFinished());
+    const auto results = task.result();
+    QCOMPARE(results.size(), 4);
+    QCOMPARE(expectVariant<QXmppMessage>(results.at(0)).body(), u"Hello 1"_s);
+    QVERIFY(std::holds_alternative<QXmppE2eeExtension::NotEncrypted>(results.at(1)));
+    QCOMPARE(expectVariant<QXmppMessage>(results.at(2)).body(), u"Hello 2"_s);
+    QCOMPARE(expectVariant<QXmppMessage>(results.at(3)).body(), u"Hello 3"_s);
+    QVERIFY(expectVariant<QXmppMessage>(results.at(3)).e2eeMetadata().has_value());
+
+    // The sending device's changes are stored in one batch.
+    QVERIFY(!recipientD->deviceStorageTimer.isActive());
+    QVERIFY(!recipient.omemoStorage->allData().result().devices.value(alice).value(aliceDeviceId).session.isEmpty());
+    recipientD->deviceBundlePublicationTimer.stop();
+#else
+    QSKIP("Requires internal tests");
+#endif
+}
+
+void tst_QXmppOmemoManager::benchmarkEnvelopeEncryption_data()
+{
+    QTest::addColumn<int>("devicesCount");
+    QTest::addColumn<int>("threadCount");
+
+    for (const auto devicesCount : { 1, 10, 50, 200 }) {
+        for (const auto threadCount : { 0, 4 }) {
+            QTest::addRow("%d-devices-%d-threads", devicesCount, threadCount) << devicesCount << threadCount;
+        }
+    }
+}
+
+void tst_QXmppOmemoManager::benchmarkEnvelopeEncryption()
+{
+#if BUILD_INTERNAL_TESTS
+    QFETCH(int, devicesCount);
+    QFETCH(int, threadCount);
+
+    OmemoUser sender;
+    initOmemoUser(sender);
+    OmemoUser recipient;
+    initOmemoUser(recipient);
+
+    auto *d = sender.manager->d.get();
+    auto *recipientD = recipient.manager->d.get();
+    sender.manager->setEnvelopeEncryptionThreadCount(threadCount);
+
+    RefCountedPtr<ratchet_identity_key_pair> identityKeyPair;
+    QVERIFY(d->setUpIdentityKeyPair(identityKeyPair.ptrRef()));
+
+    // All recipient devices share the same keys since only the sessions matter here.
+    RefCountedPtr<ratchet_identity_key_pair> recipientIdentityKeyPair;
+    QVERIFY(recipientD->setUpIdentityKeyPair(recipientIdentityKeyPair.ptrRef()));
+    QVERIFY(recipientD->updateSignedPreKeyPair(recipientIdentityKeyPair.get()));
+    QVERIFY(recipientD->updatePreKeyPairs(1));
+
+    const auto jid = u"bob@example.org"_s;
+    const auto serializedJid = jid.toUtf8();
+    QVector<OmemoEnvelopeRequest> requests;
+
+    for (auto deviceId = 1; deviceId <= devicesCount; ++deviceId) {
+        d->devices[jid].insert(uint32_t(deviceId), {});
+        QVERIFY(d->buildSession({ serializedJid.constData(), size_t(serializedJid.size()), deviceId }, recipientD->deviceBundle));
+        requests.append({ jid, uint32_t(deviceId), false });
+    }
+
+    const auto payloadEncryptionResult = d->encryptPayload(QByteArrayLiteral("<message/>"));
+    QVERIFY(payloadEncryptionResult);
+
+    QBENCHMARK {
+        const auto envelopesData = wait(d->createOmemoEnvelopesData(requests, payloadEncryptionResult->decryptionData).toFuture(sender.manager));
+        QCOMPARE(envelopesData.size(), requests.size());
+        QVERIFY(std::none_of(envelopesData.cbegin(), envelopesData.cend(), [](const QByteArray &data) {
+            return data.isEmpty();
+        }));
+    }
+#else
+    QSKIP("Requires internal tests");
+#endif
+}
+
+void tst_QXmppOmemoManager::benchmarkPayloadEncryption_data()
+{
+    QTest::addColumn<bool>("isCachingEnabled");
+
+    QTest::newRow("cached") << true;
+    QTest::newRow("uncached") << false;
+}
+
+void tst_QXmppOmemoManager::benchmarkPayloadEncryption()
+{
+#if BUILD_INTERNAL_TESTS
+    QFETCH(bool, isCachingEnabled);
+
+    auto *d = m_alice1.manager->d.get();
+    d->cryptoContexts.setCachingEnabled(isCachingEnabled);
+
+    const auto payload = QByteArrayLiteral("<body xmlns='jabber:client'>Hello Bob!</body>");
+
+    QBENCHMARK {
+        const auto payloadEncryptionResult = d->encryptPayload(payload);
+        QVERIFY(payloadEncryptionResult);
+        QCOMPARE(d->decryptPayload(payloadEncryptionResult->decryptionData, payloadEncryptionResult->encryptedPayload), payload);
+    }
+
+    d->cryptoContexts.setCachingEnabled(true);
+#else
+    QSKIP("Requires internal tests");
+#endif
+}
+
 void tst_QXmppOmemoManager::finish(OmemoUser &omemoUser)
 {
     QSignalSpy disconnectedSpy(&omemoUser.client, &QXmppClient::disconnected);
@@ -8,6 +8,29 @@
 
 #include <QtTest>
 
+// storage using the default implementations of addDevices() and sessions()
+class PerDeviceStorage : public QXmppOmemoMemoryStorage
+{
+public:
+    QXmppTask<QHash<uint32_t, QByteArray>> sessions(const QString &jid) override
+    {
+        return QXmppOmemoStorage::sessions(jid);
+    }
+
+    QXmppTask<void> addDevice(const QString &jid, uint32_t deviceId, const Device &device) override
+    {
+        ++addDeviceCalls;
+        return QXmppOmemoMemoryStorage::addDevice(jid, deviceId, device);
+    }
+
+    QXmppTask<void> addDevices(const QHash<QString, QHash<uint32_t, Device>> &devices) override
+    {
+        return QXmppOmemoStorage::addDevices(devices);
+    }
+
+    int addDeviceCalls = 0;
+};
+
 class tst_QXmppOmemoMemoryStorage : public QObject
 {
     Q_OBJECT
@@ -17,6 +40,9 @@ private:
     Q_SLOT void testSignedPreKeyPairs();
     Q_SLOT void testPreKeyPairs();
     Q_SLOT void testDevices();
+    Q_SLOT void testAddDevices();
+    Q_SLOT void testSessions();
+    Q_SLOT void testDeviceLists();
     Q_SLOT void testResetAll();
 
     QXmppOmemoMemoryStorage m_omemoStorage;
@@ -281,6 +307,103 @@ void tst_QXmppOmemoMemoryStorage::testDevices()
     QCOMPARE(resultDeviceAlice.removalFromDeviceListDate, QDateTime(QDate(2022, 01, 01), QTime()));
 }
 
+void tst_QXmppOmemoMemoryStorage::testAddDevices()
+{
+    QXmppOmemoStorage::Device deviceAlice;
+    deviceAlice.label = u"Desktop"_s;
+    deviceAlice.unrespondedSentStanzasCount = 1;
+
+    QXmppOmemoStorage::Device deviceBob;
+    deviceBob.label = u"Phone"_s;
+    deviceBob.unrespondedReceivedStanzasCount = 2;
+
+    const QHash<QString, QHash<uint32_t, QXmppOmemoStorage::Device>> devices = {
+        { u"alice@example.org"_s, { { 1, deviceAlice } } },
+        { u"bob@example.com"_s, { { 1, deviceBob }, { 2, deviceBob } } },
+    };
+
+    QXmppOmemoMemoryStorage storage;
+    storage.addDevice(u"alice@example.org"_s, 2, {});
+    QVERIFY(storage.addDevices(devices).isFinished());
+
+    auto result = storage.allData().result().devices;
+    QCOMPARE(result.size(), 2);
+    QCOMPARE(result.value(u"alice@example.org"_s).size(), 2);
+    QCOMPARE(result.value(u"alice@example.org"_s).value(1).unrespondedSentStanzasCount, 1);
+    QCOMPARE(result.value(u"bob@example.com"_s).size(), 2);
+    QCOMPARE(result.value(u"bob@example.com"_s).value(2).label, u"Phone"_s);
+
+    PerDeviceStorage perDeviceStorage;
+    QVERIFY(perDeviceStorage.addDevices(devices).isFinished());
+    QCOMPARE(perDeviceStorage.addDeviceCalls, 3);
+    QVERIFY(perDeviceStorage.addDevices({}).isFinished());
+
+    result = perDeviceStorage.allData().result().devices;
+    QCOMPARE(result.value(u"bob@example.com"_s).value(1).unrespondedReceivedStanzasCount, 2);
+}
+
+void tst_QXmppOmemoMemoryStorage::testSessions()
+{
+    QXmppOmemoStorage::Device deviceWithSession;
+    deviceWithSession.label = u"Phone"_s;
+    deviceWithSession.session = QByteArrayLiteral("session");
+
+    PerDeviceStorage storage;
+    storage.addDevice(u"bob@example.com"_s, 1, deviceWithSession);
+    storage.addDevice(u"bob@example.com"_s, 2, {});
+    storage.addDevice(u"carol@example.net"_s, 1, deviceWithSession);
+
+    auto data = storage.allDataWithoutSessions().result();
+    QCOMPARE(data.devices.size(), 2);
+    QCOMPARE(data.devices.value(u"bob@example.com"_s).value(1).label, u"Phone"_s);
+    QVERIFY(data.devices.value(u"bob@example.com"_s).value(1).session.isEmpty());
+
+    auto task = storage.QXmppOmemoMemoryStorage::sessions(u"bob@example.com"_s);
+    QVERIFY(task.isFinished());
+    auto sessions = task.result();
+    QCOMPARE(sessions.size(), 1);
+    QCOMPARE(sessions.value(1), QByteArrayLiteral("session"));
+
+    // default implementation
+    task = storage.sessions(u"bob@example.com"_s);
+    QVERIFY(task.isFinished());
+    QCOMPARE(task.result(), sessions);
+
+    QVERIFY(storage.sessions(u"alice@example.org"_s).result().isEmpty());
+}
+
+void tst_QXmppOmemoMemoryStorage::testDeviceLists()
+{
+    QXmppOmemoStorage::DeviceList deviceList;
+    deviceList.itemId = u"current"_s;
+    deviceList.hash = QByteArrayLiteral("hash");
+
+    QXmppOmemoMemoryStorage storage;
+    QVERIFY(storage.addDeviceList(u"alice@example.org"_s, deviceList).isFinished());
+    storage.addDeviceList(u"bob@example.com"_s, deviceList);
+
+    deviceList.hash = QByteArrayLiteral("changed hash");
+    storage.addDeviceList(u"alice@example.org"_s, deviceList);
+
+    auto deviceLists = storage.allData().result().deviceLists;
+    QCOMPARE(deviceLists.size(), 2);
+    QCOMPARE(deviceLists.value(u"alice@example.org"_s).itemId, u"current"_s);
+    QCOMPARE(deviceLists.value(u"alice@example.org"_s).hash, QByteArrayLiteral("changed hash"));
+    QCOMPARE(deviceLists.value(u"bob@example.com"_s).hash, QByteArrayLiteral("hash"));
+    QCOMPARE(storage.allDataWithoutSessions().result().deviceLists.size(), 2);
+
+    // The device list is removed together with the devices.
+    storage.removeDevices(u"alice@example.org"_s);
+    deviceLists = storage.allData().result().deviceLists;
+    QCOMPARE(deviceLists.size(), 1);
+    QVERIFY(deviceLists.contains(u"bob@example.com"_s));
+
+    // default implementation
+    PerDeviceStorage perDeviceStorage;
+    QVERIFY(perDeviceStorage.QXmppOmemoStorage::addDeviceList(u"alice@example.org"_s, deviceList).isFinished());
+    QVERIFY(perDeviceStorage.allData().result().deviceLists.isEmpty());
+}
+
 void tst_QXmppOmemoMemoryStorage::testResetAll()
 {
     m_omemoStorage.setOwnDevice(QXmppOmemoStorage::OwnDevice());
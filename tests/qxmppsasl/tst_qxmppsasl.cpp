@@ -5,6 +5,7 @@
 
 #include "QXmppConfiguration.h"
 #include "QXmppConstants_p.h"
+#include "QXmppPasswordChecker.h"
 #include "QXmppSasl2UserAgent.h"
 #include "QXmppSaslManager_p.h"
 #include "QXmppSasl_p.h"
@@ -89,6 +90,9 @@ private:
     Q_SLOT void testServerDigestMd5();
     Q_SLOT void testServerPlain();
     Q_SLOT void testServerPlainChallenge();
+    Q_SLOT void testServerScramSha256();
+    Q_SLOT void testServerScramSha256_bad();
+    Q_SLOT void benchmarkScramLogin();
 
     // SASL 1 client manager
     Q_SLOT void saslManagerNoMechanisms();
@@ -767,6 +771,93 @@ void tst_QXmppSasl::testServerPlainChallenge()
     QCOMPARE(server->respond(QByteArray(), response), QXmppSaslServer::Failed);
 }
 
+void tst_QXmppSasl::testServerScramSha256()
+{
+    QXmppSaslDigestMd5::setNonce("%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0");
+
+    auto server = QXmppSaslServer::create("SCRAM-SHA-256");
+    QVERIFY(server);
+    QCOMPARE(server->mechanism(), "SCRAM-SHA-256");
+
+    // credentials needed
+    const QByteArray clientFirst("n,,n=user,r=rOprNGfwEbeRWgbNEkqO");
+    QByteArray response;
+    QCOMPARE(server->respond(clientFirst, response), QXmppSaslServer::InputNeeded);
+    QCOMPARE(server->username(), QLatin1String("user"));
+
+    const auto credentials = QXmppScramCredentials::fromPassword(
+        QCryptographicHash::Sha256, "pencil", QByteArray::fromBase64("W22ZaJ0SNY7soEsUEjb6gQ=="), 4096);
+    auto *scramServer = qobject_cast<QXmppSaslServerScram *>(server.get());
+    QVERIFY(scramServer);
+    scramServer->setCredentials(credentials.salt, credentials.iterations, credentials.storedKey, credentials.serverKey);
+
+    // server-first-message
+    QCOMPARE(server->respond(clientFirst, response), QXmppSaslServer::Challenge);
+    QCOMPARE(response, QByteArray("r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0,s=W22ZaJ0SNY7soEsUEjb6gQ==,i=4096"));
+
+    // server-final-message
+    QCOMPARE(server->respond("c=biws,r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0,p=dHzbZapWIk4jUhN+Ute9ytag9zjfMHgsqmmiz7AndVQ=", response), QXmppSaslServer::Challenge);
+    QCOMPARE(response, QByteArray("v=6rriTRBi23WpRR/wtup+mMhUZUn/dB5nLTJRsjl95G4="));
+
+    // success
+    QCOMPARE(server->respond(QByteArray(), response), QXmppSaslServer::Succeeded);
+    QCOMPARE(response, QByteArray());
+
+    // any further step is an error
+    QCOMPARE(server->respond(QByteArray(), response), QXmppSaslServer::Failed);
+}
+
+void tst_QXmppSasl::testServerScramSha256_bad()
+{
+    QXmppSaslDigestMd5::setNonce("%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0");
+
+    auto server = QXmppSaslServer::create("SCRAM-SHA-256");
+    QVERIFY(server);
+
+    const auto credentials = QXmppScramCredentials::fromPassword(
+        QCryptographicHash::Sha256, "wrong", QByteArray::fromBase64("W22ZaJ0SNY7soEsUEjb6gQ=="), 4096);
+    qobject_cast<QXmppSaslServerScram *>(server.get())->setCredentials(credentials.salt, credentials.iterations, credentials.storedKey, credentials.serverKey);
+
+    // channel binding is not supported
+    QByteArray response;
+    QCOMPARE(server->respond("p=tls-unique,,n=user,r=rOprNGfwEbeRWgbNEkqO", response), QXmppSaslServer::Failed);
+
+    QCOMPARE(server->respond("n,,n=user,r=rOprNGfwEbeRWgbNEkqO", response), QXmppSaslServer::Challenge);
+
+    // proof of a different password
+    QCOMPARE(server->respond("c=biws,r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0,p=dHzbZapWIk4jUhN+Ute9ytag9zjfMHgsqmmiz7AndVQ=", response), QXmppSaslServer::Failed);
+}
+
+void tst_QXmppSasl::benchmarkScramLogin()
+{
+    // random nonces
+    QXmppSaslDigestMd5::setNonce({});
+
+    const auto credentials = QXmppScramCredentials::fromPassword(
+        QCryptographicHash::Sha256, "pencil", QByteArray::fromBase64("W22ZaJ0SNY7soEsUEjb6gQ=="), 4096);
+
+    // logins per second = 1 / time per iteration
+    QBENCHMARK {
+        auto client = QXmppSaslClient::create("SCRAM-SHA-256");
+        client->setUsername("user");
+        client->setCredentials(Credentials { .password = "pencil" });
+        auto server = QXmppSaslServer::create("SCRAM-SHA-256");
+        auto *scramServer = qobject_cast<QXmppSaslServerScram *>(server.get());
+
+        QByteArray response;
+        const auto clientFirst = client->respond({});
+        QCOMPARE(server->respond(*clientFirst, response), QXmppSaslServer::InputNeeded);
+        scramServer->setCredentials(credentials.salt, credentials.iterations, credentials.storedKey, credentials.serverKey);
+        QCOMPARE(server->respond(*clientFirst, response), QXmppSaslServer::Challenge);
+
+        const auto clientFinal = client->respond(response);
+        QVERIFY(clientFinal);
+        QCOMPARE(server->respond(*clientFinal, response), QXmppSaslServer::Challenge);
+        QVERIFY(client->respond(response));
+        QCOMPARE(server->respond({}, response), QXmppSaslServer::Succeeded);
+    }
+}
+
 void tst_QXmppSasl::saslManagerNoMechanisms()
 {
     SaslManagerTest test;
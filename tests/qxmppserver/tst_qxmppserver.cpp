@@ -3,10 +3,92 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 
 #include "QXmppClient.h"
+#include "QXmppDialback.h"
+#include "QXmppIncomingClient.h"
+#include "QXmppIncomingServer.h"
+#include "QXmppMessage.h"
+#include "QXmppOutgoingServer.h"
+#include "QXmppPasswordChecker.h"
+#include "QXmppRateLimiter_p.h"
 #include "QXmppServer.h"
+#include "QXmppServerExtension.h"
 
 #include "util.h"
 
+#include <QSignalSpy>
+#include <QSslSocket>
+
+using namespace QXmpp::Private;
+
+class TestExtension : public QXmppServerExtension
+{
+public:
+    TestExtension(int priority, QList<StanzaFilter> filters, bool accept)
+        : m_priority(priority), m_filters(std::move(filters)), m_accept(accept)
+    {
+    }
+
+    int extensionPriority() const override { return m_priority; }
+    QList<StanzaFilter> stanzaFilters() const override
+    {
+        filterQueries++;
+        return m_filters;
+    }
+    bool handleStanza(const QDomElement &) override
+    {
+        handled++;
+        return m_accept;
+    }
+
+    int handled = 0;
+    mutable int filterQueries = 0;
+
+private:
+    int m_priority;
+    QList<StanzaFilter> m_filters;
+    bool m_accept;
+};
+
+// Stores SCRAM credentials instead of deriving them from the password on every login.
+class TestScramPasswordChecker : public QXmppScramPasswordChecker
+{
+public:
+    void addCredentials(const QString &user, const QString &password)
+    {
+        m_passwords.insert(user, password);
+        for (auto algorithm : { QCryptographicHash::Sha256, QCryptographicHash::Sha512 }) {
+            m_scramCredentials.insert({ user, algorithm }, QXmppScramCredentials::fromPassword(algorithm, password, QByteArrayLiteral("salt"), 4096));
+        }
+    }
+
+    QXmppScramCredentialsReply *getScramCredentials(const QXmppPasswordRequest &request, QCryptographicHash::Algorithm algorithm) override
+    {
+        auto *reply = new QXmppScramCredentialsReply;
+        if (auto credentials = m_scramCredentials.value({ request.username(), algorithm }); !credentials.isNull()) {
+            reply->setScramCredentials(credentials);
+        } else {
+            reply->setError(QXmppPasswordReply::AuthorizationError);
+        }
+        reply->finishLater();
+        return reply;
+    }
+
+    QXmppPasswordReply::Error getPassword(const QXmppPasswordRequest &request, QString &password) override
+    {
+        if (m_passwords.contains(request.username())) {
+            password = m_passwords.value(request.username());
+            return QXmppPasswordReply::NoError;
+        }
+        return QXmppPasswordReply::AuthorizationError;
+    }
+
+    bool hasGetPassword() const override { return true; }
+
+private:
+    QMap<QString, QString> m_passwords;
+    QMap<std::pair<QString, QCryptographicHash::Algorithm>, QXmppScramCredentials> m_scramCredentials;
+};
+
 class tst_QXmppServer : public QObject
 {
     Q_OBJECT
@@ -14,6 +96,13 @@ class tst_QXmppServer : public QObject
 private:
     Q_SLOT void testConnect_data();
     Q_SLOT void testConnect();
+    Q_SLOT void testDialbackKeysPerStream();
+    Q_SLOT void testDialbackResultNotCached();
+    Q_SLOT void testOutgoingQueueLimit();
+    Q_SLOT void testOutgoingQueueOverflow();
+    Q_SLOT void testRateLimiter();
+    Q_SLOT void testIncomingClientThrottled();
+    Q_SLOT void testStanzaDispatch();
 };
 
 void tst_QXmppServer::testConnect_data()
@@ -21,27 +110,55 @@ void tst_QXmppServer::testConnect_data()
     QTest::addColumn<QString>("username");
     QTest::addColumn<QString>("password");
     QTest::addColumn<QString>("mechanism");
+    QTest::addColumn<bool>("sasl2");
     QTest::addColumn<bool>("connected");
 
     QTest::newRow("plain-good") << "testuser"
                                 << "testpwd"
-                                << "PLAIN" << true;
+                                << "PLAIN" << false << true;
     QTest::newRow("plain-bad-username") << "baduser"
                                         << "testpwd"
-                                        << "PLAIN" << false;
+                                        << "PLAIN" << false << false;
     QTest::newRow("plain-bad-password") << "testuser"
                                         << "badpwd"
-                                        << "PLAIN" << false;
+                                        << "PLAIN" << false << false;
 
     QTest::newRow("digest-good") << "testuser"
                                  << "testpwd"
-                                 << "DIGEST-MD5" << true;
+                                 << "DIGEST-MD5" << false << true;
     QTest::newRow("digest-bad-username") << "baduser"
                                          << "testpwd"
-                                         << "DIGEST-MD5" << false;
+                                         << "DIGEST-MD5" << false << false;
     QTest::newRow("digest-bad-password") << "testuser"
                                          << "badpwd"
-                                         << "DIGEST-MD5" << false;
+                                         << "DIGEST-MD5" << false << false;
+
+    QTest::newRow("plain-sasl2-good") << "testuser"
+                                      << "testpwd"
+                                      << "PLAIN" << true << true;
+    QTest::newRow("plain-sasl2-bad-password") << "testuser"
+                                              << "badpwd"
+                                              << "PLAIN" << true << false;
+
+    QTest::newRow("scram-sha-256-good") << "testuser"
+                                        << "testpwd"
+                                        << "SCRAM-SHA-256" << false << true;
+    QTest::newRow("scram-sha-256-bad-username") << "baduser"
+                                                << "testpwd"
+                                                << "SCRAM-SHA-256" << false << false;
+    QTest::newRow("scram-sha-256-bad-password") << "testuser"
+                                                << "badpwd"
+                                                << "SCRAM-SHA-256" << false << false;
+
+    QTest::newRow("scram-sha-512-sasl2-good") << "testuser"
+                                              << "testpwd"
+                                              << "SCRAM-SHA-512" << true << true;
+    QTest::newRow("scram-sha-512-sasl2-bad-username") << "baduser"
+                                                      << "testpwd"
+                                                      << "SCRAM-SHA-512" << true << false;
+    QTest::newRow("scram-sha-512-sasl2-bad-password") << "testuser"
+                                                      << "badpwd"
+                                                      << "SCRAM-SHA-512" << true << false;
 }
 
 void tst_QXmppServer::testConnect()
@@ -49,6 +166,7 @@ void tst_QXmppServer::testConnect()
     QFETCH(QString, username);
     QFETCH(QString, password);
     QFETCH(QString, mechanism);
+    QFETCH(bool, sasl2);
     QFETCH(bool, connected);
 
     const QString testDomain("localhost");
@@ -59,7 +177,7 @@ void tst_QXmppServer::testConnect()
     // logger.setLoggingType(QXmppLogger::StdoutLogging);
 
     // prepare server
-    TestPasswordChecker passwordChecker;
+    TestScramPasswordChecker passwordChecker;
     passwordChecker.addCredentials("testuser", "testpwd");
 
     QXmppServer server;
@@ -86,10 +204,274 @@ void tst_QXmppServer::testConnect()
     config.setPassword(password);
     config.setSaslAuthMechanism(mechanism);
     config.setDisabledSaslMechanisms({});
+    config.setUseSasl2Authentication(sasl2);
     client.connectToServer(config);
     loop.exec();
     QCOMPARE(client.isConnected(), connected);
 }
 
+static QByteArray streamHeader(const QString &from)
+{
+    return u"<?xml version='1.0'?><stream:stream xmlns='jabber:server' xmlns:db='jabber:server:dialback'"
+           " xmlns:stream='http://etherx.jabber.org/streams' to='example.com' from='%1' version='1.0'>"_s
+        .arg(from)
+        .toUtf8();
+}
+
+void tst_QXmppServer::testDialbackKeysPerStream()
+{
+    const quint16 testPort = 12347;
+
+    QXmppServer server;
+    server.setDomain(u"example.com"_s);
+    QVERIFY(server.listenForServers(QHostAddress::LocalHost, testPort));
+
+    QXmppMessage message(u"alice@example.com"_s, u"bob@remote.test"_s, u"Hello"_s);
+    QVERIFY(server.sendPacket(message));
+    auto streams = server.findChildren<QXmppOutgoingServer *>();
+    QCOMPARE(streams.size(), 1);
+    auto *first = streams.constFirst();
+    const auto firstKey = first->localStreamKey();
+    QVERIFY(!firstKey.isEmpty());
+
+    // a new stream to the same domain gets a new key
+    Q_EMIT first->disconnected();
+    QVERIFY(server.sendPacket(message));
+    streams = server.findChildren<QXmppOutgoingServer *>();
+    streams.removeAll(first);
+    QCOMPARE(streams.size(), 1);
+    QVERIFY(!streams.constFirst()->localStreamKey().isEmpty());
+    QVERIFY(streams.constFirst()->localStreamKey() != firstKey);
+
+    // the key of the closed stream is not accepted anymore
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, testPort);
+    QVERIFY(socket.waitForConnected());
+    socket.write(streamHeader(u"remote.test"_s));
+    QTRY_VERIFY(socket.readAll().contains("stream:features"));
+
+    socket.write(u"<db:verify from='remote.test' to='example.com' id='stream1'>%1</db:verify>"_s.arg(firstKey).toUtf8());
+    QByteArray received;
+    QTRY_VERIFY((received += socket.readAll()).contains("db:verify"));
+    QVERIFY(received.contains("type=\"invalid\""));
+}
+
+void tst_QXmppServer::testDialbackResultNotCached()
+{
+    QXmppSslServer sslServer;
+    QVERIFY(sslServer.listen(QHostAddress::LocalHost));
+
+    QList<QXmppIncomingServer *> streams;
+    connect(&sslServer, &QXmppSslServer::newConnection, this, [&](QSslSocket *socket) {
+        streams << new QXmppIncomingServer(socket, u"example.com"_s, &sslServer);
+    });
+
+    // first stream is authenticated by the authoritative server
+    QTcpSocket firstSocket;
+    firstSocket.connectToHost(QHostAddress::LocalHost, sslServer.serverPort());
+    QVERIFY(firstSocket.waitForConnected());
+    firstSocket.write(streamHeader(u"remote.test"_s));
+    QTRY_COMPARE(streams.size(), 1);
+    QTRY_VERIFY(!streams.at(0)->localStreamId().isEmpty());
+
+    firstSocket.write("<db:result from='remote.test' to='example.com'>secret</db:result>");
+    QTRY_COMPARE(streams.at(0)->findChildren<QXmppOutgoingServer *>().size(), 1);
+    auto *verifier = streams.at(0)->findChildren<QXmppOutgoingServer *>().constFirst();
+
+    QXmppDialback verify;
+    verify.setCommand(QXmppDialback::Verify);
+    verify.setId(streams.at(0)->localStreamId());
+    verify.setFrom(u"remote.test"_s);
+    verify.setTo(u"example.com"_s);
+    verify.setType(u"valid"_s);
+    Q_EMIT verifier->dialbackResponseReceived(verify);
+    QVERIFY(streams.at(0)->isConnected());
+
+    // repeating the verified result on the same stream is answered from the cache
+    QTRY_VERIFY(streams.at(0)->findChildren<QXmppOutgoingServer *>().isEmpty());
+    QTRY_VERIFY(firstSocket.readAll().contains("type=\"valid\""));
+    firstSocket.write("<db:result from='remote.test' to='example.com'>secret</db:result>");
+    QByteArray received;
+    QTRY_VERIFY((received += firstSocket.readAll()).contains("type=\"valid\""));
+    QVERIFY(streams.at(0)->findChildren<QXmppOutgoingServer *>().isEmpty());
+
+    // replaying the key on another stream requires a new verification
+    QTcpSocket secondSocket;
+    secondSocket.connectToHost(QHostAddress::LocalHost, sslServer.serverPort());
+    QVERIFY(secondSocket.waitForConnected());
+    secondSocket.write(streamHeader(u"remote.test"_s));
+    QTRY_COMPARE(streams.size(), 2);
+    QTRY_VERIFY(!streams.at(1)->localStreamId().isEmpty());
+
+    secondSocket.write("<db:result from='remote.test' to='example.com'>secret</db:result>");
+    QTRY_COMPARE(streams.at(1)->findChildren<QXmppOutgoingServer *>().size(), 1);
+    QVERIFY(!streams.at(1)->isConnected());
+    QVERIFY(!secondSocket.readAll().contains("valid"));
+
+    // results without a key are rejected
+    secondSocket.write("<db:result from='other.test' to='example.com'/>");
+    QTest::qWait(100);
+    QCOMPARE(streams.at(1)->findChildren<QXmppOutgoingServer *>().size(), 1);
+}
+
+void tst_QXmppServer::testOutgoingQueueLimit()
+{
+    QXmppOutgoingServer server(u"example.com"_s, nullptr);
+    QCOMPARE(server.queueLimit(), 0);
+
+    server.setQueueLimit(10);
+    QVERIFY(server.queueData("01234"));
+    QVERIFY(server.queueData("56789"));
+    QCOMPARE(server.queuedBytes(), 10);
+
+    // queue is full, data is dropped
+    QVERIFY(!server.queueData("a"));
+    QCOMPARE(server.queuedBytes(), 10);
+}
+
+void tst_QXmppServer::testOutgoingQueueOverflow()
+{
+    QXmppServer server;
+    server.setDomain(u"example.com"_s);
+    QVERIFY(server.listenForServers(QHostAddress::LocalHost, 12348));
+    QSignalSpy counterSpy(&server, &QXmppServer::updateCounter);
+    auto queueOverflows = [&]() {
+        return std::count_if(counterSpy.cbegin(), counterSpy.cend(), [](const auto &arguments) {
+            return arguments.at(0).toString() == u"outgoing-server.queue-overflow";
+        });
+    };
+
+    const QString body(600 * 1024, u'a');
+    QXmppMessage message(u"alice@other.test"_s, u"bob@busy.test"_s, body);
+    QVERIFY(server.sendPacket(message));
+
+    // packets of the server itself are not bounced
+    QVERIFY(!server.sendPacket(message));
+    QCOMPARE(queueOverflows(), 1);
+    QCOMPARE(server.findChildren<QXmppOutgoingServer *>().size(), 1);
+
+    // routed stanzas are bounced to the sender
+    QDomDocument document;
+    QVERIFY(document.setContent(packetToXml(message)));
+    QVERIFY(server.sendElement(document.documentElement()));
+    QCOMPARE(queueOverflows(), 2);
+
+    const auto streams = server.findChildren<QXmppOutgoingServer *>();
+    const auto bounce = std::find_if(streams.cbegin(), streams.cend(), [](auto *stream) {
+        return stream->remoteDomain() == u"other.test";
+    });
+    QVERIFY(bounce != streams.cend());
+    QVERIFY((*bounce)->queuedBytes() > 0);
+    QVERIFY((*bounce)->queuedBytes() < body.size());
+}
+
+void tst_QXmppServer::testRateLimiter()
+{
+    QVERIFY(!RateLimiter().isEnabled());
+
+    RateLimiter limiter(2, 0);
+    QVERIFY(limiter.isEnabled());
+
+    // burst of one second worth of stanzas
+    limiter.consumeStanza();
+    limiter.consumeStanza();
+    QCOMPARE(limiter.delay().count(), 0);
+
+    // exceeding the limit requires waiting for the bucket to refill
+    limiter.consumeStanza();
+    QVERIFY(limiter.delay().count() > 0);
+    QVERIFY(limiter.delay().count() <= 500);
+
+    RateLimiter byteLimiter(0, 1000);
+    QCOMPARE(RateLimiter(2, 0).availableBytes(), -1);
+    QCOMPARE(byteLimiter.availableBytes(), 1000);
+    byteLimiter.consumeBytes(600);
+    QVERIFY(byteLimiter.availableBytes() >= 400);
+    QVERIFY(byteLimiter.availableBytes() < 500);
+    byteLimiter.consumeBytes(600);
+    QCOMPARE(byteLimiter.availableBytes(), 0);
+}
+
+void tst_QXmppServer::testIncomingClientThrottled()
+{
+    QXmppSslServer sslServer;
+    QVERIFY(sslServer.listen(QHostAddress::LocalHost));
+
+    QSslSocket *serverSocket = nullptr;
+    QXmppIncomingClient *client = nullptr;
+    connect(&sslServer, &QXmppSslServer::newConnection, this, [&](QSslSocket *socket) {
+        serverSocket = socket;
+        client = new QXmppIncomingClient(socket, u"example.com"_s, &sslServer);
+        client->setRateLimit(0, 2000);
+    });
+
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, sslServer.serverPort());
+    QVERIFY(socket.waitForConnected());
+    QTRY_VERIFY(client);
+    QSignalSpy counterSpy(client, &QXmppLoggable::updateCounter);
+
+    const QByteArray data = "<?xml version='1.0'?><stream:stream xmlns='jabber:client'"
+                            " xmlns:stream='http://etherx.jabber.org/streams' to='example.com' version='1.0'>" +
+        QByteArray(6000, ' ');
+    socket.write(data);
+
+    // reading stops once the burst is used up, the rest stays in the socket
+    QTRY_VERIFY(!counterSpy.isEmpty());
+    QCOMPARE(counterSpy.constFirst().at(0).toString(), u"incoming-client.rate-limited"_s);
+    QTest::qWait(100);
+    QVERIFY(serverSocket->bytesAvailable() >= 3000);
+
+    // and is read once the limit allows it
+    QTRY_COMPARE_WITH_TIMEOUT(serverSocket->bytesAvailable(), qint64(0), 10000);
+}
+
+void tst_QXmppServer::testStanzaDispatch()
+{
+    QXmppServer server;
+    server.setDomain(u"example.com"_s);
+
+    auto *fallback = new TestExtension(0, {}, true);
+    auto *version = new TestExtension(10, { { u"iq"_s, {}, u"jabber:iq:version"_s } }, true);
+    auto *observer = new TestExtension(20, {}, false);
+    auto *clientMessages = new TestExtension(5, { { u"message"_s, u"jabber:client"_s, {} } }, false);
+    server.addExtension(fallback);
+    server.addExtension(version);
+    server.addExtension(observer);
+    server.addExtension(clientMessages);
+
+    // handled by the matching extension, lower priorities are skipped
+    server.handleElement(xmlToDom(u"<iq xmlns='jabber:client' type='get' to='example.com'><query xmlns='jabber:iq:version'/></iq>"_s));
+    QCOMPARE(observer->handled, 1);
+    QCOMPARE(version->handled, 1);
+    QCOMPARE(clientMessages->handled, 0);
+    QCOMPARE(fallback->handled, 0);
+
+    // no matching filter
+    server.handleElement(xmlToDom(u"<iq xmlns='jabber:client' type='get' to='example.com'><query xmlns='jabber:iq:last'/></iq>"_s));
+    QCOMPARE(observer->handled, 2);
+    QCOMPARE(version->handled, 1);
+    QCOMPARE(fallback->handled, 1);
+
+    // stanza namespace is matched
+    server.handleElement(xmlToDom(u"<message xmlns='jabber:client' to='example.com'/>"_s));
+    QCOMPARE(clientMessages->handled, 1);
+    server.handleElement(xmlToDom(u"<message xmlns='jabber:server' to='example.com'/>"_s));
+    QCOMPARE(clientMessages->handled, 1);
+    QCOMPARE(observer->handled, 4);
+    QCOMPARE(fallback->handled, 3);
+
+    // the filters are only queried once
+    QCOMPARE(version->filterQueries, 1);
+
+    // adding an extension rebuilds the index
+    auto *lastActivity = new TestExtension(10, { { u"iq"_s, {}, u"jabber:iq:last"_s } }, true);
+    server.addExtension(lastActivity);
+    server.handleElement(xmlToDom(u"<iq xmlns='jabber:client' type='get' to='example.com'><query xmlns='jabber:iq:last'/></iq>"_s));
+    QCOMPARE(lastActivity->handled, 1);
+    QCOMPARE(fallback->handled, 3);
+    QCOMPARE(version->filterQueries, 2);
+}
+
 QTEST_MAIN(tst_QXmppServer)
 #include "tst_qxmppserver.moc"
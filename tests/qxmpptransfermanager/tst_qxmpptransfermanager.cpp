@@ -9,7 +9,9 @@
 #include "util.h"
 
 #include <QBuffer>
+#include <QElapsedTimer>
 #include <QObject>
+#include <QTemporaryFile>
 
 class tst_QXmppTransferManager : public QObject
 {
@@ -19,9 +21,14 @@ private:
     Q_SLOT void init();
     Q_SLOT void testSendFile_data();
     Q_SLOT void testSendFile();
+    Q_SLOT void testSendLocalFile();
+    Q_SLOT void benchmarkSendFile_data();
+    Q_SLOT void benchmarkSendFile();
 
     Q_SLOT void acceptFile(QXmppTransferJob *job);
 
+    void sendViaSocks(QIODevice *device, qint64 size, int blockSize, quint16 port);
+
     QBuffer receiverBuffer;
     QXmppTransferJob *receiverJob;
 };
@@ -158,5 +165,140 @@ void tst_QXmppTransferManager::testSendFile()
     }
 }
 
+void tst_QXmppTransferManager::testSendLocalFile()
+{
+    // the content must not be a repetition of one block to notice shifted or repeated data
+    QByteArray data;
+    for (int i = 0; data.size() < 300 * 1024; i++) {
+        data += QByteArray::number(i) + ' ';
+    }
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(data);
+    QVERIFY(file.flush());
+    file.reset();
+
+    // local files are sent with sendfile() on Linux in multiple blocks
+    sendViaSocks(&file, data.size(), 64 * 1024, 12346);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    QCOMPARE(receiverBuffer.data(), data);
+}
+
+void tst_QXmppTransferManager::benchmarkSendFile_data()
+{
+    QTest::addColumn<int>("blockSize");
+    QTest::addColumn<bool>("fromFile");
+
+    // 16 KiB has been the block size before it could be changed
+    QTest::newRow("16k-buffer") << 16384 << false;
+    QTest::newRow("256k-buffer") << 256 * 1024 << false;
+    QTest::newRow("16k-file") << 16384 << true;
+    // local files are sent with sendfile() on Linux
+    QTest::newRow("256k-file") << 256 * 1024 << true;
+}
+
+void tst_QXmppTransferManager::benchmarkSendFile()
+{
+    QFETCH(int, blockSize);
+    QFETCH(bool, fromFile);
+
+    // small enough to run with the other tests, larger data can be sent by setting the size in MiB
+    const auto sizeMiB = qEnvironmentVariableIntValue("QXMPP_BENCHMARK_TRANSFER_SIZE_MIB");
+    const QByteArray data((sizeMiB > 0 ? sizeMiB : 4) * 1024 * 1024, 'x');
+
+    QBuffer buffer;
+    buffer.setData(data);
+    QTemporaryFile file;
+    QIODevice *device = &buffer;
+    if (fromFile) {
+        QVERIFY(file.open());
+        file.write(data);
+        QVERIFY(file.flush());
+        file.reset();
+        device = &file;
+    } else {
+        buffer.open(QIODevice::ReadOnly);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    sendViaSocks(device, data.size(), blockSize, 12347);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    QCOMPARE(receiverBuffer.size(), qint64(data.size()));
+
+    QTest::setBenchmarkResult(data.size() * 1000.0 / std::max(timer.elapsed(), qint64(1)), QTest::BytesPerSecond);
+}
+
+// Sends data from the device via a SOCKS5 bytestream and waits until it has been received.
+void tst_QXmppTransferManager::sendViaSocks(QIODevice *device, qint64 size, int blockSize, quint16 port)
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("sender", "testpwd");
+    passwordChecker.addCredentials("receiver", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.listenForClients(testHost, port);
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(port);
+    config.setPassword("testpwd");
+
+    QXmppClient sender;
+    auto *senderManager = new QXmppTransferManager;
+    senderManager->setSupportedMethods(QXmppTransferJob::SocksMethod);
+    senderManager->setSocksBlockSize(blockSize);
+    QCOMPARE(senderManager->socksBlockSize(), blockSize);
+    sender.addExtension(senderManager);
+
+    QXmppClient receiver;
+    auto *receiverManager = new QXmppTransferManager;
+    receiverManager->setSupportedMethods(QXmppTransferJob::SocksMethod);
+    receiverManager->setSocksBlockSize(blockSize);
+    connect(receiverManager, &QXmppTransferManager::fileReceived,
+            this, &tst_QXmppTransferManager::acceptFile);
+    receiver.addExtension(receiverManager);
+
+    for (auto [client, user] : { std::pair { &sender, "sender" }, std::pair { &receiver, "receiver" } }) {
+        QEventLoop loop;
+        connect(client, &QXmppClient::connected, &loop, &QEventLoop::quit);
+        connect(client, &QXmppClient::disconnected, &loop, &QEventLoop::quit);
+        config.setUser(user);
+        client->connectToServer(config);
+        loop.exec();
+        QVERIFY(client->isConnected());
+    }
+
+    QXmppTransferFileInfo fileInfo;
+    fileInfo.setName(u"data.bin"_s);
+    fileInfo.setSize(size);
+
+    QEventLoop loop;
+    auto *senderJob = senderManager->sendFile(receiver.configuration().jid(), device, fileInfo);
+    QVERIFY(senderJob);
+    connect(senderJob, &QXmppTransferJob::finished, &loop, &QEventLoop::quit);
+    loop.exec();
+    QCOMPARE(senderJob->error(), QXmppTransferJob::NoError);
+
+    QVERIFY(receiverJob);
+    if (receiverJob->state() != QXmppTransferJob::FinishedState) {
+        connect(receiverJob, &QXmppTransferJob::finished, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+    QCOMPARE(receiverJob->error(), QXmppTransferJob::NoError);
+}
+
 QTEST_MAIN(tst_QXmppTransferManager)
 #include "tst_qxmpptransfermanager.moc"
@@ -24,6 +24,8 @@ private:
     Q_SLOT void testKeys();
     Q_SLOT void testTrustLevels();
     Q_SLOT void testResetAll();
+    Q_SLOT void benchmarkKeys_data();
+    Q_SLOT void benchmarkKeys();
 
     // QXmppAtmTrustMemoryStorage
     Q_SLOT void atmTestKeysForPostponedTrustDecisions();
@@ -986,5 +988,68 @@ void tst_QXmppTrustMemoryStorage::atmTestResetAll()
                     distrustedKeys) }));
 }
 
+void tst_QXmppTrustMemoryStorage::benchmarkKeys_data()
+{
+    QTest::addColumn<QString>("lookup");
+
+    QTest::newRow("keys-by-trust-level") << u"keys-by-trust-level"_s;
+    QTest::newRow("keys-by-owner") << u"keys-by-owner"_s;
+    QTest::newRow("has-key") << u"has-key"_s;
+    QTest::newRow("trust-level") << u"trust-level"_s;
+    QTest::newRow("set-trust-level") << u"set-trust-level"_s;
+}
+
+void tst_QXmppTrustMemoryStorage::benchmarkKeys()
+{
+    QFETCH(QString, lookup);
+
+    // 10,000 key owners with 10 keys each
+    constexpr int keyOwnersCount = 10000;
+    constexpr int keysPerKeyOwner = 10;
+
+    QXmppTrustMemoryStorage trustStorage;
+
+    for (auto i = 0; i < keyOwnersCount; ++i) {
+        QList<QByteArray> keyIds;
+        for (auto j = 0; j < keysPerKeyOwner; ++j) {
+            keyIds.append(QByteArray::number(i * keysPerKeyOwner + j));
+        }
+
+        trustStorage.addKeys(ns_omemo,
+                             u"contact%1@example.org"_s.arg(i),
+                             keyIds,
+                             i % 2 ? TrustLevel::AutomaticallyTrusted : TrustLevel::Authenticated);
+    }
+
+    const auto keyOwnerJid = u"contact4242@example.org"_s;
+    const auto keyId = QByteArray::number(42420);
+
+    if (lookup == u"keys-by-trust-level") {
+        QBENCHMARK {
+            QCOMPARE(trustStorage.keys(ns_omemo, TrustLevel::Authenticated).result().value(TrustLevel::Authenticated).size(),
+                     keyOwnersCount / 2 * keysPerKeyOwner);
+        }
+    } else if (lookup == u"keys-by-owner") {
+        QBENCHMARK {
+            QCOMPARE(trustStorage.keys(ns_omemo, { keyOwnerJid }, TrustLevel::Authenticated).result().value(keyOwnerJid).size(),
+                     keysPerKeyOwner);
+        }
+    } else if (lookup == u"has-key") {
+        QBENCHMARK {
+            QVERIFY(trustStorage.hasKey(ns_omemo, keyOwnerJid, TrustLevel::Authenticated).result());
+        }
+    } else if (lookup == u"trust-level") {
+        QBENCHMARK {
+            QCOMPARE(trustStorage.trustLevel(ns_omemo, keyOwnerJid, keyId).result(), TrustLevel::Authenticated);
+        }
+    } else if (lookup == u"set-trust-level") {
+        QBENCHMARK {
+            trustStorage.setTrustLevel(ns_omemo, { keyOwnerJid }, TrustLevel::Authenticated, TrustLevel::ManuallyTrusted);
+            QCOMPARE(trustStorage.setTrustLevel(ns_omemo, { keyOwnerJid }, TrustLevel::ManuallyTrusted, TrustLevel::Authenticated).result().value(ns_omemo).size(),
+                     keysPerKeyOwner);
+        }
+    }
+}
+
 QTEST_MAIN(tst_QXmppTrustMemoryStorage)
 #include "tst_qxmpptrustmemorystorage.moc"
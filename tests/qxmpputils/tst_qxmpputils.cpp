@@ -12,7 +12,10 @@
 
 #include "util.h"
 
+#include <QBuffer>
+#include <QElapsedTimer>
 #include <QObject>
+#include <QTemporaryFile>
 
 using namespace QXmpp;
 using namespace QXmpp::Private;
@@ -32,6 +35,10 @@ private:
     Q_SLOT void testStanzaHash();
     Q_SLOT void testCalculateHashes_data();
     Q_SLOT void testCalculateHashes();
+    Q_SLOT void testCalculateHashesOfLocalFile();
+    Q_SLOT void testHashingDevice();
+    Q_SLOT void benchmarkCalculateHashes_data();
+    Q_SLOT void benchmarkCalculateHashes();
     Q_SLOT void testParseHostAddress_data();
     Q_SLOT void testParseHostAddress();
 };
@@ -206,6 +213,187 @@ void tst_QXmppUtils::testCalculateHashes()
     QCOMPARE(hashes.front().hash(), hash);
 }
 
+void tst_QXmppUtils::testCalculateHashesOfLocalFile()
+{
+    using Algorithm = QXmpp::HashAlgorithm;
+
+    // several blocks with an incomplete last block
+    QByteArray data;
+    for (int i = 0; data.size() < 3 * 1024 * 1024 + 123; i++) {
+        data += QByteArray::number(i);
+    }
+
+    QTemporaryFile tempFile;
+    QVERIFY(tempFile.open());
+    QCOMPARE(tempFile.write(data), qint64(data.size()));
+    QVERIFY(tempFile.flush());
+
+    auto file = std::make_unique<QFile>(tempFile.fileName());
+    QVERIFY(file->open(QFile::ReadOnly));
+    auto resultPtr = wait(calculateHashes(std::move(file), { Algorithm::Sha256, Algorithm::Sha3_256 }));
+    auto &[result, _] = *resultPtr;
+    auto hashes = expectVariant<std::vector<QXmppHash>>(std::move(result));
+    QCOMPARE(int(hashes.size()), 2);
+    QCOMPARE(hashes.at(0).hash(), QCryptographicHash::hash(data, QCryptographicHash::Sha256));
+    QCOMPARE(hashes.at(1).hash(), QCryptographicHash::hash(data, QCryptographicHash::Sha3_256));
+}
+
+void tst_QXmppUtils::testHashingDevice()
+{
+    using Algorithm = QXmpp::HashAlgorithm;
+
+    QFile file(u":/test.svg"_s);
+    QVERIFY(file.open(QFile::ReadOnly));
+    const auto data = file.readAll();
+    const auto sha256 = QByteArray::fromHex("4736d79aa2912a2693cc17c5548612e1474dd1dfca2e8ddff917358482fd309f");
+
+    auto openBuffer = [&data]() {
+        auto buffer = std::make_unique<QBuffer>();
+        buffer->setData(data);
+        buffer->open(QIODevice::ReadOnly);
+        return buffer;
+    };
+
+    // data read in small blocks
+    auto hasher = std::make_shared<StreamHasher>(std::vector { Algorithm::Sha256, Algorithm::Sha3_512 });
+    HashingDevice device(openBuffer(), hasher);
+    QCOMPARE(device.size(), qint64(data.size()));
+    QVERIFY(!hasher->result());
+
+    QByteArray readData;
+    while (!device.atEnd()) {
+        readData += device.read(100);
+    }
+    QCOMPARE(readData, data);
+
+    auto hashes = hasher->result();
+    QVERIFY(hashes);
+    QCOMPARE(int(hashes->size()), 2);
+    QCOMPARE(hashes->front().algorithm(), Algorithm::Sha256);
+    QCOMPARE(hashes->front().hash(), sha256);
+
+    // data read again after seeking backwards is not hashed twice
+    hasher = std::make_shared<StreamHasher>(std::vector { Algorithm::Sha256 });
+    HashingDevice rereadDevice(openBuffer(), hasher);
+    rereadDevice.read(1000);
+    QVERIFY(rereadDevice.seek(500));
+    QCOMPARE(rereadDevice.readAll(), data.mid(500));
+    hashes = hasher->result();
+    QVERIFY(hashes);
+    QCOMPARE(hashes->front().hash(), sha256);
+
+    // skipped data
+    hasher = std::make_shared<StreamHasher>(std::vector { Algorithm::Sha256 });
+    HashingDevice skippingDevice(openBuffer(), hasher);
+    QVERIFY(skippingDevice.seek(100));
+    skippingDevice.readAll();
+    QVERIFY(!hasher->result());
+
+    // data written out of order
+    QByteArray writtenData;
+    auto writeBuffer = std::make_unique<QBuffer>(&writtenData);
+    QVERIFY(writeBuffer->open(QIODevice::WriteOnly));
+    hasher = std::make_shared<StreamHasher>(std::vector { Algorithm::Sha256 });
+    HashingDevice writingDevice(std::move(writeBuffer), hasher);
+    QVERIFY(writingDevice.seek(1000));
+    QCOMPARE(writingDevice.write(data.mid(1000, 500)), qint64(500));
+    QCOMPARE(writingDevice.write(data.mid(1500)), qint64(data.size() - 1500));
+    QVERIFY(writingDevice.seek(0));
+    QCOMPARE(writingDevice.write(data.left(1000)), qint64(1000));
+    writingDevice.close();
+    QCOMPARE(writtenData, data);
+    hashes = hasher->result();
+    QVERIFY(hashes);
+    QCOMPARE(hashes->front().hash(), sha256);
+
+    // data missing in front of written data
+    writtenData.clear();
+    writeBuffer = std::make_unique<QBuffer>(&writtenData);
+    QVERIFY(writeBuffer->open(QIODevice::WriteOnly));
+    hasher = std::make_shared<StreamHasher>(std::vector { Algorithm::Sha256 });
+    HashingDevice gapDevice(std::move(writeBuffer), hasher);
+    QVERIFY(gapDevice.seek(100));
+    gapDevice.write(data.mid(100));
+    gapDevice.close();
+    QVERIFY(!hasher->result());
+
+    // device opened after its creation
+    hasher = std::make_shared<StreamHasher>(std::vector { Algorithm::Sha256 });
+    auto closedBuffer = std::make_unique<QBuffer>();
+    closedBuffer->setData(data);
+    HashingDevice openedDevice(std::move(closedBuffer), hasher);
+    QVERIFY(!openedDevice.isOpen());
+    QVERIFY(openedDevice.open(QIODevice::ReadOnly));
+    QCOMPARE(openedDevice.openMode(), QIODevice::ReadOnly | QIODevice::Unbuffered);
+    QCOMPARE(openedDevice.readAll(), data);
+    openedDevice.close();
+    QVERIFY(!openedDevice.isOpen());
+    QCOMPARE(hasher->result()->front().hash(), sha256);
+}
+
+void tst_QXmppUtils::benchmarkCalculateHashes_data()
+{
+    QTest::addColumn<QXmpp::HashAlgorithm>("algorithm");
+    QTest::addColumn<bool>("isFile");
+
+    const std::vector<std::pair<const char *, HashAlgorithm>> algorithms = {
+        { "sha-256", HashAlgorithm::Sha256 },
+        { "sha3-256", HashAlgorithm::Sha3_256 },
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+        { "blake2b-256", HashAlgorithm::Blake2b_256 },
+#endif
+    };
+
+    for (const auto &[name, algorithm] : algorithms) {
+        QTest::addRow("%s-memory", name) << algorithm << false;
+        QTest::addRow("%s-file", name) << algorithm << true;
+    }
+}
+
+void tst_QXmppUtils::benchmarkCalculateHashes()
+{
+    QFETCH(QXmpp::HashAlgorithm, algorithm);
+    QFETCH(bool, isFile);
+
+    // small enough to run with the other tests, larger data can be hashed by setting the size in MiB
+    const auto sizeMiB = qEnvironmentVariableIntValue("QXMPP_BENCHMARK_HASHING_SIZE_MIB");
+    const QByteArray data((sizeMiB > 0 ? sizeMiB : 4) * 1024 * 1024, 'a');
+
+    QTemporaryFile file;
+    if (isFile) {
+        QVERIFY(file.open());
+        QCOMPARE(file.write(data), qint64(data.size()));
+        QVERIFY(file.flush());
+    }
+
+    auto openDevice = [&]() -> std::unique_ptr<QIODevice> {
+        if (isFile) {
+            auto device = std::make_unique<QFile>(file.fileName());
+            device->open(QIODevice::ReadOnly);
+            return device;
+        }
+        auto device = std::make_unique<QBuffer>();
+        device->setData(data);
+        device->open(QIODevice::ReadOnly);
+        return device;
+    };
+
+    QElapsedTimer timer;
+    qint64 elapsedNanoseconds = 0;
+    constexpr int iterations = 5;
+
+    for (int i = 0; i < iterations; i++) {
+        auto device = openDevice();
+        timer.start();
+        auto result = wait(calculateHashes(std::move(device), { algorithm }));
+        elapsedNanoseconds += timer.nsecsElapsed();
+        QVERIFY(std::holds_alternative<std::vector<QXmppHash>>(result->result));
+    }
+
+    const auto bytesPerSecond = double(data.size()) * iterations / (double(std::max(elapsedNanoseconds, qint64(1))) / 1e9);
+    QTest::setBenchmarkResult(bytesPerSecond, QTest::BytesPerSecond);
+}
+
 void tst_QXmppUtils::testParseHostAddress_data()
 {
     QTest::addColumn<QString>("input");